@@ -129,6 +129,50 @@ CHECK_CXX_SOURCE_RUNS("
         }"
         HAS_AVX_EXTENSION)
 
+################################################################################
+# AVX 2
+################################################################################
+
+if(IS_GNU OR IS_CLANG)
+    set(CMAKE_REQUIRED_FLAGS "-mavx2")
+endif()
+
+CHECK_CXX_SOURCE_RUNS("
+        #include <immintrin.h>
+        int main() {
+          short vals[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+          int sums[8];
+          __m256i a = _mm256_loadu_si256((__m256i*)vals);
+          __m256i b = _mm256_madd_epi16(a, a);
+          _mm256_storeu_si256((__m256i*)sums, b);
+          return sums[0] == 5 ? 0 : 1;
+        }"
+        HAS_AVX2_EXTENSION)
+
+################################################################################
+# AVX-512 VNNI
+################################################################################
+
+if(IS_GNU OR IS_CLANG)
+    set(CMAKE_REQUIRED_FLAGS "-mfma -mavx512f -mavx512bw -mavx512vnni")
+endif()
+
+CHECK_CXX_SOURCE_RUNS("
+        #include <immintrin.h>
+        int main() {
+          unsigned char a[64];
+          signed char b[64];
+          for (int i = 0; i < 64; ++i) {
+            a[i] = 255;
+            b[i] = -1;
+          }
+          __m512i c = _mm512_dpbusd_epi32(_mm512_setzero_si512(),
+                                          _mm512_loadu_si512(a),
+                                          _mm512_loadu_si512(b));
+          return _mm512_reduce_add_epi32(c) == -64 * 255 ? 0 : 1;
+        }"
+        HAS_AVX512VNNI_EXTENSION)
+
 ################################################################################
 # Setup the compile flags
 ################################################################################
@@ -163,4 +207,10 @@ if(IS_GNU OR IS_CLANG)
     if(HAS_AVX_EXTENSION)
         set(SSE_FLAGS "${SSE_FLAGS} -mavx")
     endif()
+    if(HAS_AVX2_EXTENSION)
+        set(SSE_FLAGS "${SSE_FLAGS} -mavx2")
+    endif()
+    if(HAS_AVX512VNNI_EXTENSION)
+        set(SSE_FLAGS "${SSE_FLAGS} -mfma -mavx512f -mavx512bw -mavx512vnni")
+    endif()
 endif()
@@ -0,0 +1,215 @@
+#include "base/binary_descriptor_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include "base/feature_distance.h"
+#include "util/logging.h"
+
+namespace bkmap {
+    namespace {
+
+        const int kNumSubstringBits = 16;
+
+        uint16_t GetSubstring(const uint8_t* descriptor, const int substring_idx) {
+            return static_cast<uint16_t>(descriptor[2 * substring_idx] |
+                                         (descriptor[2 * substring_idx + 1] << 8));
+        }
+
+        // All substring masks grouped by their number of set bits, i.e. the
+        // masks to probe the buckets within a given Hamming radius.
+        std::vector<std::vector<uint16_t>> GenerateProbeMasks() {
+            std::vector<std::vector<uint16_t>> masks(kNumSubstringBits + 1);
+            for (int mask = 0; mask < (1 << kNumSubstringBits); ++mask) {
+                int num_bits = 0;
+                for (int bit = 0; bit < kNumSubstringBits; ++bit) {
+                    num_bits += (mask >> bit) & 1;
+                }
+                masks[num_bits].push_back(static_cast<uint16_t>(mask));
+            }
+            return masks;
+        }
+
+        const std::vector<std::vector<uint16_t>>& GetProbeMasks() {
+            static const std::vector<std::vector<uint16_t>> masks =
+                    GenerateProbeMasks();
+            return masks;
+        }
+
+        struct NearestNeighbors {
+            int idx1 = -1;
+            int idx2 = -1;
+            int dist1 = BinaryBestMatch::kNoMatch;
+            int dist2 = BinaryBestMatch::kNoMatch;
+
+            void Update(const int idx, const int dist) {
+                if (dist < dist1) {
+                    idx2 = idx1;
+                    dist2 = dist1;
+                    idx1 = idx;
+                    dist1 = dist;
+                } else if (dist < dist2) {
+                    idx2 = idx;
+                    dist2 = dist;
+                }
+            }
+        };
+
+    }  // namespace
+
+    BinaryDescriptorIndex::BinaryDescriptorIndex(
+            const FeatureDescriptors& descriptors)
+            : descriptors_(descriptors) {
+        if (descriptors_.rows() == 0) {
+            return;
+        }
+
+        CHECK_EQ(descriptors_.cols(), kBinaryDescriptorNumBytes);
+
+        const int num_descriptors = static_cast<int>(descriptors_.rows());
+
+        words_.resize(num_descriptors * internal::kBinaryDescriptorNumWords);
+        std::memcpy(words_.data(), descriptors_.data(), descriptors_.size());
+
+        substrings_.resize(kNumSubstrings);
+        descriptor_idxs_.resize(kNumSubstrings);
+        std::vector<uint16_t> substrings(num_descriptors);
+        for (int substring_idx = 0; substring_idx < kNumSubstrings; ++substring_idx) {
+            for (int i = 0; i < num_descriptors; ++i) {
+                substrings[i] = GetSubstring(&descriptors_(i, 0), substring_idx);
+            }
+
+            std::vector<int>& descriptor_idxs = descriptor_idxs_[substring_idx];
+            descriptor_idxs.resize(num_descriptors);
+            std::iota(descriptor_idxs.begin(), descriptor_idxs.end(), 0);
+            std::stable_sort(descriptor_idxs.begin(), descriptor_idxs.end(),
+                             [&substrings](const int idx1, const int idx2) {
+                                 return substrings[idx1] < substrings[idx2];
+                             });
+
+            std::vector<uint16_t>& sorted_substrings = substrings_[substring_idx];
+            sorted_substrings.resize(num_descriptors);
+            for (int i = 0; i < num_descriptors; ++i) {
+                sorted_substrings[i] = substrings[descriptor_idxs[i]];
+            }
+        }
+    }
+
+    size_t BinaryDescriptorIndex::NumDescriptors() const {
+        return static_cast<size_t>(descriptors_.rows());
+    }
+
+    const FeatureDescriptors& BinaryDescriptorIndex::Descriptors() const {
+        return descriptors_;
+    }
+
+    void BinaryDescriptorIndex::Search(const FeatureDescriptors& query,
+                                       const int max_distance,
+                                       const float max_ratio,
+                                       IndicesType* indices,
+                                       DistancesType* distances) const {
+        CHECK_NOTNULL(indices);
+        CHECK_NOTNULL(distances);
+        CHECK_GE(max_distance, 0);
+
+        indices->resize(query.rows(), 2);
+        indices->setConstant(-1);
+        distances->resize(query.rows(), 2);
+        distances->setConstant(BinaryBestMatch::kNoMatch);
+
+        if (query.rows() == 0 || descriptors_.rows() == 0) {
+            return;
+        }
+
+        CHECK_EQ(query.cols(), kBinaryDescriptorNumBytes);
+
+        const std::vector<std::vector<uint16_t>>& probe_masks = GetProbeMasks();
+        const int num_descriptors = static_cast<int>(descriptors_.rows());
+
+        int num_search_steps = 1;
+        while ((1 << num_search_steps) <= num_descriptors) {
+            num_search_steps += 1;
+        }
+
+        // Marks the descriptors, whose distance to the current query is known.
+        std::vector<int> visited(num_descriptors, -1);
+
+        for (int query_idx = 0; query_idx < query.rows(); ++query_idx) {
+            const uint8_t* query_descriptor = &query(query_idx, 0);
+            uint64_t query_words[internal::kBinaryDescriptorNumWords];
+            std::memcpy(query_words, query_descriptor, kBinaryDescriptorNumBytes);
+
+            NearestNeighbors neighbors;
+            const auto verify = [&](const int idx) {
+                if (visited[idx] != query_idx) {
+                    visited[idx] = query_idx;
+                    neighbors.Update(
+                            idx, internal::ComputeHammingDistance(
+                                    query_words,
+                                    words_.data() +
+                                    idx * internal::kBinaryDescriptorNumWords));
+                }
+            };
+
+            // After probing all radii below the current radius, all descriptors
+            // with a smaller distance than the bound are found.
+            int min_unknown_distance = 0;
+            int probe_cost = 0;
+            for (int radius = 0; radius <= kNumSubstringBits; ++radius) {
+                min_unknown_distance = kNumSubstrings * radius;
+
+                // Stop if both neighbors are known, if the second neighbor cannot
+                // fail the ratio test, or if there cannot be a neighbor within the
+                // maximum distance.
+                if (neighbors.dist2 <= min_unknown_distance ||
+                    (neighbors.dist1 <= min_unknown_distance &&
+                     neighbors.dist1 < max_ratio * min_unknown_distance) ||
+                    (neighbors.dist1 > max_distance &&
+                     min_unknown_distance > max_distance)) {
+                    break;
+                }
+
+                // A probe is a binary search in a table, which is assumed to be as
+                // expensive as computing the distance to one descriptor per step.
+                const std::vector<uint16_t>& masks = probe_masks[radius];
+                probe_cost += kNumSubstrings * static_cast<int>(masks.size()) *
+                              num_search_steps;
+                if (probe_cost > num_descriptors) {
+                    for (int idx = 0; idx < num_descriptors; ++idx) {
+                        verify(idx);
+                    }
+                    min_unknown_distance = BinaryBestMatch::kNoMatch;
+                    break;
+                }
+
+                for (int substring_idx = 0; substring_idx < kNumSubstrings;
+                     ++substring_idx) {
+                    const std::vector<uint16_t>& substrings = substrings_[substring_idx];
+                    const std::vector<int>& descriptor_idxs =
+                            descriptor_idxs_[substring_idx];
+                    const uint16_t query_substring =
+                            GetSubstring(query_descriptor, substring_idx);
+                    for (const uint16_t mask : masks) {
+                        const uint16_t probe = query_substring ^ mask;
+                        const auto bucket = std::equal_range(
+                                substrings.begin(), substrings.end(), probe);
+                        for (auto it = bucket.first; it != bucket.second; ++it) {
+                            verify(descriptor_idxs[it - substrings.begin()]);
+                        }
+                    }
+                }
+            }
+
+            (*indices)(query_idx, 0) = neighbors.idx1;
+            (*distances)(query_idx, 0) = neighbors.dist1;
+            if (neighbors.dist2 <= min_unknown_distance) {
+                (*indices)(query_idx, 1) = neighbors.idx2;
+                (*distances)(query_idx, 1) = neighbors.dist2;
+            } else {
+                (*distances)(query_idx, 1) = min_unknown_distance;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,65 @@
+#ifndef BKMAP_BINARY_DESCRIPTOR_INDEX_H
+#define BKMAP_BINARY_DESCRIPTOR_INDEX_H
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/feature.h"
+
+namespace bkmap {
+
+// Exact nearest neighbor index over the binary descriptors of a single image,
+// based on multi-index hashing. The descriptors are split into kNumSubstrings
+// disjoint substrings, each of which is indexed in a separate table. Two
+// descriptors with a Hamming distance of d differ in at most
+// floor(d / kNumSubstrings) bits in at least one of their substrings, so that
+// only the buckets within this radius of the query substrings must be probed.
+// The radius is increased until the two nearest neighbors are found, and the
+// search falls back to a linear scan, if probing becomes more expensive. The
+// index is immutable after construction and thread-safe for concurrent queries.
+//
+// See "Fast Exact Search in Hamming Space with Multi-Index Hashing",
+// Mohammad Norouzi, Ali Punjani and David J. Fleet, TPAMI 2014.
+    class BinaryDescriptorIndex {
+    public:
+        typedef Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> IndicesType;
+        typedef Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> DistancesType;
+
+        // The number of 16 bit substrings of the descriptors.
+        static const int kNumSubstrings = kBinaryDescriptorNumBytes / 2;
+
+        explicit BinaryDescriptorIndex(const FeatureDescriptors& descriptors);
+
+        BinaryDescriptorIndex(const BinaryDescriptorIndex&) = delete;
+        BinaryDescriptorIndex& operator=(const BinaryDescriptorIndex&) = delete;
+
+        size_t NumDescriptors() const;
+        const FeatureDescriptors& Descriptors() const;
+
+        // Find the nearest neighbor of each query descriptor and its distance to
+        // the second nearest neighbor, as far as needed to decide whether the
+        // nearest neighbor is within `max_distance` and passes the ratio test
+        // with `max_ratio`. The decision is the same as for the exact neighbors,
+        // but the second distance can be a lower bound, if it does not change the
+        // decision, in which case the index of the second neighbor is -1. The
+        // indices of missing neighbors are set to -1 and their distances to
+        // BinaryBestMatch::kNoMatch.
+        void Search(const FeatureDescriptors& query, const int max_distance,
+                    const float max_ratio, IndicesType* indices,
+                    DistancesType* distances) const;
+
+    private:
+        const FeatureDescriptors descriptors_;
+
+        // The descriptors as 64 bit words for the Hamming distance computation.
+        std::vector<uint64_t> words_;
+
+        // The descriptor indices of each table sorted by their substrings.
+        std::vector<std::vector<uint16_t>> substrings_;
+        std::vector<std::vector<int>> descriptor_idxs_;
+    };
+
+}
+
+#endif //BKMAP_BINARY_DESCRIPTOR_INDEX_H
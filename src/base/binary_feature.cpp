@@ -0,0 +1,523 @@
+#include "base/binary_feature.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+
+#include "util/logging.h"
+
+namespace bkmap {
+    namespace {
+
+        // Radius of the patch around a corner, from which the orientation and the
+        // descriptor are computed.
+        const int kPatchRadius = 15;
+
+        // Maximum distance of the sampled pixels of the binary tests to the corner,
+        // such that the rotated pixels are still within the patch.
+        const int kTestRadius = kPatchRadius - 2;
+
+        // Minimum distance of the corners to the image border, such that the
+        // patch and the Harris window of a corner are inside of the image.
+        const int kBorder = kPatchRadius + 1;
+
+        // Minimum number of contiguous pixels on the 16 pixel circle of a corner,
+        // which are all brighter or all darker than the center pixel.
+        const int kFastArcLength = 9;
+
+        // Radius of the window, over which the Harris response is computed.
+        const int kHarrisRadius = 3;
+        const float kHarrisK = 0.04f;
+
+        // Radius and standard deviation of the Gaussian kernel, which smooths the
+        // pyramid levels before the binary tests.
+        const int kSmoothingRadius = 3;
+        const float kSmoothingSigma = 2.0f;
+
+        // Offsets of the pixels on the Bresenham circle of radius 3.
+        const int kFastCircle[16][2] = {{0, -3}, {1, -3}, {2, -2}, {3, -1},
+                                        {3, 0},  {3, 1},  {2, 2},  {1, 3},
+                                        {0, 3},  {-1, 3}, {-2, 2}, {-3, 1},
+                                        {-3, 0}, {-3, -1}, {-2, -2}, {-1, -3}};
+
+        struct PyramidLevel {
+            int width = 0;
+            int height = 0;
+            std::vector<uint8_t> data;
+        };
+
+        struct Corner {
+            int x = 0;
+            int y = 0;
+            float response = 0.0f;
+        };
+
+        // Pixel pairs (x1, y1, x2, y2) of the binary tests relative to the corner.
+        typedef std::array<int, 4> BinaryTest;
+
+        // The pixels of the tests are drawn from an isotropic Gaussian-like
+        // distribution around the corner, which performs best in the BRIEF paper.
+        // The distribution is approximated with the sum of three uniform integers,
+        // so that the pattern only depends on the integer output of the random
+        // generator and is therefore the same on all platforms. Changing the
+        // pattern invalidates all binary descriptors in existing databases.
+        std::vector<BinaryTest> GenerateBinaryTests() {
+            const int kNumTests = 8 * kBinaryDescriptorNumBytes;
+            const int kUniformRadius = 6;
+
+            std::mt19937 generator(0);
+            const auto sample_coordinate = [&generator]() {
+                int coordinate = 0;
+                for (int i = 0; i < 3; ++i) {
+                    coordinate += static_cast<int>(generator() % (2 * kUniformRadius + 1)) -
+                                  kUniformRadius;
+                }
+                return coordinate;
+            };
+
+            const auto sample_pixel = [&sample_coordinate](int* x, int* y) {
+                do {
+                    *x = sample_coordinate();
+                    *y = sample_coordinate();
+                } while (*x * *x + *y * *y > kTestRadius * kTestRadius);
+            };
+
+            std::vector<BinaryTest> tests;
+            tests.reserve(kNumTests);
+            while (tests.size() < static_cast<size_t>(kNumTests)) {
+                BinaryTest test;
+                sample_pixel(&test[0], &test[1]);
+                sample_pixel(&test[2], &test[3]);
+                if (test[0] != test[2] || test[1] != test[3]) {
+                    tests.push_back(test);
+                }
+            }
+
+            return tests;
+        }
+
+        const std::vector<BinaryTest>& GetBinaryTests() {
+            static const std::vector<BinaryTest> tests = GenerateBinaryTests();
+            return tests;
+        }
+
+        // Half widths of the rows of the circular patch.
+        std::vector<int> GetPatchHalfWidths() {
+            std::vector<int> half_widths(kPatchRadius + 1);
+            for (int dy = 0; dy <= kPatchRadius; ++dy) {
+                half_widths[dy] = static_cast<int>(
+                        std::floor(std::sqrt(kPatchRadius * kPatchRadius - dy * dy)));
+            }
+            return half_widths;
+        }
+
+        PyramidLevel DownsampleLevel(const PyramidLevel& level, const int width,
+                                     const int height) {
+            PyramidLevel downsampled;
+            downsampled.width = width;
+            downsampled.height = height;
+            downsampled.data.resize(width * height);
+
+            const float scale_x = static_cast<float>(level.width) / width;
+            const float scale_y = static_cast<float>(level.height) / height;
+
+            for (int y = 0; y < height; ++y) {
+                const float src_y = std::max(0.0f, (y + 0.5f) * scale_y - 0.5f);
+                const int y0 = std::min(static_cast<int>(src_y), level.height - 1);
+                const int y1 = std::min(y0 + 1, level.height - 1);
+                const float wy = src_y - y0;
+                const uint8_t* row0 = level.data.data() + y0 * level.width;
+                const uint8_t* row1 = level.data.data() + y1 * level.width;
+                for (int x = 0; x < width; ++x) {
+                    const float src_x = std::max(0.0f, (x + 0.5f) * scale_x - 0.5f);
+                    const int x0 = std::min(static_cast<int>(src_x), level.width - 1);
+                    const int x1 = std::min(x0 + 1, level.width - 1);
+                    const float wx = src_x - x0;
+                    const float value =
+                            (1 - wy) * ((1 - wx) * row0[x0] + wx * row0[x1]) +
+                            wy * ((1 - wx) * row1[x0] + wx * row1[x1]);
+                    downsampled.data[y * width + x] =
+                            static_cast<uint8_t>(std::min(255.0f, value + 0.5f));
+                }
+            }
+
+            return downsampled;
+        }
+
+        PyramidLevel SmoothLevel(const PyramidLevel& level) {
+            float kernel[2 * kSmoothingRadius + 1];
+            float kernel_sum = 0.0f;
+            for (int i = -kSmoothingRadius; i <= kSmoothingRadius; ++i) {
+                kernel[i + kSmoothingRadius] =
+                        std::exp(-(i * i) / (2 * kSmoothingSigma * kSmoothingSigma));
+                kernel_sum += kernel[i + kSmoothingRadius];
+            }
+            for (auto& weight : kernel) {
+                weight /= kernel_sum;
+            }
+
+            const int width = level.width;
+            const int height = level.height;
+
+            // The rows are padded with their border pixels, so that the inner
+            // loops of both passes do not need to clamp the coordinates.
+            std::vector<float> padded_row(width + 2 * kSmoothingRadius);
+            std::vector<float> smoothed_rows(width * height);
+            for (int y = 0; y < height; ++y) {
+                const uint8_t* row = level.data.data() + y * width;
+                for (int x = -kSmoothingRadius; x < width + kSmoothingRadius; ++x) {
+                    padded_row[x + kSmoothingRadius] =
+                            row[std::min(std::max(x, 0), width - 1)];
+                }
+                float* smoothed_row = smoothed_rows.data() + y * width;
+                for (int x = 0; x < width; ++x) {
+                    float value = 0.0f;
+                    for (int i = 0; i <= 2 * kSmoothingRadius; ++i) {
+                        value += kernel[i] * padded_row[x + i];
+                    }
+                    smoothed_row[x] = value;
+                }
+            }
+
+            PyramidLevel smoothed;
+            smoothed.width = width;
+            smoothed.height = height;
+            smoothed.data.resize(width * height);
+            std::vector<float> smoothed_column(width);
+            for (int y = 0; y < height; ++y) {
+                std::fill(smoothed_column.begin(), smoothed_column.end(), 0.0f);
+                for (int i = -kSmoothingRadius; i <= kSmoothingRadius; ++i) {
+                    const float weight = kernel[i + kSmoothingRadius];
+                    const float* row = smoothed_rows.data() +
+                                       std::min(std::max(y + i, 0), height - 1) * width;
+                    for (int x = 0; x < width; ++x) {
+                        smoothed_column[x] += weight * row[x];
+                    }
+                }
+                uint8_t* smoothed_row = smoothed.data.data() + y * width;
+                for (int x = 0; x < width; ++x) {
+                    smoothed_row[x] = static_cast<uint8_t>(
+                            std::min(255.0f, smoothed_column[x] + 0.5f));
+                }
+            }
+
+            return smoothed;
+        }
+
+        // Returns the FAST score of the pixel, i.e. the sum of the absolute
+        // differences of the brighter or darker pixels on the circle, or zero if
+        // the pixel is not a corner. The offsets are the relative positions of
+        // the circle pixels in memory.
+        int ComputeFastScore(const uint8_t* center, const int offsets[16],
+                             const int threshold) {
+            const int value = *center;
+            const int upper = value + threshold;
+            const int lower = value - threshold;
+
+            // Any arc of 9 contiguous pixels contains one of two opposite pixels
+            // and two of the four compass pixels.
+            const int value0 = center[offsets[0]];
+            const int value8 = center[offsets[8]];
+            if (value0 <= upper && value0 >= lower && value8 <= upper &&
+                value8 >= lower) {
+                return 0;
+            }
+
+            const int value4 = center[offsets[4]];
+            const int value12 = center[offsets[12]];
+            const int num_brighter =
+                    (value0 > upper) + (value4 > upper) + (value8 > upper) +
+                    (value12 > upper);
+            const int num_darker = (value0 < lower) + (value4 < lower) +
+                                   (value8 < lower) + (value12 < lower);
+            if (num_brighter < 2 && num_darker < 2) {
+                return 0;
+            }
+
+            int states[16];
+            int brighter_score = 0;
+            int darker_score = 0;
+            for (int k = 0; k < 16; ++k) {
+                const int circle_value = center[offsets[k]];
+                if (circle_value > upper) {
+                    states[k] = 1;
+                    brighter_score += circle_value - upper;
+                } else if (circle_value < lower) {
+                    states[k] = -1;
+                    darker_score += lower - circle_value;
+                } else {
+                    states[k] = 0;
+                }
+            }
+
+            int arc_state = 0;
+            int arc_length = 0;
+            for (int k = 0; k < 16 + kFastArcLength - 1; ++k) {
+                const int state = states[k % 16];
+                if (state != 0 && state == arc_state) {
+                    arc_length += 1;
+                } else {
+                    arc_state = state;
+                    arc_length = state != 0 ? 1 : 0;
+                }
+                if (arc_length >= kFastArcLength) {
+                    return std::max(brighter_score, darker_score);
+                }
+            }
+
+            return 0;
+        }
+
+        // Detect FAST corners with non-maximum suppression in a 3x3 neighborhood.
+        // The response of the corners is their FAST score.
+        std::vector<Corner> DetectFastCorners(const PyramidLevel& level,
+                                              const int threshold) {
+            const int width = level.width;
+            const int height = level.height;
+
+            int offsets[16];
+            for (int k = 0; k < 16; ++k) {
+                offsets[k] = kFastCircle[k][1] * width + kFastCircle[k][0];
+            }
+
+            std::vector<int> scores(width * height, 0);
+            for (int y = kBorder; y < height - kBorder; ++y) {
+                const uint8_t* row = level.data.data() + y * width;
+                int* score_row = scores.data() + y * width;
+                for (int x = kBorder; x < width - kBorder; ++x) {
+                    score_row[x] = ComputeFastScore(row + x, offsets, threshold);
+                }
+            }
+
+            std::vector<Corner> corners;
+            for (int y = kBorder; y < height - kBorder; ++y) {
+                for (int x = kBorder; x < width - kBorder; ++x) {
+                    const int idx = y * width + x;
+                    const int score = scores[idx];
+                    if (score == 0) {
+                        continue;
+                    }
+
+                    // Ties are broken in favor of the first pixel in raster order.
+                    bool is_maximum = true;
+                    for (int dy = -1; dy <= 1 && is_maximum; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            const int neighbor_idx = idx + dy * width + dx;
+                            if (scores[neighbor_idx] > score ||
+                                (scores[neighbor_idx] == score && neighbor_idx < idx)) {
+                                is_maximum = false;
+                                break;
+                            }
+                        }
+                    }
+
+                    if (is_maximum) {
+                        Corner corner;
+                        corner.x = x;
+                        corner.y = y;
+                        corner.response = static_cast<float>(score);
+                        corners.push_back(corner);
+                    }
+                }
+            }
+
+            return corners;
+        }
+
+        // Keep the corners with the largest response.
+        void RetainBestCorners(const size_t num_corners,
+                               std::vector<Corner>* corners) {
+            if (corners->size() <= num_corners) {
+                return;
+            }
+            std::nth_element(corners->begin(), corners->begin() + num_corners,
+                             corners->end(),
+                             [](const Corner& corner1, const Corner& corner2) {
+                                 return corner1.response > corner2.response;
+                             });
+            corners->resize(num_corners);
+        }
+
+        float ComputeHarrisResponse(const PyramidLevel& level, const int x,
+                                    const int y) {
+            const int width = level.width;
+            float sum_xx = 0.0f;
+            float sum_xy = 0.0f;
+            float sum_yy = 0.0f;
+            for (int dy = -kHarrisRadius; dy <= kHarrisRadius; ++dy) {
+                const uint8_t* row = level.data.data() + (y + dy) * width + x;
+                for (int dx = -kHarrisRadius; dx <= kHarrisRadius; ++dx) {
+                    const uint8_t* p = row + dx;
+                    const float gx = (p[-width + 1] + 2.0f * p[1] + p[width + 1]) -
+                                     (p[-width - 1] + 2.0f * p[-1] + p[width - 1]);
+                    const float gy = (p[width - 1] + 2.0f * p[width] + p[width + 1]) -
+                                     (p[-width - 1] + 2.0f * p[-width] + p[-width + 1]);
+                    sum_xx += gx * gx;
+                    sum_xy += gx * gy;
+                    sum_yy += gy * gy;
+                }
+            }
+
+            const float trace = sum_xx + sum_yy;
+            return sum_xx * sum_yy - sum_xy * sum_xy - kHarrisK * trace * trace;
+        }
+
+        // Orientation of the intensity centroid of the circular patch.
+        float ComputeOrientation(const PyramidLevel& level, const int x, const int y,
+                                 const std::vector<int>& half_widths) {
+            const int width = level.width;
+            const uint8_t* center = level.data.data() + y * width + x;
+
+            int m10 = 0;
+            int m01 = 0;
+            for (int dy = -kPatchRadius; dy <= kPatchRadius; ++dy) {
+                const uint8_t* row = center + dy * width;
+                const int half_width = half_widths[std::abs(dy)];
+                int row_sum = 0;
+                for (int dx = -half_width; dx <= half_width; ++dx) {
+                    m10 += dx * row[dx];
+                    row_sum += row[dx];
+                }
+                m01 += dy * row_sum;
+            }
+
+            return std::atan2(static_cast<float>(m01), static_cast<float>(m10));
+        }
+
+        void ComputeDescriptor(const PyramidLevel& smoothed_level, const int x,
+                               const int y, const float orientation,
+                               uint8_t* descriptor) {
+            const int width = smoothed_level.width;
+            const uint8_t* center = smoothed_level.data.data() + y * width + x;
+
+            const float cos_angle = std::cos(orientation);
+            const float sin_angle = std::sin(orientation);
+            const auto rotated_value = [&](const int dx, const int dy) {
+                const int rx =
+                        static_cast<int>(std::round(cos_angle * dx - sin_angle * dy));
+                const int ry =
+                        static_cast<int>(std::round(sin_angle * dx + cos_angle * dy));
+                return center[ry * width + rx];
+            };
+
+            const std::vector<BinaryTest>& tests = GetBinaryTests();
+            std::fill(descriptor, descriptor + kBinaryDescriptorNumBytes, 0);
+            for (size_t i = 0; i < tests.size(); ++i) {
+                const BinaryTest& test = tests[i];
+                if (rotated_value(test[0], test[1]) < rotated_value(test[2], test[3])) {
+                    descriptor[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+                }
+            }
+        }
+
+    }  // namespace
+
+    bool BinaryExtractionOptions::Check() const {
+        CHECK_OPTION_GT(max_num_features, 0);
+        CHECK_OPTION_GT(num_levels, 0);
+        CHECK_OPTION_GT(scale_factor, 1.0);
+        CHECK_OPTION_GT(fast_threshold, 0);
+        CHECK_OPTION_LT(fast_threshold, 255);
+        return true;
+    }
+
+    bool ExtractBinaryFeatures(const BinaryExtractionOptions& options,
+                               const Bitmap& bitmap, FeatureKeypoints* keypoints,
+                               FeatureDescriptors* descriptors) {
+        CHECK(options.Check());
+        CHECK(bitmap.IsGrey());
+        CHECK_NOTNULL(keypoints);
+        CHECK_NOTNULL(descriptors);
+
+        // The number of features of a level is proportional to its scale, and
+        // unused features of a level are carried over to the next levels.
+        const double level_ratio = 1.0 / options.scale_factor;
+        std::vector<double> level_weights(options.num_levels);
+        double remaining_weight = 0;
+        for (int level_idx = options.num_levels - 1; level_idx >= 0; --level_idx) {
+            remaining_weight += std::pow(level_ratio, level_idx);
+            level_weights[level_idx] = remaining_weight;
+        }
+
+        const std::vector<int> half_widths = GetPatchHalfWidths();
+
+        PyramidLevel level;
+        level.width = bitmap.Width();
+        level.height = bitmap.Height();
+        level.data = bitmap.ConvertToRowMajorArray();
+
+        keypoints->clear();
+        std::vector<uint8_t> descriptor_data;
+
+        size_t remaining_budget = static_cast<size_t>(options.max_num_features);
+        for (int level_idx = 0; level_idx < options.num_levels; ++level_idx) {
+            if (level_idx > 0) {
+                const double level_scale = std::pow(options.scale_factor, level_idx);
+                const int width =
+                        static_cast<int>(std::round(bitmap.Width() / level_scale));
+                const int height =
+                        static_cast<int>(std::round(bitmap.Height() / level_scale));
+                if (width <= 2 * kBorder || height <= 2 * kBorder) {
+                    break;
+                }
+                level = DownsampleLevel(level, width, height);
+            }
+
+            if (level.width <= 2 * kBorder || level.height <= 2 * kBorder) {
+                break;
+            }
+
+            const size_t level_budget = static_cast<size_t>(std::round(
+                    remaining_budget * std::pow(level_ratio, level_idx) /
+                    level_weights[level_idx]));
+
+            // As in the ORB paper, the corners are first preselected by their FAST
+            // score, since the Harris response is more expensive to compute.
+            std::vector<Corner> corners =
+                    DetectFastCorners(level, options.fast_threshold);
+            RetainBestCorners(2 * level_budget, &corners);
+            for (auto& corner : corners) {
+                corner.response = ComputeHarrisResponse(level, corner.x, corner.y);
+            }
+            RetainBestCorners(level_budget, &corners);
+
+            if (corners.empty()) {
+                continue;
+            }
+
+            remaining_budget -= corners.size();
+
+            const PyramidLevel smoothed_level = SmoothLevel(level);
+
+            const float scale_x = static_cast<float>(bitmap.Width()) / level.width;
+            const float scale_y = static_cast<float>(bitmap.Height()) / level.height;
+
+            const size_t num_features = keypoints->size();
+            keypoints->resize(num_features + corners.size());
+            descriptor_data.resize(keypoints->size() * kBinaryDescriptorNumBytes);
+            for (size_t i = 0; i < corners.size(); ++i) {
+                const Corner& corner = corners[i];
+                const float orientation =
+                        ComputeOrientation(level, corner.x, corner.y, half_widths);
+
+                FeatureKeypoint& keypoint = (*keypoints)[num_features + i];
+                keypoint.x = (corner.x + 0.5f) * scale_x;
+                keypoint.y = (corner.y + 0.5f) * scale_y;
+                keypoint.scale = kPatchRadius * scale_x;
+                keypoint.orientation = orientation;
+
+                ComputeDescriptor(smoothed_level, corner.x, corner.y, orientation,
+                                  descriptor_data.data() +
+                                  (num_features + i) * kBinaryDescriptorNumBytes);
+            }
+        }
+
+        descriptors->resize(keypoints->size(), kBinaryDescriptorNumBytes);
+        std::copy(descriptor_data.begin(), descriptor_data.end(),
+                  descriptors->data());
+
+        return true;
+    }
+
+}
@@ -0,0 +1,40 @@
+#ifndef BKMAP_BINARY_FEATURE_H
+#define BKMAP_BINARY_FEATURE_H
+
+#include "base/feature.h"
+#include "util/bitmap.h"
+
+namespace bkmap {
+
+    struct BinaryExtractionOptions {
+        // Maximum number of features to detect over all pyramid levels.
+        int max_num_features = 8192;
+
+        // Number of levels of the image pyramid.
+        int num_levels = 8;
+
+        // Ratio between the image sizes of consecutive pyramid levels.
+        double scale_factor = 1.2;
+
+        // Minimum intensity difference between the center pixel and the pixels
+        // on the circle of a FAST corner.
+        int fast_threshold = 20;
+
+        bool Check() const;
+    };
+
+// Extract oriented FAST corners with rotated BRIEF descriptors (ORB) for the
+// given grey-scale image. The corners of each pyramid level are ranked by their
+// Harris response and their number decreases with the scale of the level. The
+// descriptors have kBinaryDescriptorNumBytes bytes, and the scale of the
+// keypoints is the radius of the described patch in the input image.
+//
+// See "ORB: An efficient alternative to SIFT or SURF",
+// Ethan Rublee, Vincent Rabaud, Kurt Konolige and Gary Bradski, ICCV 2011.
+    bool ExtractBinaryFeatures(const BinaryExtractionOptions& options,
+                               const Bitmap& bitmap, FeatureKeypoints* keypoints,
+                               FeatureDescriptors* descriptors);
+
+}
+
+#endif //BKMAP_BINARY_FEATURE_H
@@ -5,7 +5,9 @@
 
 #include <fstream>
 
+#include "util/misc.h"
 #include "util/string.h"
+#include "util/threading.h"
 
 namespace bkmap {
     namespace {
@@ -174,22 +176,42 @@ namespace bkmap {
     Database::~Database() { Close(); }
 
     void Database::Open(const std::string& path) {
+        OpenConnection(path, false);
+
+        const std::string feature_store_path = FeatureStore::DefaultPath(path);
+        if (ExistsFile(feature_store_path)) {
+            AttachFeatureStore(feature_store_path);
+        }
+    }
+
+    void Database::OpenReadOnly(const std::string& path) {
+        OpenConnection(path, true);
+    }
+
+    void Database::OpenConnection(const std::string& path, const bool read_only) {
         Close();
 
+        path_ = path;
+        read_only_ = read_only;
+
         // SQLITE_OPEN_NOMUTEX specifies that the connection should not have a
         // mutex (so that we don't serialize the connection's operations).
         // Modifications to the database will still be serialized, but multiple
         // connections can read concurrently.
-        SQLITE3_CALL(sqlite3_open_v2(
-                path.c_str(), &database_,
-                SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
-                nullptr));
-
-        // Don't wait for the operating system to write the changes to disk
-        SQLITE3_EXEC(database_, "PRAGMA synchronous=OFF", nullptr);
-
-        // Use faster journaling mode
-        SQLITE3_EXEC(database_, "PRAGMA journal_mode=WAL", nullptr);
+        const int open_flags =
+                read_only ? SQLITE_OPEN_READONLY
+                          : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        SQLITE3_CALL(sqlite3_open_v2(path.c_str(), &database_,
+                                     open_flags | SQLITE_OPEN_NOMUTEX, nullptr));
+
+        if (!read_only) {
+            // Don't wait for the operating system to write the changes to disk
+            SQLITE3_EXEC(database_, "PRAGMA synchronous=OFF", nullptr);
+
+            // Use faster journaling mode, which also allows readers to proceed
+            // concurrently with the writer.
+            SQLITE3_EXEC(database_, "PRAGMA journal_mode=WAL", nullptr);
+        }
 
         // Store temporary tables and indices in memory
         SQLITE3_EXEC(database_, "PRAGMA temp_store=MEMORY", nullptr);
@@ -197,17 +219,83 @@ namespace bkmap {
         // Disabled by default
         SQLITE3_EXEC(database_, "PRAGMA foreign_keys=ON", nullptr);
 
-        CreateTables();
+        if (!read_only) {
+            CreateTables();
+        }
 
         PrepareSQLStatements();
     }
 
     void Database::Close() {
+        DetachFeatureStore();
         if (database_ != nullptr) {
             FinalizeSQLStatements();
             sqlite3_close_v2(database_);
             database_ = nullptr;
         }
+        path_.clear();
+        read_only_ = false;
+    }
+
+    const std::string& Database::Path() const { return path_; }
+
+    bool Database::IsReadOnly() const { return read_only_; }
+
+    void Database::AttachFeatureStore(const std::string& path) {
+        feature_store_.reset(new FeatureStore(path));
+    }
+
+    void Database::DetachFeatureStore() { feature_store_.reset(); }
+
+    const FeatureStore* Database::GetFeatureStore() const {
+        return feature_store_.get();
+    }
+
+    void Database::ExportFeatureStore(const std::string& path) const {
+        // Reuse the attached store to keep its index consistent.
+        std::unique_ptr<FeatureStore> new_feature_store;
+        FeatureStore* feature_store = feature_store_.get();
+        if (feature_store == nullptr || feature_store->Path() != path) {
+            new_feature_store.reset(new FeatureStore(path));
+            feature_store = new_feature_store.get();
+        }
+
+        for (const auto& image : ReadAllImages()) {
+            if (ExistsKeypoints(image.ImageId()) &&
+                !feature_store->ExistsKeypoints(image.ImageId())) {
+                feature_store->WriteKeypoints(image.ImageId(),
+                                              ReadKeypointsFromTable(image.ImageId()));
+            }
+            if (ExistsDescriptors(image.ImageId()) &&
+                !feature_store->ExistsDescriptors(image.ImageId())) {
+                feature_store->WriteDescriptors(
+                        image.ImageId(), ReadDescriptorsFromTable(image.ImageId()));
+            }
+        }
+    }
+
+    void Database::ImportFeatureStore(const std::string& path) const {
+        CHECK(ExistsFile(path)) << path;
+
+        const FeatureStore feature_store(path);
+
+        BeginTransaction();
+        for (const image_t image_id : feature_store.ImageIds()) {
+            if (!ExistsImage(image_id)) {
+                continue;
+            }
+            if (feature_store.ExistsKeypoints(image_id) &&
+                !ExistsKeypoints(image_id)) {
+                WriteKeypointsToTable(image_id,
+                                      feature_store.ReadKeypoints(image_id));
+            }
+            if (feature_store.ExistsDescriptors(image_id) &&
+                !ExistsDescriptors(image_id)) {
+                WriteDescriptorsToTable(image_id,
+                                        feature_store.ReadDescriptors(image_id));
+            }
+        }
+        EndTransaction();
     }
 
     bool Database::ExistsCamera(const camera_t camera_id) const {
@@ -352,6 +440,25 @@ namespace bkmap {
     }
 
     FeatureKeypoints Database::ReadKeypoints(const image_t image_id) const {
+        // The tables are authoritative, so that the store is only read for
+        // features that exist in the tables.
+        if (feature_store_ && feature_store_->ExistsKeypoints(image_id) &&
+            ExistsKeypoints(image_id)) {
+            return feature_store_->ReadKeypoints(image_id);
+        }
+        return ReadKeypointsFromTable(image_id);
+    }
+
+    FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
+        if (feature_store_ && feature_store_->ExistsDescriptors(image_id) &&
+            ExistsDescriptors(image_id)) {
+            return feature_store_->ReadDescriptors(image_id);
+        }
+        return ReadDescriptorsFromTable(image_id);
+    }
+
+    FeatureKeypoints Database::ReadKeypointsFromTable(
+            const image_t image_id) const {
         SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_keypoints_, 1, image_id));
 
         const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_keypoints_));
@@ -363,7 +470,8 @@ namespace bkmap {
         return FeatureKeypointsFromBlob(blob);
     }
 
-    FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
+    FeatureDescriptors Database::ReadDescriptorsFromTable(
+            const image_t image_id) const {
         SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_descriptors_, 1, image_id));
 
         const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_descriptors_));
@@ -460,6 +568,27 @@ namespace bkmap {
         SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_all_));
     }
 
+    std::unordered_map<image_t, ImageFile> Database::ReadAllImageFiles() const {
+        CHECK_NOTNULL(sql_stmt_read_image_files_);
+
+        std::unordered_map<image_t, ImageFile> image_files;
+        while (SQLITE3_CALL(sqlite3_step(sql_stmt_read_image_files_)) ==
+               SQLITE_ROW) {
+            const image_t image_id = static_cast<image_t>(
+                    sqlite3_column_int64(sql_stmt_read_image_files_, 0));
+            ImageFile& image_file = image_files[image_id];
+            image_file.content_hash = std::string(reinterpret_cast<const char*>(
+                    sqlite3_column_text(sql_stmt_read_image_files_, 1)));
+            image_file.size = sqlite3_column_int64(sql_stmt_read_image_files_, 2);
+            image_file.modification_time =
+                    sqlite3_column_int64(sql_stmt_read_image_files_, 3);
+        }
+
+        SQLITE3_CALL(sqlite3_reset(sql_stmt_read_image_files_));
+
+        return image_files;
+    }
+
     void Database::ReadInlierMatchesGraph(
             std::vector<std::pair<image_t, image_t>>* image_pairs,
             std::vector<int>* num_inliers) const {
@@ -484,6 +613,68 @@ namespace bkmap {
         SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_graph_));
     }
 
+    void Database::ReadInlierMatchesConfigs(std::vector<image_pair_t>* image_pair_ids,
+                                            std::vector<int>* num_inliers,
+                                            std::vector<int>* configs) const {
+        const size_t num_verified_image_pairs = NumVerifiedImagePairs();
+        image_pair_ids->reserve(num_verified_image_pairs);
+        num_inliers->reserve(num_verified_image_pairs);
+        configs->reserve(num_verified_image_pairs);
+
+        while (SQLITE3_CALL(sqlite3_step(sql_stmt_read_inlier_matches_configs_)) ==
+               SQLITE_ROW) {
+            image_pair_ids->push_back(static_cast<image_pair_t>(
+                    sqlite3_column_int64(sql_stmt_read_inlier_matches_configs_, 0)));
+            num_inliers->push_back(static_cast<int>(
+                    sqlite3_column_int64(sql_stmt_read_inlier_matches_configs_, 1)));
+            configs->push_back(static_cast<int>(
+                    sqlite3_column_int64(sql_stmt_read_inlier_matches_configs_, 2)));
+        }
+
+        SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_configs_));
+    }
+
+    bool Database::ReadInlierMatchesChunk(
+            const size_t chunk_size, image_pair_t* next_pair_id,
+            std::vector<image_pair_t>* image_pair_ids,
+            std::vector<TwoViewGeometry>* two_view_geometries) const {
+        CHECK_GT(chunk_size, 0);
+
+        image_pair_ids->clear();
+        two_view_geometries->clear();
+
+        SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_inlier_matches_chunk_, 1,
+                                        static_cast<sqlite3_int64>(*next_pair_id)));
+        SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_inlier_matches_chunk_, 2,
+                                        static_cast<sqlite3_int64>(chunk_size)));
+
+        int rc;
+        while ((rc = SQLITE3_CALL(
+                sqlite3_step(sql_stmt_read_inlier_matches_chunk_))) == SQLITE_ROW) {
+            const image_pair_t pair_id = static_cast<image_pair_t>(
+                    sqlite3_column_int64(sql_stmt_read_inlier_matches_chunk_, 0));
+            image_pair_ids->push_back(pair_id);
+
+            TwoViewGeometry two_view_geometry;
+            const FeatureMatchesBlob blob = ReadMatrixBlob<FeatureMatchesBlob>(
+                    sql_stmt_read_inlier_matches_chunk_, rc, 1);
+            two_view_geometry.config = static_cast<int>(
+                    sqlite3_column_int64(sql_stmt_read_inlier_matches_chunk_, 4));
+            two_view_geometry.inlier_matches = FeatureMatchesFromBlob(blob);
+            two_view_geometries->push_back(std::move(two_view_geometry));
+        }
+
+        SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_chunk_));
+
+        if (image_pair_ids->empty()) {
+            return false;
+        }
+
+        *next_pair_id = image_pair_ids->back() + 1;
+
+        return true;
+    }
+
     camera_t Database::WriteCamera(const Camera& camera,
                                    const bool use_camera_id) const {
         if (use_camera_id) {
@@ -548,6 +739,22 @@ namespace bkmap {
 
     void Database::WriteKeypoints(const image_t image_id,
                                   const FeatureKeypoints& keypoints) const {
+        WriteKeypointsToTable(image_id, keypoints);
+        if (feature_store_) {
+            feature_store_->WriteKeypoints(image_id, keypoints);
+        }
+    }
+
+    void Database::WriteDescriptors(const image_t image_id,
+                                    const FeatureDescriptors& descriptors) const {
+        WriteDescriptorsToTable(image_id, descriptors);
+        if (feature_store_) {
+            feature_store_->WriteDescriptors(image_id, descriptors);
+        }
+    }
+
+    void Database::WriteKeypointsToTable(const image_t image_id,
+                                         const FeatureKeypoints& keypoints) const {
         const FeatureKeypointsBlob blob = FeatureKeypointsToBlob(keypoints);
 
         SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_keypoints_, 1, image_id));
@@ -557,8 +764,8 @@ namespace bkmap {
         SQLITE3_CALL(sqlite3_reset(sql_stmt_write_keypoints_));
     }
 
-    void Database::WriteDescriptors(const image_t image_id,
-                                    const FeatureDescriptors& descriptors) const {
+    void Database::WriteDescriptorsToTable(
+            const image_t image_id, const FeatureDescriptors& descriptors) const {
         SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_write_descriptors_, 1, image_id));
         WriteMatrixBlob(sql_stmt_write_descriptors_, descriptors, 2);
 
@@ -655,6 +862,23 @@ namespace bkmap {
         SQLITE3_CALL(sqlite3_reset(sql_stmt_update_image_));
     }
 
+    void Database::UpdateImageFile(const image_t image_id,
+                                   const ImageFile& file) const {
+        CHECK_NOTNULL(sql_stmt_update_image_file_);
+
+        SQLITE3_CALL(sqlite3_bind_text(sql_stmt_update_image_file_, 1,
+                                       file.content_hash.c_str(),
+                                       static_cast<int>(file.content_hash.size()),
+                                       SQLITE_STATIC));
+        SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_update_image_file_, 2, file.size));
+        SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_update_image_file_, 3,
+                                        file.modification_time));
+        SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_update_image_file_, 4, image_id));
+
+        SQLITE3_CALL(sqlite3_step(sql_stmt_update_image_file_));
+        SQLITE3_CALL(sqlite3_reset(sql_stmt_update_image_file_));
+    }
+
     void Database::DeleteMatches(const image_t image_id1,
                                  const image_t image_id2) const {
         const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
@@ -673,6 +897,32 @@ namespace bkmap {
         SQLITE3_CALL(sqlite3_reset(sql_stmt_delete_inlier_matches_));
     }
 
+    void Database::DeleteFeatures(const image_t image_id) const {
+        const std::vector<sqlite3_stmt*> sql_stmts = {
+                sql_stmt_delete_keypoints_, sql_stmt_delete_descriptors_};
+        for (sqlite3_stmt* sql_stmt : sql_stmts) {
+            SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
+            SQLITE3_CALL(sqlite3_step(sql_stmt));
+            SQLITE3_CALL(sqlite3_reset(sql_stmt));
+        }
+
+        if (feature_store_) {
+            feature_store_->DeleteFeatures(image_id);
+        }
+
+        // The image can be the first or second image of a pair.
+        const std::vector<sqlite3_stmt*> sql_match_stmts = {
+                sql_stmt_delete_image_matches_,
+                sql_stmt_delete_image_inlier_matches_};
+        for (sqlite3_stmt* sql_stmt : sql_match_stmts) {
+            SQLITE3_CALL(sqlite3_bind_int64(
+                    sql_stmt, 1, static_cast<sqlite3_int64>(kMaxNumImages)));
+            SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 2, image_id));
+            SQLITE3_CALL(sqlite3_step(sql_stmt));
+            SQLITE3_CALL(sqlite3_reset(sql_stmt));
+        }
+    }
+
     void Database::ClearMatches() const {
         SQLITE3_CALL(sqlite3_step(sql_stmt_clear_matches_));
         SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_matches_));
@@ -783,6 +1033,17 @@ namespace bkmap {
                                         &sql_stmt_update_image_, 0));
         sql_stmts_.push_back(sql_stmt_update_image_);
 
+        // The file fingerprint columns are only guaranteed to exist in writable
+        // connections, which update the schema of old databases.
+        if (!read_only_) {
+            sql =
+                    "UPDATE images SET content_hash=?, file_size=?, file_mtime=? "
+                            "WHERE image_id=?;";
+            SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                            &sql_stmt_update_image_file_, 0));
+            sql_stmts_.push_back(sql_stmt_update_image_file_);
+        }
+
         //////////////////////////////////////////////////////////////////////////////
         // read_*
         //////////////////////////////////////////////////////////////////////////////
@@ -848,6 +1109,28 @@ namespace bkmap {
                                         &sql_stmt_read_inlier_matches_graph_, 0));
         sql_stmts_.push_back(sql_stmt_read_inlier_matches_graph_);
 
+        sql = "SELECT pair_id, rows, config FROM inlier_matches WHERE rows > 0;";
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_read_inlier_matches_configs_, 0));
+        sql_stmts_.push_back(sql_stmt_read_inlier_matches_configs_);
+
+        // The range query on the primary key avoids an expensive offset scan.
+        sql =
+                "SELECT pair_id, rows, cols, data, config FROM inlier_matches "
+                        "WHERE rows > 0 AND pair_id >= ? ORDER BY pair_id LIMIT ?;";
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_read_inlier_matches_chunk_, 0));
+        sql_stmts_.push_back(sql_stmt_read_inlier_matches_chunk_);
+
+        if (!read_only_) {
+            sql =
+                    "SELECT image_id, content_hash, file_size, file_mtime FROM images "
+                            "WHERE content_hash IS NOT NULL;";
+            SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                            &sql_stmt_read_image_files_, 0));
+            sql_stmts_.push_back(sql_stmt_read_image_files_);
+        }
+
         //////////////////////////////////////////////////////////////////////////////
         // write_*
         //////////////////////////////////////////////////////////////////////////////
@@ -887,6 +1170,38 @@ namespace bkmap {
                                         &sql_stmt_delete_inlier_matches_, 0));
         sql_stmts_.push_back(sql_stmt_delete_inlier_matches_);
 
+        sql = "DELETE FROM keypoints WHERE image_id = ?;";
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_delete_keypoints_, 0));
+        sql_stmts_.push_back(sql_stmt_delete_keypoints_);
+
+        sql = "DELETE FROM descriptors WHERE image_id = ?;";
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_delete_descriptors_, 0));
+        sql_stmts_.push_back(sql_stmt_delete_descriptors_);
+
+        // The pair identifiers of the image as the first image of a pair are a
+        // contiguous range, and as the second image of a pair, it is paired with
+        // all smaller image identifiers. Both are looked up by the primary key
+        // instead of scanning the whole table.
+        const std::string image_pair_ids =
+                "WITH RECURSIVE image_ids(image_id) AS (SELECT 0 UNION ALL "
+                        "SELECT image_id + 1 FROM image_ids WHERE image_id + 1 < ?2) ";
+        const std::string image_pair_ids_condition =
+                "WHERE pair_id BETWEEN ?1 * ?2 AND ?1 * ?2 + ?1 - 1 OR pair_id IN "
+                        "(SELECT ?1 * image_id + ?2 FROM image_ids);";
+
+        sql = image_pair_ids + "DELETE FROM matches " + image_pair_ids_condition;
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_delete_image_matches_, 0));
+        sql_stmts_.push_back(sql_stmt_delete_image_matches_);
+
+        sql = image_pair_ids + "DELETE FROM inlier_matches " +
+              image_pair_ids_condition;
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                        &sql_stmt_delete_image_inlier_matches_, 0));
+        sql_stmts_.push_back(sql_stmt_delete_image_inlier_matches_);
+
         //////////////////////////////////////////////////////////////////////////////
         // clear_*
         //////////////////////////////////////////////////////////////////////////////
@@ -905,6 +1220,8 @@ namespace bkmap {
         for (const auto& sql_stmt : sql_stmts_) {
             SQLITE3_CALL(sqlite3_finalize(sql_stmt));
         }
+        sql_stmt_update_image_file_ = nullptr;
+        sql_stmt_read_image_files_ = nullptr;
     }
 
     void Database::CreateTables() const {
@@ -914,6 +1231,7 @@ namespace bkmap {
         CreateDescriptorsTable();
         CreateMatchesTable();
         CreateInlierMatchesTable();
+        UpdateImageTableSchema();
     }
 
     void Database::CreateCameraTable() const {
@@ -942,6 +1260,9 @@ namespace bkmap {
                         "    prior_tx   REAL,"
                         "    prior_ty   REAL,"
                         "    prior_tz   REAL,"
+                        "    content_hash  TEXT,"
+                        "    file_size     INTEGER,"
+                        "    file_mtime    INTEGER,"
                         "CONSTRAINT image_id_check CHECK(image_id >= 0 and image_id < %d),"
                         "FOREIGN KEY(camera_id) REFERENCES cameras(camera_id));"
                         "CREATE UNIQUE INDEX IF NOT EXISTS index_name ON images(name);",
@@ -997,6 +1318,32 @@ namespace bkmap {
         SQLITE3_EXEC(database_, sql.c_str(), nullptr);
     }
 
+    void Database::UpdateImageTableSchema() const {
+        const std::string sql = "PRAGMA table_info(images);";
+        sqlite3_stmt* sql_stmt;
+
+        SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1, &sql_stmt, 0));
+
+        bool exists_content_hash = false;
+        while (SQLITE3_CALL(sqlite3_step(sql_stmt)) == SQLITE_ROW) {
+            const std::string column_name(
+                    reinterpret_cast<const char*>(sqlite3_column_text(sql_stmt, 1)));
+            if (column_name == "content_hash") {
+                exists_content_hash = true;
+            }
+        }
+
+        SQLITE3_CALL(sqlite3_finalize(sql_stmt));
+
+        if (!exists_content_hash) {
+            SQLITE3_EXEC(database_,
+                         "ALTER TABLE images ADD COLUMN content_hash TEXT;"
+                                 "ALTER TABLE images ADD COLUMN file_size INTEGER;"
+                                 "ALTER TABLE images ADD COLUMN file_mtime INTEGER;",
+                         nullptr);
+        }
+    }
+
     bool Database::ExistsRowId(sqlite3_stmt* sql_stmt,
                                const sqlite3_int64 row_id) const {
         SQLITE3_CALL(
@@ -1102,4 +1449,73 @@ namespace bkmap {
 
     DatabaseTransaction::~DatabaseTransaction() { database_->EndTransaction(); }
 
+    DatabaseReaderPool::Handle::Handle(DatabaseReaderPool* pool, Database* database)
+            : pool_(pool), database_(database) {}
+
+    DatabaseReaderPool::Handle::Handle(Handle&& other)
+            : pool_(other.pool_), database_(other.database_) {
+        other.database_ = nullptr;
+    }
+
+    DatabaseReaderPool::Handle::~Handle() {
+        if (database_ != nullptr) {
+            pool_->Release(database_);
+        }
+    }
+
+    const Database& DatabaseReaderPool::Handle::operator*() const {
+        return *database_;
+    }
+
+    const Database* DatabaseReaderPool::Handle::operator->() const {
+        return database_;
+    }
+
+    DatabaseReaderPool::DatabaseReaderPool(const Database& database,
+                                           const int max_num_connections)
+            : path_(database.Path()),
+              feature_store_(database.feature_store_),
+              max_num_connections_(static_cast<size_t>(
+                                           GetEffectiveNumThreads(max_num_connections))) {
+        CHECK(!path_.empty()) << "Database not open";
+    }
+
+    size_t DatabaseReaderPool::NumConnections() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return databases_.size();
+    }
+
+    size_t DatabaseReaderPool::MaxNumConnections() const {
+        return max_num_connections_;
+    }
+
+    DatabaseReaderPool::Handle DatabaseReaderPool::Acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (available_databases_.empty() &&
+            databases_.size() < max_num_connections_) {
+            std::unique_ptr<Database> database(new Database());
+            database->OpenReadOnly(path_);
+            database->feature_store_ = feature_store_;
+            available_databases_.push_back(database.get());
+            databases_.push_back(std::move(database));
+        }
+
+        available_condition_.wait(lock,
+                                  [this] { return !available_databases_.empty(); });
+
+        Database* database = available_databases_.back();
+        available_databases_.pop_back();
+
+        return Handle(this, database);
+    }
+
+    void DatabaseReaderPool::Release(Database* database) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_databases_.push_back(database);
+        }
+        available_condition_.notify_one();
+    }
+
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 
 #ifndef BKMAP_DATABASE_H
 #define BKMAP_DATABASE_H
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
@@ -12,6 +14,7 @@
 
 #include "base/camera.h"
 #include "base/feature.h"
+#include "base/feature_store.h"
 #include "base/image.h"
 #include "estimators/two_view_geometry.h"
 #include "ext/SQLite/sqlite3.h"
@@ -20,11 +23,22 @@
 
 namespace bkmap {
 
+// Fingerprint of the file of an image, which is used to detect new, renamed and
+// modified image files. The size and the modification time allow to recognize
+// unchanged files without reading them.
+    struct ImageFile {
+        // Hash of the entire file content or empty, if it is unknown.
+        std::string content_hash;
+        int64_t size = -1;
+        int64_t modification_time = -1;
+    };
+
 // Database class to read and write images, features, cameras, matches, etc.
 // from a SQLite database. The class is not thread-safe and must not be accessed
 // concurrently. The class is optimized for single-thread speed and for optimal
 // performance, wrap multiple method calls inside a leading `BeginTransaction`
-// and trailing `EndTransaction`.
+// and trailing `EndTransaction`. For concurrent reads, use one read-only
+// connection per thread, e.g., through the `DatabaseReaderPool`.
     class Database {
     public:
         const static int kSchemaVersion = 1;
@@ -40,10 +54,39 @@ namespace bkmap {
         ~Database();
 
         // Open and close database. The same database should not be opened
-        // concurrently in multiple threads or processes.
+        // concurrently in multiple threads or processes. The sidecar feature
+        // store at `FeatureStore::DefaultPath(path)` is attached, if it exists.
         void Open(const std::string& path);
         void Close();
 
+        // Open an existing database as a read-only connection. Multiple read-only
+        // connections can read concurrently with each other and with a single
+        // writing connection, as the database uses write-ahead logging.
+        void OpenReadOnly(const std::string& path);
+
+        const std::string& Path() const;
+        bool IsReadOnly() const;
+
+        // Attach a memory-mapped feature store, from which keypoints and
+        // descriptors are read instead of the SQLite tables, if available.
+        // Written features are stored in both the tables and the feature store.
+        // The tables remain authoritative, i.e., the store is only read for the
+        // features of images that also have features in the tables.
+        void AttachFeatureStore(const std::string& path);
+        void DetachFeatureStore();
+
+        // The attached feature store or null, if no store is attached.
+        const FeatureStore* GetFeatureStore() const;
+
+        // Export the features of all images from the SQLite tables to the feature
+        // store at the given path. Images already in the store are skipped.
+        void ExportFeatureStore(const std::string& path) const;
+
+        // Import the features of all images from the feature store at the given
+        // path into the SQLite tables. Only features of existing images, which do
+        // not have features in the tables yet, are imported.
+        void ImportFeatureStore(const std::string& path) const;
+
         // Check if entry already exists in database. For image pairs, the order of
         // `image_id1` and `image_id2` does not matter.
         bool ExistsCamera(const camera_t camera_id) const;
@@ -132,12 +175,33 @@ namespace bkmap {
                 std::vector<image_pair_t>* image_pair_ids,
                 std::vector<TwoViewGeometry>* two_view_geometries) const;
 
+        // Read the file fingerprints of all images, for which they are known.
+        std::unordered_map<image_t, ImageFile> ReadAllImageFiles() const;
+
         // Read all image pairs that have an entry in the `inlier_matches` table with
         // at least one inlier match and their corresponding number of inlier matches.
         void ReadInlierMatchesGraph(
                 std::vector<std::pair<image_t, image_t>>* image_pairs,
                 std::vector<int>* num_inliers) const;
 
+        // Read the number of inlier matches and the configuration of all image
+        // pairs with at least one inlier match, without reading the matches.
+        void ReadInlierMatchesConfigs(std::vector<image_pair_t>* image_pair_ids,
+                                      std::vector<int>* num_inliers,
+                                      std::vector<int>* configs) const;
+
+        // Read the next chunk of at most `chunk_size` image pairs with at least
+        // one inlier match, in ascending order of their pair identifiers, starting
+        // from the pair identifier `*next_pair_id`. The identifier is advanced past
+        // the read chunk, so that the entire table can be streamed with bounded
+        // memory by repeated calls. Only the inlier matches and the configuration
+        // of the two-view geometries are read. Returns false, if there are no more
+        // image pairs to read.
+        bool ReadInlierMatchesChunk(
+                const size_t chunk_size, image_pair_t* next_pair_id,
+                std::vector<image_pair_t>* image_pair_ids,
+                std::vector<TwoViewGeometry>* two_view_geometries) const;
+
         // Add new camera and return its database identifier. If `use_camera_id`
         // is false a new identifier is automatically generated.
         camera_t WriteCamera(const Camera& camera,
@@ -167,6 +231,9 @@ namespace bkmap {
         // making sure that the entry already exists.
         void UpdateImage(const Image& image) const;
 
+        // Update the file fingerprint of an existing image.
+        void UpdateImageFile(const image_t image_id, const ImageFile& file) const;
+
         // Delete matches of an image pair.
         void DeleteMatches(const image_t image_id1, const image_t image_id2) const;
 
@@ -174,6 +241,11 @@ namespace bkmap {
         void DeleteInlierMatches(const image_t image_id1,
                                  const image_t image_id2) const;
 
+        // Delete the keypoints, descriptors and all matches of an image, e.g.,
+        // because its file was modified and the features are stale. The features
+        // are also deleted from the attached feature store.
+        void DeleteFeatures(const image_t image_id) const;
+
         // Clear the entire matches table.
         void ClearMatches() const;
 
@@ -181,8 +253,11 @@ namespace bkmap {
         void ClearInlierMatches() const;
 
     private:
+        friend class DatabaseReaderPool;
         friend class DatabaseTransaction;
 
+        void OpenConnection(const std::string& path, const bool read_only);
+
         // Combine multiple queries into one transaction by wrapping a code section
         // into a `BeginTransaction` and `EndTransaction`. You can create a scoped
         // transaction with `DatabaseTransaction` that ends when the transaction
@@ -205,6 +280,10 @@ namespace bkmap {
         void CreateMatchesTable() const;
         void CreateInlierMatchesTable() const;
 
+        // Add the columns of the file fingerprints to databases created before
+        // their introduction.
+        void UpdateImageTableSchema() const;
+
         bool ExistsRowId(sqlite3_stmt* sql_stmt, const sqlite3_int64 row_id) const;
         bool ExistsRowString(sqlite3_stmt* sql_stmt,
                              const std::string& row_entry) const;
@@ -215,8 +294,21 @@ namespace bkmap {
         size_t SumColumn(const std::string& column, const std::string& table) const;
         size_t MaxColumn(const std::string& column, const std::string& table) const;
 
+        FeatureKeypoints ReadKeypointsFromTable(const image_t image_id) const;
+        FeatureDescriptors ReadDescriptorsFromTable(const image_t image_id) const;
+        void WriteKeypointsToTable(const image_t image_id,
+                                   const FeatureKeypoints& keypoints) const;
+        void WriteDescriptorsToTable(const image_t image_id,
+                                     const FeatureDescriptors& descriptors) const;
+
         sqlite3* database_ = nullptr;
 
+        std::string path_;
+        bool read_only_ = false;
+
+        // The store is shared with the read-only connections of a reader pool.
+        std::shared_ptr<FeatureStore> feature_store_;
+
         // Used to ensure that only one transaction is active at the same time.
         std::mutex transaction_mutex_;
 
@@ -243,6 +335,7 @@ namespace bkmap {
         // update_*
         sqlite3_stmt* sql_stmt_update_camera_ = nullptr;
         sqlite3_stmt* sql_stmt_update_image_ = nullptr;
+        sqlite3_stmt* sql_stmt_update_image_file_ = nullptr;
 
         // read_*
         sqlite3_stmt* sql_stmt_read_camera_ = nullptr;
@@ -257,6 +350,9 @@ namespace bkmap {
         sqlite3_stmt* sql_stmt_read_inlier_matches_ = nullptr;
         sqlite3_stmt* sql_stmt_read_inlier_matches_all_ = nullptr;
         sqlite3_stmt* sql_stmt_read_inlier_matches_graph_ = nullptr;
+        sqlite3_stmt* sql_stmt_read_inlier_matches_configs_ = nullptr;
+        sqlite3_stmt* sql_stmt_read_inlier_matches_chunk_ = nullptr;
+        sqlite3_stmt* sql_stmt_read_image_files_ = nullptr;
 
         // write_*
         sqlite3_stmt* sql_stmt_write_keypoints_ = nullptr;
@@ -267,6 +363,10 @@ namespace bkmap {
         // delete_*
         sqlite3_stmt* sql_stmt_delete_matches_ = nullptr;
         sqlite3_stmt* sql_stmt_delete_inlier_matches_ = nullptr;
+        sqlite3_stmt* sql_stmt_delete_keypoints_ = nullptr;
+        sqlite3_stmt* sql_stmt_delete_descriptors_ = nullptr;
+        sqlite3_stmt* sql_stmt_delete_image_matches_ = nullptr;
+        sqlite3_stmt* sql_stmt_delete_image_inlier_matches_ = nullptr;
 
         // clear_*
         sqlite3_stmt* sql_stmt_clear_matches_ = nullptr;
@@ -288,6 +388,56 @@ namespace bkmap {
         std::unique_lock<std::mutex> database_lock_;
     };
 
+// Pool of read-only connections to the database of a given connection, so that
+// multiple threads can read keypoints, descriptors, matches, etc. in parallel.
+// Connections are opened on demand up to the maximum number of connections,
+// and a thread acquiring a connection blocks until one becomes available.
+// The connections share the feature store of the given connection.
+    class DatabaseReaderPool {
+    public:
+        // Scoped handle to a connection, which is returned to the pool when the
+        // handle is destructed.
+        class Handle {
+        public:
+            Handle(Handle&& other);
+            ~Handle();
+
+            const Database& operator*() const;
+            const Database* operator->() const;
+
+        private:
+            friend class DatabaseReaderPool;
+            NON_COPYABLE(Handle)
+            Handle(DatabaseReaderPool* pool, Database* database);
+            DatabaseReaderPool* pool_;
+            Database* database_;
+        };
+
+        // The maximum number of connections defaults to the number of threads.
+        explicit DatabaseReaderPool(const Database& database,
+                                    const int max_num_connections = -1);
+
+        size_t NumConnections() const;
+        size_t MaxNumConnections() const;
+
+        Handle Acquire();
+
+    private:
+        NON_COPYABLE(DatabaseReaderPool)
+        NON_MOVABLE(DatabaseReaderPool)
+
+        void Release(Database* database);
+
+        const std::string path_;
+        const std::shared_ptr<FeatureStore> feature_store_;
+        const size_t max_num_connections_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable available_condition_;
+        std::vector<std::unique_ptr<Database>> databases_;
+        std::vector<Database*> available_databases_;
+    };
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
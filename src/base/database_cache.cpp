@@ -4,12 +4,26 @@
 
 #include "base/database_cache.h"
 
+#include <algorithm>
 #include <unordered_set>
 
+#include "util/misc.h"
 #include "util/string.h"
+#include "util/threading.h"
 #include "util/timer.h"
 
 namespace bkmap {
+    namespace {
+
+        // Number of image pairs, whose inlier matches are read from the database
+        // at once while building the scene graph. This bounds the memory of the
+        // raw matches, which are discarded after their correspondences are added.
+        const size_t kInlierMatchesChunkSize = 1000;
+
+        // Number of progress reports while building the scene graph.
+        const size_t kNumProgressReports = 10;
+
+    }  // namespace
 
     DatabaseCache::DatabaseCache() {}
 
@@ -49,26 +63,28 @@ namespace bkmap {
         << std::endl;
 
         //////////////////////////////////////////////////////////////////////////////
-        // Load matches
+        // Load match graph
         //////////////////////////////////////////////////////////////////////////////
 
+        // Only the number of inlier matches and the configurations are loaded
+        // here, while the matches are streamed when building the scene graph.
+
         timer.Restart();
-        std::cout << "Loading matches..." << std::flush;
+        std::cout << "Loading match graph..." << std::flush;
 
         std::vector<image_pair_t> image_pair_ids;
-        std::vector<TwoViewGeometry> two_view_geometries;
-        database.ReadAllInlierMatches(&image_pair_ids, &two_view_geometries);
+        std::vector<int> num_inliers;
+        std::vector<int> configs;
+        database.ReadInlierMatchesConfigs(&image_pair_ids, &num_inliers, &configs);
 
         std::cout << StringPrintf(" %d in %.3fs", image_pair_ids.size(),
                                   timer.ElapsedSeconds())
         << std::endl;
 
         auto UseInlierMatchesCheck = [min_num_matches, ignore_watermarks](
-                const TwoViewGeometry& two_view_geometry) {
-            return static_cast<size_t>(two_view_geometry.inlier_matches.size()) >=
-                   min_num_matches &&
-                   (!ignore_watermarks ||
-                    two_view_geometry.config != TwoViewGeometry::WATERMARK);
+                const size_t num_inlier_matches, const int config) {
+            return num_inlier_matches >= min_num_matches &&
+                   (!ignore_watermarks || config != TwoViewGeometry::WATERMARK);
         };
 
         //////////////////////////////////////////////////////////////////////////////
@@ -100,7 +116,8 @@ namespace bkmap {
             std::unordered_set<image_t> connected_image_ids;
             connected_image_ids.reserve(image_ids.size());
             for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-                if (UseInlierMatchesCheck(two_view_geometries[i])) {
+                if (UseInlierMatchesCheck(static_cast<size_t>(num_inliers[i]),
+                                          configs[i])) {
                     image_t image_id1;
                     image_t image_id2;
                     Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
@@ -118,14 +135,34 @@ namespace bkmap {
                 if (image_ids.count(image.ImageId()) > 0 &&
                     connected_image_ids.count(image.ImageId()) > 0) {
                     images_.emplace(image.ImageId(), image);
-                    const FeatureKeypoints keypoints =
-                            database.ReadKeypoints(image.ImageId());
-                    const std::vector<Eigen::Vector2d> points =
-                            FeatureKeypointsToPointsVector(keypoints);
-                    images_[image.ImageId()].SetPoints2D(points);
                 }
             }
 
+            // Read the keypoints in parallel through read-only connections. This
+            // is not possible for in-memory databases, which are read serially.
+            std::unique_ptr<DatabaseReaderPool> database_reader_pool;
+            if (!database.Path().empty() && database.Path() != ":memory:") {
+                database_reader_pool.reset(new DatabaseReaderPool(database));
+            }
+
+            ThreadPool thread_pool(database_reader_pool ? ThreadPool::kMaxNumThreads
+                                                        : 1);
+            for (auto& image : images_) {
+                thread_pool.AddTask(
+                        [&database, &database_reader_pool](class Image* image) {
+                            FeatureKeypoints keypoints;
+                            if (database_reader_pool) {
+                                keypoints = database_reader_pool->Acquire()->ReadKeypoints(
+                                        image->ImageId());
+                            } else {
+                                keypoints = database.ReadKeypoints(image->ImageId());
+                            }
+                            image->SetPoints2D(FeatureKeypointsToPointsVector(keypoints));
+                        },
+                        &image.second);
+            }
+            thread_pool.Wait();
+
             std::cout << StringPrintf(" %d in %.3fs (connected %d)", images.size(),
                                       timer.ElapsedSeconds(),
                                       connected_image_ids.size())
@@ -137,26 +174,59 @@ namespace bkmap {
         //////////////////////////////////////////////////////////////////////////////
 
         timer.Restart();
-        std::cout << "Building scene graph..." << std::flush;
+        std::cout << "Building scene graph..." << std::endl;
 
         for (const auto& image : images_) {
             scene_graph_.AddImage(image.first, image.second.NumPoints2D());
         }
 
+        const size_t num_image_pairs = image_pair_ids.size();
+        image_pair_ids.clear();
+        image_pair_ids.shrink_to_fit();
+        num_inliers.clear();
+        num_inliers.shrink_to_fit();
+        configs.clear();
+        configs.shrink_to_fit();
+
+        const size_t progress_step =
+                std::max<size_t>(num_image_pairs / kNumProgressReports, 1);
+        size_t next_progress = progress_step;
+
+        size_t num_read_image_pairs = 0;
         size_t num_ignored_image_pairs = 0;
-        for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-            if (UseInlierMatchesCheck(two_view_geometries[i])) {
-                image_t image_id1;
-                image_t image_id2;
-                Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-                if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-                    scene_graph_.AddCorrespondences(image_id1, image_id2,
-                                                    two_view_geometries[i].inlier_matches);
+
+        image_pair_t next_pair_id = 0;
+        std::vector<TwoViewGeometry> two_view_geometries;
+        while (database.ReadInlierMatchesChunk(kInlierMatchesChunkSize,
+                                               &next_pair_id, &image_pair_ids,
+                                               &two_view_geometries)) {
+            for (size_t i = 0; i < image_pair_ids.size(); ++i) {
+                const TwoViewGeometry& two_view_geometry = two_view_geometries[i];
+                if (UseInlierMatchesCheck(two_view_geometry.inlier_matches.size(),
+                                          two_view_geometry.config)) {
+                    image_t image_id1;
+                    image_t image_id2;
+                    Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
+                    if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
+                        scene_graph_.AddCorrespondences(image_id1, image_id2,
+                                                        two_view_geometry.inlier_matches);
+                    } else {
+                        num_ignored_image_pairs += 1;
+                    }
                 } else {
                     num_ignored_image_pairs += 1;
                 }
-            } else {
-                num_ignored_image_pairs += 1;
+            }
+
+            num_read_image_pairs += image_pair_ids.size();
+            if (num_read_image_pairs >= next_progress) {
+                std::cout << StringPrintf("  %d / %d image pairs in %.3fs",
+                                          num_read_image_pairs, num_image_pairs,
+                                          timer.ElapsedSeconds())
+                << std::endl;
+                while (next_progress <= num_read_image_pairs) {
+                    next_progress += progress_step;
+                }
             }
         }
 
@@ -170,8 +240,12 @@ namespace bkmap {
                     scene_graph_.NumCorrespondencesForImage(image.first));
         }
 
-        std::cout << StringPrintf(" in %.3fs (ignored %d)", timer.ElapsedSeconds(),
-                                  num_ignored_image_pairs)
+        std::cout << StringPrintf("Built scene graph in %.3fs (ignored %d)",
+                                  timer.ElapsedSeconds(), num_ignored_image_pairs)
+        << std::endl;
+
+        std::cout << StringPrintf("Peak memory usage: %.1fMB",
+                                  GetPeakMemoryUsage() / (1024.0 * 1024.0))
         << std::endl;
     }
 
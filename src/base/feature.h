@@ -38,6 +38,10 @@ namespace bkmap{
             FeatureDescriptors;
     typedef std::vector<FeatureMatch> FeatureMatches;
 
+    // Number of bytes of binary feature descriptors, i.e. the descriptors have
+    // 256 bits, which are stored in the rows of `FeatureDescriptors`.
+    const int kBinaryDescriptorNumBytes = 32;
+
     // Convert feature keypoints to vector of points.
     std::vector<Eigen::Vector2d> FeatureKeypointsToPointsVector(
             const FeatureKeypoints& keypoints);
@@ -0,0 +1,158 @@
+#ifndef BKMAP_FEATURE_DESCRIPTOR_INDEX_H
+#define BKMAP_FEATURE_DESCRIPTOR_INDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+#include <Eigen/Core>
+
+#include "ext/FLANN/flann.hpp"
+#include "util/logging.h"
+
+namespace bkmap {
+
+// Approximate nearest neighbor index over the feature descriptors of a single
+// image, based on randomized kd-trees. The index is built once per image and
+// can then be queried with the descriptors of any number of other images, i.e.
+// the index is immutable after construction and thread-safe for concurrent
+// queries. The descriptors are either unsigned byte SIFT descriptors with a
+// norm of 512 or floating point descriptors with unit norm.
+    template <typename kDescType = uint8_t>
+    class FeatureDescriptorIndex {
+    public:
+        typedef Eigen::Matrix<kDescType, Eigen::Dynamic, Eigen::Dynamic,
+                Eigen::RowMajor> DescType;
+        typedef typename flann::L2<kDescType>::ResultType DistType;
+        typedef Eigen::Matrix<int, Eigen::Dynamic, 2, Eigen::RowMajor> IndicesType;
+        typedef Eigen::Matrix<DistType, Eigen::Dynamic, 2, Eigen::RowMajor>
+                DistancesType;
+
+        // The number of randomized kd-trees in the index.
+        static const int kNumTrees = 4;
+
+        // The L2-norm of the descriptors of the given type.
+        static constexpr float kDescNorm =
+                std::is_floating_point<kDescType>::value ? 1.0f : 512.0f;
+
+        explicit FeatureDescriptorIndex(
+                const Eigen::Ref<const DescType>& descriptors);
+
+        FeatureDescriptorIndex(const FeatureDescriptorIndex&) = delete;
+        FeatureDescriptorIndex& operator=(const FeatureDescriptorIndex&) = delete;
+
+        size_t NumDescriptors() const;
+        const DescType& Descriptors() const;
+
+        // Find the two nearest neighbors in the index for each of the query
+        // descriptors. The indices of missing neighbors are set to -1 and their
+        // squared Euclidean distances to the maximum representable value.
+        void Search(const DescType& query, const int num_checks,
+                    IndicesType* indices, DistancesType* distances) const;
+
+        // Convert the squared Euclidean distance between two descriptors to the
+        // angle between them, assuming both descriptors are normalized.
+        static float DistanceToAngle(const DistType distance);
+
+    private:
+        // The index only stores pointers into the descriptor data, which must
+        // therefore remain at the same memory location.
+        const DescType descriptors_;
+        std::unique_ptr<flann::Index<flann::L2<kDescType>>> index_;
+    };
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+    template <typename kDescType>
+    constexpr float FeatureDescriptorIndex<kDescType>::kDescNorm;
+
+    template <typename kDescType>
+    FeatureDescriptorIndex<kDescType>::FeatureDescriptorIndex(
+            const Eigen::Ref<const DescType>& descriptors)
+            : descriptors_(descriptors) {
+        static_assert(DescType::IsRowMajor, "Descriptors must be row-major");
+
+        if (descriptors_.rows() == 0) {
+            return;
+        }
+
+        const flann::Matrix<kDescType> dataset(
+                const_cast<kDescType*>(descriptors_.data()), descriptors_.rows(),
+                descriptors_.cols());
+        index_.reset(new flann::Index<flann::L2<kDescType>>(
+                dataset, flann::KDTreeIndexParams(kNumTrees)));
+        index_->buildIndex();
+    }
+
+    template <typename kDescType>
+    size_t FeatureDescriptorIndex<kDescType>::NumDescriptors() const {
+        return static_cast<size_t>(descriptors_.rows());
+    }
+
+    template <typename kDescType>
+    const typename FeatureDescriptorIndex<kDescType>::DescType&
+    FeatureDescriptorIndex<kDescType>::Descriptors() const {
+        return descriptors_;
+    }
+
+    template <typename kDescType>
+    void FeatureDescriptorIndex<kDescType>::Search(const DescType& query,
+                                                   const int num_checks,
+                                                   IndicesType* indices,
+                                                   DistancesType* distances) const {
+        CHECK_NOTNULL(indices);
+        CHECK_NOTNULL(distances);
+
+        indices->resize(query.rows(), 2);
+        indices->setConstant(-1);
+        distances->resize(query.rows(), 2);
+        distances->setConstant(std::numeric_limits<DistType>::max());
+
+        if (query.rows() == 0 || !index_) {
+            return;
+        }
+
+        CHECK_EQ(query.cols(), descriptors_.cols());
+
+        const size_t num_neighbors =
+                std::min(static_cast<size_t>(2), NumDescriptors());
+
+        // The FLANN result matrices must be dense with exactly num_neighbors
+        // columns, so search into temporary buffers if only one neighbor exists.
+        Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+                index_matrix(query.rows(), num_neighbors);
+        Eigen::Matrix<DistType, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+                distance_matrix(query.rows(), num_neighbors);
+        index_matrix.setConstant(-1);
+        distance_matrix.setConstant(std::numeric_limits<DistType>::max());
+
+        flann::Matrix<int> flann_indices(index_matrix.data(), query.rows(),
+                                         num_neighbors);
+        flann::Matrix<DistType> flann_distances(distance_matrix.data(),
+                                                query.rows(), num_neighbors);
+        const flann::Matrix<kDescType> flann_query(
+                const_cast<kDescType*>(query.data()), query.rows(), query.cols());
+
+        index_->knnSearch(flann_query, flann_indices, flann_distances,
+                          num_neighbors, flann::SearchParams(num_checks));
+
+        indices->leftCols(num_neighbors) = index_matrix;
+        distances->leftCols(num_neighbors) = distance_matrix;
+    }
+
+    template <typename kDescType>
+    float FeatureDescriptorIndex<kDescType>::DistanceToAngle(
+            const DistType distance) {
+        // For normalized descriptors, |d1 - d2|^2 = 2 * norm^2 - 2 * d1^T d2.
+        const float kDistNorm = 1.0f / (2.0f * kDescNorm * kDescNorm);
+        const float cos_angle = 1.0f - kDistNorm * static_cast<float>(distance);
+        return std::acos(std::max(-1.0f, std::min(cos_angle, 1.0f)));
+    }
+
+}
+
+#endif //BKMAP_FEATURE_DESCRIPTOR_INDEX_H
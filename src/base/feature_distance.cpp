@@ -0,0 +1,110 @@
+#include "base/feature_distance.h"
+
+#include <cstring>
+
+#include "util/logging.h"
+
+namespace bkmap {
+    namespace {
+
+        static_assert(kBinaryDescriptorNumBytes ==
+                      8 * internal::kBinaryDescriptorNumWords,
+                      "Binary descriptors must consist of 64 bit words");
+
+        // Copy the descriptors into 64 bit words, which avoids unaligned loads.
+        std::vector<uint64_t> ConvertBinaryDescriptors(
+                const FeatureDescriptors& descriptors) {
+            CHECK_EQ(descriptors.cols(), kBinaryDescriptorNumBytes);
+            std::vector<uint64_t> words(descriptors.rows() *
+                                        internal::kBinaryDescriptorNumWords);
+            if (!words.empty()) {
+                std::memcpy(words.data(), descriptors.data(),
+                            words.size() * sizeof(uint64_t));
+            }
+            return words;
+        }
+
+        void PrepareSiftDescriptors(const FeatureDescriptors& descriptors,
+                                    internal::PreparedSiftDescriptors* prepared) {
+            if (descriptors.rows() > 0) {
+                CHECK_EQ(descriptors.cols(), internal::kSiftDescriptorDim);
+            }
+            internal::PrepareSiftDescriptors(descriptors.data(),
+                                             static_cast<int>(descriptors.rows()),
+                                             prepared);
+        }
+
+        void FindBestSiftMatches(
+                const internal::PreparedSiftDescriptors& descriptors1,
+                const FeatureDescriptors& descriptors2,
+                const SiftGuidedFilter& guided_filter,
+                std::vector<SiftBestMatch>* best_matches12,
+                std::vector<SiftBestMatch>* best_matches21) {
+            if (descriptors2.rows() > 0) {
+                CHECK_EQ(descriptors2.cols(), internal::kSiftDescriptorDim);
+            }
+            internal::FindBestSiftMatches(
+                    descriptors1, descriptors2.data(),
+                    static_cast<int>(descriptors2.rows()), guided_filter,
+                    best_matches12, best_matches21);
+        }
+
+    }  // namespace
+
+    void FindBestSiftMatches(const FeatureDescriptors& descriptors1,
+                             const FeatureDescriptors& descriptors2,
+                             const SiftGuidedFilter& guided_filter,
+                             std::vector<SiftBestMatch>* best_matches12,
+                             std::vector<SiftBestMatch>* best_matches21) {
+        internal::PreparedSiftDescriptors prepared_descriptors1;
+        PrepareSiftDescriptors(descriptors1, &prepared_descriptors1);
+        FindBestSiftMatches(prepared_descriptors1, descriptors2, guided_filter,
+                            best_matches12, best_matches21);
+    }
+
+    void FindBestSiftMatches(
+            const FeatureDescriptors& descriptors1,
+            const std::vector<const FeatureDescriptors*>& descriptors2,
+            std::vector<std::vector<SiftBestMatch>>* best_matches12,
+            std::vector<std::vector<SiftBestMatch>>* best_matches21) {
+        CHECK_NOTNULL(best_matches12);
+
+        internal::PreparedSiftDescriptors prepared_descriptors1;
+        PrepareSiftDescriptors(descriptors1, &prepared_descriptors1);
+
+        best_matches12->resize(descriptors2.size());
+        if (best_matches21 != nullptr) {
+            best_matches21->resize(descriptors2.size());
+        }
+
+        for (size_t i = 0; i < descriptors2.size(); ++i) {
+            FindBestSiftMatches(
+                    prepared_descriptors1, *CHECK_NOTNULL(descriptors2[i]), nullptr,
+                    &(*best_matches12)[i],
+                    best_matches21 == nullptr ? nullptr : &(*best_matches21)[i]);
+        }
+    }
+
+    int ComputeHammingDistance(const uint8_t* descriptor1,
+                               const uint8_t* descriptor2) {
+        uint64_t words1[internal::kBinaryDescriptorNumWords];
+        uint64_t words2[internal::kBinaryDescriptorNumWords];
+        std::memcpy(words1, descriptor1, kBinaryDescriptorNumBytes);
+        std::memcpy(words2, descriptor2, kBinaryDescriptorNumBytes);
+        return internal::ComputeHammingDistance(words1, words2);
+    }
+
+    void FindBestBinaryMatches(const FeatureDescriptors& descriptors1,
+                               const FeatureDescriptors& descriptors2,
+                               const SiftGuidedFilter& guided_filter,
+                               std::vector<BinaryBestMatch>* best_matches12,
+                               std::vector<BinaryBestMatch>* best_matches21) {
+        const std::vector<uint64_t> data1 = ConvertBinaryDescriptors(descriptors1);
+        const std::vector<uint64_t> data2 = ConvertBinaryDescriptors(descriptors2);
+        internal::FindBestBinaryMatches(
+                data1.data(), static_cast<int>(descriptors1.rows()), data2.data(),
+                static_cast<int>(descriptors2.rows()), guided_filter,
+                best_matches12, best_matches21);
+    }
+
+}
@@ -0,0 +1,52 @@
+#ifndef BKMAP_FEATURE_DISTANCE_H
+#define BKMAP_FEATURE_DISTANCE_H
+
+#include <functional>
+#include <vector>
+
+#include "base/feature.h"
+#include "base/feature_distance_simd.h"
+
+namespace bkmap {
+
+// Exhaustively find the best and second best matches between two sets of SIFT
+// descriptors. The dot products are computed in blocks using AVX-512 VNNI or
+// AVX2 instructions, if available (see feature_distance_simd.h), and the top-2
+// search is fused into the kernel, so that the full distance matrix is never
+// stored. The best matches
+// from the second to the first set are only computed if `best_matches21` is
+// not null. The guided filter is optional.
+    void FindBestSiftMatches(const FeatureDescriptors& descriptors1,
+                             const FeatureDescriptors& descriptors2,
+                             const SiftGuidedFilter& guided_filter,
+                             std::vector<SiftBestMatch>* best_matches12,
+                             std::vector<SiftBestMatch>* best_matches21);
+
+// Find the best matches of one set of descriptors against multiple other sets,
+// e.g., when matching one image against many candidate images. This avoids
+// preparing the first set of descriptors for every pair.
+    void FindBestSiftMatches(
+            const FeatureDescriptors& descriptors1,
+            const std::vector<const FeatureDescriptors*>& descriptors2,
+            std::vector<std::vector<SiftBestMatch>>* best_matches12,
+            std::vector<std::vector<SiftBestMatch>>* best_matches21);
+
+// Hamming distance between two binary descriptors with
+// kBinaryDescriptorNumBytes bytes. Use internal::ComputeHammingDistance for
+// descriptors, which are already stored as 64 bit words.
+    int ComputeHammingDistance(const uint8_t* descriptor1,
+                               const uint8_t* descriptor2);
+
+// Exhaustively find the best and second best matches between two sets of
+// binary descriptors. The Hamming distances are computed with POPCNT
+// instructions, if available, in the same blocks as for SIFT descriptors and
+// the guided filter is optional.
+    void FindBestBinaryMatches(const FeatureDescriptors& descriptors1,
+                               const FeatureDescriptors& descriptors2,
+                               const SiftGuidedFilter& guided_filter,
+                               std::vector<BinaryBestMatch>* best_matches12,
+                               std::vector<BinaryBestMatch>* best_matches21);
+
+}
+
+#endif //BKMAP_FEATURE_DISTANCE_H
@@ -0,0 +1,375 @@
+#include "base/feature_distance_simd.h"
+
+#include <algorithm>
+
+#if defined(__AVX512VNNI__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__POPCNT__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "util/logging.h"
+
+namespace bkmap {
+    namespace internal {
+        namespace {
+
+            // Number of descriptors of the first set, whose dot products with one
+            // descriptor of the second set are computed at once in registers.
+            const int kBlockSize1 = 4;
+
+            // Number of descriptors of the second set, which are matched against all
+            // descriptors of the first set, before moving on to the next block. The
+            // block should fit into the L2 cache.
+            const int kBlockSize2 = 256;
+
+#if defined(__AVX512VNNI__)
+
+            // The VNNI instructions multiply unsigned with signed bytes. The dot
+            // product is therefore computed as a^T b = a^T (b - 128) + 128 * sum(a).
+            typedef uint8_t DescElemType1;
+            typedef int8_t DescElemType2;
+
+            int ComputeDotProductOffset(const uint8_t* descriptor) {
+                int sum = 0;
+                for (int k = 0; k < kSiftDescriptorDim; ++k) {
+                    sum += descriptor[k];
+                }
+                return 128 * sum;
+            }
+
+            DescElemType1 ConvertDescElem1(const uint8_t value) { return value; }
+
+            DescElemType2 ConvertDescElem2(const uint8_t value) {
+                return static_cast<int8_t>(value ^ 0x80);
+            }
+
+            void ComputeDotProducts(const DescElemType1* const a[kBlockSize1],
+                                    const DescElemType2* b, int dists[kBlockSize1]) {
+                const __m512i b0 = _mm512_loadu_si512(b);
+                const __m512i b1 = _mm512_loadu_si512(b + 64);
+                for (int r = 0; r < kBlockSize1; ++r) {
+                    __m512i acc = _mm512_dpbusd_epi32(_mm512_setzero_si512(),
+                                                      _mm512_loadu_si512(a[r]), b0);
+                    acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a[r] + 64), b1);
+                    dists[r] = _mm512_reduce_add_epi32(acc);
+                }
+            }
+
+#elif defined(__AVX2__)
+
+            // The descriptors are widened to 16 bit once, so that the dot products
+            // can be computed with multiply-add instructions without overflow.
+            typedef int16_t DescElemType1;
+            typedef int16_t DescElemType2;
+
+            int ComputeDotProductOffset(const uint8_t* descriptor) { return 0; }
+
+            DescElemType1 ConvertDescElem1(const uint8_t value) { return value; }
+
+            DescElemType2 ConvertDescElem2(const uint8_t value) { return value; }
+
+            void ComputeDotProducts(const DescElemType1* const a[kBlockSize1],
+                                    const DescElemType2* b, int dists[kBlockSize1]) {
+                static_assert(kBlockSize1 == 4, "Reduction assumes four rows");
+
+                __m256i acc0 = _mm256_setzero_si256();
+                __m256i acc1 = _mm256_setzero_si256();
+                __m256i acc2 = _mm256_setzero_si256();
+                __m256i acc3 = _mm256_setzero_si256();
+                for (int k = 0; k < kSiftDescriptorDim; k += 16) {
+                    const __m256i bk =
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+                    acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(a[0] + k)), bk));
+                    acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(a[1] + k)), bk));
+                    acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(a[2] + k)), bk));
+                    acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(a[3] + k)), bk));
+                }
+
+                // Reduce all four accumulators at once.
+                const __m256i sum01 = _mm256_hadd_epi32(acc0, acc1);
+                const __m256i sum23 = _mm256_hadd_epi32(acc2, acc3);
+                const __m256i sum0123 = _mm256_hadd_epi32(sum01, sum23);
+                const __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sum0123),
+                                                  _mm256_extracti128_si256(sum0123, 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dists), sum);
+            }
+
+#else
+
+            typedef uint8_t DescElemType1;
+            typedef uint8_t DescElemType2;
+
+            int ComputeDotProductOffset(const uint8_t* descriptor) { return 0; }
+
+            DescElemType1 ConvertDescElem1(const uint8_t value) { return value; }
+
+            DescElemType2 ConvertDescElem2(const uint8_t value) { return value; }
+
+            void ComputeDotProducts(const DescElemType1* const a[kBlockSize1],
+                                    const DescElemType2* b, int dists[kBlockSize1]) {
+                for (int r = 0; r < kBlockSize1; ++r) {
+                    int dist = 0;
+                    for (int k = 0; k < kSiftDescriptorDim; ++k) {
+                        dist += static_cast<int>(a[r][k]) * static_cast<int>(b[k]);
+                    }
+                    dists[r] = dist;
+                }
+            }
+
+#endif
+
+            template <typename DescElemType, typename ConvertFunc>
+            void ConvertDescriptors(const uint8_t* descriptors,
+                                    const size_t num_elems,
+                                    ConvertFunc convert_func,
+                                    DescElemType* converted) {
+                for (size_t i = 0; i < num_elems; ++i) {
+                    converted[i] = convert_func(descriptors[i]);
+                }
+            }
+
+            void UpdateBestMatch(const int idx, const int dist,
+                                 SiftBestMatch* match) {
+                if (dist > match->dist) {
+                    match->idx = idx;
+                    match->second_dist = match->dist;
+                    match->dist = dist;
+                } else if (dist > match->second_dist) {
+                    match->second_dist = dist;
+                }
+            }
+
+            void UpdateBestMatch(const int idx, const int dist,
+                                 BinaryBestMatch* match) {
+                if (dist < match->dist) {
+                    match->idx = idx;
+                    match->second_dist = match->dist;
+                    match->dist = dist;
+                } else if (dist < match->second_dist) {
+                    match->second_dist = dist;
+                }
+            }
+
+        }  // namespace
+
+        void PrepareSiftDescriptors(const uint8_t* descriptors,
+                                    const int num_descriptors,
+                                    PreparedSiftDescriptors* prepared) {
+            CHECK_NOTNULL(prepared);
+
+            prepared->num_descriptors = num_descriptors;
+            prepared->data.clear();
+            prepared->offsets.clear();
+            if (num_descriptors == 0) {
+                return;
+            }
+
+            // The storage of the data is untyped, since the element type depends
+            // on the available instructions.
+            const size_t num_elems =
+                    static_cast<size_t>(num_descriptors) * kSiftDescriptorDim;
+            prepared->data.resize(num_elems * sizeof(DescElemType1));
+            ConvertDescriptors(descriptors, num_elems, ConvertDescElem1,
+                               reinterpret_cast<DescElemType1*>(prepared->data.data()));
+
+            prepared->offsets.resize(num_descriptors);
+            for (int i1 = 0; i1 < num_descriptors; ++i1) {
+                prepared->offsets[i1] =
+                        ComputeDotProductOffset(descriptors + i1 * kSiftDescriptorDim);
+            }
+        }
+
+        void FindBestSiftMatches(const PreparedSiftDescriptors& descriptors1,
+                                 const uint8_t* descriptors2,
+                                 const int num_descriptors2,
+                                 const SiftGuidedFilter& guided_filter,
+                                 std::vector<SiftBestMatch>* best_matches12,
+                                 std::vector<SiftBestMatch>* best_matches21) {
+            CHECK_NOTNULL(best_matches12);
+
+            const int num_descriptors1 = descriptors1.num_descriptors;
+
+            best_matches12->clear();
+            best_matches12->resize(num_descriptors1);
+            if (best_matches21 != nullptr) {
+                best_matches21->clear();
+                best_matches21->resize(num_descriptors2);
+            }
+
+            if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+                return;
+            }
+
+            const DescElemType1* data1 =
+                    reinterpret_cast<const DescElemType1*>(descriptors1.data.data());
+            const std::vector<int>& offsets1 = descriptors1.offsets;
+            std::vector<DescElemType2> data2(
+                    static_cast<size_t>(num_descriptors2) * kSiftDescriptorDim);
+            ConvertDescriptors(descriptors2, data2.size(), ConvertDescElem2,
+                               data2.data());
+
+            std::vector<char> filtered;
+
+            for (int i2_begin = 0; i2_begin < num_descriptors2;
+                 i2_begin += kBlockSize2) {
+                const int i2_end = std::min(num_descriptors2, i2_begin + kBlockSize2);
+                const int block_size2 = i2_end - i2_begin;
+
+                for (int i1_begin = 0; i1_begin < num_descriptors1;
+                     i1_begin += kBlockSize1) {
+                    const int i1_end = std::min(num_descriptors1, i1_begin + kBlockSize1);
+                    const int block_size1 = i1_end - i1_begin;
+
+                    if (guided_filter) {
+                        filtered.assign(block_size1 * block_size2, false);
+                        guided_filter(i1_begin, i1_end, i2_begin, i2_end, &filtered);
+                    }
+
+                    // Incomplete blocks at the end repeat the last descriptor, whose
+                    // dot products are computed but ignored.
+                    const DescElemType1* rows1[kBlockSize1];
+                    for (int r = 0; r < kBlockSize1; ++r) {
+                        rows1[r] = data1 + std::min(i1_begin + r, i1_end - 1) *
+                                       kSiftDescriptorDim;
+                    }
+
+                    for (int i2 = i2_begin; i2 < i2_end; ++i2) {
+                        const int filtered_idx = i2 - i2_begin;
+
+                        if (guided_filter) {
+                            bool all_filtered = true;
+                            for (int r = 0; r < block_size1; ++r) {
+                                if (!filtered[r * block_size2 + filtered_idx]) {
+                                    all_filtered = false;
+                                    break;
+                                }
+                            }
+                            if (all_filtered) {
+                                continue;
+                            }
+                        }
+
+                        int dists[kBlockSize1];
+                        ComputeDotProducts(
+                                rows1, data2.data() + i2 * kSiftDescriptorDim, dists);
+
+                        for (int r = 0; r < block_size1; ++r) {
+                            if (guided_filter && filtered[r * block_size2 + filtered_idx]) {
+                                continue;
+                            }
+
+                            const int i1 = i1_begin + r;
+                            const int dist = dists[r] + offsets1[i1];
+                            UpdateBestMatch(i2, dist, &(*best_matches12)[i1]);
+                            if (best_matches21 != nullptr) {
+                                UpdateBestMatch(i1, dist, &(*best_matches21)[i2]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        int ComputeHammingDistance(const uint64_t* descriptor1,
+                                   const uint64_t* descriptor2) {
+            int dist = 0;
+            for (int k = 0; k < kBinaryDescriptorNumWords; ++k) {
+                const uint64_t value = descriptor1[k] ^ descriptor2[k];
+#if defined(__POPCNT__) && defined(__x86_64__)
+                dist += static_cast<int>(_mm_popcnt_u64(value));
+#else
+                uint64_t count = value - ((value >> 1) & 0x5555555555555555ULL);
+                count = (count & 0x3333333333333333ULL) +
+                        ((count >> 2) & 0x3333333333333333ULL);
+                count = (count + (count >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+                dist += static_cast<int>((count * 0x0101010101010101ULL) >> 56);
+#endif
+            }
+            return dist;
+        }
+
+        void FindBestBinaryMatches(const uint64_t* descriptors1,
+                                   const int num_descriptors1,
+                                   const uint64_t* descriptors2,
+                                   const int num_descriptors2,
+                                   const SiftGuidedFilter& guided_filter,
+                                   std::vector<BinaryBestMatch>* best_matches12,
+                                   std::vector<BinaryBestMatch>* best_matches21) {
+            CHECK_NOTNULL(best_matches12);
+
+            best_matches12->clear();
+            best_matches12->resize(num_descriptors1);
+            if (best_matches21 != nullptr) {
+                best_matches21->clear();
+                best_matches21->resize(num_descriptors2);
+            }
+
+            if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+                return;
+            }
+
+            std::vector<char> filtered;
+            std::vector<int> dists(kBlockSize2);
+
+            for (int i2_begin = 0; i2_begin < num_descriptors2;
+                 i2_begin += kBlockSize2) {
+                const int i2_end = std::min(num_descriptors2, i2_begin + kBlockSize2);
+                const int block_size2 = i2_end - i2_begin;
+                const uint64_t* block2 =
+                        descriptors2 + i2_begin * kBinaryDescriptorNumWords;
+
+                for (int i1_begin = 0; i1_begin < num_descriptors1;
+                     i1_begin += kBlockSize1) {
+                    const int i1_end = std::min(num_descriptors1, i1_begin + kBlockSize1);
+
+                    if (guided_filter) {
+                        filtered.assign((i1_end - i1_begin) * block_size2, false);
+                        guided_filter(i1_begin, i1_end, i2_begin, i2_end, &filtered);
+                    }
+
+                    for (int i1 = i1_begin; i1 < i1_end; ++i1) {
+                        // The distances to the whole block are computed first, so
+                        // that the POPCNT instructions are not interleaved with
+                        // branches.
+                        const uint64_t* descriptor1 =
+                                descriptors1 + i1 * kBinaryDescriptorNumWords;
+                        for (int j = 0; j < block_size2; ++j) {
+                            dists[j] = ComputeHammingDistance(
+                                    descriptor1, block2 + j * kBinaryDescriptorNumWords);
+                        }
+
+                        const char* filtered_row =
+                                guided_filter
+                                ? filtered.data() + (i1 - i1_begin) * block_size2
+                                : nullptr;
+                        BinaryBestMatch* best_match12 = &(*best_matches12)[i1];
+                        for (int j = 0; j < block_size2; ++j) {
+                            if (filtered_row != nullptr && filtered_row[j]) {
+                                continue;
+                            }
+
+                            const int dist = dists[j];
+                            if (dist < best_match12->second_dist) {
+                                UpdateBestMatch(i2_begin + j, dist, best_match12);
+                            }
+                            if (best_matches21 != nullptr &&
+                                dist < (*best_matches21)[i2_begin + j].second_dist) {
+                                UpdateBestMatch(i1, dist,
+                                                &(*best_matches21)[i2_begin + j]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+    }  // namespace internal
+
+    const int BinaryBestMatch::kNoMatch;
+}
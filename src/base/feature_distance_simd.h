@@ -0,0 +1,99 @@
+#ifndef BKMAP_FEATURE_DISTANCE_SIMD_H
+#define BKMAP_FEATURE_DISTANCE_SIMD_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// The vectorized descriptor distance kernels. This header and its source file
+// must not include Eigen, since the source file is the only one compiled with
+// the instruction set extensions in `SSE_FLAGS`, which change the alignment
+// and layout of fixed-size Eigen types. The kernels therefore operate on raw
+// descriptor data.
+
+namespace bkmap {
+
+// Best and second best match of a SIFT descriptor, where the distances are the
+// dot products of the unsigned byte descriptors, i.e., larger values denote
+// more similar descriptors. A distance of zero denotes no match.
+    struct SiftBestMatch {
+        int idx = -1;
+        int dist = 0;
+        int second_dist = 0;
+    };
+
+// Best and second best match of a binary descriptor, where the distances are
+// the Hamming distances of the descriptors in bits, i.e., smaller values denote
+// more similar descriptors. The distances of missing matches are kNoMatch.
+    struct BinaryBestMatch {
+        static const int kNoMatch = std::numeric_limits<int>::max();
+        int idx = -1;
+        int dist = kNoMatch;
+        int second_dist = kNoMatch;
+    };
+
+// Filter for guided matching, which is evaluated for one tile of descriptor
+// pairs at once to avoid the overhead of a function call per pair. The filter
+// must set `filtered[(i1 - i1_begin) * (i2_end - i2_begin) + i2 - i2_begin]`
+// to true, if the pair (i1, i2) should be excluded from matching.
+    typedef std::function<void(const int i1_begin, const int i1_end,
+                               const int i2_begin, const int i2_end,
+                               std::vector<char>* filtered)> SiftGuidedFilter;
+
+    namespace internal {
+
+        // Dimensionality of the SIFT descriptors of the kernels.
+        const int kSiftDescriptorDim = 128;
+
+        // The first set of SIFT descriptors converted into the element format of
+        // the kernel, which depends on the available instructions. The conversion
+        // is only done once when matching one set against multiple other sets.
+        struct PreparedSiftDescriptors {
+            int num_descriptors = 0;
+            std::vector<uint8_t> data;
+            std::vector<int> offsets;
+        };
+
+        // Convert row-major descriptors with kSiftDescriptorDim bytes each.
+        void PrepareSiftDescriptors(const uint8_t* descriptors,
+                                    const int num_descriptors,
+                                    PreparedSiftDescriptors* prepared);
+
+        // Find the best matches between the prepared descriptors and row-major
+        // descriptors with kSiftDescriptorDim bytes each. The best matches from
+        // the second to the first set are only computed, if `best_matches21` is
+        // not null. The guided filter is optional.
+        void FindBestSiftMatches(const PreparedSiftDescriptors& descriptors1,
+                                 const uint8_t* descriptors2,
+                                 const int num_descriptors2,
+                                 const SiftGuidedFilter& guided_filter,
+                                 std::vector<SiftBestMatch>* best_matches12,
+                                 std::vector<SiftBestMatch>* best_matches21);
+
+        // Number of 64 bit words of a binary descriptor, which must match
+        // kBinaryDescriptorNumBytes.
+        const int kBinaryDescriptorNumWords = 4;
+
+        // Hamming distance between two binary descriptors with
+        // kBinaryDescriptorNumWords words, using POPCNT instructions, if
+        // available.
+        int ComputeHammingDistance(const uint64_t* descriptor1,
+                                   const uint64_t* descriptor2);
+
+        // Find the best matches between two sets of row-major binary descriptors
+        // with kBinaryDescriptorNumWords words each, with the same semantics as
+        // for the SIFT descriptors.
+        void FindBestBinaryMatches(const uint64_t* descriptors1,
+                                   const int num_descriptors1,
+                                   const uint64_t* descriptors2,
+                                   const int num_descriptors2,
+                                   const SiftGuidedFilter& guided_filter,
+                                   std::vector<BinaryBestMatch>* best_matches12,
+                                   std::vector<BinaryBestMatch>* best_matches21);
+
+    }  // namespace internal
+
+}
+
+#endif //BKMAP_FEATURE_DISTANCE_SIMD_H
@@ -8,14 +8,28 @@
 #include <fstream>
 #include <memory>
 
+#include "base/binary_feature.h"
+#include "base/sift_cpu.h"
 #include "ext/SiftGPU/SiftGPU.h"
+#include "ext/VLFeat/mathop.h"
 #include "ext/VLFeat/sift.h"
 //#include "util/cuda.h"
+#include "util/buffer_pool.h"
 #include "util/misc.h"
 
 namespace bkmap {
     namespace {
 
+        // Maximum number of bytes of unused image buffers retained for later images.
+        const size_t kMaxNumPooledImageBytes = 512 * 1024 * 1024;
+
+        // Pool of the intensity images, which are passed to the first octave and are
+        // reused across the images of all extraction threads.
+        BufferPool<float>& GetSiftImageBufferPool() {
+            static BufferPool<float> buffer_pool(kMaxNumPooledImageBytes);
+            return buffer_pool;
+        }
+
         // VLFeat uses a different convention to store its descriptors. This transforms
         // the VLFeat format into the original SIFT format that is also used by SiftGPU.
         FeatureDescriptors TransformVLFeatToUBCFeatureDescriptors(
@@ -51,6 +65,313 @@ namespace bkmap {
             }
         }
 
+        // Number of keypoints whose orientations and descriptors are computed in
+        // a single task of the intra-image thread pool.
+        const size_t kSiftNumKeypointsPerTask = 32;
+
+        // Computes the gradient magnitudes and angles of the rows [row_begin,
+        // row_end) of an octave level. This is equivalent to the gradient
+        // computation in VLFeat, which cannot be run in parallel.
+        void ComputeSiftGradientRows(const vl_sift_pix* level, const int width,
+                                     const int height, const int row_begin,
+                                     const int row_end, vl_sift_pix* grad) {
+            for (int y = row_begin; y < row_end; ++y) {
+                const vl_sift_pix* src = level + y * width;
+                vl_sift_pix* dst = grad + 2 * y * width;
+                for (int x = 0; x < width; ++x, ++src) {
+                    vl_sift_pix gx;
+                    if (x == 0) {
+                        gx = src[1] - src[0];
+                    } else if (x == width - 1) {
+                        gx = src[0] - src[-1];
+                    } else {
+                        gx = 0.5 * (src[1] - src[-1]);
+                    }
+
+                    vl_sift_pix gy;
+                    if (y == 0) {
+                        gy = src[width] - src[0];
+                    } else if (y == height - 1) {
+                        gy = src[0] - src[-width];
+                    } else {
+                        gy = 0.5 * (src[width] - src[-width]);
+                    }
+
+                    *dst++ = vl_fast_sqrt_f(gx * gx + gy * gy);
+                    *dst++ = vl_mod_2pi_f(vl_fast_atan2_f(gy, gx) + 2 * VL_PI);
+                }
+            }
+        }
+
+        // Computes the gradients of all levels of the current octave, optionally in
+        // parallel, so that VLFeat does not lazily compute them on the first
+        // orientation or descriptor query. Returns false if the octave is too
+        // small, in which case the gradients are left to VLFeat.
+        bool ComputeSiftOctaveGradients(const SiftExtractionOptions& options,
+                                        VlSiftFilt* sift, ThreadPool* thread_pool) {
+            const int width = vl_sift_get_octave_width(sift);
+            const int height = vl_sift_get_octave_height(sift);
+            if (width < 2 || height < 2) {
+                return false;
+            }
+
+            const auto ComputeGradientRows =
+                    options.use_simd ? ComputeSiftGradients : ComputeSiftGradientRows;
+
+            const int num_blocks =
+                    thread_pool ? static_cast<int>(thread_pool->NumThreads()) : 1;
+            const int block_size = (height + num_blocks - 1) / num_blocks;
+
+            for (int s = sift->s_min + 1; s <= sift->s_max - 2; ++s) {
+                const vl_sift_pix* level = vl_sift_get_octave(sift, s);
+                vl_sift_pix* grad =
+                        sift->grad + 2 * width * height * (s - sift->s_min - 1);
+                for (int row_begin = 0; row_begin < height; row_begin += block_size) {
+                    const int row_end = std::min(row_begin + block_size, height);
+                    if (thread_pool) {
+                        thread_pool->AddTask(ComputeGradientRows, level, width, height,
+                                             row_begin, row_end, grad);
+                    } else {
+                        ComputeGradientRows(level, width, height, row_begin, row_end,
+                                            grad);
+                    }
+                }
+            }
+
+            if (thread_pool) {
+                thread_pool->Wait();
+            }
+
+            sift->grad_o = sift->o_cur;
+
+            return true;
+        }
+
+        // Ratio of the feature budgets of consecutive octaves. The coarser octaves
+        // get a larger share of the budget than their area, as their features are
+        // fewer but more repeatable.
+        const double kSiftOctaveBudgetRatio = 0.5;
+
+        // Determines the number of keypoints to describe in the current octave,
+        // given the budget that is left for the current and the remaining octaves.
+        size_t GetSiftOctaveBudget(const VlSiftFilt* sift,
+                                   const size_t remaining_budget) {
+            const int num_remaining_octaves =
+                    vl_sift_get_noctaves(sift) - (sift->o_cur - sift->o_min);
+            double remaining_weight = 0;
+            for (int i = 0; i < num_remaining_octaves; ++i) {
+                remaining_weight += std::pow(kSiftOctaveBudgetRatio, i);
+            }
+            if (remaining_weight <= 1) {
+                return remaining_budget;
+            }
+            return static_cast<size_t>(std::round(remaining_budget / remaining_weight));
+        }
+
+        // Selects at most `max_num_keypoints` keypoints of the current octave with
+        // the strongest DoG response, in the order of their detection. With a grid,
+        // every cell first contributes its strongest keypoint, then its second
+        // strongest keypoint, etc., which distributes the keypoints uniformly.
+        std::vector<VlSiftKeypoint> SelectSiftOctaveKeypoints(
+                const SiftExtractionOptions& options, const VlSiftFilt* sift,
+                const size_t max_num_keypoints) {
+            const size_t num_keypoints = vl_sift_get_nkeypoints(sift);
+            const VlSiftKeypoint* keypoints = vl_sift_get_keypoints(sift);
+            if (num_keypoints <= max_num_keypoints) {
+                return std::vector<VlSiftKeypoint>(keypoints, keypoints + num_keypoints);
+            }
+
+            const int width = sift->octave_width;
+            const int height = sift->octave_height;
+
+            std::vector<std::pair<float, size_t>> responses(num_keypoints);
+            for (size_t i = 0; i < num_keypoints; ++i) {
+                const VlSiftKeypoint& keypoint = keypoints[i];
+                const vl_sift_pix dog =
+                        sift->dog[keypoint.ix + keypoint.iy * width +
+                                  (keypoint.is - sift->s_min) * width * height];
+                responses[i] = std::make_pair(std::abs(dog), i);
+            }
+
+            std::sort(responses.begin(), responses.end(),
+                      [](const std::pair<float, size_t>& response1,
+                         const std::pair<float, size_t>& response2) {
+                          return response1.first > response2.first;
+                      });
+
+            if (options.feature_grid_size > 0) {
+                const int cell_size =
+                        (std::max(width, height) + options.feature_grid_size - 1) /
+                        options.feature_grid_size;
+                const int num_cells_x = (width + cell_size - 1) / cell_size;
+                const int num_cells_y = (height + cell_size - 1) / cell_size;
+
+                // Rank of each keypoint among the keypoints of its cell.
+                std::vector<int> cell_num_keypoints(num_cells_x * num_cells_y, 0);
+                std::vector<int> ranks(num_keypoints);
+                for (const auto& response : responses) {
+                    const VlSiftKeypoint& keypoint = keypoints[response.second];
+                    const int cell_idx = (keypoint.iy / cell_size) * num_cells_x +
+                                         keypoint.ix / cell_size;
+                    ranks[response.second] = cell_num_keypoints[cell_idx]++;
+                }
+
+                std::stable_sort(responses.begin(), responses.end(),
+                                 [&ranks](const std::pair<float, size_t>& response1,
+                                          const std::pair<float, size_t>& response2) {
+                                     return ranks[response1.second] <
+                                            ranks[response2.second];
+                                 });
+            }
+
+            std::vector<bool> selected(num_keypoints, false);
+            for (size_t i = 0; i < max_num_keypoints; ++i) {
+                selected[responses[i].second] = true;
+            }
+
+            std::vector<VlSiftKeypoint> selected_keypoints;
+            selected_keypoints.reserve(max_num_keypoints);
+            for (size_t i = 0; i < num_keypoints; ++i) {
+                if (selected[i]) {
+                    selected_keypoints.push_back(keypoints[i]);
+                }
+            }
+
+            return selected_keypoints;
+        }
+
+        // Features of a single octave. The filter is a copy of the VLFeat filter
+        // state for the octave, such that the next octave can be processed while
+        // the descriptors of this octave are computed. The features of the i-th
+        // keypoint are stored in the slots starting at i * max_num_orientations.
+        struct SiftOctaveFeatures {
+            VlSiftFilt sift;
+            std::vector<VlSiftKeypoint> vl_keypoints;
+            std::vector<int> num_orientations;
+            FeatureKeypoints keypoints;
+            FeatureDescriptors descriptors;
+        };
+
+        // Computes the orientations and descriptors of the keypoints [begin, end).
+        void ExtractSiftOctaveFeatures(const SiftExtractionOptions& options,
+                                       const size_t begin, const size_t end,
+                                       SiftOctaveFeatures* features) {
+            for (size_t i = begin; i < end; ++i) {
+                const VlSiftKeypoint& vl_keypoint = features->vl_keypoints[i];
+
+                // Extract feature orientations.
+                double angles[4];
+                int num_orientations;
+                if (options.upright) {
+                    num_orientations = 1;
+                    angles[0] = 0.0;
+                } else {
+                    num_orientations = vl_sift_calc_keypoint_orientations(
+                            &features->sift, angles, &vl_keypoint);
+                }
+
+                // Note that this is different from SiftGPU, which selects the top
+                // global maxima as orientations while this selects the first two
+                // local maxima. It is not clear which procedure is better.
+                const int num_used_orientations =
+                        std::min(num_orientations, options.max_num_orientations);
+                features->num_orientations[i] = num_used_orientations;
+
+                for (int o = 0; o < num_used_orientations; ++o) {
+                    const size_t idx = i * options.max_num_orientations + o;
+
+                    features->keypoints[idx].x = vl_keypoint.x + 0.5f;
+                    features->keypoints[idx].y = vl_keypoint.y + 0.5f;
+                    features->keypoints[idx].scale = vl_keypoint.sigma;
+                    features->keypoints[idx].orientation = angles[o];
+
+                    // The vectorized descriptor requires precomputed gradients,
+                    // which are not available for very small octaves.
+                    Eigen::MatrixXf desc(1, 128);
+                    if (options.use_simd &&
+                        features->sift.grad_o == features->sift.o_cur) {
+                        ComputeSiftDescriptor(&features->sift, &vl_keypoint, angles[o],
+                                              desc.data());
+                    } else {
+                        vl_sift_calc_keypoint_descriptor(&features->sift, desc.data(),
+                                                         &vl_keypoint, angles[o]);
+                    }
+                    if (options.normalization == SiftExtractionOptions::Normalization::L2) {
+                        desc = L2NormalizeFeatureDescriptors(desc);
+                    } else if (options.normalization ==
+                               SiftExtractionOptions::Normalization::L1_ROOT) {
+                        desc = L1RootNormalizeFeatureDescriptors(desc);
+                    }
+                    features->descriptors.row(idx) = FeatureDescriptorsToUnsignedByte(desc);
+                }
+            }
+        }
+
+        // Appends the features of an octave to the containers per DOG level in the
+        // order of the detected keypoints.
+        void AppendSiftOctaveFeatures(const SiftExtractionOptions& options,
+                                      const SiftOctaveFeatures& features,
+                                      std::vector<size_t>* level_num_features,
+                                      std::vector<FeatureKeypoints>* level_keypoints,
+                                      std::vector<FeatureDescriptors>* level_descriptors) {
+            const size_t num_keypoints = features.vl_keypoints.size();
+
+            size_t level_idx = 0;
+            int prev_level = -1;
+            for (size_t i = 0; i < num_keypoints; ++i) {
+                if (features.vl_keypoints[i].is != prev_level) {
+                    if (i > 0) {
+                        // Resize containers of previous DOG level.
+                        level_keypoints->back().resize(level_idx);
+                        level_descriptors->back().conservativeResize(level_idx, 128);
+                    }
+
+                    // Add containers for new DOG level.
+                    level_idx = 0;
+                    level_num_features->push_back(0);
+                    level_keypoints->emplace_back(options.max_num_orientations *
+                                                  num_keypoints);
+                    level_descriptors->emplace_back(
+                            options.max_num_orientations * num_keypoints, 128);
+                }
+
+                level_num_features->back() += 1;
+                prev_level = features.vl_keypoints[i].is;
+
+                for (int o = 0; o < features.num_orientations[i]; ++o) {
+                    const size_t idx = i * options.max_num_orientations + o;
+                    level_keypoints->back()[level_idx] = features.keypoints[idx];
+                    level_descriptors->back().row(level_idx) =
+                            features.descriptors.row(idx);
+                    level_idx += 1;
+                }
+            }
+
+            // Resize containers for last DOG level in octave.
+            level_keypoints->back().resize(level_idx);
+            level_descriptors->back().conservativeResize(level_idx, 128);
+        }
+
+        // The images are only decoded at the resolution needed for extraction, since
+        // the resizer threads downsample them to the maximum image size anyway.
+        ImageReader::Options GetExtractionReaderOptions(
+                const ImageReader::Options& reader_options,
+                const SiftExtractionOptions& sift_options) {
+            ImageReader::Options options = reader_options;
+            options.max_image_size = sift_options.max_image_size;
+            return options;
+        }
+
+        BinaryExtractionOptions GetBinaryExtractionOptions(
+                const SiftExtractionOptions& sift_options) {
+            BinaryExtractionOptions options;
+            options.max_num_features = sift_options.max_num_features;
+            options.num_levels = sift_options.binary_num_levels;
+            options.scale_factor = sift_options.binary_scale_factor;
+            options.fast_threshold = sift_options.binary_fast_threshold;
+            return options;
+        }
+
     }  // namespace
 
     bool SiftExtractionOptions::Check() const {
@@ -63,13 +384,21 @@ namespace bkmap {
         CHECK_OPTION_GT(peak_threshold, 0.0);
         CHECK_OPTION_GT(edge_threshold, 0.0);
         CHECK_OPTION_GT(max_num_orientations, 0);
+        CHECK_OPTION_NE(num_image_threads, 0);
+        CHECK_OPTION_GE(feature_grid_size, 0);
+        CHECK_OPTION_GT(max_write_batch_size, 0);
+        CHECK_OPTION_GE(max_write_batch_time, 0);
+        if (binary_descriptors) {
+            CHECK_OPTION(GetBinaryExtractionOptions(*this).Check());
+        }
         return true;
     }
 
     SiftFeatureExtractor::SiftFeatureExtractor(
             const ImageReader::Options& reader_options,
             const SiftExtractionOptions& sift_options)
-            : reader_options_(reader_options),
+            : reader_options_(
+                      GetExtractionReaderOptions(reader_options, sift_options)),
               sift_options_(sift_options),
               database_(reader_options_.database_path),
               image_reader_(reader_options_, &database_) {
@@ -86,20 +415,33 @@ namespace bkmap {
         extractor_queue_.reset(new JobQueue<internal::ImageData>(kQueueSize));
         writer_queue_.reset(new JobQueue<internal::ImageData>(kQueueSize));
 
+        // Each stage has enough threads to use all cores, but at most
+        // `num_threads` resizers and extractors are busy at the same time.
+        thread_budget_.reset(new internal::ThreadBudget(num_threads));
+
+        reader_stats_.reset(new internal::StageStats());
+        resizer_stats_.reset(new internal::StageStats());
+        extractor_stats_.reset(new internal::StageStats());
+        writer_stats_.reset(new internal::StageStats());
+
         if (sift_options_.max_image_size > 0) {
             for (int i = 0; i < num_threads; ++i) {
                 resizers_.emplace_back(new internal::ImageResizerThread(
-                        sift_options_.max_image_size, resizer_queue_.get(),
+                        sift_options_.max_image_size, thread_budget_.get(),
+                        resizer_stats_.get(), resizer_queue_.get(),
                         extractor_queue_.get()));
             }
         }
         for (int i = 0; i < num_threads; ++i) {
             extractors_.emplace_back(new internal::SiftCPUFeatureExtractorThread(
-                    sift_options_, extractor_queue_.get(), writer_queue_.get()));
+                    sift_options_, thread_budget_.get(), extractor_stats_.get(),
+                    extractor_queue_.get(), writer_queue_.get()));
         }
 
         writer_.reset(new internal::FeatureWriterThread(
-                image_reader_.NumImages(), &database_, writer_queue_.get()));
+                image_reader_.NumImages(), sift_options_.max_write_batch_size,
+                sift_options_.max_write_batch_time, &database_, writer_stats_.get(),
+                writer_queue_.get()));
     }
 
     void SiftFeatureExtractor::Run() {
@@ -132,9 +474,15 @@ namespace bkmap {
                 break;
             }
 
+            Timer timer;
+            timer.Start();
+
             internal::ImageData image_data;
-            image_data.status = image_reader_.Next(
-                    &image_data.camera, &image_data.image, &image_data.bitmap);
+            image_data.status =
+                    image_reader_.Next(&image_data.camera, &image_data.image,
+                                       &image_data.bitmap, &image_data.image_file);
+
+            reader_stats_->Add(timer.ElapsedSeconds());
 
             if (image_data.status != ImageReader::Status::SUCCESS) {
                 image_data.bitmap.Deallocate();
@@ -163,9 +511,92 @@ namespace bkmap {
         writer_queue_->Stop();
         writer_->Wait();
 
+        PrintStats(GetTimer().ElapsedSeconds());
+
         GetTimer().PrintMinutes();
     }
 
+    void SiftFeatureExtractor::PrintStats(const double elapsed_time) {
+        struct Stage {
+            std::string name;
+            size_t num_threads;
+            const internal::StageStats* stats;
+        };
+
+        const std::vector<Stage> stages = {
+                {"reader", 1, reader_stats_.get()},
+                {"resizer", resizers_.size(), resizer_stats_.get()},
+                {"extractor", extractors_.size(), extractor_stats_.get()},
+                {"writer", 1, writer_stats_.get()},
+        };
+
+        // The stage with the highest utilization limits the throughput.
+        std::string bottleneck = "";
+        double max_utilization = 0;
+
+        std::string stages_json;
+        for (const auto& stage : stages) {
+            if (stage.num_threads == 0) {
+                continue;
+            }
+            // The budgeted stages cannot use more cores than the budget.
+            const size_t num_threads =
+                    std::min(stage.num_threads,
+                             static_cast<size_t>(thread_budget_->NumSlots()));
+            const double utilization =
+                    elapsed_time > 0
+                    ? stage.stats->BusyTime() / (num_threads * elapsed_time)
+                    : 0;
+            if (utilization > max_utilization) {
+                max_utilization = utilization;
+                bottleneck = stage.name;
+            }
+            stages_json += StringPrintf(
+                    "%s{\"name\": \"%s\", \"num_threads\": %d, \"num_images\": %d, "
+                    "\"busy_time\": %.3f, \"throughput\": %.3f, "
+                    "\"utilization\": %.3f}",
+                    stages_json.empty() ? "" : ", ", stage.name.c_str(),
+                    static_cast<int>(stage.num_threads),
+                    static_cast<int>(stage.stats->NumImages()),
+                    stage.stats->BusyTime(),
+                    elapsed_time > 0 ? stage.stats->NumImages() / elapsed_time : 0,
+                    utilization);
+        }
+
+        const std::vector<std::pair<std::string, JobQueue<internal::ImageData>*>>
+                queues = {
+                {"resizer_queue", resizer_queue_.get()},
+                {"extractor_queue", extractor_queue_.get()},
+                {"writer_queue", writer_queue_.get()},
+        };
+
+        std::string queues_json;
+        for (const auto& queue : queues) {
+            const auto stats = queue.second->GetStats();
+            queues_json += StringPrintf(
+                    "%s{\"name\": \"%s\", \"num_jobs\": %d, \"max_depth\": %d, "
+                    "\"mean_depth\": %.3f, \"push_wait_time\": %.3f, "
+                    "\"pop_wait_time\": %.3f}",
+                    queues_json.empty() ? "" : ", ", queue.first.c_str(),
+                    static_cast<int>(stats.num_pushed),
+                    static_cast<int>(stats.max_num_jobs),
+                    stats.num_pushed > 0
+                    ? static_cast<double>(stats.sum_num_jobs) / stats.num_pushed
+                    : 0,
+                    stats.push_wait_time, stats.pop_wait_time);
+        }
+
+        PrintHeading2("Pipeline statistics");
+        std::cout << StringPrintf(
+                "{\"elapsed_time\": %.3f, \"num_slots\": %d, "
+                "\"slot_wait_time\": %.3f, \"bottleneck\": \"%s\", "
+                "\"stages\": [%s], \"queues\": [%s]}",
+                elapsed_time, thread_budget_->NumSlots(),
+                thread_budget_->WaitTime(), bottleneck.c_str(),
+                stages_json.c_str(), queues_json.c_str())
+                  << std::endl;
+    }
+
     FeatureImporter::FeatureImporter(const ImageReader::Options& reader_options,
                                      const std::string& import_path)
             : reader_options_(reader_options), import_path_(import_path) {}
@@ -195,7 +626,8 @@ namespace bkmap {
             Camera camera;
             Image image;
             Bitmap bitmap;
-            if (image_reader.Next(&camera, &image, &bitmap) !=
+            ImageFile image_file;
+            if (image_reader.Next(&camera, &image, &bitmap, &image_file) !=
                 ImageReader::Status::SUCCESS) {
                 continue;
             }
@@ -215,6 +647,10 @@ namespace bkmap {
                     image.SetImageId(database.WriteImage(image));
                 }
 
+                if (!image_file.content_hash.empty()) {
+                    database.UpdateImageFile(image.ImageId(), image_file);
+                }
+
                 if (!database.ExistsKeypoints(image.ImageId())) {
                     database.WriteKeypoints(image.ImageId(), keypoints);
                 }
@@ -254,103 +690,130 @@ namespace bkmap {
         vl_sift_set_peak_thresh(sift.get(), options.peak_threshold);
         vl_sift_set_edge_thresh(sift.get(), options.edge_threshold);
 
+        // The keypoints of each octave are extracted in parallel, if multiple
+        // threads are used per image. Their orientations and descriptors are
+        // computed while the next octave is processed, since the pyramid of the
+        // next octave depends on the current octave.
+        std::unique_ptr<ThreadPool> thread_pool;
+        if (GetEffectiveNumThreads(options.num_image_threads) > 1) {
+            thread_pool.reset(new ThreadPool(options.num_image_threads));
+        }
+
         // Iterate through octaves.
         std::vector<size_t> level_num_features;
         std::vector<FeatureKeypoints> level_keypoints;
         std::vector<FeatureDescriptors> level_descriptors;
+        std::unique_ptr<SiftOctaveFeatures> octave_features;
+        size_t remaining_budget = options.max_num_features;
         bool first_octave = true;
         while (true) {
             if (first_octave) {
-                const std::vector<uint8_t> data_uint8 = bitmap.ConvertToRowMajorArray();
-                std::vector<float> data_float(data_uint8.size());
-                for (size_t i = 0; i < data_uint8.size(); ++i) {
-                    data_float[i] = static_cast<float>(data_uint8[i]) / 255.0f;
-                }
-                if (vl_sift_process_first_octave(sift.get(), data_float.data())) {
+                // The image is copied into the pyramid of the first octave, so that
+                // its buffer can be returned to the pool right away.
+                const BitmapView view = bitmap.View();
+                BufferPool<float>::Buffer data_float =
+                        GetSiftImageBufferPool().Acquire(
+                                static_cast<size_t>(view.Width()) * view.Height());
+                view.ConvertToRowMajorArray(255.0f, data_float.Data());
+                if (options.use_simd) {
+                    if (!ProcessFirstSiftOctave(sift.get(), data_float.Data())) {
+                        break;
+                    }
+                } else if (vl_sift_process_first_octave(sift.get(),
+                                                        data_float.Data())) {
                     break;
                 }
                 first_octave = false;
             } else {
-                if (vl_sift_process_next_octave(sift.get())) {
+                if (options.use_simd) {
+                    if (!ProcessNextSiftOctave(sift.get())) {
+                        break;
+                    }
+                } else if (vl_sift_process_next_octave(sift.get())) {
                     break;
                 }
             }
 
             // Detect keypoints.
-            vl_sift_detect(sift.get());
-
-            // Extract detected keypoints.
-            const VlSiftKeypoint* vl_keypoints = vl_sift_get_keypoints(sift.get());
-            const int num_keypoints = vl_sift_get_nkeypoints(sift.get());
-            if (num_keypoints == 0) {
-                continue;
+            if (options.use_simd) {
+                DetectSiftKeypoints(sift.get());
+            } else {
+                vl_sift_detect(sift.get());
             }
 
-            // Extract features with different orientations per DOG level.
-            size_t level_idx = 0;
-            int prev_level = -1;
-            for (int i = 0; i < num_keypoints; ++i) {
-                if (vl_keypoints[i].is != prev_level) {
-                    if (i > 0) {
-                        // Resize containers of previous DOG level.
-                        level_keypoints.back().resize(level_idx);
-                        level_descriptors.back().conservativeResize(level_idx, 128);
-                    }
-
-                    // Add containers for new DOG level.
-                    level_idx = 0;
-                    level_num_features.push_back(0);
-                    level_keypoints.emplace_back(options.max_num_orientations *
-                                                 num_keypoints);
-                    level_descriptors.emplace_back(
-                            options.max_num_orientations * num_keypoints, 128);
-                }
-
-                level_num_features.back() += 1;
-                prev_level = vl_keypoints[i].is;
+            // The features of the previous octave must be finished before the
+            // gradients of this octave overwrite the shared gradient buffer.
+            if (thread_pool) {
+                thread_pool->Wait();
+            }
 
-                // Extract feature orientations.
-                double angles[4];
-                int num_orientations;
-                if (options.upright) {
-                    num_orientations = 1;
-                    angles[0] = 0.0;
-                } else {
-                    num_orientations = vl_sift_calc_keypoint_orientations(
-                            sift.get(), angles, &vl_keypoints[i]);
-                }
+            if (octave_features) {
+                AppendSiftOctaveFeatures(options, *octave_features, &level_num_features,
+                                         &level_keypoints, &level_descriptors);
+                octave_features.reset();
+            }
 
-                // Note that this is different from SiftGPU, which selects the top
-                // global maxima as orientations while this selects the first two
-                // local maxima. It is not clear which procedure is better.
-                const int num_used_orientations =
-                        std::min(num_orientations, options.max_num_orientations);
+            // Only the budgeted keypoints are described.
+            std::vector<VlSiftKeypoint> vl_keypoints;
+            if (options.budget_octave_features) {
+                vl_keypoints = SelectSiftOctaveKeypoints(
+                        options, sift.get(),
+                        GetSiftOctaveBudget(sift.get(), remaining_budget));
+                remaining_budget -= vl_keypoints.size();
+            } else {
+                const VlSiftKeypoint* detected_keypoints =
+                        vl_sift_get_keypoints(sift.get());
+                vl_keypoints.assign(
+                        detected_keypoints,
+                        detected_keypoints + vl_sift_get_nkeypoints(sift.get()));
+            }
 
-                for (int o = 0; o < num_used_orientations; ++o) {
-                    level_keypoints.back()[level_idx].x = vl_keypoints[i].x + 0.5f;
-                    level_keypoints.back()[level_idx].y = vl_keypoints[i].y + 0.5f;
-                    level_keypoints.back()[level_idx].scale = vl_keypoints[i].sigma;
-                    level_keypoints.back()[level_idx].orientation = angles[o];
+            // Extract detected keypoints.
+            const int num_keypoints = static_cast<int>(vl_keypoints.size());
+            if (num_keypoints == 0) {
+                continue;
+            }
 
-                    Eigen::MatrixXf desc(1, 128);
-                    vl_sift_calc_keypoint_descriptor(sift.get(), desc.data(),
-                                                     &vl_keypoints[i], angles[o]);
-                    if (options.normalization == SiftExtractionOptions::Normalization::L2) {
-                        desc = L2NormalizeFeatureDescriptors(desc);
-                    } else if (options.normalization ==
-                               SiftExtractionOptions::Normalization::L1_ROOT) {
-                        desc = L1RootNormalizeFeatureDescriptors(desc);
-                    }
-                    level_descriptors.back().row(level_idx) =
-                            FeatureDescriptorsToUnsignedByte(desc);
+            // The gradients are computed in advance for the parallel and the
+            // vectorized extraction, otherwise they are computed by VLFeat.
+            const bool computed_gradients =
+                    (thread_pool || options.use_simd) &&
+                    ComputeSiftOctaveGradients(options, sift.get(), thread_pool.get());
+            const bool parallel_octave = thread_pool && computed_gradients;
+
+            octave_features.reset(new SiftOctaveFeatures());
+            octave_features->sift = *sift;
+            octave_features->vl_keypoints = std::move(vl_keypoints);
+            octave_features->num_orientations.resize(num_keypoints, 0);
+            octave_features->keypoints.resize(options.max_num_orientations *
+                                              num_keypoints);
+            octave_features->descriptors.resize(
+                    options.max_num_orientations * num_keypoints, 128);
 
-                    level_idx += 1;
+            // Extract features with different orientations per DOG level.
+            if (parallel_octave) {
+                SiftOctaveFeatures* features = octave_features.get();
+                for (size_t begin = 0; begin < static_cast<size_t>(num_keypoints);
+                     begin += kSiftNumKeypointsPerTask) {
+                    const size_t end = std::min(begin + kSiftNumKeypointsPerTask,
+                                                static_cast<size_t>(num_keypoints));
+                    thread_pool->AddTask([&options, features, begin, end]() {
+                        ExtractSiftOctaveFeatures(options, begin, end, features);
+                    });
                 }
+            } else {
+                ExtractSiftOctaveFeatures(options, 0, num_keypoints,
+                                          octave_features.get());
             }
+        }
 
-            // Resize containers for last DOG level in octave.
-            level_keypoints.back().resize(level_idx);
-            level_descriptors.back().conservativeResize(level_idx, 128);
+        if (thread_pool) {
+            thread_pool->Wait();
+        }
+
+        if (octave_features) {
+            AppendSiftOctaveFeatures(options, *octave_features, &level_num_features,
+                                     &level_keypoints, &level_descriptors);
         }
 
         // Determine how many DOG levels to keep to satisfy max_num_features option.
@@ -593,10 +1056,71 @@ namespace bkmap {
 
     namespace internal {
 
+        StageStats::StageStats() : num_images_(0), busy_time_(0) {}
+
+        void StageStats::Add(const double busy_time) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            num_images_ += 1;
+            busy_time_ += busy_time;
+        }
+
+        void StageStats::AddTime(const double busy_time) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            busy_time_ += busy_time;
+        }
+
+        size_t StageStats::NumImages() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return num_images_;
+        }
+
+        double StageStats::BusyTime() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return busy_time_;
+        }
+
+        ThreadBudget::ThreadBudget(const int num_slots)
+                : num_slots_(num_slots), num_used_slots_(0), wait_time_(0) {
+            CHECK_GT(num_slots_, 0);
+        }
+
+        void ThreadBudget::Acquire() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (num_used_slots_ >= num_slots_) {
+                Timer timer;
+                timer.Start();
+                while (num_used_slots_ >= num_slots_) {
+                    release_condition_.wait(lock);
+                }
+                wait_time_ += timer.ElapsedSeconds();
+            }
+            num_used_slots_ += 1;
+        }
+
+        void ThreadBudget::Release() {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                CHECK_GT(num_used_slots_, 0);
+                num_used_slots_ -= 1;
+            }
+            release_condition_.notify_one();
+        }
+
+        int ThreadBudget::NumSlots() const { return num_slots_; }
+
+        double ThreadBudget::WaitTime() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            return wait_time_;
+        }
+
         ImageResizerThread::ImageResizerThread(const int max_image_size,
+                                               ThreadBudget* thread_budget,
+                                               StageStats* stats,
                                                JobQueue<ImageData>* input_queue,
                                                JobQueue<ImageData>* output_queue)
                 : max_image_size_(max_image_size),
+                  thread_budget_(thread_budget),
+                  stats_(stats),
                   input_queue_(input_queue),
                   output_queue_(output_queue) {}
 
@@ -610,6 +1134,10 @@ namespace bkmap {
                 if (input_job.IsValid()) {
                     auto image_data = input_job.Data();
 
+                    thread_budget_->Acquire();
+                    Timer timer;
+                    timer.Start();
+
                     if (image_data.status == ImageReader::Status::SUCCESS) {
                         if (static_cast<int>(image_data.bitmap.Width()) > max_image_size_ ||
                             static_cast<int>(image_data.bitmap.Height()) > max_image_size_) {
@@ -626,6 +1154,9 @@ namespace bkmap {
                         }
                     }
 
+                    stats_->Add(timer.ElapsedSeconds());
+                    thread_budget_->Release();
+
                     output_queue_->Push(image_data);
                 } else {
                     break;
@@ -634,9 +1165,12 @@ namespace bkmap {
         }
 
         SiftCPUFeatureExtractorThread::SiftCPUFeatureExtractorThread(
-                const SiftExtractionOptions& sift_options, JobQueue<ImageData>* input_queue,
+                const SiftExtractionOptions& sift_options, ThreadBudget* thread_budget,
+                StageStats* stats, JobQueue<ImageData>* input_queue,
                 JobQueue<ImageData>* output_queue)
                 : sift_options_(sift_options),
+                  thread_budget_(thread_budget),
+                  stats_(stats),
                   input_queue_(input_queue),
                   output_queue_(output_queue) {
             CHECK(sift_options_.Check());
@@ -654,10 +1188,21 @@ namespace bkmap {
                 if (input_job.IsValid()) {
                     auto image_data = input_job.Data();
 
+                    thread_budget_->Acquire();
+                    Timer timer;
+                    timer.Start();
+
                     if (image_data.status == ImageReader::Status::SUCCESS) {
-                        if (ExtractSiftFeaturesCPU(sift_options_, image_data.bitmap,
-                                                   &image_data.keypoints,
-                                                   &image_data.descriptors)) {
+                        const bool success =
+                                sift_options_.binary_descriptors
+                                ? ExtractBinaryFeatures(
+                                        GetBinaryExtractionOptions(sift_options_),
+                                        image_data.bitmap, &image_data.keypoints,
+                                        &image_data.descriptors)
+                                : ExtractSiftFeaturesCPU(sift_options_, image_data.bitmap,
+                                                         &image_data.keypoints,
+                                                         &image_data.descriptors);
+                        if (success) {
                             ScaleKeypoints(image_data.bitmap, image_data.camera,
                                            &image_data.keypoints);
                         } else {
@@ -667,6 +1212,9 @@ namespace bkmap {
 
                     image_data.bitmap.Deallocate();
 
+                    stats_->Add(timer.ElapsedSeconds());
+                    thread_budget_->Release();
+
                     output_queue_->Push(image_data);
                 } else {
                     break;
@@ -677,85 +1225,153 @@ namespace bkmap {
 
 
         FeatureWriterThread::FeatureWriterThread(const size_t num_images,
+                                                 const int max_batch_size,
+                                                 const int max_batch_time,
                                                  Database* database,
+                                                 StageStats* stats,
                                                  JobQueue<ImageData>* input_queue)
-                : num_images_(num_images), database_(database), input_queue_(input_queue) {}
+                : num_images_(num_images),
+                  max_batch_size_(max_batch_size),
+                  max_batch_time_(max_batch_time),
+                  database_(database),
+                  stats_(stats),
+                  input_queue_(input_queue) {
+            CHECK_GT(max_batch_size_, 0);
+            CHECK_GE(max_batch_time_, 0);
+        }
 
         void FeatureWriterThread::Run() {
+            std::vector<ImageData> batch;
+            batch.reserve(max_batch_size_);
+            Timer batch_timer;
+
             size_t image_index = 0;
             while (true) {
                 if (IsStopped()) {
                     break;
                 }
 
-                auto input_job = input_queue_->Pop();
-                if (input_job.IsValid()) {
-                    auto& image_data = input_job.Data();
+                // Only wait for the next image until the current batch is due.
+                JobQueue<ImageData>::Job input_job;
+                if (batch.empty()) {
+                    input_job = input_queue_->Pop();
+                    if (!input_job.IsValid()) {
+                        break;
+                    }
+                } else {
+                    const int remaining_time = std::max(
+                            0, max_batch_time_ -
+                               static_cast<int>(batch_timer.ElapsedSeconds() * 1000));
+                    input_job = input_queue_->TryPop(remaining_time);
+                    if (!input_job.IsValid()) {
+                        WriteBatch(&batch);
+                        continue;
+                    }
+                }
 
-                    image_index += 1;
+                auto& image_data = input_job.Data();
 
-                    std::cout << StringPrintf("Processed file [%d/%d]", image_index,
-                                              num_images_)
-                    << std::endl;
+                Timer timer;
+                timer.Start();
 
-                    std::cout << StringPrintf("  Name:            %s",
-                                              image_data.image.Name().c_str())
-                    << std::endl;
+                image_index += 1;
 
-                    if (image_data.status == ImageReader::Status::IMAGE_EXISTS) {
-                        std::cout << "  SKIP: Features for image already extracted."
-                        << std::endl;
-                    } else if (image_data.status == ImageReader::Status::BITMAP_ERROR) {
-                        std::cout << "  ERROR: Failed to read image file format." << std::endl;
-                    } else if (image_data.status ==
-                               ImageReader::Status::CAMERA_SINGLE_ERROR) {
-                        std::cout << "  ERROR: Single camera specified, "
-                                "but images have different dimensions."
-                        << std::endl;
-                    } else if (image_data.status == ImageReader::Status::CAMERA_DIM_ERROR) {
-                        std::cout << "  ERROR: Image previously processed, but current file "
-                                "has different image dimensions."
-                        << std::endl;
-                    } else if (image_data.status == ImageReader::Status::CAMERA_PARAM_ERROR) {
-                        std::cout << "  ERROR: Camera has invalid parameters." << std::endl;
-                    } else if (image_data.status == ImageReader::Status::FAILURE) {
-                        std::cout << "  ERROR: Failed to extract features." << std::endl;
-                    }
+                std::cout << StringPrintf("Processed file [%d/%d]", image_index,
+                                          num_images_)
+                << std::endl;
 
-                    if (image_data.status != ImageReader::Status::SUCCESS) {
-                        continue;
-                    }
+                std::cout << StringPrintf("  Name:            %s",
+                                          image_data.image.Name().c_str())
+                << std::endl;
 
-                    std::cout << StringPrintf("  Dimensions:      %d x %d",
-                                              image_data.camera.Width(),
-                                              image_data.camera.Height())
+                if (image_data.status == ImageReader::Status::IMAGE_EXISTS) {
+                    std::cout << "  SKIP: Features for image already extracted."
                     << std::endl;
-                    std::cout << StringPrintf("  Camera:          %d (%s)",
-                                              image_data.camera.CameraId(),
-                                              image_data.camera.ModelName().c_str())
+                } else if (image_data.status == ImageReader::Status::BITMAP_ERROR) {
+                    std::cout << "  ERROR: Failed to read image file format." << std::endl;
+                } else if (image_data.status ==
+                           ImageReader::Status::CAMERA_SINGLE_ERROR) {
+                    std::cout << "  ERROR: Single camera specified, "
+                            "but images have different dimensions."
                     << std::endl;
-                    std::cout << StringPrintf("  Focal Length:    %.2fpx (%s)",
-                                              image_data.camera.MeanFocalLength(),
-                                              image_data.camera.HasPriorFocalLength()
-                                              ? "EXIF"
-                                              : "Default")
+                } else if (image_data.status == ImageReader::Status::CAMERA_DIM_ERROR) {
+                    std::cout << "  ERROR: Image previously processed, but current file "
+                            "has different image dimensions."
                     << std::endl;
-                    if (image_data.image.HasTvecPrior()) {
-                        std::cout
-                        << StringPrintf(
-                                "  GPS:             LAT=%.3f, LON=%.3f, ALT=%.3f (EXIF)",
-                                image_data.image.TvecPrior(0), image_data.image.TvecPrior(1),
-                                image_data.image.TvecPrior(2))
-                        << std::endl;
-                    }
-                    std::cout << StringPrintf("  Features:        %d",
-                                              image_data.keypoints.size())
+                } else if (image_data.status == ImageReader::Status::CAMERA_PARAM_ERROR) {
+                    std::cout << "  ERROR: Camera has invalid parameters." << std::endl;
+                } else if (image_data.status == ImageReader::Status::FAILURE) {
+                    std::cout << "  ERROR: Failed to extract features." << std::endl;
+                }
+
+                if (image_data.status != ImageReader::Status::SUCCESS) {
+                    stats_->Add(timer.ElapsedSeconds());
+                    continue;
+                }
+
+                std::cout << StringPrintf("  Dimensions:      %d x %d",
+                                          image_data.camera.Width(),
+                                          image_data.camera.Height())
+                << std::endl;
+                std::cout << StringPrintf("  Camera:          %d (%s)",
+                                          image_data.camera.CameraId(),
+                                          image_data.camera.ModelName().c_str())
+                << std::endl;
+                std::cout << StringPrintf("  Focal Length:    %.2fpx (%s)",
+                                          image_data.camera.MeanFocalLength(),
+                                          image_data.camera.HasPriorFocalLength()
+                                          ? "EXIF"
+                                          : "Default")
+                << std::endl;
+                if (image_data.image.HasTvecPrior()) {
+                    std::cout
+                    << StringPrintf(
+                            "  GPS:             LAT=%.3f, LON=%.3f, ALT=%.3f (EXIF)",
+                            image_data.image.TvecPrior(0), image_data.image.TvecPrior(1),
+                            image_data.image.TvecPrior(2))
                     << std::endl;
+                }
+                std::cout << StringPrintf("  Features:        %d",
+                                          image_data.keypoints.size())
+                << std::endl;
+
+                stats_->Add(timer.ElapsedSeconds());
+
+                if (batch.empty()) {
+                    batch_timer.Restart();
+                }
+
+                batch.push_back(std::move(image_data));
 
-                    DatabaseTransaction database_transaction(database_);
+                if (batch.size() >= static_cast<size_t>(max_batch_size_) ||
+                    batch_timer.ElapsedSeconds() * 1000 >= max_batch_time_) {
+                    WriteBatch(&batch);
+                }
+            }
+
+            WriteBatch(&batch);
+        }
+
+        void FeatureWriterThread::WriteBatch(std::vector<ImageData>* batch) {
+            if (batch->empty()) {
+                return;
+            }
+
+            Timer timer;
+            timer.Start();
 
+            {
+                DatabaseTransaction database_transaction(database_);
+
+                for (auto& image_data : *batch) {
                     if (image_data.image.ImageId() == kInvalidImageId) {
-                        image_data.image.SetImageId(database_->WriteImage(image_data.image));
+                        image_data.image.SetImageId(
+                                database_->WriteImage(image_data.image));
+                    }
+
+                    if (!image_data.image_file.content_hash.empty()) {
+                        database_->UpdateImageFile(image_data.image.ImageId(),
+                                                   image_data.image_file);
                     }
 
                     if (!database_->ExistsKeypoints(image_data.image.ImageId())) {
@@ -767,10 +1383,13 @@ namespace bkmap {
                         database_->WriteDescriptors(image_data.image.ImageId(),
                                                     image_data.descriptors);
                     }
-                } else {
-                    break;
                 }
             }
+
+            // The images were already counted, when they were buffered.
+            stats_->AddTime(timer.ElapsedSeconds());
+
+            batch->clear();
         }
 
     }  // namespace internal
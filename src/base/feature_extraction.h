@@ -19,6 +19,12 @@ namespace bkmap {
         // Number of threads for feature extraction.
         int num_threads = ThreadPool::kMaxNumThreads;
 
+        // Number of threads used to extract the features of a single image on
+        // the CPU. This is useful, if there are fewer images than threads or the
+        // images are very large. The extracted features are the same as for a
+        // single thread.
+        int num_image_threads = 1;
+
         // Whether to use the GPU for feature extraction.
         bool use_gpu = false;
 
@@ -32,6 +38,19 @@ namespace bkmap {
         // Maximum number of features to detect, keeping larger-scale features.
         int max_num_features = 8192;
 
+        // Whether to budget the maximum number of features over the octaves on
+        // the CPU, such that only the selected keypoints of each octave are
+        // described, instead of describing all keypoints and keeping the
+        // larger-scale features afterwards. The budget halves with every octave
+        // and unused budget is carried over to the next octaves. The keypoints
+        // with the strongest DoG response are selected.
+        bool budget_octave_features = false;
+
+        // Number of grid cells along the larger image dimension, over which the
+        // budgeted keypoints of an octave are uniformly distributed. If 0, the
+        // keypoints are selected regardless of their location.
+        int feature_grid_size = 0;
+
         // First octave in the pyramid, i.e. -1 upsamples the image by one level.
         int first_octave = -1;
 
@@ -53,6 +72,30 @@ namespace bkmap {
         // Fix the orientation to 0 for upright features.
         bool upright = false;
 
+        // Whether to use the vectorized implementation of the CPU extraction
+        // instead of VLFeat for the scale space, detection and descriptors. The
+        // features match VLFeat up to small numerical differences.
+        bool use_simd = false;
+
+        // Whether to extract binary ORB features instead of SIFT features, which
+        // are an order of magnitude faster to extract and match, e.g., for video
+        // frames or preview reconstructions. The binary features are extracted on
+        // the CPU and must be matched with `SiftMatchingOptions::binary_descriptors`.
+        bool binary_descriptors = false;
+
+        // Number of pyramid levels, ratio between the sizes of consecutive levels
+        // and the FAST corner threshold of the binary feature extraction.
+        int binary_num_levels = 8;
+        double binary_scale_factor = 1.2;
+        int binary_fast_threshold = 20;
+
+        // Maximum number of images and maximum time in milliseconds, for which the
+        // extracted features are buffered before they are written to the database
+        // in a single transaction. If the extraction is interrupted, only the
+        // images of the current batch are lost and extracted again on restart.
+        int max_write_batch_size = 32;
+        int max_write_batch_time = 1000;
+
         // Whether to adapt the feature detection depending on the image darkness.
         // Note that this feature is only available in the OpenGL SiftGPU version.
         bool darkness_adaptivity = false;
@@ -74,6 +117,8 @@ namespace bkmap {
     namespace internal {
 
         struct ImageData;
+        class StageStats;
+        class ThreadBudget;
 
     }  // namespace internal
 
@@ -86,6 +131,10 @@ namespace bkmap {
     private:
         void Run();
 
+        // Print the throughput, utilization and stall times of the pipeline
+        // stages and queues as a single line of JSON.
+        void PrintStats(const double elapsed_time);
+
         const ImageReader::Options reader_options_;
         const SiftExtractionOptions sift_options_;
 
@@ -99,6 +148,14 @@ namespace bkmap {
         std::unique_ptr<JobQueue<internal::ImageData>> resizer_queue_;
         std::unique_ptr<JobQueue<internal::ImageData>> extractor_queue_;
         std::unique_ptr<JobQueue<internal::ImageData>> writer_queue_;
+
+        // The resizer and extractor threads share the cores of the machine.
+        std::unique_ptr<internal::ThreadBudget> thread_budget_;
+
+        std::unique_ptr<internal::StageStats> reader_stats_;
+        std::unique_ptr<internal::StageStats> resizer_stats_;
+        std::unique_ptr<internal::StageStats> extractor_stats_;
+        std::unique_ptr<internal::StageStats> writer_stats_;
     };
 
 // Import features from text files. Each image must have a corresponding text
@@ -168,14 +225,64 @@ namespace bkmap {
             Camera camera;
             Image image;
             Bitmap bitmap;
+            ImageFile image_file;
 
             FeatureKeypoints keypoints;
             FeatureDescriptors descriptors;
         };
 
+// Accumulated processing statistics of all threads of a pipeline stage.
+        class StageStats {
+        public:
+            StageStats();
+
+            // Add an image, which was processed in the given time in seconds.
+            void Add(const double busy_time);
+
+            // Add processing time in seconds, which is not specific to an image.
+            void AddTime(const double busy_time);
+
+            size_t NumImages() const;
+            double BusyTime() const;
+
+        private:
+            mutable std::mutex mutex_;
+            size_t num_images_;
+            double busy_time_;
+        };
+
+// Limits the number of threads of multiple pipeline stages that process an
+// image at the same time. Rather than statically assigning the cores to the
+// stages, the threads of the stage with queued images take the idle cores, so
+// that the cores are continuously rebalanced towards the bottleneck stage.
+// Threads must not wait for other threads while holding a slot.
+        class ThreadBudget {
+        public:
+            explicit ThreadBudget(const int num_slots);
+
+            // Wait for a free slot and acquire it.
+            void Acquire();
+
+            // Release a previously acquired slot.
+            void Release();
+
+            int NumSlots() const;
+
+            // Time in seconds that threads waited for a free slot.
+            double WaitTime() const;
+
+        private:
+            const int num_slots_;
+            int num_used_slots_;
+            double wait_time_;
+            mutable std::mutex mutex_;
+            std::condition_variable release_condition_;
+        };
+
         class ImageResizerThread : public Thread {
         public:
-            ImageResizerThread(const int max_image_size, JobQueue<ImageData>* input_queue,
+            ImageResizerThread(const int max_image_size, ThreadBudget* thread_budget,
+                               StageStats* stats, JobQueue<ImageData>* input_queue,
                                JobQueue<ImageData>* output_queue);
 
         private:
@@ -183,6 +290,9 @@ namespace bkmap {
 
             const int max_image_size_;
 
+            ThreadBudget* thread_budget_;
+            StageStats* stats_;
+
             JobQueue<ImageData>* input_queue_;
             JobQueue<ImageData>* output_queue_;
         };
@@ -191,6 +301,8 @@ namespace bkmap {
         class SiftCPUFeatureExtractorThread : public Thread {
         public:
             SiftCPUFeatureExtractorThread(const SiftExtractionOptions& sift_options,
+                                          ThreadBudget* thread_budget,
+                                          StageStats* stats,
                                           JobQueue<ImageData>* input_queue,
                                           JobQueue<ImageData>* output_queue);
 
@@ -199,6 +311,9 @@ namespace bkmap {
 
             const SiftExtractionOptions sift_options_;
 
+            ThreadBudget* thread_budget_;
+            StageStats* stats_;
+
             JobQueue<ImageData>* input_queue_;
             JobQueue<ImageData>* output_queue_;
         };
@@ -221,16 +336,26 @@ namespace bkmap {
             JobQueue<ImageData>* output_queue_;
         };
 
+// Write the extracted features to the database in batches of images. The image,
+// its keypoints and descriptors are always written in the same transaction, so
+// that the extraction can be resumed after a crash from the committed images.
         class FeatureWriterThread : public Thread {
         public:
-            FeatureWriterThread(const size_t num_images, Database* database,
-                                JobQueue<ImageData>* input_queue);
+            FeatureWriterThread(const size_t num_images, const int max_batch_size,
+                                const int max_batch_time, Database* database,
+                                StageStats* stats, JobQueue<ImageData>* input_queue);
 
         private:
             void Run();
 
+            // Write the buffered images in a single transaction.
+            void WriteBatch(std::vector<ImageData>* batch);
+
             const size_t num_images_;
+            const int max_batch_size_;
+            const int max_batch_time_;
             Database* database_;
+            StageStats* stats_;
             JobQueue<ImageData>* input_queue_;
         };
 
@@ -8,7 +8,9 @@
 #include <numeric>
 
 #include "base/camera_models.h"
+#include "base/binary_descriptor_index.h"
 #include "base/database.h"
+#include "base/feature_distance.h"
 #include "base/gps.h"
 #include "estimators/essential_matrix.h"
 #include "estimators/two_view_geometry.h"
@@ -22,20 +24,30 @@
 namespace bkmap {
     namespace {
 
+        // The number of leafs to visit in the approximate nearest neighbor search
+        // of the descriptor indices.
+        const int kNumDescriptorIndexChecks = 1024;
+
         void PrintElapsedTime(const Timer& timer) {
             std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
         }
 
-        void IndexImagesInVisualIndex(const int num_threads, const int max_num_features,
-                                      const std::vector<image_t>& image_ids,
-                                      Thread* thread, FeatureMatcherCache* cache,
-                                      retrieval::VisualIndex<>* visual_index) {
+        // Index the images that are not indexed yet and return their number.
+        size_t IndexImagesInVisualIndex(const int num_threads, const int max_num_features,
+                                        const std::vector<image_t>& image_ids,
+                                        Thread* thread, FeatureMatcherCache* cache,
+                                        retrieval::VisualIndex<>* visual_index) {
             retrieval::VisualIndex<>::IndexOptions index_options;
             index_options.num_threads = num_threads;
 
+            size_t num_indexed_images = 0;
             for (size_t i = 0; i < image_ids.size(); ++i) {
                 if (thread->IsStopped()) {
-                    return;
+                    return num_indexed_images;
+                }
+
+                if (visual_index->HasImage(image_ids[i])) {
+                    continue;
                 }
 
                 Timer timer;
@@ -51,12 +63,17 @@ namespace bkmap {
                 }
 
                 visual_index->Add(index_options, image_ids[i], keypoints, descriptors);
+                num_indexed_images += 1;
 
                 PrintElapsedTime(timer);
             }
 
             // Compute the TF-IDF weights, etc.
-            visual_index->Prepare();
+            if (num_indexed_images > 0 || !visual_index->IsPrepared()) {
+                visual_index->Prepare();
+            }
+
+            return num_indexed_images;
         }
 
         void MatchNearestNeighborsInVisualIndex(
@@ -64,143 +81,161 @@ namespace bkmap {
                 const int max_num_features, const std::vector<image_t>& image_ids,
                 Thread* thread, FeatureMatcherCache* cache,
                 retrieval::VisualIndex<>* visual_index, SiftFeatureMatcher* matcher) {
-            struct Retrieval {
-                image_t image_id = kInvalidImageId;
-                std::vector<retrieval::ImageScore> image_scores;
+            // The number of images that are retrieved together in one batch.
+            const size_t kRetrievalBatchSize = 64;
+
+            struct RetrievalBatch {
+                std::vector<image_t> image_ids;
+                std::vector<std::vector<retrieval::ImageScore>> image_scores;
             };
 
-            // Create a thread pool to retrieve the nearest neighbors.
-            ThreadPool retrieval_thread_pool(num_threads);
-            JobQueue<Retrieval> retrieval_queue(num_threads);
+            // A persistent index can contain images, which were deleted from the
+            // database since they were indexed. These images cannot be matched.
+            const std::vector<image_t> database_image_ids = cache->GetImageIds();
+            const std::unordered_set<image_t> database_image_id_set(
+                    database_image_ids.begin(), database_image_ids.end());
 
-            // The retrieval thread kernel function. Note that the descriptors should be
-            // extracted outside of this function sequentially to avoid any concurrent
-            // access to the database causing race conditions.
             retrieval::VisualIndex<>::QueryOptions query_options;
             query_options.max_num_images = num_images;
             query_options.max_num_verifications = num_verifications;
-            auto QueryFunc = [&](const image_t image_id) {
-                auto keypoints = cache->GetKeypoints(image_id);
-                auto descriptors = cache->GetDescriptors(image_id);
-                if (max_num_features > 0 && descriptors.rows() > max_num_features) {
-                    ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
+            query_options.num_threads = num_threads;
+
+            // The retrieval function of a batch of images. The visual words of all
+            // images in the batch are found at once and the inverted files are
+            // scanned for many images at a time, which uses the threads much better
+            // than querying the images one by one.
+            auto QueryFunc = [&](const size_t begin) {
+                const size_t end =
+                        std::min(begin + kRetrievalBatchSize, image_ids.size());
+
+                RetrievalBatch batch;
+                batch.image_ids.assign(image_ids.begin() + begin,
+                                       image_ids.begin() + end);
+
+                std::vector<FeatureKeypoints> keypoints;
+                std::vector<FeatureDescriptors> descriptors;
+                keypoints.reserve(batch.image_ids.size());
+                descriptors.reserve(batch.image_ids.size());
+                for (const image_t image_id : batch.image_ids) {
+                    keypoints.push_back(cache->GetKeypoints(image_id));
+                    descriptors.push_back(cache->GetDescriptors(image_id));
+                    if (max_num_features > 0 &&
+                        descriptors.back().rows() > max_num_features) {
+                        ExtractTopScaleFeatures(&keypoints.back(), &descriptors.back(),
+                                                max_num_features);
+                    }
                 }
 
-                Retrieval retrieval;
-                retrieval.image_id = image_id;
-                visual_index->QueryWithVerification(query_options, keypoints, descriptors,
-                                                    &retrieval.image_scores);
+                visual_index->QueryWithVerification(query_options, keypoints,
+                                                    descriptors, &batch.image_scores);
 
-                CHECK(retrieval_queue.Push(retrieval));
+                return batch;
             };
 
-            // Initially, make all retrieval threads busy and continue with the matching.
-            size_t image_idx = 0;
-            const size_t init_num_tasks =
-                    std::min(image_ids.size(), 2 * retrieval_thread_pool.NumThreads());
-            for (; image_idx < init_num_tasks; ++image_idx) {
-                retrieval_thread_pool.AddTask(QueryFunc, image_ids[image_idx]);
+            // Retrieve the next batch in the background, while the images of the
+            // current batch are matched.
+            ThreadPool retrieval_thread_pool(1);
+            std::future<RetrievalBatch> next_batch;
+            if (!image_ids.empty()) {
+                next_batch = retrieval_thread_pool.AddTask(QueryFunc, 0);
             }
 
             std::vector<std::pair<image_t, image_t>> image_pairs;
 
-            // Pop the finished retrieval results and enqueue them for feature matching.
-            for (size_t i = 0; i < image_ids.size(); ++i) {
-                if (thread->IsStopped()) {
-                    retrieval_queue.Stop();
-                    return;
+            size_t i = 0;
+            for (size_t begin = 0; begin < image_ids.size();
+                 begin += kRetrievalBatchSize) {
+                const RetrievalBatch batch = next_batch.get();
+                if (begin + kRetrievalBatchSize < image_ids.size()) {
+                    next_batch = retrieval_thread_pool.AddTask(
+                            QueryFunc, begin + kRetrievalBatchSize);
                 }
 
-                Timer timer;
-                timer.Start();
-
-                std::cout << StringPrintf("Matching image [%d/%d]", i + 1, image_ids.size())
-                << std::flush;
+                for (size_t j = 0; j < batch.image_ids.size(); ++j, ++i) {
+                    if (thread->IsStopped()) {
+                        return;
+                    }
 
-                // Push the next image to the retrieval queue.
-                if (image_idx < image_ids.size()) {
-                    retrieval_thread_pool.AddTask(QueryFunc, image_ids[image_idx]);
-                    image_idx += 1;
-                }
+                    Timer timer;
+                    timer.Start();
 
-                // Pop the next results from the retrieval queue.
-                const auto retrieval = retrieval_queue.Pop();
-                CHECK(retrieval.IsValid());
+                    std::cout << StringPrintf("Matching image [%d/%d]", i + 1,
+                                              image_ids.size())
+                    << std::flush;
 
-                const auto& image_id = retrieval.Data().image_id;
-                const auto& image_scores = retrieval.Data().image_scores;
+                    const image_t image_id = batch.image_ids[j];
+                    const auto& image_scores = batch.image_scores[j];
 
-                // Compose the image pairs from the scores.
-                image_pairs.clear();
-                image_pairs.reserve(image_scores.size());
-                for (const auto image_score : image_scores) {
-                    image_pairs.emplace_back(image_id, image_score.image_id);
-                }
+                    // Compose the image pairs from the scores.
+                    image_pairs.clear();
+                    image_pairs.reserve(image_scores.size());
+                    for (const auto image_score : image_scores) {
+                        if (database_image_id_set.count(image_score.image_id) > 0) {
+                            image_pairs.emplace_back(image_id, image_score.image_id);
+                        }
+                    }
 
-                matcher->Match(image_pairs);
+                    matcher->Match(image_pairs);
 
-                PrintElapsedTime(timer);
+                    PrintElapsedTime(timer);
+                }
             }
         }
 
-        Eigen::MatrixXi ComputeSiftDistanceMatrix(
-                const FeatureKeypoints* keypoints1, const FeatureKeypoints* keypoints2,
-                const FeatureDescriptors& descriptors1,
-                const FeatureDescriptors& descriptors2,
-                const std::function<bool(float, float, float, float)>& guided_filter) {
-            if (guided_filter != nullptr) {
-                CHECK_NOTNULL(keypoints1);
-                CHECK_NOTNULL(keypoints2);
-                CHECK_EQ(keypoints1->size(), descriptors1.rows());
-                CHECK_EQ(keypoints2->size(), descriptors2.rows());
-            }
+        size_t FindBestMatchesOneWay(const std::vector<SiftBestMatch>& best_matches,
+                                     const float max_ratio, const float max_distance,
+                                     std::vector<int>* matches) {
+            // SIFT descriptor vectors are normalized to length 512.
+            const float kDistNorm = 1.0f / (512.0f * 512.0f);
 
-            const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors1_int =
-                    descriptors1.cast<int>();
-            const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors2_int =
-                    descriptors2.cast<int>();
+            size_t num_matches = 0;
+            matches->resize(best_matches.size(), -1);
 
-            Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dists(
-                    descriptors1.rows(), descriptors2.rows());
+            for (size_t i1 = 0; i1 < best_matches.size(); ++i1) {
+                const SiftBestMatch& best_match = best_matches[i1];
 
-            for (FeatureDescriptors::Index i1 = 0; i1 < descriptors1.rows(); ++i1) {
-                for (FeatureDescriptors::Index i2 = 0; i2 < descriptors2.rows(); ++i2) {
-                    if (guided_filter != nullptr &&
-                        guided_filter((*keypoints1)[i1].x, (*keypoints1)[i1].y,
-                                      (*keypoints2)[i2].x, (*keypoints2)[i2].y)) {
-                        dists(i1, i2) = 0;
-                    } else {
-                        dists(i1, i2) = descriptors1_int.row(i1).dot(descriptors2_int.row(i2));
-                    }
+                // Check if any match found.
+                if (best_match.idx == -1) {
+                    continue;
                 }
+
+                const float best_dist_normed =
+                        std::acos(std::min(kDistNorm * best_match.dist, 1.0f));
+
+                // Check if match distance passes threshold.
+                if (best_dist_normed > max_distance) {
+                    continue;
+                }
+
+                const float second_best_dist_normed =
+                        std::acos(std::min(kDistNorm * best_match.second_dist, 1.0f));
+
+                // Check if match passes ratio test. Keep this comparison >= in order to
+                // ensure that the case of best == second_best is detected.
+                if (best_dist_normed >= max_ratio * second_best_dist_normed) {
+                    continue;
+                }
+
+                num_matches += 1;
+                (*matches)[i1] = best_match.idx;
             }
 
-            return dists;
+            return num_matches;
         }
 
-        size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
+        size_t FindBestMatchesOneWay(const FeatureDescriptorIndex<>& index,
+                                     const FeatureDescriptors& query,
                                      const float max_ratio, const float max_distance,
                                      std::vector<int>* matches) {
-            // SIFT descriptor vectors are normalized to length 512.
-            const float kDistNorm = 1.0f / (512.0f * 512.0f);
+            FeatureDescriptorIndex<>::IndicesType indices;
+            FeatureDescriptorIndex<>::DistancesType dists;
+            index.Search(query, kNumDescriptorIndexChecks, &indices, &dists);
 
             size_t num_matches = 0;
-            matches->resize(dists.rows(), -1);
-
-            for (Eigen::MatrixXi::Index i1 = 0; i1 < dists.rows(); ++i1) {
-                int best_i2 = -1;
-                int best_dist = 0;
-                int second_best_dist = 0;
-                for (Eigen::MatrixXi::Index i2 = 0; i2 < dists.cols(); ++i2) {
-                    const int dist = dists(i1, i2);
-                    if (dist > best_dist) {
-                        best_i2 = i2;
-                        second_best_dist = best_dist;
-                        best_dist = dist;
-                    } else if (dist > second_best_dist) {
-                        second_best_dist = dist;
-                    }
-                }
+            matches->resize(query.rows(), -1);
+
+            for (FeatureDescriptors::Index i1 = 0; i1 < query.rows(); ++i1) {
+                const int best_i2 = indices(i1, 0);
 
                 // Check if any match found.
                 if (best_i2 == -1) {
@@ -208,7 +243,7 @@ namespace bkmap {
                 }
 
                 const float best_dist_normed =
-                        std::acos(std::min(kDistNorm * best_dist, 1.0f));
+                        FeatureDescriptorIndex<>::DistanceToAngle(dists(i1, 0));
 
                 // Check if match distance passes threshold.
                 if (best_dist_normed > max_distance) {
@@ -216,7 +251,7 @@ namespace bkmap {
                 }
 
                 const float second_best_dist_normed =
-                        std::acos(std::min(kDistNorm * second_best_dist, 1.0f));
+                        FeatureDescriptorIndex<>::DistanceToAngle(dists(i1, 1));
 
                 // Check if match passes ratio test. Keep this comparison >= in order to
                 // ensure that the case of best == second_best is detected.
@@ -231,23 +266,20 @@ namespace bkmap {
             return num_matches;
         }
 
-        void FindBestMatches(const Eigen::MatrixXi& dists, const float max_ratio,
-                             const float max_distance, const bool cross_check,
-                             FeatureMatches* matches) {
+        // Compose the final matches from the one-way matches, where matches21 is
+        // null if no cross check should be performed.
+        void ComposeMatches(const std::vector<int>& matches12,
+                            const size_t num_matches12,
+                            const std::vector<int>* matches21,
+                            const size_t num_matches21,
+                            FeatureMatches* matches) {
             matches->clear();
 
-            std::vector<int> matches12;
-            const size_t num_matches12 =
-                    FindBestMatchesOneWay(dists, max_ratio, max_distance, &matches12);
-
-            if (cross_check) {
-                std::vector<int> matches21;
-                const size_t num_matches21 = FindBestMatchesOneWay(
-                        dists.transpose(), max_ratio, max_distance, &matches21);
+            if (matches21 != nullptr) {
                 matches->reserve(std::min(num_matches12, num_matches21));
                 for (size_t i1 = 0; i1 < matches12.size(); ++i1) {
-                    if (matches12[i1] != -1 && matches21[matches12[i1]] != -1 &&
-                        matches21[matches12[i1]] == static_cast<int>(i1)) {
+                    if (matches12[i1] != -1 && (*matches21)[matches12[i1]] != -1 &&
+                        (*matches21)[matches12[i1]] == static_cast<int>(i1)) {
                         FeatureMatch match;
                         match.point2D_idx1 = i1;
                         match.point2D_idx2 = matches12[i1];
@@ -267,6 +299,133 @@ namespace bkmap {
             }
         }
 
+        // Find the matches from the best matches of the SIFT distance kernel,
+        // where best_matches21 is null if no cross check should be performed.
+        void FindBestMatches(const std::vector<SiftBestMatch>& best_matches12,
+                             const std::vector<SiftBestMatch>* best_matches21,
+                             const float max_ratio, const float max_distance,
+                             FeatureMatches* matches) {
+            std::vector<int> matches12;
+            const size_t num_matches12 = FindBestMatchesOneWay(
+                    best_matches12, max_ratio, max_distance, &matches12);
+
+            if (best_matches21 != nullptr) {
+                std::vector<int> matches21;
+                const size_t num_matches21 = FindBestMatchesOneWay(
+                        *best_matches21, max_ratio, max_distance, &matches21);
+                ComposeMatches(matches12, num_matches12, &matches21, num_matches21,
+                               matches);
+            } else {
+                ComposeMatches(matches12, num_matches12, nullptr, 0, matches);
+            }
+        }
+
+        void FindBestMatches(const FeatureDescriptors& descriptors1,
+                             const FeatureDescriptors& descriptors2,
+                             const SiftGuidedFilter& guided_filter,
+                             const float max_ratio, const float max_distance,
+                             const bool cross_check, FeatureMatches* matches) {
+            std::vector<SiftBestMatch> best_matches12;
+            std::vector<SiftBestMatch> best_matches21;
+            FindBestSiftMatches(descriptors1, descriptors2, guided_filter,
+                                &best_matches12,
+                                cross_check ? &best_matches21 : nullptr);
+            FindBestMatches(best_matches12, cross_check ? &best_matches21 : nullptr,
+                            max_ratio, max_distance, matches);
+        }
+
+        void FindBestMatches(const FeatureDescriptorIndex<>& index1,
+                             const FeatureDescriptorIndex<>& index2,
+                             const float max_ratio, const float max_distance,
+                             const bool cross_check, FeatureMatches* matches) {
+            std::vector<int> matches12;
+            const size_t num_matches12 =
+                    FindBestMatchesOneWay(index2, index1.Descriptors(), max_ratio,
+                                          max_distance, &matches12);
+
+            if (cross_check) {
+                std::vector<int> matches21;
+                const size_t num_matches21 =
+                        FindBestMatchesOneWay(index1, index2.Descriptors(), max_ratio,
+                                              max_distance, &matches21);
+                ComposeMatches(matches12, num_matches12, &matches21, num_matches21,
+                               matches);
+            } else {
+                ComposeMatches(matches12, num_matches12, nullptr, 0, matches);
+            }
+        }
+
+        size_t FindBestMatchesOneWay(const std::vector<BinaryBestMatch>& best_matches,
+                                     const float max_ratio, const int max_distance,
+                                     std::vector<int>* matches) {
+            size_t num_matches = 0;
+            matches->resize(best_matches.size(), -1);
+
+            for (size_t i1 = 0; i1 < best_matches.size(); ++i1) {
+                const BinaryBestMatch& best_match = best_matches[i1];
+
+                // Check if any match found.
+                if (best_match.idx == -1) {
+                    continue;
+                }
+
+                // Check if match distance passes threshold.
+                if (best_match.dist > max_distance) {
+                    continue;
+                }
+
+                // Check if match passes ratio test. Keep this comparison >= in order to
+                // ensure that the case of best == second_best is detected.
+                if (best_match.dist >= max_ratio * best_match.second_dist) {
+                    continue;
+                }
+
+                num_matches += 1;
+                (*matches)[i1] = best_match.idx;
+            }
+
+            return num_matches;
+        }
+
+        // Find the matches from the best matches of the binary distance kernel or
+        // the multi-index hashing, where best_matches21 is null if no cross check
+        // should be performed.
+        void FindBestMatches(const std::vector<BinaryBestMatch>& best_matches12,
+                             const std::vector<BinaryBestMatch>* best_matches21,
+                             const float max_ratio, const int max_distance,
+                             FeatureMatches* matches) {
+            std::vector<int> matches12;
+            const size_t num_matches12 = FindBestMatchesOneWay(
+                    best_matches12, max_ratio, max_distance, &matches12);
+
+            if (best_matches21 != nullptr) {
+                std::vector<int> matches21;
+                const size_t num_matches21 = FindBestMatchesOneWay(
+                        *best_matches21, max_ratio, max_distance, &matches21);
+                ComposeMatches(matches12, num_matches12, &matches21, num_matches21,
+                               matches);
+            } else {
+                ComposeMatches(matches12, num_matches12, nullptr, 0, matches);
+            }
+        }
+
+        void FindBestBinaryMatches(const BinaryDescriptorIndex& index,
+                                   const FeatureDescriptors& query,
+                                   const float max_ratio, const int max_distance,
+                                   std::vector<BinaryBestMatch>* best_matches) {
+            BinaryDescriptorIndex::IndicesType indices;
+            BinaryDescriptorIndex::DistancesType dists;
+            index.Search(query, max_distance, max_ratio, &indices, &dists);
+
+            best_matches->resize(query.rows());
+            for (FeatureDescriptors::Index i = 0; i < query.rows(); ++i) {
+                BinaryBestMatch& best_match = (*best_matches)[i];
+                best_match.idx = indices(i, 0);
+                best_match.dist = dists(i, 0);
+                best_match.second_dist = dists(i, 1);
+            }
+        }
+
         void WarnIfMaxNumMatchesReachedGPU(const SiftMatchGPU& sift_match_gpu,
                                            const FeatureDescriptors& descriptors) {
             if (sift_match_gpu.GetMaxSift() < descriptors.rows()) {
@@ -286,6 +445,8 @@ namespace bkmap {
         }
         CHECK_OPTION_GT(max_ratio, 0.0);
         CHECK_OPTION_GT(max_distance, 0.0);
+        CHECK_OPTION_GE(max_hamming_distance, 0);
+        CHECK_OPTION_GT(cpu_batch_size, 0);
         CHECK_OPTION_GT(max_error, 0.0);
         CHECK_OPTION_GT(max_num_trials, 0);
         CHECK_OPTION_GE(min_inlier_ratio, 0);
@@ -322,6 +483,19 @@ namespace bkmap {
                 cache_size_, [this](const image_t image_id) {
                     return database_->ReadDescriptors(image_id);
                 }));
+
+        // In-memory databases cannot be shared between multiple connections.
+        if (!database_->Path().empty() && database_->Path() != ":memory:") {
+            database_reader_pool_.reset(new DatabaseReaderPool(*database_));
+        }
+
+        // The indices are always set manually in GetDescriptorIndex.
+        descriptor_index_cache_.reset(
+                new LRUCache<image_t, std::shared_ptr<const FeatureDescriptorIndex<>>>(
+                        cache_size_, [](const image_t image_id) {
+                            LOG(FATAL) << "Descriptor index not built";
+                            return std::shared_ptr<const FeatureDescriptorIndex<>>();
+                        }));
     }
 
     const Camera& FeatureMatcherCache::GetCamera(const camera_t camera_id) const {
@@ -335,15 +509,84 @@ namespace bkmap {
     const FeatureKeypoints& FeatureMatcherCache::GetKeypoints(
             const image_t image_id) {
         std::unique_lock<std::mutex> lock(database_mutex_);
+        if (database_reader_pool_ && !keypoints_cache_->Exists(image_id)) {
+            // Read through a pooled connection outside of the lock, so that
+            // multiple threads can load the features of different images.
+            lock.unlock();
+            FeatureKeypoints keypoints =
+                    database_reader_pool_->Acquire()->ReadKeypoints(image_id);
+            lock.lock();
+            if (!keypoints_cache_->Exists(image_id)) {
+                keypoints_cache_->Set(image_id, std::move(keypoints));
+            }
+        }
         return keypoints_cache_->Get(image_id);
     }
 
     const FeatureDescriptors& FeatureMatcherCache::GetDescriptors(
             const image_t image_id) {
         std::unique_lock<std::mutex> lock(database_mutex_);
+        if (database_reader_pool_ && !descriptors_cache_->Exists(image_id)) {
+            lock.unlock();
+            FeatureDescriptors descriptors =
+                    database_reader_pool_->Acquire()->ReadDescriptors(image_id);
+            lock.lock();
+            if (!descriptors_cache_->Exists(image_id)) {
+                descriptors_cache_->Set(image_id, std::move(descriptors));
+            }
+        }
         return descriptors_cache_->Get(image_id);
     }
 
+    std::shared_ptr<const FeatureDescriptorIndex<>>
+    FeatureMatcherCache::GetDescriptorIndex(const image_t image_id) {
+        {
+            std::unique_lock<std::mutex> lock(descriptor_index_mutex_);
+
+            // Wait if another thread is currently building the same index.
+            descriptor_index_condition_.wait(lock, [this, image_id] {
+                return descriptor_indices_in_progress_.count(image_id) == 0;
+            });
+
+            if (descriptor_index_cache_->Exists(image_id)) {
+                return descriptor_index_cache_->Get(image_id);
+            }
+
+            descriptor_indices_in_progress_.insert(image_id);
+        }
+
+        // Build the index directly from the memory-mapped feature store without
+        // going through the descriptors cache, if possible. As in the database,
+        // the store is only used for descriptors that exist in the tables.
+        std::shared_ptr<const FeatureDescriptorIndex<>> descriptor_index;
+        const FeatureStore* feature_store = database_->GetFeatureStore();
+        bool use_feature_store = false;
+        if (feature_store != nullptr && feature_store->ExistsDescriptors(image_id)) {
+            std::unique_lock<std::mutex> lock(database_mutex_);
+            use_feature_store = database_->ExistsDescriptors(image_id);
+        }
+        if (use_feature_store) {
+            std::shared_ptr<const void> mapping;
+            descriptor_index.reset(new FeatureDescriptorIndex<>(
+                    feature_store->ReadDescriptorsMap(image_id, &mapping)));
+        } else {
+            descriptor_index.reset(
+                    new FeatureDescriptorIndex<>(GetDescriptors(image_id)));
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(descriptor_index_mutex_);
+            descriptor_index_cache_->Set(
+                    image_id,
+                    std::shared_ptr<const FeatureDescriptorIndex<>>(descriptor_index));
+            descriptor_indices_in_progress_.erase(image_id);
+        }
+
+        descriptor_index_condition_.notify_all();
+
+        return descriptor_index;
+    }
+
     FeatureMatches FeatureMatcherCache::GetMatches(const image_t image_id1,
                                                    const image_t image_id2) {
         std::unique_lock<std::mutex> lock(database_mutex_);
@@ -416,6 +659,12 @@ namespace bkmap {
     void SiftCPUFeatureMatcher::Run() {
         SignalValidSetup();
 
+        const size_t num_threads =
+                static_cast<size_t>(GetEffectiveNumThreads(options_.num_threads));
+
+        std::vector<Input> batch;
+        batch.reserve(options_.cpu_batch_size);
+
         while (true) {
             if (IsStopped()) {
                 break;
@@ -423,15 +672,106 @@ namespace bkmap {
 
             const auto input_job = input_queue_->Pop();
             if (input_job.IsValid()) {
-                auto data = input_job.Data();
+                batch.clear();
+                batch.push_back(input_job.Data());
+
+                // Only take a fair share of the queued pairs, so that the other
+                // matcher threads do not run idle for small numbers of pairs.
+                const size_t max_batch_size =
+                        std::min(static_cast<size_t>(options_.cpu_batch_size),
+                                 1 + input_queue_->Size() / num_threads);
+                while (batch.size() < max_batch_size) {
+                    const auto next_input_job = input_queue_->TryPop();
+                    if (!next_input_job.IsValid()) {
+                        break;
+                    }
+                    batch.push_back(next_input_job.Data());
+                }
 
-                const FeatureDescriptors descriptors1 =
-                        cache_->GetDescriptors(data.image_id1);
-                const FeatureDescriptors descriptors2 =
-                        cache_->GetDescriptors(data.image_id2);
-                MatchSiftFeaturesCPU(options_, descriptors1, descriptors2, &data.matches);
+                MatchBatch(&batch);
 
-                CHECK(output_queue_->Push(data));
+                for (const auto& data : batch) {
+                    CHECK(output_queue_->Push(data));
+                }
+            }
+        }
+    }
+
+    void SiftCPUFeatureMatcher::MatchBatch(std::vector<Input>* batch) {
+        // Group the pairs by the image they share. Pairs can only be flipped, if
+        // cross checking is enabled, since the matches are otherwise asymmetric.
+        std::vector<image_t> group_image_ids;
+        std::unordered_map<image_t, std::vector<size_t>> groups;
+        std::vector<bool> flipped(batch->size(), false);
+        for (size_t i = 0; i < batch->size(); ++i) {
+            const auto& data = (*batch)[i];
+            if (groups.count(data.image_id1) == 0 && options_.cross_check &&
+                groups.count(data.image_id2) > 0) {
+                flipped[i] = true;
+                groups[data.image_id2].push_back(i);
+                continue;
+            }
+
+            if (groups.count(data.image_id1) == 0) {
+                group_image_ids.push_back(data.image_id1);
+            }
+            groups[data.image_id1].push_back(i);
+        }
+
+        std::vector<FeatureMatches> matches;
+        for (const auto image_id : group_image_ids) {
+            const std::vector<size_t>& group = groups.at(image_id);
+
+            std::vector<image_t> other_image_ids;
+            other_image_ids.reserve(group.size());
+            for (const auto i : group) {
+                const auto& data = (*batch)[i];
+                other_image_ids.push_back(flipped[i] ? data.image_id1 : data.image_id2);
+            }
+
+            if (options_.cpu_brute_force_matching || options_.binary_descriptors) {
+                const FeatureDescriptors descriptors = cache_->GetDescriptors(image_id);
+                std::vector<FeatureDescriptors> other_descriptors;
+                other_descriptors.reserve(group.size());
+                std::vector<const FeatureDescriptors*> other_descriptors_ptrs;
+                other_descriptors_ptrs.reserve(group.size());
+                for (const auto other_image_id : other_image_ids) {
+                    other_descriptors.push_back(cache_->GetDescriptors(other_image_id));
+                    other_descriptors_ptrs.push_back(&other_descriptors.back());
+                }
+                if (options_.binary_descriptors) {
+                    MatchBinaryFeaturesCPU(options_, descriptors, other_descriptors_ptrs,
+                                           &matches);
+                } else {
+                    MatchSiftFeaturesCPU(options_, descriptors, other_descriptors_ptrs,
+                                         &matches);
+                }
+            } else {
+                const auto descriptor_index = cache_->GetDescriptorIndex(image_id);
+                std::vector<std::shared_ptr<const FeatureDescriptorIndex<>>>
+                        other_descriptor_indices;
+                other_descriptor_indices.reserve(group.size());
+                std::vector<const FeatureDescriptorIndex<>*>
+                        other_descriptor_indices_ptrs;
+                other_descriptor_indices_ptrs.reserve(group.size());
+                for (const auto other_image_id : other_image_ids) {
+                    other_descriptor_indices.push_back(
+                            cache_->GetDescriptorIndex(other_image_id));
+                    other_descriptor_indices_ptrs.push_back(
+                            other_descriptor_indices.back().get());
+                }
+                MatchSiftFeaturesCPU(options_, *descriptor_index,
+                                     other_descriptor_indices_ptrs, &matches);
+            }
+
+            for (size_t j = 0; j < group.size(); ++j) {
+                auto& data = (*batch)[group[j]];
+                data.matches = std::move(matches[j]);
+                if (flipped[group[j]]) {
+                    for (auto& match : data.matches) {
+                        std::swap(match.point2D_idx1, match.point2D_idx2);
+                    }
+                }
             }
         }
     }
@@ -641,6 +981,8 @@ namespace bkmap {
                 static_cast<size_t>(options_.max_num_trials);
         two_view_geometry_options_.ransac_options.min_inlier_ratio =
                 options_.min_inlier_ratio;
+        two_view_geometry_options_.interleaved_estimation =
+                options_.interleaved_verification;
     }
 
     void TwoViewGeometryVerifier::Run() {
@@ -667,6 +1009,9 @@ namespace bkmap {
                 const auto points1 = FeatureKeypointsToPointsVector(keypoints1);
                 const auto points2 = FeatureKeypointsToPointsVector(keypoints2);
 
+                Timer timer;
+                timer.Start();
+
                 if (options_.multiple_models) {
                     data.two_view_geometry.EstimateMultiple(camera1, points1, camera2,
                                                             points2, data.matches,
@@ -677,6 +1022,8 @@ namespace bkmap {
                                                     two_view_geometry_options_);
                 }
 
+                data.verification_time = timer.ElapsedSeconds();
+
                 CHECK(output_queue_->Push(data));
             }
         }
@@ -685,7 +1032,13 @@ namespace bkmap {
     SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
                                            Database* database,
                                            FeatureMatcherCache* cache)
-            : options_(options), database_(database), cache_(cache), is_setup_(false) {
+            : options_(options),
+              database_(database),
+              cache_(cache),
+              is_setup_(false),
+              num_verified_image_pairs_(0),
+              verification_time_(0),
+              max_verification_time_(0) {
         CHECK(options_.Check());
 
         const int num_threads = GetEffectiveNumThreads(options_.num_threads);
@@ -753,6 +1106,16 @@ namespace bkmap {
         for (auto& guided_matcher : guided_matchers_) {
             guided_matcher->Wait();
         }
+
+        if (num_verified_image_pairs_ > 0) {
+            std::cout << StringPrintf(
+                    "Geometric verification: %d image pairs in %.3fs "
+                    "(mean %.3fms, max %.3fms per pair)",
+                    num_verified_image_pairs_, verification_time_,
+                    1000 * verification_time_ / num_verified_image_pairs_,
+                    1000 * max_verification_time_)
+            << std::endl;
+        }
     }
 
     bool SiftFeatureMatcher::Setup() {
@@ -868,6 +1231,13 @@ namespace bkmap {
             CHECK(output_job.IsValid());
             auto output = output_job.Data();
 
+            if (output.verification_time >= 0) {
+                num_verified_image_pairs_ += 1;
+                verification_time_ += output.verification_time;
+                max_verification_time_ =
+                        std::max(max_verification_time_, output.verification_time);
+            }
+
             if (output.matches.size() < static_cast<size_t>(options_.min_num_inliers)) {
                 output.matches = {};
             }
@@ -999,7 +1369,12 @@ namespace bkmap {
 
         RunSequentialMatching(ordered_image_ids);
         if (options_.loop_detection) {
-            RunLoopDetection(ordered_image_ids);
+            if (match_options_.binary_descriptors) {
+                std::cerr << "WARNING: Loop detection is not supported for binary "
+                        "descriptors." << std::endl;
+            } else {
+                RunLoopDetection(ordered_image_ids);
+            }
         }
 
         GetTimer().PrintMinutes();
@@ -1120,15 +1495,26 @@ namespace bkmap {
     void VocabTreeFeatureMatcher::Run() {
         PrintHeading1("Vocabulary tree feature matching");
 
+        if (match_options_.binary_descriptors) {
+            std::cerr << "ERROR: Vocabulary tree matching is not supported for "
+                    "binary descriptors." << std::endl;
+            return;
+        }
+
         if (!matcher_.Setup()) {
             return;
         }
 
         cache_.Setup();
 
-        // Read the pre-trained vocabulary tree from disk.
+        // Read the persistent index of previously indexed images, if it exists, or
+        // otherwise the pre-trained vocabulary tree from disk.
         retrieval::VisualIndex<> visual_index;
-        visual_index.Read(options_.vocab_tree_path);
+        if (!options_.index_path.empty() && ExistsFile(options_.index_path)) {
+            visual_index.Read(options_.index_path);
+        } else {
+            visual_index.Read(options_.vocab_tree_path);
+        }
 
         const std::vector<image_t> all_image_ids = cache_.GetImageIds();
         std::vector<image_t> image_ids;
@@ -1163,15 +1549,20 @@ namespace bkmap {
         }
 
         // Index all images in the visual index.
-        IndexImagesInVisualIndex(match_options_.num_threads,
-                                 options_.max_num_features, all_image_ids, this,
-                                 &cache_, &visual_index);
+        const size_t num_indexed_images = IndexImagesInVisualIndex(
+                match_options_.num_threads, options_.max_num_features, all_image_ids,
+                this, &cache_, &visual_index);
 
         if (IsStopped()) {
             GetTimer().PrintMinutes();
             return;
         }
 
+        // Append the newly indexed images to the persistent index.
+        if (!options_.index_path.empty() && num_indexed_images > 0) {
+            visual_index.Append(options_.index_path);
+        }
+
         // Match all images in the visual index.
         MatchNearestNeighborsInVisualIndex(
                 match_options_.num_threads, options_.num_images,
@@ -1735,100 +2126,102 @@ namespace bkmap {
         GetTimer().PrintMinutes();
     }
 
-    flann::Matrix<int> matchOneWayKdTree(const FeatureDescriptors& descriptors1,
-                                                 const FeatureDescriptors& descriptors2){
-
-        int nn = 100;
-        const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors1_int =
-                    descriptors1.cast<int>();
-        const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors2_int =
-                descriptors2.cast<int>();
+    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                              const FeatureDescriptors& descriptors1,
+                              const FeatureDescriptors& descriptors2,
+                              FeatureMatches* matches) {
+        CHECK(match_options.Check());
+        CHECK_NOTNULL(matches);
 
-        flann::Matrix<int> dataset(new int[descriptors1_int.rows() * 128], descriptors1_int.rows(), 128);
-        flann::Matrix<int> query(new int[descriptors2_int.rows() * 128], descriptors2_int.rows(), 128);
-        for(auto i = 0; i < descriptors1_int.rows(); i++){
-            for(auto j=0; j< nn; j++){
-                int test = descriptors1_int(i,j);
-                dataset[i][j] = descriptors1_int(i,j);
-            }
+        if (match_options.cpu_brute_force_matching) {
+            FindBestMatches(descriptors1, descriptors2, nullptr,
+                            match_options.max_ratio, match_options.max_distance,
+                            match_options.cross_check, matches);
+        } else {
+            const FeatureDescriptorIndex<> index1(descriptors1);
+            const FeatureDescriptorIndex<> index2(descriptors2);
+            FindBestMatches(index1, index2, match_options.max_ratio,
+                            match_options.max_distance, match_options.cross_check,
+                            matches);
         }
+    }
 
-        for(auto i = 0; i < descriptors2_int.rows(); i++){
-            for(auto j=0; j< nn; j++){
-                query[i][j] = descriptors2_int(i,j);
-            }
-        }
+    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                              const FeatureDescriptorIndex<>& index1,
+                              const FeatureDescriptorIndex<>& index2,
+                              FeatureMatches* matches) {
+        CHECK(match_options.Check());
+        CHECK_NOTNULL(matches);
 
-        flann::Matrix<int > indices(new int[query.rows*nn], query.rows, nn);
-        flann::Matrix<float> dists(new float[query.rows*nn], query.rows, nn);
-        flann::Index<flann::L2<int> > index(dataset, flann::KDTreeIndexParams(4));
-        index.buildIndex();
-        index.knnSearch(query, indices, dists, nn, flann::SearchParams(1024));
-//        index.radiusSearch(query, indices, dists, 10000, nn);
-        flann::Matrix<int> bestMatches(new int[query.rows], query.rows, 1);
+        if (match_options.cpu_brute_force_matching) {
+            FindBestMatches(index1.Descriptors(), index2.Descriptors(), nullptr,
+                            match_options.max_ratio, match_options.max_distance,
+                            match_options.cross_check, matches);
+        } else {
+            FindBestMatches(index1, index2, match_options.max_ratio,
+                            match_options.max_distance, match_options.cross_check,
+                            matches);
+        }
+    }
 
-        for(auto id = 0; id < indices.rows; id++){
-            float bestMatchDistance  = 10000;
-            float secondBestDistance = 10000;
-            int bestMatch = -1;
+    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                              const FeatureDescriptors& descriptors1,
+                              const std::vector<const FeatureDescriptors*>& descriptors2,
+                              std::vector<FeatureMatches>* matches) {
+        CHECK(match_options.Check());
+        CHECK_NOTNULL(matches);
 
-            for(auto i=0; i<nn; i++){
-                if(dists[id][i] < bestMatchDistance ){
-                    bestMatch = indices[id][i];
-                    bestMatchDistance = dists[id][i];
-                }
-            }
+        matches->resize(descriptors2.size());
 
-            if(bestMatch != -1){
-                //find second best
-                for(auto i=0; i<nn; i++){
-                    if(dists[id][i] < secondBestDistance &&  indices[id][i] !=  bestMatch){
-                        secondBestDistance = dists[id][i];
-                    }
-                }
-            }
-            if(bestMatchDistance >= 0.8 * secondBestDistance){
-                bestMatches[id][0] = -1;
-            }
-            else{
-                bestMatches[id][0] = bestMatch;
+        if (!match_options.cpu_brute_force_matching) {
+            const FeatureDescriptorIndex<> index1(descriptors1);
+            for (size_t i = 0; i < descriptors2.size(); ++i) {
+                const FeatureDescriptorIndex<> index2(*CHECK_NOTNULL(descriptors2[i]));
+                FindBestMatches(index1, index2, match_options.max_ratio,
+                                match_options.max_distance, match_options.cross_check,
+                                &(*matches)[i]);
             }
+            return;
         }
 
-        return bestMatches;
-    }
+        std::vector<std::vector<SiftBestMatch>> best_matches12;
+        std::vector<std::vector<SiftBestMatch>> best_matches21;
+        FindBestSiftMatches(descriptors1, descriptors2, &best_matches12,
+                            match_options.cross_check ? &best_matches21 : nullptr);
 
-    void findBestMatchesKDTree(const FeatureDescriptors& descriptors1,
-                               const FeatureDescriptors& descriptors2, FeatureMatches* matches){
-        matches->clear();
-        flann::Matrix<int> matches_12 = matchOneWayKdTree(descriptors1, descriptors2);
-        flann::Matrix<int> matches_21 = matchOneWayKdTree(descriptors2, descriptors1);
-        matches->reserve(std::min(matches_12.rows, matches_21.rows));
-
-        for (size_t i1 = 0; i1 < matches_12.rows; ++i1) {
-            if(matches_12[i1][0] > 0 && matches_21[matches_12[i1][0]][0] == static_cast<int>(i1)){
-                FeatureMatch match;
-                match.point2D_idx1 = i1;
-                match.point2D_idx2 = matches_12[i1][0];
-                matches->push_back(match);
-            }
+        for (size_t i = 0; i < descriptors2.size(); ++i) {
+            FindBestMatches(best_matches12[i],
+                            match_options.cross_check ? &best_matches21[i] : nullptr,
+                            match_options.max_ratio, match_options.max_distance,
+                            &(*matches)[i]);
         }
     }
 
-    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
-                              const FeatureDescriptors& descriptors1,
-                              const FeatureDescriptors& descriptors2,
-                              FeatureMatches* matches) {
+    void MatchSiftFeaturesCPU(
+            const SiftMatchingOptions& match_options,
+            const FeatureDescriptorIndex<>& index1,
+            const std::vector<const FeatureDescriptorIndex<>*>& indices2,
+            std::vector<FeatureMatches>* matches) {
         CHECK(match_options.Check());
         CHECK_NOTNULL(matches);
 
-        findBestMatchesKDTree(descriptors1, descriptors2, matches);
+        if (match_options.cpu_brute_force_matching) {
+            std::vector<const FeatureDescriptors*> descriptors2;
+            descriptors2.reserve(indices2.size());
+            for (const auto index2 : indices2) {
+                descriptors2.push_back(&CHECK_NOTNULL(index2)->Descriptors());
+            }
+            MatchSiftFeaturesCPU(match_options, index1.Descriptors(), descriptors2,
+                                 matches);
+            return;
+        }
 
-//        const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-//                nullptr, nullptr, descriptors1, descriptors2, nullptr);
-//
-//        FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
-//                        match_options.cross_check, matches);
+        matches->resize(indices2.size());
+        for (size_t i = 0; i < indices2.size(); ++i) {
+            FindBestMatches(index1, *CHECK_NOTNULL(indices2[i]),
+                            match_options.max_ratio, match_options.max_distance,
+                            match_options.cross_check, &(*matches)[i]);
+        }
     }
 
     void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
@@ -1845,30 +2238,65 @@ namespace bkmap {
         const Eigen::Matrix3f F = two_view_geometry->F.cast<float>();
         const Eigen::Matrix3f H = two_view_geometry->H.cast<float>();
 
-        std::function<bool(float, float, float, float)> guided_filter;
+        CHECK_EQ(keypoints1.size(), descriptors1.rows());
+        CHECK_EQ(keypoints2.size(), descriptors2.rows());
+
+        Eigen::Matrix3Xf points1(3, keypoints1.size());
+        for (size_t i1 = 0; i1 < keypoints1.size(); ++i1) {
+            points1.col(i1) = Eigen::Vector3f(keypoints1[i1].x, keypoints1[i1].y, 1.0f);
+        }
+
+        Eigen::Matrix3Xf points2(3, keypoints2.size());
+        for (size_t i2 = 0; i2 < keypoints2.size(); ++i2) {
+            points2.col(i2) = Eigen::Vector3f(keypoints2[i2].x, keypoints2[i2].y, 1.0f);
+        }
+
+        // The per-keypoint terms of the residuals are precomputed, so that the
+        // filter only has to combine them for each pair of keypoints.
+        Eigen::Matrix3Xf Fx1;
+        Eigen::Matrix3Xf Ftx2;
+        Eigen::Matrix2Xf Hx1;
+
+        SiftGuidedFilter guided_filter;
         if (two_view_geometry->config == TwoViewGeometry::CALIBRATED ||
             two_view_geometry->config == TwoViewGeometry::UNCALIBRATED) {
-            guided_filter = [&](const float x1, const float y1, const float x2,
-                                const float y2) {
-                const Eigen::Vector3f p1(x1, y1, 1.0f);
-                const Eigen::Vector3f p2(x2, y2, 1.0f);
-                const Eigen::Vector3f Fx1 = F * p1;
-                const Eigen::Vector3f Ftx2 = F.transpose() * p2;
-                const float x2tFx1 = p2.transpose() * Fx1;
-                return x2tFx1 * x2tFx1 /
-                       (Fx1(0) * Fx1(0) + Fx1(1) * Fx1(1) + Ftx2(0) * Ftx2(0) +
-                        Ftx2(1) * Ftx2(1)) >
-                       max_residual;
+            Fx1 = F * points1;
+            Ftx2 = F.transpose() * points2;
+            guided_filter = [&](const int i1_begin, const int i1_end,
+                                const int i2_begin, const int i2_end,
+                                std::vector<char>* filtered) {
+                const int block_size2 = i2_end - i2_begin;
+                for (int i1 = i1_begin; i1 < i1_end; ++i1) {
+                    const Eigen::Vector3f Fx1_i1 = Fx1.col(i1);
+                    const float Fx1_norm = Fx1_i1(0) * Fx1_i1(0) + Fx1_i1(1) * Fx1_i1(1);
+                    char* filtered_row = filtered->data() + (i1 - i1_begin) * block_size2;
+                    for (int i2 = i2_begin; i2 < i2_end; ++i2) {
+                        const float x2tFx1 = points2.col(i2).dot(Fx1_i1);
+                        filtered_row[i2 - i2_begin] =
+                                x2tFx1 * x2tFx1 /
+                                (Fx1_norm + Ftx2(0, i2) * Ftx2(0, i2) +
+                                 Ftx2(1, i2) * Ftx2(1, i2)) >
+                                max_residual;
+                    }
+                }
             };
         } else if (two_view_geometry->config == TwoViewGeometry::PLANAR ||
                    two_view_geometry->config == TwoViewGeometry::PANORAMIC ||
                    two_view_geometry->config ==
                    TwoViewGeometry::PLANAR_OR_PANORAMIC) {
-            guided_filter = [&](const float x1, const float y1, const float x2,
-                                const float y2) {
-                const Eigen::Vector3f p1(x1, y1, 1.0f);
-                const Eigen::Vector2f p2(x2, y2);
-                return ((H * p1).hnormalized() - p2).squaredNorm() > max_residual;
+            Hx1 = (H * points1).colwise().hnormalized();
+            guided_filter = [&](const int i1_begin, const int i1_end,
+                                const int i2_begin, const int i2_end,
+                                std::vector<char>* filtered) {
+                const int block_size2 = i2_end - i2_begin;
+                for (int i1 = i1_begin; i1 < i1_end; ++i1) {
+                    char* filtered_row = filtered->data() + (i1 - i1_begin) * block_size2;
+                    for (int i2 = i2_begin; i2 < i2_end; ++i2) {
+                        filtered_row[i2 - i2_begin] =
+                                (Hx1.col(i1) - points2.col(i2).head<2>()).squaredNorm() >
+                                max_residual;
+                    }
+                }
             };
         } else {
             return;
@@ -1876,12 +2304,78 @@ namespace bkmap {
 
         CHECK(guided_filter);
 
-        const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-                &keypoints1, &keypoints2, descriptors1, descriptors2, guided_filter);
+        if (match_options.binary_descriptors) {
+            std::vector<BinaryBestMatch> best_matches12;
+            std::vector<BinaryBestMatch> best_matches21;
+            FindBestBinaryMatches(
+                    descriptors1, descriptors2, guided_filter, &best_matches12,
+                    match_options.cross_check ? &best_matches21 : nullptr);
+            FindBestMatches(best_matches12,
+                            match_options.cross_check ? &best_matches21 : nullptr,
+                            match_options.max_ratio, match_options.max_hamming_distance,
+                            &two_view_geometry->inlier_matches);
+        } else {
+            FindBestMatches(descriptors1, descriptors2, guided_filter,
+                            match_options.max_ratio, match_options.max_distance,
+                            match_options.cross_check,
+                            &two_view_geometry->inlier_matches);
+        }
+    }
 
-        FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
-                        match_options.cross_check,
-                        &two_view_geometry->inlier_matches);
+    void MatchBinaryFeaturesCPU(const SiftMatchingOptions& match_options,
+                                const FeatureDescriptors& descriptors1,
+                                const FeatureDescriptors& descriptors2,
+                                FeatureMatches* matches) {
+        CHECK_NOTNULL(matches);
+
+        std::vector<FeatureMatches> batch_matches;
+        MatchBinaryFeaturesCPU(match_options, descriptors1, {&descriptors2},
+                               &batch_matches);
+        *matches = std::move(batch_matches[0]);
+    }
+
+    void MatchBinaryFeaturesCPU(
+            const SiftMatchingOptions& match_options,
+            const FeatureDescriptors& descriptors1,
+            const std::vector<const FeatureDescriptors*>& descriptors2,
+            std::vector<FeatureMatches>* matches) {
+        CHECK(match_options.Check());
+        CHECK_NOTNULL(matches);
+
+        matches->resize(descriptors2.size());
+
+        const float max_ratio = static_cast<float>(match_options.max_ratio);
+        const int max_distance = match_options.max_hamming_distance;
+
+        std::vector<BinaryBestMatch> best_matches12;
+        std::vector<BinaryBestMatch> best_matches21;
+
+        if (match_options.cpu_brute_force_matching) {
+            for (size_t i = 0; i < descriptors2.size(); ++i) {
+                FindBestBinaryMatches(
+                        descriptors1, *CHECK_NOTNULL(descriptors2[i]), nullptr,
+                        &best_matches12,
+                        match_options.cross_check ? &best_matches21 : nullptr);
+                FindBestMatches(best_matches12,
+                                match_options.cross_check ? &best_matches21 : nullptr,
+                                max_ratio, max_distance, &(*matches)[i]);
+            }
+            return;
+        }
+
+        const BinaryDescriptorIndex index1(descriptors1);
+        for (size_t i = 0; i < descriptors2.size(); ++i) {
+            const BinaryDescriptorIndex index2(*CHECK_NOTNULL(descriptors2[i]));
+            FindBestBinaryMatches(index2, descriptors1, max_ratio, max_distance,
+                                  &best_matches12);
+            if (match_options.cross_check) {
+                FindBestBinaryMatches(index1, *descriptors2[i], max_ratio,
+                                      max_distance, &best_matches21);
+            }
+            FindBestMatches(best_matches12,
+                            match_options.cross_check ? &best_matches21 : nullptr,
+                            max_ratio, max_distance, &(*matches)[i]);
+        }
     }
 
     bool CreateSiftGPUMatcher(const SiftMatchingOptions& match_options,
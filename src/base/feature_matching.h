@@ -6,11 +6,14 @@
 #define BKMAP_FEATURE_MATCHING_H
 
 #include <array>
+#include <condition_variable>
+#include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
 #include "base/database.h"
+#include "base/feature_descriptor_index.h"
 #include "util/alignment.h"
 #include "util/cache.h"
 #include "util/opengl_utils.h"
@@ -41,6 +44,25 @@ namespace bkmap {
         // Whether to enable cross checking in matching.
         bool cross_check = true;
 
+        // Whether to use exact brute-force matching on the CPU instead of the
+        // approximate nearest neighbor search in the per-image descriptor indices.
+        bool cpu_brute_force_matching = false;
+
+        // Whether the images have binary descriptors, as extracted with
+        // `SiftExtractionOptions::binary_descriptors`, which are matched by their
+        // Hamming distances on the CPU. Without brute-force matching, the
+        // descriptors are matched with multi-index hashing, which finds the same
+        // matches and is faster for similar images, e.g., consecutive video frames.
+        bool binary_descriptors = false;
+
+        // Maximum Hamming distance in bits to the best match of binary descriptors.
+        int max_hamming_distance = 64;
+
+        // Maximum number of image pairs that a CPU matcher thread matches in one
+        // batch. Pairs in a batch that share an image are matched together, so
+        // that the data of the shared image is only loaded and prepared once.
+        int cpu_batch_size = 16;
+
         // Maximum number of matches.
         int max_num_matches = 32768;
 
@@ -66,6 +88,11 @@ namespace bkmap {
         // Whether to attempt to estimate multiple geometric models per image pair.
         bool multiple_models = false;
 
+        // Whether to estimate the two-view geometry models in an interleaved
+        // schedule with SPRT model verification, which rejects hopeless image
+        // pairs early instead of running all estimations to completion.
+        bool interleaved_verification = false;
+
         // Whether to perform guided matching, if geometric verification succeeds.
         bool guided_matching = false;
 
@@ -79,6 +106,9 @@ namespace bkmap {
             image_t image_id2 = kInvalidImageId;
             FeatureMatches matches;
             TwoViewGeometry two_view_geometry;
+            // Time of the geometric verification in seconds, which is negative
+            // if the two-view geometry was not estimated.
+            double verification_time = -1;
         };
 
     }  // namespace internal
@@ -97,6 +127,12 @@ namespace bkmap {
         FeatureMatches GetMatches(const image_t image_id1, const image_t image_id2);
         std::vector<image_t> GetImageIds() const;
 
+        // Get the nearest neighbor index over the descriptors of an image. The
+        // index is built on first access and then shared by all image pairs the
+        // image takes part in, until it is evicted from the cache.
+        std::shared_ptr<const FeatureDescriptorIndex<>> GetDescriptorIndex(
+                const image_t image_id);
+
         bool ExistsMatches(const image_t image_id1, const image_t image_id2);
         bool ExistsInlierMatches(const image_t image_id1, const image_t image_id2);
 
@@ -112,10 +148,23 @@ namespace bkmap {
         const size_t cache_size_;
         const Database* database_;
         std::mutex database_mutex_;
+        // Read-only connections to load features concurrently with other threads
+        // using the database. Matches are still read through the main connection,
+        // as they are modified within its transaction.
+        std::unique_ptr<DatabaseReaderPool> database_reader_pool_;
         EIGEN_STL_UMAP(camera_t, Camera) cameras_cache_;
         EIGEN_STL_UMAP(image_t, Image) images_cache_;
         std::unique_ptr<LRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
         std::unique_ptr<LRUCache<image_t, FeatureDescriptors>> descriptors_cache_;
+
+        // The descriptor indices are built outside of the lock, so that multiple
+        // matcher threads can build the indices of different images in parallel.
+        std::mutex descriptor_index_mutex_;
+        std::condition_variable descriptor_index_condition_;
+        std::unordered_set<image_t> descriptor_indices_in_progress_;
+        std::unique_ptr<LRUCache<image_t,
+                std::shared_ptr<const FeatureDescriptorIndex<>>>>
+                descriptor_index_cache_;
     };
 
     class FeatureMatcherThread : public Thread {
@@ -143,6 +192,9 @@ namespace bkmap {
     protected:
         void Run() override;
 
+        // Match a batch of image pairs, grouped by the image they share.
+        void MatchBatch(std::vector<Input>* batch);
+
         JobQueue<Input>* input_queue_;
         JobQueue<Output>* output_queue_;
     };
@@ -263,6 +315,11 @@ namespace bkmap {
 
         bool is_setup_;
 
+        // Statistics of the geometric verification over all matched image pairs.
+        size_t num_verified_image_pairs_;
+        double verification_time_;
+        double max_verification_time_;
+
         std::vector<std::unique_ptr<FeatureMatcherThread>> matchers_;
         std::vector<std::unique_ptr<FeatureMatcherThread>> guided_matchers_;
         std::vector<std::unique_ptr<Thread>> verifiers_;
@@ -405,6 +462,16 @@ namespace bkmap {
             // Path to the vocabulary tree.
             std::string vocab_tree_path = ":/media/vocab_tree-65536.bin";
 
+            // Optional path to a persistent visual index of the database images. If
+            // it exists, it is read instead of the vocabulary tree, and the images
+            // that are not indexed yet are appended to it. The index is only valid
+            // for the database it was created from. Retrieved images, which were
+            // deleted from the database, are skipped. Images are never indexed
+            // again, so that the index must be deleted, if the features of
+            // indexed images change, e.g., when modified image files are
+            // extracted again.
+            std::string index_path = "";
+
             // Optional path to file with specific image names to match.
             std::string match_list_path = "";
 
@@ -573,6 +640,41 @@ namespace bkmap {
                               const FeatureDescriptors& descriptors1,
                               const FeatureDescriptors& descriptors2,
                               FeatureMatches* matches);
+
+// Match the given SIFT features on the CPU using the prebuilt descriptor
+// indices of both images, e.g., as returned by FeatureMatcherCache.
+    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                              const FeatureDescriptorIndex<>& index1,
+                              const FeatureDescriptorIndex<>& index2,
+                              FeatureMatches* matches);
+
+// Match the SIFT features of one image against multiple other images on the
+// CPU, where the i-th matches correspond to the i-th image in the batch.
+    void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                              const FeatureDescriptors& descriptors1,
+                              const std::vector<const FeatureDescriptors*>& descriptors2,
+                              std::vector<FeatureMatches>* matches);
+    void MatchSiftFeaturesCPU(
+            const SiftMatchingOptions& match_options,
+            const FeatureDescriptorIndex<>& index1,
+            const std::vector<const FeatureDescriptorIndex<>*>& indices2,
+            std::vector<FeatureMatches>* matches);
+
+// Match the given binary features on the CPU, either exhaustively or with
+// multi-index hashing. The i-th matches correspond to the i-th image in the
+// batch, when matching one image against multiple other images.
+    void MatchBinaryFeaturesCPU(const SiftMatchingOptions& match_options,
+                                const FeatureDescriptors& descriptors1,
+                                const FeatureDescriptors& descriptors2,
+                                FeatureMatches* matches);
+    void MatchBinaryFeaturesCPU(
+            const SiftMatchingOptions& match_options,
+            const FeatureDescriptors& descriptors1,
+            const std::vector<const FeatureDescriptors*>& descriptors2,
+            std::vector<FeatureMatches>* matches);
+
+// Match the given SIFT or binary features on the CPU under the constraint of
+// the estimated two-view geometry.
     void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                                     const FeatureKeypoints& keypoints1,
                                     const FeatureKeypoints& keypoints2,
@@ -0,0 +1,369 @@
+#include "base/feature_store.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/misc.h"
+
+namespace bkmap {
+    namespace {
+
+        const char kMagic[8] = {'B', 'K', 'F', 'S', 'T', 'O', 'R', 'E'};
+        // Version 2 added the records that delete the features of an image.
+        const uint32_t kVersion = 2;
+        const uint32_t kByteOrderMark = 0x01020304;
+
+        const uint64_t kFileHeaderSize = 16;
+        const uint64_t kRecordHeaderSize = 32;
+
+        // Alignment of the records and their data in the file.
+        const uint64_t kAlignment = 16;
+
+        uint64_t AlignSize(const uint64_t size) {
+            return (size + kAlignment - 1) / kAlignment * kAlignment;
+        }
+
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order_mark;
+        };
+
+        struct RecordHeader {
+            uint32_t image_id;
+            uint32_t type;
+            uint64_t rows;
+            uint64_t cols;
+            uint64_t num_bytes;
+        };
+
+        static_assert(sizeof(FileHeader) == kFileHeaderSize,
+                      "Invalid file header size");
+        static_assert(sizeof(RecordHeader) == kRecordHeaderSize,
+                      "Invalid record header size");
+        static_assert(sizeof(FeatureKeypoint) == 4 * sizeof(float),
+                      "Keypoints must be stored as four floats");
+
+    }  // namespace
+
+    FeatureStore::FeatureStore() {}
+
+    FeatureStore::FeatureStore(const std::string& path) : FeatureStore() {
+        Open(path);
+    }
+
+    FeatureStore::~FeatureStore() { Close(); }
+
+    void FeatureStore::Open(const std::string& path) {
+        Close();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // The data is mapped into memory without any conversion.
+        CHECK(IsLittleEndian()) << "Feature store requires little endian";
+
+        path_ = path;
+
+        if (!ExistsFile(path_)) {
+            std::ofstream file(path_, std::ios::binary);
+            CHECK(file.is_open()) << path_;
+            FileHeader header;
+            memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.version = kVersion;
+            header.byte_order_mark = kByteOrderMark;
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+
+        ReadRecordIndex();
+
+        file_.open(path_, std::ios::binary | std::ios::app);
+        CHECK(file_.is_open()) << path_;
+
+        file_mapping_.reset(new boost::interprocess::file_mapping(
+                path_.c_str(), boost::interprocess::read_only));
+    }
+
+    void FeatureStore::Close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        mapped_region_.reset();
+        mapped_size_ = 0;
+        file_mapping_.reset();
+        if (file_.is_open()) {
+            file_.close();
+        }
+        file_size_ = 0;
+        keypoints_index_.clear();
+        descriptors_index_.clear();
+        path_.clear();
+    }
+
+    bool FeatureStore::IsOpen() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return file_mapping_ != nullptr;
+    }
+
+    const std::string& FeatureStore::Path() const { return path_; }
+
+    std::string FeatureStore::DefaultPath(const std::string& database_path) {
+        return database_path + ".features";
+    }
+
+    bool FeatureStore::ExistsKeypoints(const image_t image_id) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return keypoints_index_.count(image_id) > 0;
+    }
+
+    bool FeatureStore::ExistsDescriptors(const image_t image_id) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return descriptors_index_.count(image_id) > 0;
+    }
+
+    std::vector<image_t> FeatureStore::ImageIds() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::vector<image_t> image_ids;
+        image_ids.reserve(keypoints_index_.size());
+        for (const auto& record : keypoints_index_) {
+            image_ids.push_back(record.first);
+        }
+        for (const auto& record : descriptors_index_) {
+            if (keypoints_index_.count(record.first) == 0) {
+                image_ids.push_back(record.first);
+            }
+        }
+        return image_ids;
+    }
+
+    FeatureStore::KeypointsMap FeatureStore::ReadKeypointsMap(
+            const image_t image_id, std::shared_ptr<const void>* mapping) const {
+        Record record;
+        const char* data =
+                GetRecordData(image_id, RecordType::KEYPOINTS, &record, mapping);
+        return KeypointsMap(reinterpret_cast<const float*>(data),
+                            static_cast<Eigen::Index>(record.rows), 4);
+    }
+
+    FeatureStore::DescriptorsMap FeatureStore::ReadDescriptorsMap(
+            const image_t image_id, std::shared_ptr<const void>* mapping) const {
+        Record record;
+        const char* data =
+                GetRecordData(image_id, RecordType::DESCRIPTORS, &record, mapping);
+        return DescriptorsMap(reinterpret_cast<const uint8_t*>(data),
+                              static_cast<Eigen::Index>(record.rows),
+                              static_cast<Eigen::Index>(record.cols));
+    }
+
+    FeatureKeypoints FeatureStore::ReadKeypoints(const image_t image_id) const {
+        std::shared_ptr<const void> mapping;
+        const KeypointsMap keypoints_map = ReadKeypointsMap(image_id, &mapping);
+        FeatureKeypoints keypoints(static_cast<size_t>(keypoints_map.rows()));
+        for (Eigen::Index i = 0; i < keypoints_map.rows(); ++i) {
+            keypoints[i].x = keypoints_map(i, 0);
+            keypoints[i].y = keypoints_map(i, 1);
+            keypoints[i].scale = keypoints_map(i, 2);
+            keypoints[i].orientation = keypoints_map(i, 3);
+        }
+        return keypoints;
+    }
+
+    FeatureDescriptors FeatureStore::ReadDescriptors(const image_t image_id) const {
+        std::shared_ptr<const void> mapping;
+        return ReadDescriptorsMap(image_id, &mapping);
+    }
+
+    void FeatureStore::WriteKeypoints(const image_t image_id,
+                                      const FeatureKeypoints& keypoints) {
+        WriteRecord(image_id, RecordType::KEYPOINTS, keypoints.size(), 4,
+                    reinterpret_cast<const char*>(keypoints.data()),
+                    keypoints.size() * sizeof(FeatureKeypoint));
+    }
+
+    void FeatureStore::WriteDescriptors(const image_t image_id,
+                                        const FeatureDescriptors& descriptors) {
+        WriteRecord(image_id, RecordType::DESCRIPTORS,
+                    static_cast<uint64_t>(descriptors.rows()),
+                    static_cast<uint64_t>(descriptors.cols()),
+                    reinterpret_cast<const char*>(descriptors.data()),
+                    static_cast<uint64_t>(descriptors.size()));
+    }
+
+    void FeatureStore::DeleteFeatures(const image_t image_id) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (keypoints_index_.count(image_id) == 0 &&
+                descriptors_index_.count(image_id) == 0) {
+                return;
+            }
+        }
+
+        WriteRecord(image_id, RecordType::DELETED, 0, 0, nullptr, 0);
+    }
+
+    void FeatureStore::ReadRecordIndex() {
+        std::ifstream file(path_, std::ios::binary);
+        CHECK(file.is_open()) << path_;
+
+        const uint64_t file_size = GetFileSize(path_);
+        CHECK_GE(file_size, kFileHeaderSize) << "Invalid feature store " << path_;
+
+        FileHeader file_header;
+        file.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+        CHECK_EQ(memcmp(file_header.magic, kMagic, sizeof(kMagic)), 0)
+            << "Invalid feature store " << path_;
+        CHECK_GE(file_header.version, 1);
+        CHECK_LE(file_header.version, kVersion)
+            << "Unsupported version of feature store " << path_;
+        CHECK_EQ(file_header.byte_order_mark, kByteOrderMark);
+
+        uint64_t offset = kFileHeaderSize;
+        while (offset + kRecordHeaderSize <= file_size) {
+            RecordHeader record_header;
+            file.seekg(offset);
+            file.read(reinterpret_cast<char*>(&record_header), sizeof(record_header));
+            if (!file) {
+                break;
+            }
+
+            const uint64_t next_offset =
+                    offset + kRecordHeaderSize + AlignSize(record_header.num_bytes);
+            if (next_offset > file_size || record_header.type > 2) {
+                break;
+            }
+
+            if (static_cast<RecordType>(record_header.type) == RecordType::DELETED) {
+                keypoints_index_.erase(record_header.image_id);
+                descriptors_index_.erase(record_header.image_id);
+                offset = next_offset;
+                continue;
+            }
+
+            Record record;
+            record.data_offset = offset + kRecordHeaderSize;
+            record.rows = record_header.rows;
+            record.cols = record_header.cols;
+            GetRecordIndex(static_cast<RecordType>(record_header.type))
+            [record_header.image_id] = record;
+
+            offset = next_offset;
+        }
+
+        file.close();
+
+        // Discard the incomplete record at the end of the file, which is the
+        // result of an interrupted write.
+        if (offset < file_size) {
+            std::cout << "WARNING: Discarding " << file_size - offset
+                      << " bytes of incomplete records in feature store " << path_
+                      << std::endl;
+            boost::filesystem::resize_file(path_, offset);
+        }
+
+        // Upgrade the version of older stores, since they may contain deletions
+        // from now on, which older versions cannot read.
+        if (file_header.version < kVersion) {
+            std::fstream version_file(path_,
+                                      std::ios::binary | std::ios::in | std::ios::out);
+            CHECK(version_file.is_open()) << path_;
+            version_file.seekp(offsetof(FileHeader, version));
+            version_file.write(reinterpret_cast<const char*>(&kVersion),
+                               sizeof(kVersion));
+            CHECK(version_file.good()) << path_;
+        }
+
+        file_size_ = offset;
+    }
+
+    void FeatureStore::WriteRecord(const image_t image_id, const RecordType type,
+                                   const uint64_t rows, const uint64_t cols,
+                                   const char* data, const uint64_t num_bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        CHECK(file_.is_open());
+
+        RecordHeader record_header;
+        record_header.image_id = image_id;
+        record_header.type = static_cast<uint32_t>(type);
+        record_header.rows = rows;
+        record_header.cols = cols;
+        record_header.num_bytes = num_bytes;
+
+        file_.write(reinterpret_cast<const char*>(&record_header),
+                    sizeof(record_header));
+        if (num_bytes > 0) {
+            file_.write(data, num_bytes);
+        }
+
+        const char kPadding[kAlignment] = {0};
+        file_.write(kPadding, AlignSize(num_bytes) - num_bytes);
+
+        // Make the record visible to the memory mapping.
+        file_.flush();
+        CHECK(file_.good()) << path_;
+
+        if (type == RecordType::DELETED) {
+            keypoints_index_.erase(image_id);
+            descriptors_index_.erase(image_id);
+        } else {
+            Record record;
+            record.data_offset = file_size_ + kRecordHeaderSize;
+            record.rows = rows;
+            record.cols = cols;
+            GetRecordIndex(type)[image_id] = record;
+        }
+
+        file_size_ += kRecordHeaderSize + AlignSize(num_bytes);
+    }
+
+    const FeatureStore::RecordIndex& FeatureStore::GetRecordIndex(
+            const RecordType type) const {
+        return type == RecordType::KEYPOINTS ? keypoints_index_ : descriptors_index_;
+    }
+
+    FeatureStore::RecordIndex& FeatureStore::GetRecordIndex(const RecordType type) {
+        return type == RecordType::KEYPOINTS ? keypoints_index_ : descriptors_index_;
+    }
+
+    const char* FeatureStore::GetRecordData(const image_t image_id,
+                                            const RecordType type,
+                                            Record* record,
+                                            std::shared_ptr<const void>* mapping) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        CHECK(file_mapping_) << "Feature store not open";
+
+        const RecordIndex& index = GetRecordIndex(type);
+        const auto record_it = index.find(image_id);
+        CHECK(record_it != index.end())
+        << "Image " << image_id << " not in feature store";
+        *record = record_it->second;
+
+        const uint64_t num_bytes =
+                record->rows * record->cols *
+                (type == RecordType::KEYPOINTS ? sizeof(float) : sizeof(uint8_t));
+        if (num_bytes == 0) {
+            return nullptr;
+        }
+
+        // Replace the region, if the record was appended beyond its end. The
+        // region always covers exactly the current file, since mapping beyond
+        // the end of the file is not portable and accessing such pages faults.
+        if (record->data_offset + num_bytes > mapped_size_) {
+            mapped_region_ = std::make_shared<boost::interprocess::mapped_region>(
+                    *file_mapping_, boost::interprocess::read_only, 0,
+                    static_cast<size_t>(file_size_));
+            mapped_size_ = file_size_;
+        }
+
+        *mapping = mapped_region_;
+
+        return static_cast<const char*>(mapped_region_->get_address()) +
+               record->data_offset;
+    }
+
+}
@@ -0,0 +1,142 @@
+#ifndef BKMAP_FEATURE_STORE_H
+#define BKMAP_FEATURE_STORE_H
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/feature.h"
+#include "util/types.h"
+
+namespace boost {
+    namespace interprocess {
+        class file_mapping;
+        class mapped_region;
+    }  // namespace interprocess
+}  // namespace boost
+
+namespace bkmap {
+
+// Append-only binary store of feature keypoints and descriptors, which is
+// memory-mapped for reading. The store is used as a sidecar of the database to
+// avoid reading the features from the SQLite BLOB columns, and the features
+// can be read without any copy through the `Read*Map` functions.
+//
+// The file starts with a 16 byte header, followed by one record per written
+// keypoints or descriptors. Each record consists of a 32 byte header with the
+// image identifier, the record type, the number of rows and columns, and the
+// number of data bytes, followed by the data padded to 16 bytes. Records of an
+// image supersede previously written records of the same type, and deletion
+// records without data invalidate all previous records of an image. The offset
+// index of the records is built when opening the store, and incomplete records
+// at the end of the file, e.g. after a crash, are discarded.
+//
+// The store is thread-safe. The memory of the maps remains valid as long as
+// the mapping returned with them is alive, even if new records are appended
+// and the file is mapped again in the meantime.
+    class FeatureStore {
+    public:
+        typedef Eigen::Matrix<float, Eigen::Dynamic, 4, Eigen::RowMajor>
+                KeypointsMatrix;
+        typedef Eigen::Map<const KeypointsMatrix> KeypointsMap;
+        typedef Eigen::Map<const FeatureDescriptors> DescriptorsMap;
+
+        FeatureStore();
+        explicit FeatureStore(const std::string& path);
+        ~FeatureStore();
+
+        // Open the store and create it, if it does not exist yet.
+        void Open(const std::string& path);
+        void Close();
+
+        bool IsOpen() const;
+        const std::string& Path() const;
+
+        // The path of the sidecar store of the database at the given path.
+        static std::string DefaultPath(const std::string& database_path);
+
+        bool ExistsKeypoints(const image_t image_id) const;
+        bool ExistsDescriptors(const image_t image_id) const;
+
+        // The identifiers of all images with keypoints or descriptors.
+        std::vector<image_t> ImageIds() const;
+
+        // Read the features of an image without copying the data. The image must
+        // exist in the store, and the returned map must not be used after the
+        // returned mapping is released.
+        KeypointsMap ReadKeypointsMap(
+                const image_t image_id,
+                std::shared_ptr<const void>* mapping) const;
+        DescriptorsMap ReadDescriptorsMap(
+                const image_t image_id,
+                std::shared_ptr<const void>* mapping) const;
+
+        FeatureKeypoints ReadKeypoints(const image_t image_id) const;
+        FeatureDescriptors ReadDescriptors(const image_t image_id) const;
+
+        void WriteKeypoints(const image_t image_id,
+                            const FeatureKeypoints& keypoints);
+        void WriteDescriptors(const image_t image_id,
+                              const FeatureDescriptors& descriptors);
+
+        // Delete the keypoints and descriptors of an image by appending a deletion
+        // record, e.g., because the features are stale. The space of the deleted
+        // records is not reclaimed.
+        void DeleteFeatures(const image_t image_id);
+
+    private:
+        enum class RecordType : uint32_t {
+            KEYPOINTS = 0,
+            DESCRIPTORS = 1,
+            DELETED = 2,
+        };
+
+        struct Record {
+            // Offset of the data from the beginning of the file.
+            uint64_t data_offset = 0;
+            uint64_t rows = 0;
+            uint64_t cols = 0;
+        };
+
+        typedef std::unordered_map<image_t, Record> RecordIndex;
+
+        void ReadRecordIndex();
+        void WriteRecord(const image_t image_id, const RecordType type,
+                         const uint64_t rows, const uint64_t cols,
+                         const char* data, const uint64_t num_bytes);
+
+        const RecordIndex& GetRecordIndex(const RecordType type) const;
+        RecordIndex& GetRecordIndex(const RecordType type);
+
+        // Find the record and return a pointer to its mapped data, which is valid
+        // as long as the returned mapping is alive.
+        const char* GetRecordData(const image_t image_id, const RecordType type,
+                                  Record* record,
+                                  std::shared_ptr<const void>* mapping) const;
+
+        std::string path_;
+
+        mutable std::mutex mutex_;
+
+        std::ofstream file_;
+        uint64_t file_size_ = 0;
+
+        RecordIndex keypoints_index_;
+        RecordIndex descriptors_index_;
+
+        // The region is replaced by a region of the current file size, when
+        // reading data beyond its end. Previous regions are unmapped as soon as
+        // the maps into them are released.
+        std::unique_ptr<boost::interprocess::file_mapping> file_mapping_;
+        mutable std::shared_ptr<boost::interprocess::mapped_region> mapped_region_;
+        mutable uint64_t mapped_size_ = 0;
+    };
+
+}
+
+#endif //BKMAP_FEATURE_STORE_H
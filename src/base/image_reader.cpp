@@ -4,12 +4,59 @@
 
 #include "base/image_reader.h"
 
+#include <fstream>
+#include <unordered_set>
+
+#include <boost/filesystem/operations.hpp>
+
 #include "util/misc.h"
 
 namespace bkmap {
+    namespace {
+
+        // Get the size and modification time of a file without reading it.
+        ImageFile StatImageFile(const std::string& path) {
+            ImageFile image_file;
+            boost::system::error_code error_code;
+            const auto size = boost::filesystem::file_size(path, error_code);
+            if (!error_code) {
+                image_file.size = static_cast<int64_t>(size);
+            }
+            const auto modification_time =
+                    boost::filesystem::last_write_time(path, error_code);
+            if (!error_code) {
+                image_file.modification_time =
+                        static_cast<int64_t>(modification_time);
+            }
+            return image_file;
+        }
+
+        // 64-bit FNV-1a hash of the entire file content in hexadecimal notation.
+        std::string ComputeContentHash(const std::string& path) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.is_open()) {
+                return "";
+            }
+
+            uint64_t hash = 14695981039346656037ULL;
+            std::vector<char> buffer(1 << 20);
+            while (file) {
+                file.read(buffer.data(), buffer.size());
+                const std::streamsize num_bytes = file.gcount();
+                for (std::streamsize i = 0; i < num_bytes; ++i) {
+                    hash ^= static_cast<uint8_t>(buffer[i]);
+                    hash *= 1099511628211ULL;
+                }
+            }
+
+            return StringPrintf("%016llx", static_cast<unsigned long long>(hash));
+        }
+
+    }  // namespace
 
     bool ImageReader::Options::Check() const {
         CHECK_OPTION_GT(default_focal_length_factor, 0.0);
+        CHECK_OPTION_NE(max_image_size, 0);
         const int model_id = CameraModelNameToId(camera_model);
         CHECK_OPTION_NE(model_id, -1);
         if (!camera_params.empty()) {
@@ -37,6 +84,10 @@ namespace bkmap {
             }
         }
 
+        if (options_.check_content_hashes) {
+            ScanImageFiles();
+        }
+
         // Set the manually specified camera parameters.
         prev_camera_.SetCameraId(kInvalidCameraId);
         prev_camera_.SetModelIdFromName(options_.camera_model);
@@ -46,7 +97,7 @@ namespace bkmap {
     }
 
     ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
-                                          Bitmap* bitmap) {
+                                          Bitmap* bitmap, ImageFile* image_file) {
         CHECK_NOTNULL(camera);
         CHECK_NOTNULL(image);
         CHECK_NOTNULL(bitmap);
@@ -56,6 +107,19 @@ namespace bkmap {
 
         const std::string image_path = options_.image_list.at(image_index_ - 1);
 
+        if (image_file != nullptr) {
+            const auto image_file_it = image_files_.find(image_path);
+            if (image_file_it == image_files_.end()) {
+                *image_file = ImageFile();
+            } else {
+                *image_file = image_file_it->second;
+                // New files are only hashed now, right before they are decoded.
+                if (image_file->content_hash.empty()) {
+                    image_file->content_hash = ComputeContentHash(image_path);
+                }
+            }
+        }
+
         DatabaseTransaction database_transaction(database_);
 
         //////////////////////////////////////////////////////////////////////////////
@@ -89,7 +153,14 @@ namespace bkmap {
         // Read image.
         //////////////////////////////////////////////////////////////////////////////
 
-        if (!bitmap->Read(image_path, false)) {
+        // The bitmap might be decoded at a reduced resolution, while the camera
+        // always refers to the original image dimensions.
+        int image_width;
+        int image_height;
+        const int min_image_size =
+                options_.scaled_decoding ? options_.max_image_size : -1;
+        if (!bitmap->ReadScaled(image_path, false, min_image_size, &image_width,
+                                &image_height)) {
             return Status::BITMAP_ERROR;
         }
 
@@ -106,8 +177,8 @@ namespace bkmap {
                 return Status::CAMERA_SINGLE_ERROR;
             }
 
-            if (static_cast<size_t>(bitmap->Width()) != camera.Width() ||
-                static_cast<size_t>(bitmap->Height()) != camera.Height()) {
+            if (static_cast<size_t>(image_width) != camera.Width() ||
+                static_cast<size_t>(image_height) != camera.Height()) {
                 return Status::CAMERA_DIM_ERROR;
             }
         }
@@ -117,13 +188,13 @@ namespace bkmap {
         //////////////////////////////////////////////////////////////////////////////
 
         if (options_.single_camera && prev_camera_.CameraId() != kInvalidCameraId &&
-            (prev_camera_.Width() != static_cast<size_t>(bitmap->Width()) ||
-             prev_camera_.Height() != static_cast<size_t>(bitmap->Height()))) {
+            (prev_camera_.Width() != static_cast<size_t>(image_width) ||
+             prev_camera_.Height() != static_cast<size_t>(image_height))) {
             return Status::CAMERA_SINGLE_ERROR;
         }
 
-        prev_camera_.SetWidth(static_cast<size_t>(bitmap->Width()));
-        prev_camera_.SetHeight(static_cast<size_t>(bitmap->Height()));
+        prev_camera_.SetWidth(static_cast<size_t>(image_width));
+        prev_camera_.SetHeight(static_cast<size_t>(image_height));
 
         //////////////////////////////////////////////////////////////////////////////
         // Extract camera model and focal length
@@ -134,10 +205,14 @@ namespace bkmap {
                 // Extract focal length.
                 double focal_length = 0.0;
                 if (bitmap->ExifFocalLength(&focal_length)) {
+                    // The EXIF focal length is relative to the decoded resolution.
+                    focal_length *=
+                            std::max(image_width, image_height) /
+                            static_cast<double>(std::max(bitmap->Width(), bitmap->Height()));
                     prev_camera_.SetPriorFocalLength(true);
                 } else {
                     focal_length = options_.default_focal_length_factor *
-                                   std::max(bitmap->Width(), bitmap->Height());
+                                   std::max(image_width, image_height);
                     prev_camera_.SetPriorFocalLength(false);
                 }
 
@@ -174,6 +249,178 @@ namespace bkmap {
 
     size_t ImageReader::NextIndex() const { return image_index_; }
 
+    void ImageReader::ScanImageFiles() {
+        Timer timer;
+        timer.Start();
+
+        const std::vector<Image> images = database_->ReadAllImages();
+        const std::unordered_map<image_t, ImageFile> database_image_files =
+                database_->ReadAllImageFiles();
+
+        std::unordered_map<std::string, const Image*> name_to_image;
+        name_to_image.reserve(images.size());
+        for (const auto& image : images) {
+            name_to_image.emplace(image.Name(), &image);
+        }
+
+        std::vector<std::string> image_names(options_.image_list.size());
+        std::unordered_set<std::string> listed_image_names;
+        for (size_t i = 0; i < options_.image_list.size(); ++i) {
+            image_names[i] = StringReplace(options_.image_list[i], "\\", "/");
+            image_names[i] = image_names[i].substr(options_.image_path.size());
+            listed_image_names.insert(image_names[i]);
+        }
+
+        // Images in the database, whose files are not in the image list, are the
+        // candidates for renamed files.
+        std::unordered_multimap<std::string, const Image*> hash_to_unlisted_image;
+        std::unordered_set<int64_t> unlisted_image_sizes;
+        for (const auto& image : images) {
+            if (listed_image_names.count(image.Name()) > 0) {
+                continue;
+            }
+            const auto database_image_file_it =
+                    database_image_files.find(image.ImageId());
+            if (database_image_file_it != database_image_files.end()) {
+                hash_to_unlisted_image.emplace(
+                        database_image_file_it->second.content_hash, &image);
+                unlisted_image_sizes.insert(database_image_file_it->second.size);
+            }
+        }
+
+        // Files of known images are only hashed, if their size or modification
+        // time changed, and files of unknown images only, if they can be renamed
+        // files. The file system accesses are latency bound on network file
+        // systems, so they are performed in parallel.
+        std::vector<ImageFile> image_files(options_.image_list.size());
+        {
+            ThreadPool thread_pool;
+            for (size_t i = 0; i < options_.image_list.size(); ++i) {
+                thread_pool.AddTask([&, i]() {
+                    image_files[i] = StatImageFile(options_.image_list[i]);
+
+                    const auto image_it = name_to_image.find(image_names[i]);
+                    if (image_it == name_to_image.end()) {
+                        if (unlisted_image_sizes.count(image_files[i].size) == 0) {
+                            return;
+                        }
+                    } else {
+                        const auto database_image_file_it =
+                                database_image_files.find(image_it->second->ImageId());
+                        if (database_image_file_it != database_image_files.end() &&
+                            database_image_file_it->second.size == image_files[i].size &&
+                            database_image_file_it->second.modification_time ==
+                            image_files[i].modification_time) {
+                            image_files[i].content_hash =
+                                    database_image_file_it->second.content_hash;
+                            return;
+                        }
+                    }
+
+                    image_files[i].content_hash =
+                            ComputeContentHash(options_.image_list[i]);
+                });
+            }
+            thread_pool.Wait();
+        }
+
+        size_t num_new = 0;
+        size_t num_modified = 0;
+        size_t num_renamed = 0;
+        size_t num_unchanged = 0;
+
+        std::vector<std::string> image_list;
+        image_list.reserve(options_.image_list.size());
+
+        DatabaseTransaction database_transaction(database_);
+
+        for (size_t i = 0; i < options_.image_list.size(); ++i) {
+            const std::string& image_path = options_.image_list[i];
+            const ImageFile& image_file = image_files[i];
+
+            image_t image_id = kInvalidImageId;
+
+            const auto image_it = name_to_image.find(image_names[i]);
+            if (image_it == name_to_image.end()) {
+                // Rename an image, whose file was moved, rather than extracting its
+                // features again.
+                auto range =
+                        hash_to_unlisted_image.equal_range(image_file.content_hash);
+                if (image_file.content_hash.empty()) {
+                    range.first = range.second;
+                }
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (!ExistsFile(
+                            JoinPaths(options_.image_path, it->second->Name()))) {
+                        Image image = *it->second;
+                        image.SetName(image_names[i]);
+                        database_->UpdateImage(image);
+                        database_->UpdateImageFile(image.ImageId(), image_file);
+                        image_id = image.ImageId();
+                        hash_to_unlisted_image.erase(it);
+                        num_renamed += 1;
+                        break;
+                    }
+                }
+
+                if (image_id == kInvalidImageId) {
+                    num_new += 1;
+                    image_files_.emplace(image_path, image_file);
+                    image_list.push_back(image_path);
+                    continue;
+                }
+            } else if (image_file.content_hash.empty()) {
+                // The file cannot be read and the error is reported by `Next`.
+                image_list.push_back(image_path);
+                continue;
+            } else {
+                image_id = image_it->second->ImageId();
+
+                const auto database_image_file_it = database_image_files.find(image_id);
+                if (database_image_file_it == database_image_files.end()) {
+                    // Images from before the content hashes were stored are assumed
+                    // to be unchanged.
+                    database_->UpdateImageFile(image_id, image_file);
+                    num_unchanged += 1;
+                } else if (database_image_file_it->second.content_hash !=
+                           image_file.content_hash) {
+                    database_->DeleteFeatures(image_id);
+                    database_->UpdateImageFile(image_id, image_file);
+                    num_modified += 1;
+                } else {
+                    if (database_image_file_it->second.size != image_file.size ||
+                        database_image_file_it->second.modification_time !=
+                        image_file.modification_time) {
+                        database_->UpdateImageFile(image_id, image_file);
+                    }
+                    num_unchanged += 1;
+                }
+            }
+
+            if (!database_->ExistsKeypoints(image_id) ||
+                !database_->ExistsDescriptors(image_id)) {
+                image_files_.emplace(image_path, image_file);
+                image_list.push_back(image_path);
+            }
+        }
+
+        std::cout << StringPrintf(
+                "Scanned %d image files in %.3fs: %d new, %d modified, %d renamed, "
+                        "%d unchanged, %d to read",
+                options_.image_list.size(), timer.ElapsedSeconds(), num_new,
+                num_modified, num_renamed, num_unchanged, image_list.size())
+                  << std::endl;
+
+        if (num_modified > 0) {
+            std::cout << "WARNING: The features of modified images are extracted "
+                    "again, and persistent visual indices of the database must be "
+                    "deleted, since they still contain the previous features."
+                      << std::endl;
+        }
+
+        options_.image_list = std::move(image_list);
+    }
+
     size_t ImageReader::NumImages() const { return options_.image_list.size(); }
 
 }
\ No newline at end of file
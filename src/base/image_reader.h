@@ -42,6 +42,23 @@ namespace bkmap {
             // value `default_focal_length_factor * max(width, height)`.
             double default_focal_length_factor = 1.2;
 
+            // Whether to decode JPEG images at a reduced scale of 1/2, 1/4 or 1/8,
+            // if the images are not needed at a resolution above `max_image_size`.
+            // The images are decoded once and directly to greyscale. The cameras
+            // are always initialized with the original image dimensions.
+            bool scaled_decoding = true;
+
+            // Maximum image size, at which the images are consumed, or -1 if the
+            // images are needed at their original resolution.
+            int max_image_size = -1;
+
+            // Whether to scan the image files and to compare them against the
+            // content hashes in the database before reading the images. Only new
+            // and modified images are read, the stale features of modified images
+            // are deleted, and renamed images are renamed in the database. Files
+            // with unchanged size and modification time are not read by the scan.
+            bool check_content_hashes = true;
+
             bool Check() const;
         };
 
@@ -57,11 +74,19 @@ namespace bkmap {
 
         explicit ImageReader(const Options& options, Database* database);
 
-        Status Next(Camera* camera, Image* image, Bitmap* bitmap);
+        // Read the next image. If the content hashes are checked, the fingerprint
+        // of the image file is optionally returned, so that it can be stored
+        // together with the image. Otherwise, its content hash is empty.
+        Status Next(Camera* camera, Image* image, Bitmap* bitmap,
+                    ImageFile* image_file = nullptr);
         size_t NextIndex() const;
         size_t NumImages() const;
 
     private:
+        // Compare the image files against the database and remove the unchanged
+        // and renamed images with existing features from the image list.
+        void ScanImageFiles();
+
         // Image reader options.
         Options options_;
         Database* database_;
@@ -69,6 +94,8 @@ namespace bkmap {
         size_t image_index_;
         // Previously processed camera.
         Camera prev_camera_;
+        // Fingerprints of the files in the image list, if they are checked.
+        std::unordered_map<std::string, ImageFile> image_files_;
     };
 
 }
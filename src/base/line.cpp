@@ -16,16 +16,15 @@ namespace bkmap {
                                                 const double min_length) {
         const double min_length_squared = min_length * min_length;
 
-        std::vector<uint8_t> bitmap_data;
-        if (bitmap.IsGrey()) {
-            bitmap_data = bitmap.ConvertToRowMajorArray();
-        } else {
-            const Bitmap bitmap_gray = bitmap.CloneAsGrey();
-            bitmap_data = bitmap_gray.ConvertToRowMajorArray();
+        Bitmap bitmap_gray;
+        if (!bitmap.IsGrey()) {
+            bitmap_gray = bitmap.CloneAsGrey();
         }
 
-        std::vector<double> bitmap_data_double(bitmap_data.begin(),
-                                               bitmap_data.end());
+        const BitmapView view = bitmap.IsGrey() ? bitmap.View() : bitmap_gray.View();
+        std::vector<double> bitmap_data_double(
+                static_cast<size_t>(view.Width()) * view.Height());
+        view.ConvertToRowMajorArray(1.0, bitmap_data_double.data());
 
         int num_segments;
         std::unique_ptr<double> segments_data(lsd(&num_segments,
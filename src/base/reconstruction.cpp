@@ -13,6 +13,7 @@
 #include "estimators/similarity_transform.h"
 #include "optim/loransac.h"
 #include "util/bitmap.h"
+#include "util/bitmap_cache.h"
 #include "util/misc.h"
 
 namespace bkmap {
@@ -1285,8 +1286,9 @@ namespace bkmap {
                                                const std::string& path) {
         const class Image& image = Image(image_id);
 
-        Bitmap bitmap;
-        if (!bitmap.Read(JoinPaths(path, image.Name()))) {
+        const std::shared_ptr<const Bitmap> bitmap =
+                BitmapCache::Global().Read(JoinPaths(path, image.Name()), true);
+        if (!bitmap) {
             return false;
         }
 
@@ -1296,7 +1298,7 @@ namespace bkmap {
                 class Point3D& point3D = Point3D(point2D.Point3DId());
                 if (point3D.Color() == kBlackColor) {
                     BitmapColor<float> color;
-                    if (bitmap.InterpolateBilinear(point2D.X(), point2D.Y(), &color)) {
+                    if (bitmap->InterpolateBilinear(point2D.X(), point2D.Y(), &color)) {
                         const BitmapColor<uint8_t> color_ub = color.Cast<uint8_t>();
                         point3D.SetColor(
                                 Eigen::Vector3ub(color_ub.r, color_ub.g, color_ub.b));
@@ -1316,8 +1318,9 @@ namespace bkmap {
             const class Image& image = Image(reg_image_ids_[i]);
             const std::string image_path = JoinPaths(path, image.Name());
 
-            Bitmap bitmap;
-            if (!bitmap.Read(image_path)) {
+            const std::shared_ptr<const Bitmap> bitmap =
+                    BitmapCache::Global().Read(image_path, true);
+            if (!bitmap) {
                 std::cout << StringPrintf("Could not read image %s at path %s.",
                                           image.Name().c_str(), image_path.c_str())
                 << std::endl;
@@ -1327,7 +1330,7 @@ namespace bkmap {
             for (const Point2D point2D : image.Points2D()) {
                 if (point2D.HasPoint3D()) {
                     BitmapColor<float> color;
-                    if (bitmap.InterpolateBilinear(point2D.X(), point2D.Y(), &color)) {
+                    if (bitmap->InterpolateBilinear(point2D.X(), point2D.Y(), &color)) {
                         if (color_sums.count(point2D.Point3DId())) {
                             Eigen::Vector3d& color_sum = color_sums[point2D.Point3DId()];
                             color_sum(0) += color.r;
@@ -2053,7 +2056,7 @@ namespace bkmap {
 
         const class Image& image = Image(image_id);
         const Point2D& point2D = image.Point2D(point2D_idx);
-        const std::vector<SceneGraph::Correspondence>& corrs =
+        const SceneGraph::CorrespondenceRange corrs =
                 scene_graph_->FindCorrespondences(image_id, point2D_idx);
 
         CHECK(image.IsRegistered());
@@ -2085,7 +2088,7 @@ namespace bkmap {
 
         const class Image& image = Image(image_id);
         const Point2D& point2D = image.Point2D(point2D_idx);
-        const std::vector<SceneGraph::Correspondence>& corrs =
+        const SceneGraph::CorrespondenceRange corrs =
                 scene_graph_->FindCorrespondences(image_id, point2D_idx);
 
         CHECK(image.IsRegistered());
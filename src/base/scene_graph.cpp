@@ -4,6 +4,7 @@
 
 #include "base/scene_graph.h"
 
+#include <algorithm>
 #include <unordered_set>
 
 #include "util/string.h"
@@ -13,30 +14,112 @@ namespace bkmap {
     SceneGraph::SceneGraph() {}
 
     void SceneGraph::Finalize() {
+        if (finalized_) {
+            return;
+        }
+
+        // Count the correspondences per image point, temporarily stored at the
+        // offset of the next image point.
+        for (auto& image : images_) {
+            image.second.point2D_corrs_offsets.assign(image.second.num_points2D + 1, 0);
+        }
+
+        for (const auto& image_pair_matches : image_pair_matches_) {
+            if (image_pair_matches.matches.empty()) {
+                continue;
+            }
+            auto& offsets1 = images_.at(image_pair_matches.image_id1).point2D_corrs_offsets;
+            auto& offsets2 = images_.at(image_pair_matches.image_id2).point2D_corrs_offsets;
+            for (const auto& match : image_pair_matches.matches) {
+                offsets1[match.point2D_idx1 + 1] += 1;
+                offsets2[match.point2D_idx2 + 1] += 1;
+            }
+        }
+
+        // Delete images without observations and compute the offsets of the
+        // remaining images in the correspondence buffer.
+        size_t num_corrs = 0;
         for (auto it = images_.begin(); it != images_.end();) {
-            it->second.num_observations = 0;
-            for (auto& corr : it->second.corrs) {
-                corr.shrink_to_fit();
-                if (corr.size() > 0) {
-                    it->second.num_observations += 1;
+            struct Image& image = it->second;
+            image.num_observations = 0;
+            for (point2D_t point2D_idx = 0; point2D_idx < image.num_points2D;
+                 ++point2D_idx) {
+                if (image.point2D_corrs_offsets[point2D_idx + 1] > 0) {
+                    image.num_observations += 1;
                 }
+                image.point2D_corrs_offsets[point2D_idx + 1] +=
+                        image.point2D_corrs_offsets[point2D_idx];
             }
-            if (it->second.num_observations == 0) {
+
+            if (image.num_observations == 0) {
                 images_.erase(it++);
             } else {
+                image.corrs_offset = num_corrs;
+                num_corrs += image.point2D_corrs_offsets.back();
                 ++it;
             }
         }
+
+        // Fill the correspondence buffer in the order in which the matches were
+        // added, using the offset of each image point as its write position.
+        // Afterwards, the offset of each image point equals the initial offset of
+        // the next image point and the offsets are shifted back.
+        corrs_.clear();
+        corrs_.shrink_to_fit();
+        corrs_.resize(num_corrs);
+
+        for (const auto& image_pair_matches : image_pair_matches_) {
+            if (image_pair_matches.matches.empty()) {
+                continue;
+            }
+            const image_t image_id1 = image_pair_matches.image_id1;
+            const image_t image_id2 = image_pair_matches.image_id2;
+            struct Image& image1 = images_.at(image_id1);
+            struct Image& image2 = images_.at(image_id2);
+            for (const auto& match : image_pair_matches.matches) {
+                corrs_[image1.corrs_offset +
+                       image1.point2D_corrs_offsets[match.point2D_idx1]++] =
+                        Correspondence(image_id2, match.point2D_idx2);
+                corrs_[image2.corrs_offset +
+                       image2.point2D_corrs_offsets[match.point2D_idx2]++] =
+                        Correspondence(image_id1, match.point2D_idx1);
+            }
+        }
+
+        for (auto& image : images_) {
+            auto& offsets = image.second.point2D_corrs_offsets;
+            for (size_t i = offsets.size() - 1; i > 0; --i) {
+                offsets[i] = offsets[i - 1];
+            }
+            offsets[0] = 0;
+        }
+
+        // Build the sorted table of image pairs.
+        image_pairs_.reserve(image_pairs_.size() + image_pair_infos_.size());
+        for (const auto& image_pair_info : image_pair_infos_) {
+            image_pairs_.emplace_back(image_pair_info.first,
+                                      image_pair_info.second.num_correspondences);
+        }
+        std::sort(image_pairs_.begin(), image_pairs_.end());
+
+        std::vector<ImagePairMatches>().swap(image_pair_matches_);
+        std::unordered_map<image_pair_t, ImagePairInfo>().swap(image_pair_infos_);
+
+        finalized_ = true;
     }
 
     void SceneGraph::AddImage(const image_t image_id, const size_t num_points) {
         CHECK(!ExistsImage(image_id));
-        images_[image_id].corrs.resize(num_points);
+        struct Image& image = images_[image_id];
+        image.num_points2D = static_cast<point2D_t>(num_points);
+        image.point2D_corrs_offsets.resize(num_points + 1, 0);
     }
 
     void SceneGraph::AddCorrespondences(const image_t image_id1,
                                         const image_t image_id2,
                                         const FeatureMatches& matches) {
+        CHECK(!finalized_) << "Scene graph already finalized";
+
         // Avoid self-matches - should only happen, if user provides custom matches.
         if (image_id1 == image_id2) {
             std::cout << "WARNING: Cannot use self-matches for image_id=" << image_id1
@@ -54,34 +137,45 @@ namespace bkmap {
 
         const image_pair_t pair_id =
                 Database::ImagePairToPairId(image_id1, image_id2);
-        point2D_t& num_correspondences = image_pairs_[pair_id];
+        ImagePairInfo& image_pair_info = image_pair_infos_[pair_id];
+        point2D_t& num_correspondences = image_pair_info.num_correspondences;
         num_correspondences += static_cast<point2D_t>(matches.size());
 
-        // Store all matches in correspondence graph data structure. This data-
-        // structure uses more memory than storing the raw match matrices, but is
-        // significantly more efficient when updating the correspondences in case an
-        // observation is triangulated.
+        // Mark the image points, which already have a correspondence in the
+        // other image, including the ones from previously added matches.
+        std::vector<bool> has_corr1(image1.num_points2D, false);
+        std::vector<bool> has_corr2(image2.num_points2D, false);
+        for (int64_t idx = image_pair_info.last_matches_idx; idx >= 0;
+             idx = image_pair_matches_[idx].prev_idx) {
+            const ImagePairMatches& prev_matches = image_pair_matches_[idx];
+            const bool swapped = prev_matches.image_id1 != image_id1;
+            for (const auto& match : prev_matches.matches) {
+                has_corr1[swapped ? match.point2D_idx2 : match.point2D_idx1] = true;
+                has_corr2[swapped ? match.point2D_idx1 : match.point2D_idx2] = true;
+            }
+        }
+
+        ImagePairMatches image_pair_matches;
+        image_pair_matches.image_id1 = image_id1;
+        image_pair_matches.image_id2 = image_id2;
+        image_pair_matches.matches.reserve(matches.size());
+        image_pair_matches.prev_idx = image_pair_info.last_matches_idx;
+
+        // Only store the matches here, as the correspondences are packed into the
+        // compressed sparse row layout on finalization. The layout uses less
+        // memory than storing the raw match matrices and is significantly more
+        // efficient when updating the correspondences in case an observation is
+        // triangulated.
         for (size_t i = 0; i < matches.size(); ++i) {
             const point2D_t point2D_idx1 = matches[i].point2D_idx1;
             const point2D_t point2D_idx2 = matches[i].point2D_idx2;
 
-            const bool valid_idx1 = point2D_idx1 < image1.corrs.size();
-            const bool valid_idx2 = point2D_idx2 < image2.corrs.size();
+            const bool valid_idx1 = point2D_idx1 < image1.num_points2D;
+            const bool valid_idx2 = point2D_idx2 < image2.num_points2D;
 
             if (valid_idx1 && valid_idx2) {
-                auto& corrs1 = image1.corrs[point2D_idx1];
-                auto& corrs2 = image2.corrs[point2D_idx2];
-
-                const bool duplicate1 =
-                        std::find_if(corrs1.begin(), corrs1.end(),
-                                     [image_id2](const Correspondence& corr) {
-                                         return corr.image_id == image_id2;
-                                     }) != corrs1.end();
-                const bool duplicate2 =
-                        std::find_if(corrs2.begin(), corrs2.end(),
-                                     [image_id1](const Correspondence& corr) {
-                                         return corr.image_id == image_id1;
-                                     }) != corrs2.end();
+                const bool duplicate1 = has_corr1[point2D_idx1];
+                const bool duplicate2 = has_corr2[point2D_idx2];
 
                 if (duplicate1 || duplicate2) {
                     image1.num_correspondences -= 1;
@@ -94,8 +188,9 @@ namespace bkmap {
                             point2D_idx1, image_id1, point2D_idx2, image_id2)
                     << std::endl;
                 } else {
-                    corrs1.emplace_back(image_id2, point2D_idx2);
-                    corrs2.emplace_back(image_id1, point2D_idx1);
+                    has_corr1[point2D_idx1] = true;
+                    has_corr2[point2D_idx2] = true;
+                    image_pair_matches.matches.push_back(matches[i]);
                 }
             } else {
                 image1.num_correspondences -= 1;
@@ -117,6 +212,10 @@ namespace bkmap {
                 }
             }
         }
+
+        image_pair_info.last_matches_idx =
+                static_cast<int64_t>(image_pair_matches_.size());
+        image_pair_matches_.push_back(std::move(image_pair_matches));
     }
 
     std::vector<SceneGraph::Correspondence>
@@ -124,7 +223,9 @@ namespace bkmap {
                                               const point2D_t point2D_idx,
                                               const size_t transitivity) const {
         if (transitivity == 1) {
-            return FindCorrespondences(image_id, point2D_idx);
+            const CorrespondenceRange corrs =
+                    FindCorrespondences(image_id, point2D_idx);
+            return std::vector<Correspondence>(corrs.begin(), corrs.end());
         }
 
         std::vector<Correspondence> found_corrs;
@@ -146,9 +247,8 @@ namespace bkmap {
             for (size_t i = corr_queue_begin; i < corr_queue_end; ++i) {
                 const Correspondence ref_corr = found_corrs[i];
 
-                const Image& image = images_.at(ref_corr.image_id);
-                const std::vector<Correspondence>& ref_corrs =
-                        image.corrs[ref_corr.point2D_idx];
+                const CorrespondenceRange ref_corrs =
+                        FindCorrespondences(ref_corr.image_id, ref_corr.point2D_idx);
 
                 for (const Correspondence corr : ref_corrs) {
                     // Check if correspondence already collected, otherwise collect.
@@ -184,10 +284,18 @@ namespace bkmap {
     SceneGraph::FindCorrespondencesBetweenImages(const image_t image_id1,
                                                  const image_t image_id2) const {
         std::vector<std::pair<point2D_t, point2D_t>> found_corrs;
+        const point2D_t num_corrs =
+                NumCorrespondencesBetweenImages(image_id1, image_id2);
+        if (num_corrs == 0) {
+            return found_corrs;
+        }
+        found_corrs.reserve(num_corrs);
+
         const struct Image& image1 = images_.at(image_id1);
-        for (point2D_t point2D_idx1 = 0; point2D_idx1 < image1.corrs.size();
+        for (point2D_t point2D_idx1 = 0; point2D_idx1 < image1.num_points2D;
              ++point2D_idx1) {
-            for (const Correspondence& corr1 : image1.corrs[point2D_idx1]) {
+            for (const Correspondence& corr1 :
+                    FindCorrespondences(image_id1, point2D_idx1)) {
                 if (corr1.image_id == image_id2) {
                     found_corrs.emplace_back(point2D_idx1, corr1.point2D_idx);
                 }
@@ -198,15 +306,12 @@ namespace bkmap {
 
     bool SceneGraph::IsTwoViewObservation(const image_t image_id,
                                           const point2D_t point2D_idx) const {
-        const struct Image& image = images_.at(image_id);
-        const std::vector<Correspondence>& corrs = image.corrs.at(point2D_idx);
+        const CorrespondenceRange corrs = FindCorrespondences(image_id, point2D_idx);
         if (corrs.size() != 1) {
             return false;
         }
-        const struct Image& other_image = images_.at(corrs[0].image_id);
-        const std::vector<Correspondence>& other_corrs =
-                other_image.corrs.at(corrs[0].point2D_idx);
-        return other_corrs.size() == 1;
+        return FindCorrespondences(corrs[0].image_id, corrs[0].point2D_idx).size() ==
+               1;
     }
 
-}
\ No newline at end of file
+}
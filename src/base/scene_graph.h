@@ -5,7 +5,9 @@
 #ifndef BKMAP_SCENE_GRAPH_H
 #define BKMAP_SCENE_GRAPH_H
 
+#include <algorithm>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "base/database.h"
@@ -15,6 +17,13 @@ namespace bkmap {
 
 // Scene graph represents the graph of image to image and feature to feature
 // correspondences of a dataset. It should be accessed from the DatabaseCache.
+//
+// The graph is built by adding images and correspondences, and then frozen by
+// `Finalize` into a compressed sparse row layout: the correspondences of all
+// image points are stored in one contiguous buffer, indexed by per-image offset
+// arrays, and the number of correspondences between image pairs is stored in a
+// table sorted by pair identifier. The correspondences can only be queried
+// after finalization.
     class SceneGraph {
     public:
         struct Correspondence {
@@ -30,6 +39,27 @@ namespace bkmap {
             point2D_t point2D_idx;
         };
 
+        // Contiguous range of the correspondences of an image point, which remains
+        // valid as long as the scene graph is not modified.
+        class CorrespondenceRange {
+        public:
+            CorrespondenceRange(const Correspondence* begin,
+                                const Correspondence* end)
+                    : begin_(begin), end_(end) {}
+
+            const Correspondence* begin() const { return begin_; }
+            const Correspondence* end() const { return end_; }
+            size_t size() const { return static_cast<size_t>(end_ - begin_); }
+            bool empty() const { return begin_ == end_; }
+            const Correspondence& operator[](const size_t idx) const {
+                return begin_[idx];
+            }
+
+        private:
+            const Correspondence* begin_;
+            const Correspondence* end_;
+        };
+
         SceneGraph();
 
         // Number of added images.
@@ -49,8 +79,9 @@ namespace bkmap {
         inline point2D_t NumCorrespondencesBetweenImages(
                 const image_t image_id1, const image_t image_id2) const;
 
-        // Get the number of correspondences between all images.
-        inline const std::unordered_map<image_pair_t, point2D_t>&
+        // Get the number of correspondences between all images, sorted by the
+        // pair identifier.
+        inline const std::vector<std::pair<image_pair_t, point2D_t>>&
                 NumCorrespondencesBetweenImages() const;
 
         // Finalize the database manager.
@@ -58,7 +89,8 @@ namespace bkmap {
         // - Calculates the number of observations per image by counting the number
         //   of image points that have at least one correspondence.
         // - Deletes images without observations, as they are useless for SfM.
-        // - Shrinks the correspondence vectors to their size to save memory.
+        // - Packs all correspondences into the compressed sparse row layout and
+        //   releases the memory of the added matches.
         void Finalize();
 
         // Add new image to the scene graph.
@@ -67,12 +99,13 @@ namespace bkmap {
         // Add matches between images. This function ignores invalid correspondences
         // where the point indices are out of bounds or duplicate correspondences
         // between the same image points. Whenever either of the two cases occur
-        // this function prints a warning to the standard output.
+        // this function prints a warning to the standard output. Correspondences
+        // cannot be added after finalization.
         void AddCorrespondences(const image_t image_id1, const image_t image_id2,
                                 const FeatureMatches& matches);
 
         // Find the correspondence of an image point to any other image.
-        inline const std::vector<Correspondence>& FindCorrespondences(
+        inline CorrespondenceRange FindCorrespondences(
                 const image_t image_id, const point2D_t point2D_idx) const;
 
         // Find correspondences to the given observation.
@@ -110,15 +143,49 @@ namespace bkmap {
             // to find a good initial pair, that is connected to many images.
             point2D_t num_correspondences = 0;
 
-            // Correspondences to other images per image point.
-            std::vector<std::vector<Correspondence>> corrs;
+            // Number of 2D points in the image.
+            point2D_t num_points2D = 0;
+
+            // Offset of the first correspondence of the image in the buffer.
+            size_t corrs_offset = 0;
+
+            // Offsets of the correspondences per image point relative to the offset
+            // of the image, with `num_points2D + 1` entries after finalization.
+            std::vector<point2D_t> point2D_corrs_offsets;
+        };
+
+        // Matches added between a pair of images, which are packed into the
+        // correspondence buffer on finalization.
+        struct ImagePairMatches {
+            image_t image_id1 = kInvalidImageId;
+            image_t image_id2 = kInvalidImageId;
+            FeatureMatches matches;
+
+            // Index of the previously added matches of the same image pair or -1.
+            int64_t prev_idx = -1;
+        };
+
+        struct ImagePairInfo {
+            point2D_t num_correspondences = 0;
+
+            // Index of the last added matches of the image pair.
+            int64_t last_matches_idx = -1;
         };
 
         // The nodes of the scene graph are images.
         EIGEN_STL_UMAP(image_t, Image) images_;
 
+        // The correspondences of all image points of all images.
+        std::vector<Correspondence> corrs_;
+
         // The number of correspondences between pairs of images.
-        std::unordered_map<image_pair_t, point2D_t> image_pairs_;
+        std::vector<std::pair<image_pair_t, point2D_t>> image_pairs_;
+
+        // The matches and image pairs added before finalization.
+        std::vector<ImagePairMatches> image_pair_matches_;
+        std::unordered_map<image_pair_t, ImagePairInfo> image_pair_infos_;
+
+        bool finalized_ = false;
     };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -143,27 +210,35 @@ namespace bkmap {
             const image_t image_id1, const image_t image_id2) const {
         const image_pair_t pair_id =
                 Database::ImagePairToPairId(image_id1, image_id2);
-        const auto it = image_pairs_.find(pair_id);
-        if (it == image_pairs_.end()) {
+        const auto it = std::lower_bound(
+                image_pairs_.begin(), image_pairs_.end(), pair_id,
+                [](const std::pair<image_pair_t, point2D_t>& image_pair,
+                   const image_pair_t pair_id) { return image_pair.first < pair_id; });
+        if (it == image_pairs_.end() || it->first != pair_id) {
             return 0;
         } else {
-            return static_cast<point2D_t>(it->second);
+            return it->second;
         }
     }
 
-    inline const std::unordered_map<image_pair_t, point2D_t>&
+    const std::vector<std::pair<image_pair_t, point2D_t>>&
     SceneGraph::NumCorrespondencesBetweenImages() const {
         return image_pairs_;
     }
 
-    const std::vector<SceneGraph::Correspondence>& SceneGraph::FindCorrespondences(
+    SceneGraph::CorrespondenceRange SceneGraph::FindCorrespondences(
             const image_t image_id, const point2D_t point2D_idx) const {
-        return images_.at(image_id).corrs.at(point2D_idx);
+        const struct Image& image = images_.at(image_id);
+        CHECK_LT(point2D_idx, image.num_points2D);
+        const Correspondence* corrs = corrs_.data() + image.corrs_offset;
+        return CorrespondenceRange(
+                corrs + image.point2D_corrs_offsets[point2D_idx],
+                corrs + image.point2D_corrs_offsets[point2D_idx + 1]);
     }
 
     bool SceneGraph::HasCorrespondences(const image_t image_id,
                                         const point2D_t point2D_idx) const {
-        return !images_.at(image_id).corrs.at(point2D_idx).empty();
+        return !FindCorrespondences(image_id, point2D_idx).empty();
     }
 
 }
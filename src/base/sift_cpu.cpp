@@ -0,0 +1,1001 @@
+#include "base/sift_cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "ext/VLFeat/generic.h"
+#include "ext/VLFeat/mathop.h"
+#include "util/logging.h"
+
+namespace bkmap {
+    namespace {
+
+        // Number of orientation and spatial bins of the SIFT descriptor.
+        const int kNumOrientationBins = 8;
+        const int kNumSpatialBins = 4;
+        const int kDescDim =
+                kNumOrientationBins * kNumSpatialBins * kNumSpatialBins;
+
+        // Keypoints are refined for at most this number of iterations.
+        const int kMaxNumRefinementIterations = 5;
+
+#if defined(__AVX2__)
+
+        typedef __m256 FloatVec;
+        typedef __m256 MaskVec;
+
+        const int kVecSize = 8;
+
+        inline FloatVec LoadVec(const float* ptr) { return _mm256_loadu_ps(ptr); }
+        inline void StoreVec(float* ptr, const FloatVec a) { _mm256_storeu_ps(ptr, a); }
+        inline FloatVec SetVec(const float value) { return _mm256_set1_ps(value); }
+        inline FloatVec IotaVec() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+
+        inline FloatVec AddVec(const FloatVec a, const FloatVec b) { return _mm256_add_ps(a, b); }
+        inline FloatVec SubVec(const FloatVec a, const FloatVec b) { return _mm256_sub_ps(a, b); }
+        inline FloatVec MulVec(const FloatVec a, const FloatVec b) { return _mm256_mul_ps(a, b); }
+        inline FloatVec DivVec(const FloatVec a, const FloatVec b) { return _mm256_div_ps(a, b); }
+        inline FloatVec MinVec(const FloatVec a, const FloatVec b) { return _mm256_min_ps(a, b); }
+        inline FloatVec MaxVec(const FloatVec a, const FloatVec b) { return _mm256_max_ps(a, b); }
+        inline FloatVec AbsVec(const FloatVec a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+        inline FloatVec RsqrtVec(const FloatVec a) { return _mm256_rsqrt_ps(a); }
+        inline FloatVec RoundVec(const FloatVec a) {
+            return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        }
+
+        // Computes a * b + c.
+        inline FloatVec MulAddVec(const FloatVec a, const FloatVec b, const FloatVec c) {
+#if defined(__FMA__)
+            return _mm256_fmadd_ps(a, b, c);
+#else
+            return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+        }
+
+        // Computes 2^n for integral n.
+        inline FloatVec Pow2Vec(const FloatVec n) {
+            return _mm256_castsi256_ps(_mm256_slli_epi32(
+                    _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+        }
+
+        inline MaskVec GreaterVec(const FloatVec a, const FloatVec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        inline MaskVec GreaterEqualVec(const FloatVec a, const FloatVec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+        inline MaskVec LessVec(const FloatVec a, const FloatVec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        inline MaskVec LessEqualVec(const FloatVec a, const FloatVec b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        inline int MaskBits(const MaskVec mask) { return _mm256_movemask_ps(mask); }
+
+        // Selects the elements of a where the mask is set and of b otherwise.
+        inline FloatVec SelectVec(const MaskVec mask, const FloatVec a, const FloatVec b) {
+            return _mm256_blendv_ps(b, a, mask);
+        }
+
+        // Stores the elements a0, b0, a1, b1, ... to the memory.
+        inline void StoreInterleavedVec(float* ptr, const FloatVec a, const FloatVec b) {
+            const __m256 lo = _mm256_unpacklo_ps(a, b);
+            const __m256 hi = _mm256_unpackhi_ps(a, b);
+            _mm256_storeu_ps(ptr, _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(ptr + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+
+        // Loads the elements a0, b0, a1, b1, ... from the memory.
+        inline void LoadInterleavedVec(const float* ptr, FloatVec* a, FloatVec* b) {
+            const __m256 v0 = _mm256_loadu_ps(ptr);
+            const __m256 v1 = _mm256_loadu_ps(ptr + 8);
+            const __m256 lo = _mm256_permute2f128_ps(v0, v1, 0x20);
+            const __m256 hi = _mm256_permute2f128_ps(v0, v1, 0x31);
+            *a = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+            *b = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+
+#elif defined(__SSE2__)
+
+        typedef __m128 FloatVec;
+        typedef __m128 MaskVec;
+
+        const int kVecSize = 4;
+
+        inline FloatVec LoadVec(const float* ptr) { return _mm_loadu_ps(ptr); }
+        inline void StoreVec(float* ptr, const FloatVec a) { _mm_storeu_ps(ptr, a); }
+        inline FloatVec SetVec(const float value) { return _mm_set1_ps(value); }
+        inline FloatVec IotaVec() { return _mm_setr_ps(0, 1, 2, 3); }
+
+        inline FloatVec AddVec(const FloatVec a, const FloatVec b) { return _mm_add_ps(a, b); }
+        inline FloatVec SubVec(const FloatVec a, const FloatVec b) { return _mm_sub_ps(a, b); }
+        inline FloatVec MulVec(const FloatVec a, const FloatVec b) { return _mm_mul_ps(a, b); }
+        inline FloatVec DivVec(const FloatVec a, const FloatVec b) { return _mm_div_ps(a, b); }
+        inline FloatVec MinVec(const FloatVec a, const FloatVec b) { return _mm_min_ps(a, b); }
+        inline FloatVec MaxVec(const FloatVec a, const FloatVec b) { return _mm_max_ps(a, b); }
+        inline FloatVec AbsVec(const FloatVec a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+        inline FloatVec RsqrtVec(const FloatVec a) { return _mm_rsqrt_ps(a); }
+        inline FloatVec RoundVec(const FloatVec a) {
+#if defined(__SSE4_1__)
+            return _mm_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+#else
+            return _mm_cvtepi32_ps(_mm_cvtps_epi32(a));
+#endif
+        }
+
+        // Computes a * b + c.
+        inline FloatVec MulAddVec(const FloatVec a, const FloatVec b, const FloatVec c) {
+            return _mm_add_ps(_mm_mul_ps(a, b), c);
+        }
+
+        // Computes 2^n for integral n.
+        inline FloatVec Pow2Vec(const FloatVec n) {
+            return _mm_castsi128_ps(_mm_slli_epi32(
+                    _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+        }
+
+        inline MaskVec GreaterVec(const FloatVec a, const FloatVec b) { return _mm_cmpgt_ps(a, b); }
+        inline MaskVec GreaterEqualVec(const FloatVec a, const FloatVec b) { return _mm_cmpge_ps(a, b); }
+        inline MaskVec LessVec(const FloatVec a, const FloatVec b) { return _mm_cmplt_ps(a, b); }
+        inline MaskVec LessEqualVec(const FloatVec a, const FloatVec b) { return _mm_cmple_ps(a, b); }
+        inline int MaskBits(const MaskVec mask) { return _mm_movemask_ps(mask); }
+
+        // Selects the elements of a where the mask is set and of b otherwise.
+        inline FloatVec SelectVec(const MaskVec mask, const FloatVec a, const FloatVec b) {
+#if defined(__SSE4_1__)
+            return _mm_blendv_ps(b, a, mask);
+#else
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+#endif
+        }
+
+        // Stores the elements a0, b0, a1, b1, ... to the memory.
+        inline void StoreInterleavedVec(float* ptr, const FloatVec a, const FloatVec b) {
+            _mm_storeu_ps(ptr, _mm_unpacklo_ps(a, b));
+            _mm_storeu_ps(ptr + 4, _mm_unpackhi_ps(a, b));
+        }
+
+        // Loads the elements a0, b0, a1, b1, ... from the memory.
+        inline void LoadInterleavedVec(const float* ptr, FloatVec* a, FloatVec* b) {
+            const __m128 v0 = _mm_loadu_ps(ptr);
+            const __m128 v1 = _mm_loadu_ps(ptr + 4);
+            *a = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(2, 0, 2, 0));
+            *b = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+
+#else
+
+        typedef float FloatVec;
+        typedef bool MaskVec;
+
+        const int kVecSize = 1;
+
+        inline FloatVec LoadVec(const float* ptr) { return *ptr; }
+        inline void StoreVec(float* ptr, const FloatVec a) { *ptr = a; }
+        inline FloatVec SetVec(const float value) { return value; }
+        inline FloatVec IotaVec() { return 0; }
+
+        inline FloatVec AddVec(const FloatVec a, const FloatVec b) { return a + b; }
+        inline FloatVec SubVec(const FloatVec a, const FloatVec b) { return a - b; }
+        inline FloatVec MulVec(const FloatVec a, const FloatVec b) { return a * b; }
+        inline FloatVec DivVec(const FloatVec a, const FloatVec b) { return a / b; }
+        inline FloatVec MinVec(const FloatVec a, const FloatVec b) { return std::min(a, b); }
+        inline FloatVec MaxVec(const FloatVec a, const FloatVec b) { return std::max(a, b); }
+        inline FloatVec AbsVec(const FloatVec a) { return std::abs(a); }
+        inline FloatVec RsqrtVec(const FloatVec a) { return 1.0f / std::sqrt(a); }
+        inline FloatVec RoundVec(const FloatVec a) { return std::round(a); }
+
+        // Computes a * b + c.
+        inline FloatVec MulAddVec(const FloatVec a, const FloatVec b, const FloatVec c) {
+            return a * b + c;
+        }
+
+        // Computes 2^n for integral n.
+        inline FloatVec Pow2Vec(const FloatVec n) {
+            return std::ldexp(1.0f, static_cast<int>(n));
+        }
+
+        inline MaskVec GreaterVec(const FloatVec a, const FloatVec b) { return a > b; }
+        inline MaskVec GreaterEqualVec(const FloatVec a, const FloatVec b) { return a >= b; }
+        inline MaskVec LessVec(const FloatVec a, const FloatVec b) { return a < b; }
+        inline MaskVec LessEqualVec(const FloatVec a, const FloatVec b) { return a <= b; }
+        inline int MaskBits(const MaskVec mask) { return mask ? 1 : 0; }
+
+        // Selects the elements of a where the mask is set and of b otherwise.
+        inline FloatVec SelectVec(const MaskVec mask, const FloatVec a, const FloatVec b) {
+            return mask ? a : b;
+        }
+
+        // Stores the elements a0, b0, a1, b1, ... to the memory.
+        inline void StoreInterleavedVec(float* ptr, const FloatVec a, const FloatVec b) {
+            ptr[0] = a;
+            ptr[1] = b;
+        }
+
+        // Loads the elements a0, b0, a1, b1, ... from the memory.
+        inline void LoadInterleavedVec(const float* ptr, FloatVec* a, FloatVec* b) {
+            *a = ptr[0];
+            *b = ptr[1];
+        }
+
+#endif
+
+        // Vectorized version of `vl_fast_sqrt_f`.
+        inline FloatVec FastSqrtVec(const FloatVec x) {
+            FloatVec r = RsqrtVec(x);
+            // Refine the approximate reciprocal square root by a Newton step.
+            r = MulVec(r, SubVec(SetVec(1.5f),
+                                 MulVec(MulVec(SetVec(0.5f), x), MulVec(r, r))));
+            return SelectVec(LessVec(x, SetVec(1e-8f)), SetVec(0.0f), MulVec(x, r));
+        }
+
+        // Wraps angles in the range [-2 * pi, 4 * pi] to [0, 2 * pi].
+        inline FloatVec Mod2PiVec(const FloatVec x) {
+            const FloatVec two_pi = SetVec(static_cast<float>(2 * VL_PI));
+            const FloatVec y = SelectVec(LessVec(x, SetVec(0.0f)), AddVec(x, two_pi), x);
+            return SelectVec(GreaterVec(y, two_pi), SubVec(y, two_pi), y);
+        }
+
+        // Vectorized version of `vl_mod_2pi_f(vl_fast_atan2_f(y, x) + 2 * pi)`.
+        inline FloatVec FastAtan2Vec(const FloatVec y, const FloatVec x) {
+            const FloatVec abs_y = AddVec(AbsVec(y), SetVec(VL_EPSILON_F));
+            const MaskVec x_nonnegative = GreaterEqualVec(x, SetVec(0.0f));
+            const FloatVec r =
+                    DivVec(SelectVec(x_nonnegative, SubVec(x, abs_y), AddVec(x, abs_y)),
+                           SelectVec(x_nonnegative, AddVec(x, abs_y), SubVec(abs_y, x)));
+            FloatVec angle = SelectVec(x_nonnegative,
+                                       SetVec(static_cast<float>(VL_PI / 4)),
+                                       SetVec(static_cast<float>(3 * VL_PI / 4)));
+            angle = MulAddVec(MulAddVec(SetVec(0.1821f), MulVec(r, r), SetVec(-0.9675f)),
+                              r, angle);
+            angle = SelectVec(LessVec(y, SetVec(0.0f)), SubVec(SetVec(0.0f), angle), angle);
+            return Mod2PiVec(AddVec(angle, SetVec(static_cast<float>(2 * VL_PI))));
+        }
+
+        // Computes exp(-x) for x >= 0, which is zero for x > 25 as the table based
+        // approximation in VLFeat. The exponential is evaluated by range reduction
+        // and a polynomial approximation of the remainder.
+        inline FloatVec ExpNegVec(const FloatVec x) {
+            const FloatVec max_x = SetVec(25.0f);
+            const FloatVec y = SubVec(SetVec(0.0f), MinVec(x, max_x));
+            const FloatVec n = RoundVec(MulVec(y, SetVec(1.44269504088896341f)));
+            FloatVec r = MulAddVec(n, SetVec(-0.693359375f), y);
+            r = MulAddVec(n, SetVec(2.12194440e-4f), r);
+            FloatVec p = SetVec(1.9875691500e-4f);
+            p = MulAddVec(p, r, SetVec(1.3981999507e-3f));
+            p = MulAddVec(p, r, SetVec(8.3334519073e-3f));
+            p = MulAddVec(p, r, SetVec(4.1665795894e-2f));
+            p = MulAddVec(p, r, SetVec(1.6666665459e-1f));
+            p = MulAddVec(p, r, SetVec(5.0000001201e-1f));
+            p = AddVec(MulAddVec(p, MulVec(r, r), r), SetVec(1.0f));
+            return SelectVec(GreaterVec(x, max_x), SetVec(0.0f), MulVec(p, Pow2Vec(n)));
+        }
+
+        // Equivalent to `copy_and_upsample_rows` applied twice in VLFeat, which
+        // upsamples the image by a factor of two using linear interpolation.
+        void UpsampleImage(const float* image, const int width, const int height,
+                           float* output) {
+            const int output_width = 2 * width;
+            for (int y = 0; y < height; ++y) {
+                const float* src = image + y * width;
+                float* dst = output + 2 * y * output_width;
+                for (int x = 0; x < width - 1; ++x) {
+                    dst[2 * x] = src[x];
+                    dst[2 * x + 1] = 0.5 * (src[x] + src[x + 1]);
+                }
+                dst[output_width - 2] = src[width - 1];
+                dst[output_width - 1] = src[width - 1];
+            }
+
+            for (int y = 0; y < height; ++y) {
+                const float* src0 = output + 2 * y * output_width;
+                const float* src1 = y < height - 1 ? src0 + 2 * output_width : src0;
+                float* dst = output + (2 * y + 1) * output_width;
+                if (y < height - 1) {
+                    for (int x = 0; x < output_width; ++x) {
+                        dst[x] = 0.5 * (src0[x] + src1[x]);
+                    }
+                } else {
+                    std::copy(src0, src0 + output_width, dst);
+                }
+            }
+        }
+
+        // Equivalent to `copy_and_downsample` in VLFeat, which downsamples the
+        // image by a factor of 2^num_octaves.
+        void DownsampleImage(const float* image, const int width, const int height,
+                             const int num_octaves, float* output) {
+            const int step = 1 << num_octaves;
+            for (int y = 0; y < height; y += step) {
+                const float* src = image + y * width;
+                for (int x = 0; x < width - (step - 1); x += step) {
+                    *output++ = src[x];
+                }
+            }
+        }
+
+        // Computes the normalized Gaussian filter in the same way as VLFeat.
+        std::vector<float> CreateGaussianFilter(const double sigma) {
+            const int radius = std::max(static_cast<int>(std::ceil(4.0 * sigma)), 1);
+            std::vector<float> filter(2 * radius + 1);
+            float sum = 0;
+            for (int j = 0; j < 2 * radius + 1; ++j) {
+                const float d = static_cast<float>(j - radius) / static_cast<float>(sigma);
+                filter[j] = static_cast<float>(std::exp(-0.5 * (d * d)));
+                sum += filter[j];
+            }
+            for (auto& value : filter) {
+                value /= sum;
+            }
+            return filter;
+        }
+
+        // Smooths the image with a separable Gaussian filter, where the image is
+        // padded by continuity. In contrast to VLFeat, the image is never
+        // transposed and both filter passes are vectorized along the rows.
+        // The image and output buffer may be the same.
+        void SmoothImage(const float* image, const int width, const int height,
+                         const double sigma, float* temp, float* output) {
+            const std::vector<float> filter = CreateGaussianFilter(sigma);
+            const int filter_size = static_cast<int>(filter.size());
+            const int radius = (filter_size - 1) / 2;
+
+            // Filter the columns of the image.
+            std::vector<const float*> rows(filter_size);
+            for (int y = 0; y < height; ++y) {
+                for (int j = 0; j < filter_size; ++j) {
+                    const int row = std::min(std::max(y + j - radius, 0), height - 1);
+                    rows[j] = image + row * width;
+                }
+
+                float* dst = temp + y * width;
+                int x = 0;
+                for (; x + kVecSize <= width; x += kVecSize) {
+                    FloatVec sum = SetVec(0.0f);
+                    for (int j = 0; j < filter_size; ++j) {
+                        sum = MulAddVec(SetVec(filter[j]), LoadVec(rows[j] + x), sum);
+                    }
+                    StoreVec(dst + x, sum);
+                }
+                for (; x < width; ++x) {
+                    float sum = 0;
+                    for (int j = 0; j < filter_size; ++j) {
+                        sum += filter[j] * rows[j][x];
+                    }
+                    dst[x] = sum;
+                }
+            }
+
+            // Filter the rows of the image, which are padded to avoid boundary checks.
+            std::vector<float> padded_row(width + 2 * radius);
+            for (int y = 0; y < height; ++y) {
+                const float* src = temp + y * width;
+                std::fill(padded_row.begin(), padded_row.begin() + radius, src[0]);
+                std::copy(src, src + width, padded_row.begin() + radius);
+                std::fill(padded_row.begin() + radius + width, padded_row.end(),
+                          src[width - 1]);
+
+                float* dst = output + y * width;
+                int x = 0;
+                for (; x + kVecSize <= width; x += kVecSize) {
+                    FloatVec sum = SetVec(0.0f);
+                    for (int j = 0; j < filter_size; ++j) {
+                        sum = MulAddVec(SetVec(filter[j]),
+                                        LoadVec(padded_row.data() + x + j), sum);
+                    }
+                    StoreVec(dst + x, sum);
+                }
+                for (; x < width; ++x) {
+                    float sum = 0;
+                    for (int j = 0; j < filter_size; ++j) {
+                        sum += filter[j] * padded_row[x + j];
+                    }
+                    dst[x] = sum;
+                }
+            }
+        }
+
+        // Computes the remaining levels of the current octave from its first level.
+        void ProcessSiftOctaveLevels(VlSiftFilt* sift) {
+            const int width = sift->octave_width;
+            const int height = sift->octave_height;
+            for (int s = sift->s_min + 1; s <= sift->s_max; ++s) {
+                const double sigma = sift->dsigma0 * std::pow(sift->sigmak, s);
+                SmoothImage(vl_sift_get_octave(sift, s - 1), width, height, sigma,
+                            sift->temp, vl_sift_get_octave(sift, s));
+            }
+        }
+
+        void AddSiftKeypoint(VlSiftFilt* sift, const int x, const int y,
+                             const int s) {
+            if (sift->nkeys >= sift->keys_res) {
+                sift->keys_res += 500;
+                const size_t num_bytes = sift->keys_res * sizeof(VlSiftKeypoint);
+                if (sift->keys) {
+                    sift->keys = static_cast<VlSiftKeypoint*>(
+                            vl_realloc(sift->keys, num_bytes));
+                } else {
+                    sift->keys = static_cast<VlSiftKeypoint*>(vl_malloc(num_bytes));
+                }
+            }
+
+            VlSiftKeypoint* keypoint = sift->keys + sift->nkeys;
+            keypoint->ix = x;
+            keypoint->iy = y;
+            keypoint->is = s;
+            sift->nkeys += 1;
+        }
+
+        // Scalar check for a local extremum of the DoG at the given pointer, with
+        // the same semantics as the vectorized check in DetectSiftKeypoints.
+        bool IsSiftExtremum(const float* dog, const int width, const int level_size,
+                            const float threshold) {
+            const float value = *dog;
+            const bool maybe_max = value >= threshold;
+            const bool maybe_min = value <= -threshold;
+            if (!maybe_max && !maybe_min) {
+                return false;
+            }
+
+            bool is_max = maybe_max;
+            bool is_min = maybe_min;
+            for (int ds = -1; ds <= 1; ++ds) {
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        if (ds == 0 && dy == 0 && dx == 0) {
+                            continue;
+                        }
+                        const float neighbor = dog[ds * level_size + dy * width + dx];
+                        is_max = is_max && value > neighbor;
+                        is_min = is_min && value < neighbor;
+                    }
+                }
+            }
+
+            return is_max || is_min;
+        }
+
+        // Refines the detected local extrema of the DoG and discards unstable
+        // keypoints. This is the same as the refinement in `vl_sift_detect`.
+        void RefineSiftKeypoints(VlSiftFilt* sift) {
+            const float* dog = sift->dog;
+            const int s_min = sift->s_min;
+            const int s_max = sift->s_max;
+            const int w = sift->octave_width;
+            const int h = sift->octave_height;
+            const double te = sift->edge_thresh;
+            const double tp = sift->peak_thresh;
+
+            const int xo = 1;
+            const int yo = w;
+            const int so = w * h;
+
+            const double xper = std::pow(2.0, sift->o_cur);
+
+            VlSiftKeypoint* k = sift->keys;
+
+            for (int i = 0; i < sift->nkeys; ++i) {
+                int x = sift->keys[i].ix;
+                int y = sift->keys[i].iy;
+                const int s = sift->keys[i].is;
+
+                double Dx = 0, Dy = 0, Ds = 0, Dxx = 0, Dyy = 0, Dss = 0, Dxy = 0,
+                        Dxs = 0, Dys = 0;
+                double A[3 * 3];
+                double b[3];
+
+                int dx = 0;
+                int dy = 0;
+
+                const float* pt = nullptr;
+
+                for (int iter = 0; iter < kMaxNumRefinementIterations; ++iter) {
+                    x += dx;
+                    y += dy;
+
+                    pt = dog + xo * x + yo * y + so * (s - s_min);
+
+                    auto at = [pt, xo, yo, so](const int dx, const int dy,
+                                               const int ds) {
+                        return pt[dx * xo + dy * yo + ds * so];
+                    };
+
+                    // Compute the gradient.
+                    Dx = 0.5 * (at(+1, 0, 0) - at(-1, 0, 0));
+                    Dy = 0.5 * (at(0, +1, 0) - at(0, -1, 0));
+                    Ds = 0.5 * (at(0, 0, +1) - at(0, 0, -1));
+
+                    // Compute the Hessian.
+                    Dxx = (at(+1, 0, 0) + at(-1, 0, 0) - 2.0 * at(0, 0, 0));
+                    Dyy = (at(0, +1, 0) + at(0, -1, 0) - 2.0 * at(0, 0, 0));
+                    Dss = (at(0, 0, +1) + at(0, 0, -1) - 2.0 * at(0, 0, 0));
+
+                    Dxy = 0.25 * (at(+1, +1, 0) + at(-1, -1, 0) - at(-1, +1, 0) -
+                                  at(+1, -1, 0));
+                    Dxs = 0.25 * (at(+1, 0, +1) + at(-1, 0, -1) - at(-1, 0, +1) -
+                                  at(+1, 0, -1));
+                    Dys = 0.25 * (at(0, +1, +1) + at(0, -1, -1) - at(0, -1, +1) -
+                                  at(0, +1, -1));
+
+                    // Solve the linear system with column-major A.
+                    A[0] = Dxx;
+                    A[4] = Dyy;
+                    A[8] = Dss;
+                    A[3] = A[1] = Dxy;
+                    A[6] = A[2] = Dxs;
+                    A[7] = A[5] = Dys;
+
+                    b[0] = -Dx;
+                    b[1] = -Dy;
+                    b[2] = -Ds;
+
+                    // Gauss elimination.
+                    for (int j = 0; j < 3; ++j) {
+                        double maxa = 0;
+                        double maxabsa = 0;
+                        int maxi = -1;
+
+                        // Look for the maximally stable pivot.
+                        for (int ii = j; ii < 3; ++ii) {
+                            const double a = A[ii + j * 3];
+                            const double absa = std::abs(a);
+                            if (absa > maxabsa) {
+                                maxa = a;
+                                maxabsa = absa;
+                                maxi = ii;
+                            }
+                        }
+
+                        // If singular give up.
+                        if (maxabsa < 1e-10f) {
+                            b[0] = 0;
+                            b[1] = 0;
+                            b[2] = 0;
+                            break;
+                        }
+
+                        // Swap j-th row with the pivot row and normalize j-th row.
+                        for (int jj = j; jj < 3; ++jj) {
+                            std::swap(A[maxi + jj * 3], A[j + jj * 3]);
+                            A[j + jj * 3] /= maxa;
+                        }
+                        std::swap(b[j], b[maxi]);
+                        b[j] /= maxa;
+
+                        // Elimination.
+                        for (int ii = j + 1; ii < 3; ++ii) {
+                            const double factor = A[ii + j * 3];
+                            for (int jj = j; jj < 3; ++jj) {
+                                A[ii + jj * 3] -= factor * A[j + jj * 3];
+                            }
+                            b[ii] -= factor * b[j];
+                        }
+                    }
+
+                    // Backward substitution.
+                    for (int ii = 2; ii > 0; --ii) {
+                        const double value = b[ii];
+                        for (int jj = ii - 1; jj >= 0; --jj) {
+                            b[jj] -= value * A[jj + ii * 3];
+                        }
+                    }
+
+                    // If the translation of the keypoint is big, move the keypoint
+                    // and re-iterate the computation.
+                    dx = ((b[0] > 0.6 && x < w - 2) ? 1 : 0) +
+                         ((b[0] < -0.6 && x > 1) ? -1 : 0);
+                    dy = ((b[1] > 0.6 && y < h - 2) ? 1 : 0) +
+                         ((b[1] < -0.6 && y > 1) ? -1 : 0);
+
+                    if (dx == 0 && dy == 0) {
+                        break;
+                    }
+                }
+
+                // Check the threshold and other conditions.
+                const double val = *pt + 0.5 * (Dx * b[0] + Dy * b[1] + Ds * b[2]);
+                const double score =
+                        (Dxx + Dyy) * (Dxx + Dyy) / (Dxx * Dyy - Dxy * Dxy);
+                const double xn = x + b[0];
+                const double yn = y + b[1];
+                const double sn = s + b[2];
+
+                const bool good = std::abs(val) > tp &&
+                                  score < (te + 1) * (te + 1) / te && score >= 0 &&
+                                  std::abs(b[0]) < 1.5 && std::abs(b[1]) < 1.5 &&
+                                  std::abs(b[2]) < 1.5 && xn >= 0 && xn <= w - 1 &&
+                                  yn >= 0 && yn <= h - 1 && sn >= s_min &&
+                                  sn <= s_max;
+
+                if (good) {
+                    k->o = sift->o_cur;
+                    k->ix = x;
+                    k->iy = y;
+                    k->is = s;
+                    k->s = sn;
+                    k->x = xn * xper;
+                    k->y = yn * xper;
+                    k->sigma = sift->sigma0 * std::pow(2.0, sn / sift->S) * xper;
+                    ++k;
+                }
+            }
+
+            sift->nkeys = static_cast<int>(k - sift->keys);
+        }
+
+        // Equivalent to `normalize_histogram` in VLFeat.
+        float NormalizeSiftHistogram(float* histogram) {
+            float norm = 0;
+            for (int i = 0; i < kDescDim; ++i) {
+                norm += histogram[i] * histogram[i];
+            }
+
+            norm = vl_fast_sqrt_f(norm) + VL_EPSILON_F;
+
+            for (int i = 0; i < kDescDim; ++i) {
+                histogram[i] /= norm;
+            }
+
+            return norm;
+        }
+
+    }  // namespace
+
+    bool ProcessFirstSiftOctave(VlSiftFilt* sift, const float* image) {
+        const int width = sift->width;
+        const int height = sift->height;
+        const int o_min = sift->o_min;
+        const int s_min = sift->s_min;
+
+        sift->o_cur = o_min;
+        sift->nkeys = 0;
+        const int w = sift->octave_width = VL_SHIFT_LEFT(width, -o_min);
+        const int h = sift->octave_height = VL_SHIFT_LEFT(height, -o_min);
+
+        if (sift->O == 0) {
+            return false;
+        }
+
+        // Compute the first level of the first octave, which is upsampled or
+        // downsampled depending on the index of the first octave.
+        float* octave = vl_sift_get_octave(sift, s_min);
+
+        if (o_min < 0) {
+            UpsampleImage(image, width, height, octave);
+            for (int o = -1; o > o_min; --o) {
+                const int octave_width = width << -o;
+                const int octave_height = height << -o;
+                UpsampleImage(octave, octave_width, octave_height, sift->temp);
+                std::copy(sift->temp, sift->temp + 4 * octave_width * octave_height,
+                          octave);
+            }
+        } else if (o_min > 0) {
+            DownsampleImage(image, width, height, o_min, octave);
+        } else {
+            std::copy(image, image + width * height, octave);
+        }
+
+        // Adjust the smoothing of the first level, where the input image is
+        // assumed to have the nominal smoothing.
+        const double sa = sift->sigma0 * std::pow(sift->sigmak, s_min);
+        const double sb = sift->sigman * std::pow(2.0, -o_min);
+        if (sa > sb) {
+            SmoothImage(octave, w, h, std::sqrt(sa * sa - sb * sb), sift->temp,
+                        octave);
+        }
+
+        ProcessSiftOctaveLevels(sift);
+
+        return true;
+    }
+
+    bool ProcessNextSiftOctave(VlSiftFilt* sift) {
+        const int S = sift->S;
+        const int s_min = sift->s_min;
+        const int s_max = sift->s_max;
+
+        if (sift->o_cur == sift->o_min + sift->O - 1) {
+            return false;
+        }
+
+        // The first level of the next octave is downsampled from the level of
+        // the current octave with twice the smoothing of its first level.
+        const int s_best = std::min(s_min + S, s_max);
+        DownsampleImage(vl_sift_get_octave(sift, s_best), sift->octave_width,
+                        sift->octave_height, 1, vl_sift_get_octave(sift, s_min));
+
+        sift->o_cur += 1;
+        sift->nkeys = 0;
+        const int w = sift->octave_width = VL_SHIFT_LEFT(sift->width, -sift->o_cur);
+        const int h = sift->octave_height =
+                VL_SHIFT_LEFT(sift->height, -sift->o_cur);
+
+        const double sa = sift->sigma0 * powf(sift->sigmak, s_min);
+        const double sb = sift->sigma0 * powf(sift->sigmak, s_best - S);
+        if (sa > sb) {
+            float* octave = vl_sift_get_octave(sift, s_min);
+            SmoothImage(octave, w, h, std::sqrt(sa * sa - sb * sb), sift->temp,
+                        octave);
+        }
+
+        ProcessSiftOctaveLevels(sift);
+
+        return true;
+    }
+
+    void DetectSiftKeypoints(VlSiftFilt* sift) {
+        const int s_min = sift->s_min;
+        const int s_max = sift->s_max;
+        const int w = sift->octave_width;
+        const int h = sift->octave_height;
+        const int level_size = w * h;
+
+        sift->nkeys = 0;
+
+        // Compute the difference of Gaussians.
+        for (int s = s_min; s <= s_max - 1; ++s) {
+            const float* src1 = vl_sift_get_octave(sift, s);
+            const float* src2 = vl_sift_get_octave(sift, s + 1);
+            float* dst = sift->dog + (s - s_min) * level_size;
+            int i = 0;
+            for (; i + kVecSize <= level_size; i += kVecSize) {
+                StoreVec(dst + i, SubVec(LoadVec(src2 + i), LoadVec(src1 + i)));
+            }
+            for (; i < level_size; ++i) {
+                dst[i] = src2[i] - src1[i];
+            }
+        }
+
+        // The smallest float that is not smaller than the threshold in double
+        // precision, such that the comparisons are the same as in VLFeat.
+        const double threshold_double = 0.8 * sift->peak_thresh;
+        float threshold = static_cast<float>(threshold_double);
+        if (threshold < threshold_double) {
+            threshold = std::nextafter(threshold, std::numeric_limits<float>::max());
+        }
+
+        // Find the local extrema of the DoG. Most pixels are rejected by the
+        // threshold, so the neighbors are only compared for candidate vectors.
+        for (int s = s_min + 1; s <= s_max - 2; ++s) {
+            for (int y = 1; y < h - 1; ++y) {
+                const float* row = sift->dog + (s - s_min) * level_size + y * w;
+                int x = 1;
+                for (; x + kVecSize <= w - 1; x += kVecSize) {
+                    const FloatVec value = LoadVec(row + x);
+                    const int maybe_max =
+                            MaskBits(GreaterEqualVec(value, SetVec(threshold)));
+                    const int maybe_min =
+                            MaskBits(LessEqualVec(value, SetVec(-threshold)));
+                    if (maybe_max == 0 && maybe_min == 0) {
+                        continue;
+                    }
+
+                    FloatVec max_neighbor = SetVec(-std::numeric_limits<float>::max());
+                    FloatVec min_neighbor = SetVec(std::numeric_limits<float>::max());
+                    for (int ds = -1; ds <= 1; ++ds) {
+                        for (int dy = -1; dy <= 1; ++dy) {
+                            for (int dx = -1; dx <= 1; ++dx) {
+                                if (ds == 0 && dy == 0 && dx == 0) {
+                                    continue;
+                                }
+                                const FloatVec neighbor =
+                                        LoadVec(row + x + ds * level_size + dy * w + dx);
+                                max_neighbor = MaxVec(max_neighbor, neighbor);
+                                min_neighbor = MinVec(min_neighbor, neighbor);
+                            }
+                        }
+                    }
+
+                    const int is_extremum =
+                            (maybe_max & MaskBits(GreaterVec(value, max_neighbor))) |
+                            (maybe_min & MaskBits(LessVec(value, min_neighbor)));
+                    for (int i = 0; i < kVecSize; ++i) {
+                        if (is_extremum & (1 << i)) {
+                            AddSiftKeypoint(sift, x + i, y, s);
+                        }
+                    }
+                }
+
+                for (; x < w - 1; ++x) {
+                    if (IsSiftExtremum(row + x, w, level_size, threshold)) {
+                        AddSiftKeypoint(sift, x, y, s);
+                    }
+                }
+            }
+        }
+
+        RefineSiftKeypoints(sift);
+    }
+
+    void ComputeSiftGradients(const float* level, const int width,
+                              const int height, const int row_begin,
+                              const int row_end, float* grad) {
+        CHECK_GE(width, 2);
+        CHECK_GE(height, 2);
+
+        for (int y = row_begin; y < row_end; ++y) {
+            const float* src = level + y * width;
+            const float* src_up = y > 0 ? src - width : src;
+            const float* src_down = y < height - 1 ? src + width : src;
+            const float scale_y = (y > 0 && y < height - 1) ? 0.5f : 1.0f;
+            float* dst = grad + 2 * y * width;
+
+            auto ComputeGradient = [&](const int x, const float gx) {
+                const float gy = scale_y * (src_down[x] - src_up[x]);
+                dst[2 * x] = vl_fast_sqrt_f(gx * gx + gy * gy);
+                dst[2 * x + 1] = vl_mod_2pi_f(vl_fast_atan2_f(gy, gx) + 2 * VL_PI);
+            };
+
+            ComputeGradient(0, src[1] - src[0]);
+
+            int x = 1;
+            for (; x + kVecSize <= width - 1; x += kVecSize) {
+                const FloatVec gx =
+                        MulVec(SetVec(0.5f), SubVec(LoadVec(src + x + 1),
+                                                    LoadVec(src + x - 1)));
+                const FloatVec gy =
+                        MulVec(SetVec(scale_y), SubVec(LoadVec(src_down + x),
+                                                       LoadVec(src_up + x)));
+                StoreInterleavedVec(dst + 2 * x,
+                                    FastSqrtVec(MulAddVec(gx, gx, MulVec(gy, gy))),
+                                    FastAtan2Vec(gy, gx));
+            }
+            for (; x < width - 1; ++x) {
+                ComputeGradient(x, 0.5f * (src[x + 1] - src[x - 1]));
+            }
+
+            ComputeGradient(width - 1, src[width - 1] - src[width - 2]);
+        }
+    }
+
+    void ComputeSiftDescriptor(const VlSiftFilt* sift,
+                               const VlSiftKeypoint* keypoint,
+                               const double angle, float* descriptor) {
+        const int w = sift->octave_width;
+        const int h = sift->octave_height;
+        const double xper = std::pow(2.0, sift->o_cur);
+        const double x = keypoint->x / xper;
+        const double y = keypoint->y / xper;
+        const double sigma = keypoint->sigma / xper;
+
+        const int xi = static_cast<int>(x + 0.5);
+        const int yi = static_cast<int>(y + 0.5);
+        const int si = keypoint->is;
+
+        const float st0 = static_cast<float>(std::sin(angle));
+        const float ct0 = static_cast<float>(std::cos(angle));
+        const double SBP = sift->magnif * sigma + VL_EPSILON_D;
+        const int W = static_cast<int>(
+                std::floor(std::sqrt(2.0) * SBP * (kNumSpatialBins + 1) / 2.0 + 0.5));
+
+        const int bin_t_stride = 1;
+        const int bin_x_stride = kNumOrientationBins;
+        const int bin_y_stride = kNumOrientationBins * kNumSpatialBins;
+
+        std::fill(descriptor, descriptor + kDescDim, 0.0f);
+
+        if (keypoint->o != sift->o_cur || xi < 0 || xi >= w || yi < 0 ||
+            yi >= h - 1 || si < sift->s_min + 1 || si > sift->s_max - 2) {
+            return;
+        }
+
+        CHECK_EQ(sift->grad_o, sift->o_cur)
+            << "Gradients of the current octave must be computed";
+
+        // Center the gradients and the descriptor on the keypoint, where the
+        // descriptor points to the bin of center (SBP/2, SBP/2, 0).
+        const float* pt = sift->grad + 2 * xi + 2 * w * yi +
+                          2 * w * h * (si - sift->s_min - 1);
+        float* dpt = descriptor + (kNumSpatialBins / 2) * bin_y_stride +
+                     (kNumSpatialBins / 2) * bin_x_stride;
+
+        const float inv_SBP = static_cast<float>(1.0 / SBP);
+        const float window_scale =
+                static_cast<float>(1.0 / (2.0 * sift->windowSize * sift->windowSize));
+        const float orientation_scale =
+                static_cast<float>(kNumOrientationBins / (2 * VL_PI));
+
+        // The samples are computed in vectors and then distributed to the bins.
+        float nx_samples[kVecSize];
+        float ny_samples[kVecSize];
+        float nt_samples[kVecSize];
+        float weight_samples[kVecSize];
+        float grad_samples[2 * kVecSize];
+
+        const int dxi_begin = std::max(-W, 1 - xi);
+        const int dxi_end = std::min(W, w - xi - 2) + 1;
+        const int dyi_begin = std::max(-W, 1 - yi);
+        const int dyi_end = std::min(W, h - yi - 2) + 1;
+
+        for (int dyi = dyi_begin; dyi < dyi_end; ++dyi) {
+            const float dy = static_cast<float>(yi + dyi - y);
+            const FloatVec st0_dy = SetVec(st0 * dy);
+            const FloatVec ct0_dy = SetVec(ct0 * dy);
+            const float* row = pt + 2 * w * dyi;
+
+            for (int dxi = dxi_begin; dxi < dxi_end; dxi += kVecSize) {
+                const int num_samples = std::min(kVecSize, dxi_end - dxi);
+
+                FloatVec mod;
+                FloatVec grad_angle;
+                if (num_samples == kVecSize) {
+                    LoadInterleavedVec(row + 2 * dxi, &mod, &grad_angle);
+                } else {
+                    std::fill(grad_samples, grad_samples + 2 * kVecSize, 0.0f);
+                    std::copy(row + 2 * dxi, row + 2 * (dxi + num_samples),
+                              grad_samples);
+                    LoadInterleavedVec(grad_samples, &mod, &grad_angle);
+                }
+
+                const FloatVec dx =
+                        AddVec(SetVec(static_cast<float>(xi + dxi - x)), IotaVec());
+
+                // Displacement normalized w.r.t. the keypoint orientation and
+                // extension.
+                const FloatVec nx =
+                        MulVec(MulAddVec(SetVec(ct0), dx, st0_dy), SetVec(inv_SBP));
+                const FloatVec ny =
+                        MulVec(SubVec(ct0_dy, MulVec(SetVec(st0), dx)), SetVec(inv_SBP));
+                const FloatVec theta = Mod2PiVec(
+                        SubVec(grad_angle, SetVec(static_cast<float>(angle))));
+                const FloatVec nt = MulVec(theta, SetVec(orientation_scale));
+
+                // Gaussian weight of the sample with a standard deviation of half
+                // the descriptor extent in the normalized frame.
+                const FloatVec win = ExpNegVec(
+                        MulVec(MulAddVec(nx, nx, MulVec(ny, ny)), SetVec(window_scale)));
+
+                StoreVec(nx_samples, nx);
+                StoreVec(ny_samples, ny);
+                StoreVec(nt_samples, nt);
+                StoreVec(weight_samples, MulVec(win, mod));
+
+                // Distribute the samples into the 8 adjacent bins, starting from
+                // the lower-left bin.
+                for (int i = 0; i < num_samples; ++i) {
+                    const int binx = static_cast<int>(std::floor(nx_samples[i] - 0.5f));
+                    const int biny = static_cast<int>(std::floor(ny_samples[i] - 0.5f));
+                    const int bint = static_cast<int>(std::floor(nt_samples[i]));
+                    const float rbinx = nx_samples[i] - (binx + 0.5f);
+                    const float rbiny = ny_samples[i] - (biny + 0.5f);
+                    const float rbint = nt_samples[i] - bint;
+
+                    for (int dbinx = 0; dbinx < 2; ++dbinx) {
+                        if (binx + dbinx < -(kNumSpatialBins / 2) ||
+                            binx + dbinx >= (kNumSpatialBins / 2)) {
+                            continue;
+                        }
+                        const float weight_x =
+                                weight_samples[i] * std::abs(1 - dbinx - rbinx);
+                        for (int dbiny = 0; dbiny < 2; ++dbiny) {
+                            if (biny + dbiny < -(kNumSpatialBins / 2) ||
+                                biny + dbiny >= (kNumSpatialBins / 2)) {
+                                continue;
+                            }
+                            const float weight_xy =
+                                    weight_x * std::abs(1 - dbiny - rbiny);
+                            float* bin = dpt + (binx + dbinx) * bin_x_stride +
+                                         (biny + dbiny) * bin_y_stride;
+                            for (int dbint = 0; dbint < 2; ++dbint) {
+                                bin[((bint + dbint) % kNumOrientationBins) *
+                                    bin_t_stride] +=
+                                        weight_xy * std::abs(1 - dbint - rbint);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Standard SIFT descriptors are normalized, truncated and normalized again.
+        const float norm = NormalizeSiftHistogram(descriptor);
+        if (sift->norm_thresh && norm < sift->norm_thresh) {
+            std::fill(descriptor, descriptor + kDescDim, 0.0f);
+        } else {
+            for (int i = 0; i < kDescDim; ++i) {
+                descriptor[i] = std::min(descriptor[i], 0.2f);
+            }
+            NormalizeSiftHistogram(descriptor);
+        }
+    }
+
+}
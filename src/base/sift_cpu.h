@@ -0,0 +1,40 @@
+#ifndef BKMAP_SIFT_CPU_H
+#define BKMAP_SIFT_CPU_H
+
+#include "ext/VLFeat/sift.h"
+
+namespace bkmap {
+
+// Vectorized implementations of the stages of the VLFeat SIFT detector and
+// descriptor. The functions operate on the state of a VLFeat filter, so that
+// they can be mixed with the VLFeat functions, e.g., for the computation of the
+// keypoint orientations. The kernels use AVX2 or SSE2 instructions, if
+// available, and the results match VLFeat up to floating point precision.
+
+// Equivalent to `vl_sift_process_first_octave`. Returns false if there are no
+// octaves to process.
+    bool ProcessFirstSiftOctave(VlSiftFilt* sift, const float* image);
+
+// Equivalent to `vl_sift_process_next_octave`. Returns false if there are no
+// more octaves to process.
+    bool ProcessNextSiftOctave(VlSiftFilt* sift);
+
+// Equivalent to `vl_sift_detect`.
+    void DetectSiftKeypoints(VlSiftFilt* sift);
+
+// Computes the interleaved gradient magnitudes and angles of the rows
+// [row_begin, row_end) of an octave level, as stored in the gradient buffer of
+// the VLFeat filter. The level must be at least 2x2 pixels.
+    void ComputeSiftGradients(const float* level, const int width,
+                              const int height, const int row_begin,
+                              const int row_end, float* grad);
+
+// Equivalent to `vl_sift_calc_keypoint_descriptor`, but the gradients of the
+// current octave must already be computed. The descriptor has 128 elements.
+    void ComputeSiftDescriptor(const VlSiftFilt* sift,
+                               const VlSiftKeypoint* keypoint,
+                               const double angle, float* descriptor);
+
+}
+
+#endif //BKMAP_SIFT_CPU_H
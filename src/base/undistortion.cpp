@@ -8,11 +8,29 @@
 
 #include "base/pose.h"
 #include "base/warp.h"
+#include "util/bitmap_cache.h"
 #include "util/misc.h"
 
 namespace bkmap {
     namespace {
 
+        // Whether images written to the path are stored without loss, so that
+        // the written image can be used instead of reading it again.
+        bool IsLosslessImageFormat(const std::string& path) {
+            switch (FreeImage_GetFIFFromFilename(path.c_str())) {
+                case FIF_BMP:
+                case FIF_PNG:
+                case FIF_TIFF:
+                case FIF_PGM:
+                case FIF_PGMRAW:
+                case FIF_PPM:
+                case FIF_PPMRAW:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
         template <typename Derived>
         void WriteMatrix(const Eigen::MatrixBase<Derived>& matrix,
                          std::ofstream* file) {
@@ -176,20 +194,27 @@ namespace bkmap {
         const std::string output_image_path =
                 JoinPaths(output_path_, "images", image.Name());
 
-        Bitmap distorted_bitmap;
         const std::string input_image_path = JoinPaths(image_path_, image.Name());
-        if (!distorted_bitmap.Read(input_image_path)) {
+        const std::shared_ptr<const Bitmap> distorted_bitmap =
+                BitmapCache::Global().Read(input_image_path, true);
+        if (!distorted_bitmap) {
             std::cerr << "ERROR: Cannot read image at path " << input_image_path
             << std::endl;
             return;
         }
 
-        Bitmap undistorted_bitmap;
+        std::shared_ptr<Bitmap> undistorted_bitmap(new Bitmap());
         Camera undistorted_camera;
-        UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
+        UndistortImage(options_, *distorted_bitmap, camera, undistorted_bitmap.get(),
                        &undistorted_camera);
 
-        undistorted_bitmap.Write(output_image_path);
+        // The undistorted image is read again by the dense stereo and fusion.
+        // Lossy formats, e.g. JPEG, are not cached, since the written image
+        // differs from the pixels in memory.
+        if (undistorted_bitmap->Write(output_image_path) &&
+            IsLosslessImageFormat(output_image_path)) {
+            BitmapCache::Global().Insert(output_image_path, undistorted_bitmap);
+        }
     }
 
     void COLMAPUndistorter::WritePatchMatchConfig() const {
@@ -301,9 +326,10 @@ namespace bkmap {
         const Image& image = reconstruction_.Image(image_id);
         const Camera& camera = reconstruction_.Camera(image.CameraId());
 
-        Bitmap distorted_bitmap;
         const std::string input_image_path = JoinPaths(image_path_, image.Name());
-        if (!distorted_bitmap.Read(input_image_path)) {
+        const std::shared_ptr<const Bitmap> distorted_bitmap =
+                BitmapCache::Global().Read(input_image_path, true);
+        if (!distorted_bitmap) {
             std::cerr << StringPrintf("ERROR: Cannot read image at path %s",
                                       input_image_path.c_str())
             << std::endl;
@@ -312,7 +338,7 @@ namespace bkmap {
 
         Bitmap undistorted_bitmap;
         Camera undistorted_camera;
-        UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
+        UndistortImage(options_, *distorted_bitmap, camera, &undistorted_bitmap,
                        &undistorted_camera);
 
         undistorted_bitmap.Write(output_image_path);
@@ -502,9 +528,10 @@ namespace bkmap {
         const Image& image = reconstruction_.Image(image_id);
         const Camera& camera = reconstruction_.Camera(image.CameraId());
 
-        Bitmap distorted_bitmap;
         const std::string input_image_path = JoinPaths(image_path_, image.Name());
-        if (!distorted_bitmap.Read(input_image_path)) {
+        const std::shared_ptr<const Bitmap> distorted_bitmap =
+                BitmapCache::Global().Read(input_image_path, true);
+        if (!distorted_bitmap) {
             std::cerr << "ERROR: Cannot read image at path " << input_image_path
             << std::endl;
             return;
@@ -512,7 +539,7 @@ namespace bkmap {
 
         Bitmap undistorted_bitmap;
         Camera undistorted_camera;
-        UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
+        UndistortImage(options_, *distorted_bitmap, camera, &undistorted_bitmap,
                        &undistorted_camera);
 
         undistorted_bitmap.Write(output_image_path);
@@ -576,17 +603,19 @@ namespace bkmap {
         const std::string output_image2_path =
                 JoinPaths(output_path_, stereo_pair_name, image_name2);
 
-        Bitmap distorted_bitmap1;
         const std::string input_image1_path = JoinPaths(image_path_, image1.Name());
-        if (!distorted_bitmap1.Read(input_image1_path)) {
+        const std::shared_ptr<const Bitmap> distorted_bitmap1 =
+                BitmapCache::Global().Read(input_image1_path, true);
+        if (!distorted_bitmap1) {
             std::cerr << "ERROR: Cannot read image at path " << input_image1_path
             << std::endl;
             return;
         }
 
-        Bitmap distorted_bitmap2;
         const std::string input_image2_path = JoinPaths(image_path_, image2.Name());
-        if (!distorted_bitmap2.Read(input_image2_path)) {
+        const std::shared_ptr<const Bitmap> distorted_bitmap2 =
+                BitmapCache::Global().Read(input_image2_path, true);
+        if (!distorted_bitmap2) {
             std::cerr << "ERROR: Cannot read image at path " << input_image2_path
             << std::endl;
             return;
@@ -602,7 +631,7 @@ namespace bkmap {
         Camera undistorted_camera;
         Eigen::Matrix4d Q;
         RectifyAndUndistortStereoImages(
-                options_, distorted_bitmap1, distorted_bitmap2, camera1, camera2, qvec,
+                options_, *distorted_bitmap1, *distorted_bitmap2, camera1, camera2, qvec,
                 tvec, &undistorted_bitmap1, &undistorted_bitmap2, &undistorted_camera,
                 &Q);
 
@@ -10,6 +10,20 @@
 namespace bkmap {
     namespace {
 
+        // Allocate the target image, unless it was already allocated by the caller
+        // with the same dimensions and channels, e.g. to clone the metadata of the
+        // source image, in which case its memory and metadata are reused.
+        void AllocateTargetImage(const Camera& target_camera,
+                                 const Bitmap& source_image, Bitmap* target_image) {
+            const int width = static_cast<int>(target_camera.Width());
+            const int height = static_cast<int>(target_camera.Height());
+            if (target_image->Data() == nullptr || target_image->Width() != width ||
+                target_image->Height() != height ||
+                target_image->IsRGB() != source_image.IsRGB()) {
+                target_image->Allocate(width, height, source_image.IsRGB());
+            }
+        }
+
         float GetPixelConstantBorder(const float* data, const int rows, const int cols,
                                      const int row, const int col) {
             if (row >= 0 && col >= 0 && row < rows && col < cols) {
@@ -28,9 +42,7 @@ namespace bkmap {
         CHECK_EQ(source_camera.Height(), source_image.Height());
         CHECK_NOTNULL(target_image);
 
-        target_image->Allocate(static_cast<int>(target_camera.Width()),
-                               static_cast<int>(target_camera.Height()),
-                               source_image.IsRGB());
+        AllocateTargetImage(target_camera, source_image, target_image);
 
         Eigen::Vector2d image_point;
         for (int y = 0; y < target_image->Height(); ++y) {
@@ -89,9 +101,7 @@ namespace bkmap {
         CHECK_EQ(source_camera.Height(), source_image.Height());
         CHECK_NOTNULL(target_image);
 
-        target_image->Allocate(static_cast<int>(target_camera.Width()),
-                               static_cast<int>(target_camera.Height()),
-                               source_image.IsRGB());
+        AllocateTargetImage(target_camera, source_image, target_image);
 
         Eigen::Vector3d image_point(0, 0, 1);
         for (int y = 0; y < target_image->Height(); ++y) {
@@ -13,7 +13,8 @@ namespace bkmap {
 
 // Warp source image to target image by projecting the pixels of the target
 // image up to infinity and projecting it down into the source image
-// (i.e. an inverse mapping). The function allocates the target image.
+// (i.e. an inverse mapping). The function allocates the target image, unless
+// it is already allocated with the target dimensions and channels.
     void WarpImageBetweenCameras(const Camera& source_camera,
                                  const Camera& target_camera,
                                  const Bitmap& source_image, Bitmap* target_image);
@@ -27,7 +28,8 @@ namespace bkmap {
 // First, warp source image to target image by projecting the pixels of the
 // target image up to infinity and projecting it down into the source image
 // (i.e. an inverse mapping). Second, warp the coordinates from the first
-// warping with the given homography. The function allocates the target image.
+// warping with the given homography. The function allocates the target image,
+// unless it is already allocated with the target dimensions and channels.
     void WarpImageWithHomographyBetweenCameras(const Eigen::Matrix3d& H,
                                                const Camera& source_camera,
                                                const Camera& target_camera,
@@ -10,6 +10,7 @@
 #include "controllers/incremental_mapper.h"
 #include "mvs/fusion.h"
 #include "mvs/patch_match.h"
+#include "util/bitmap_cache.h"
 #include "util/misc.h"
 #include "util/option_manager.h"
 
@@ -24,6 +25,14 @@ namespace bkmap {
         CHECK(ExistsDir(options_.image_path));
         CHECK_NOTNULL(reconstruction_manager_);
 
+        BitmapCache::Options image_cache_options;
+        image_cache_options.cache_size = options_.image_cache_size;
+        if (options_.disk_image_cache) {
+            image_cache_options.disk_cache_path =
+                    JoinPaths(options_.workspace_path, "image_cache");
+        }
+        BitmapCache::Global().SetOptions(image_cache_options);
+
         option_manager_.AddAllOptions();
 
         *option_manager_.image_path = options_.image_path;
@@ -77,6 +86,7 @@ namespace bkmap {
         option_manager_.sift_extraction->num_threads = options_.num_threads;
         option_manager_.sift_matching->num_threads = options_.num_threads;
         option_manager_.mapper->num_threads = options_.num_threads;
+        option_manager_.dense_stereo->num_threads = options_.num_threads;
         option_manager_.dense_meshing->num_threads = options_.num_threads;
 
         ImageReader::Options reader_options = *option_manager_.image_reader;
@@ -89,7 +99,6 @@ namespace bkmap {
 
         option_manager_.sift_extraction->gpu_index = options_.gpu_index;
         option_manager_.sift_matching->gpu_index = options_.gpu_index;
-        option_manager_.dense_stereo->gpu_index = options_.gpu_index;
 
         feature_extractor_.reset(new SiftFeatureExtractor(
                 reader_options, *option_manager_.sift_extraction));
@@ -117,6 +126,10 @@ namespace bkmap {
         }
     }
 
+    AutomaticReconstructionController::~AutomaticReconstructionController() {
+        BitmapCache::Global().SetOptions(BitmapCache::Options());
+    }
+
     void AutomaticReconstructionController::Stop() {
         if (active_thread_ != nullptr) {
             active_thread_->Stop();
@@ -218,14 +231,6 @@ namespace bkmap {
     }
 
     void AutomaticReconstructionController::RunDenseMapper() {
-#ifndef CUDA_ENABLED
-        std::cout
-        << std::endl
-        << "WARNING: Skipping dense reconstruction because CUDA is not available"
-        << std::endl;
-        return;
-#endif
-
         CreateDirIfNotExists(JoinPaths(options_.workspace_path, "dense"));
 
         for (size_t i = 0; i < reconstruction_manager_->Size(); ++i) {
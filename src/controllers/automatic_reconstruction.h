@@ -40,12 +40,8 @@ namespace bkmap {
             // Whether to perform sparse mapping.
             bool sparse = true;
 
-// Whether to perform dense mapping.
-#ifdef CUDA_ENABLED
+            // Whether to perform dense mapping.
             bool dense = true;
-#else
-            bool dense = false;
-#endif
 
             // The number of threads to use in all stages.
             int num_threads = -1;
@@ -53,15 +49,28 @@ namespace bkmap {
             // Whether to use the GPU in feature extraction and matching.
             bool use_gpu = true;
 
-            // Index of the GPU used for GPU stages. For multi-GPU computation,
-            // you should separate multiple GPU indices by comma, e.g., "0,1,2,3".
-            // By default, all GPUs will be used in all stages.
+            // Index of the GPU used for feature extraction and matching. For
+            // multi-GPU computation, you should separate multiple GPU indices by
+            // comma, e.g., "0,1,2,3". By default, all GPUs will be used.
             std::string gpu_index = "-1";
+
+            // Maximum size of the decoded images in memory in gigabytes, which are
+            // shared between the stages instead of being decoded in each stage. The
+            // images are decoded in each stage, if the size is zero.
+            double image_cache_size = 2.0;
+
+            // Whether to additionally cache the decoded images as raw pixels in the
+            // workspace folder, which are faster to read than decoding the images
+            // again, but which require considerably more disk space.
+            bool disk_image_cache = false;
         };
 
         AutomaticReconstructionController(
                 const Options& options, ReconstructionManager* reconstruction_manager);
 
+        // Disables the process-wide image cache again.
+        ~AutomaticReconstructionController();
+
         void Stop() override;
 
     private:
@@ -4,6 +4,9 @@
 
 #include "estimators/two_view_geometry.h"
 
+#include <algorithm>
+#include <functional>
+
 #include "base/camera.h"
 #include "base/essential_matrix.h"
 #include "base/homography_matrix.h"
@@ -16,6 +19,7 @@
 #include "estimators/translation_transform.h"
 #include "optim/loransac.h"
 #include "optim/ransac.h"
+#include "optim/sprt_loransac.h"
 #include "util/random.h"
 
 namespace bkmap {
@@ -56,6 +60,82 @@ namespace bkmap {
                    point(1) <= maxy;
         }
 
+        // Number of trials of each estimation per round of the interleaved
+        // estimation schedule.
+        const size_t kInterleavedNumTrialsPerRound = 10;
+
+        // Create the SPRT options of an estimator, where the time ratio of model
+        // estimation over the verification of one data point and the number of
+        // models per sample are characteristics of the minimal solver.
+        SPRT::Options CreateSPRTOptions(const RANSACOptions& ransac_options,
+                                        const double eval_time_ratio,
+                                        const int num_models_per_sample) {
+            SPRT::Options sprt_options;
+            sprt_options.epsilon = std::min(
+                    std::max(ransac_options.min_inlier_ratio, 2 * sprt_options.delta),
+                    0.99);
+            sprt_options.eval_time_ratio = eval_time_ratio;
+            sprt_options.num_models_per_sample = num_models_per_sample;
+            return sprt_options;
+        }
+
+        SPRT::Options CreateEssentialSPRTOptions(
+                const RANSACOptions& ransac_options) {
+            return CreateSPRTOptions(ransac_options, 400, 4);
+        }
+
+        SPRT::Options CreateFundamentalSPRTOptions(
+                const RANSACOptions& ransac_options) {
+            return CreateSPRTOptions(ransac_options, 200, 2);
+        }
+
+        SPRT::Options CreateHomographySPRTOptions(
+                const RANSACOptions& ransac_options) {
+            return CreateSPRTOptions(ransac_options, 100, 1);
+        }
+
+        // The number of trials, after which an image pair is considered hopeless,
+        // if none of the models has reached the minimum number of inliers.
+        size_t ComputeNumEarlyExitTrials(const size_t num_matches,
+                                         const TwoViewGeometry::Options& options) {
+            const size_t num_inliers = static_cast<size_t>(
+                    std::ceil(options.early_exit_min_inlier_ratio * num_matches));
+            return RANSAC<FundamentalMatrixSevenPointEstimator>::ComputeNumTrials(
+                    num_inliers, num_matches, options.ransac_options.confidence);
+        }
+
+        // Run the trials of the estimations in interleaved rounds until all
+        // estimations are finished. Returns false, if the image pair was rejected
+        // early, because none of the estimations has found a model with the
+        // minimum number of inliers after the given number of trials.
+        bool RunInterleavedEstimation(
+                const std::vector<std::function<bool(const size_t)>>& iterate_funcs,
+                const std::function<size_t()>& max_num_inliers_func,
+                const size_t min_num_inliers, const size_t num_early_exit_trials) {
+            std::vector<char> running(iterate_funcs.size(), true);
+            size_t num_trials = 0;
+            bool early_exit = true;
+            while (std::find(running.begin(), running.end(), true) != running.end()) {
+                for (size_t i = 0; i < iterate_funcs.size(); ++i) {
+                    if (running[i]) {
+                        running[i] = iterate_funcs[i](kInterleavedNumTrialsPerRound);
+                    }
+                }
+
+                num_trials += kInterleavedNumTrialsPerRound;
+
+                if (early_exit) {
+                    if (max_num_inliers_func() >= min_num_inliers) {
+                        early_exit = false;
+                    } else if (num_trials >= num_early_exit_trials) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
     }  // namespace
 
     void TwoViewGeometry::Estimate(const Camera& camera1,
@@ -206,24 +286,74 @@ namespace bkmap {
                  camera2.ImageToWorldThreshold(options.ransac_options.max_error)) /
                 2;
 
-        LORANSAC<EssentialMatrixFivePointEstimator, EssentialMatrixFivePointEstimator>
-                E_ransac(E_ransac_options);
-        const auto E_report = E_ransac.Estimate(matched_points1_N, matched_points2_N);
+        RANSAC<EssentialMatrixFivePointEstimator>::Report E_report;
+        RANSAC<FundamentalMatrixSevenPointEstimator>::Report F_report;
+        RANSAC<HomographyMatrixEstimator>::Report H_report;
+
+        if (options.interleaved_estimation) {
+            SPRTLORANSAC<EssentialMatrixFivePointEstimator,
+            EssentialMatrixFivePointEstimator>
+                    E_ransac(E_ransac_options,
+                             CreateEssentialSPRTOptions(E_ransac_options));
+            SPRTLORANSAC<FundamentalMatrixSevenPointEstimator,
+            FundamentalMatrixEightPointEstimator>
+                    F_ransac(options.ransac_options,
+                             CreateFundamentalSPRTOptions(options.ransac_options));
+            SPRTLORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator>
+                    H_ransac(options.ransac_options,
+                             CreateHomographySPRTOptions(options.ransac_options));
+
+            E_ransac.Initialize(matched_points1_N, matched_points2_N);
+            F_ransac.Initialize(matched_points1, matched_points2);
+            H_ransac.Initialize(matched_points1, matched_points2);
+
+            const bool success = RunInterleavedEstimation(
+                    {[&E_ransac](const size_t num_trials) {
+                        return E_ransac.Iterate(num_trials);
+                    },
+                     [&F_ransac](const size_t num_trials) {
+                         return F_ransac.Iterate(num_trials);
+                     },
+                     [&H_ransac](const size_t num_trials) {
+                         return H_ransac.Iterate(num_trials);
+                     }},
+                    [&E_ransac, &F_ransac, &H_ransac]() {
+                        return std::max({E_ransac.NumInliers(), F_ransac.NumInliers(),
+                                         H_ransac.NumInliers()});
+                    },
+                    options.min_num_inliers,
+                    ComputeNumEarlyExitTrials(matches.size(), options));
+
+            if (!success) {
+                config = ConfigurationType::DEGENERATE;
+                return;
+            }
+
+            E_report = E_ransac.Finish();
+            F_report = F_ransac.Finish();
+            H_report = H_ransac.Finish();
+        } else {
+            LORANSAC<EssentialMatrixFivePointEstimator,
+            EssentialMatrixFivePointEstimator>
+                    E_ransac(E_ransac_options);
+            E_report = E_ransac.Estimate(matched_points1_N, matched_points2_N);
+
+            LORANSAC<FundamentalMatrixSevenPointEstimator,
+            FundamentalMatrixEightPointEstimator>
+                    F_ransac(options.ransac_options);
+            F_report = F_ransac.Estimate(matched_points1, matched_points2);
+
+            // Estimate planar or panoramic model.
+
+            LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
+                    options.ransac_options);
+            H_report = H_ransac.Estimate(matched_points1, matched_points2);
+        }
+
         E = E_report.model;
         E_num_inliers = E_report.support.num_inliers;
-
-        LORANSAC<FundamentalMatrixSevenPointEstimator,
-        FundamentalMatrixEightPointEstimator>
-                F_ransac(options.ransac_options);
-        const auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
         F = F_report.model;
         F_num_inliers = F_report.support.num_inliers;
-
-        // Estimate planar or panoramic model.
-
-        LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
-                options.ransac_options);
-        const auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
         H = H_report.model;
         H_num_inliers = H_report.support.num_inliers;
 
@@ -325,20 +455,56 @@ namespace bkmap {
             matched_points2[i] = points2[matches[i].point2D_idx2];
         }
 
-        // Estimate epipolar model.
+        // Estimate epipolar and planar or panoramic model.
+
+        RANSAC<FundamentalMatrixSevenPointEstimator>::Report F_report;
+        RANSAC<HomographyMatrixEstimator>::Report H_report;
+
+        if (options.interleaved_estimation) {
+            SPRTLORANSAC<FundamentalMatrixSevenPointEstimator,
+            FundamentalMatrixEightPointEstimator>
+                    F_ransac(options.ransac_options,
+                             CreateFundamentalSPRTOptions(options.ransac_options));
+            SPRTLORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator>
+                    H_ransac(options.ransac_options,
+                             CreateHomographySPRTOptions(options.ransac_options));
+
+            F_ransac.Initialize(matched_points1, matched_points2);
+            H_ransac.Initialize(matched_points1, matched_points2);
+
+            const bool success = RunInterleavedEstimation(
+                    {[&F_ransac](const size_t num_trials) {
+                        return F_ransac.Iterate(num_trials);
+                    },
+                     [&H_ransac](const size_t num_trials) {
+                         return H_ransac.Iterate(num_trials);
+                     }},
+                    [&F_ransac, &H_ransac]() {
+                        return std::max(F_ransac.NumInliers(), H_ransac.NumInliers());
+                    },
+                    options.min_num_inliers,
+                    ComputeNumEarlyExitTrials(matches.size(), options));
+
+            if (!success) {
+                config = ConfigurationType::DEGENERATE;
+                return;
+            }
+
+            F_report = F_ransac.Finish();
+            H_report = H_ransac.Finish();
+        } else {
+            LORANSAC<FundamentalMatrixSevenPointEstimator,
+            FundamentalMatrixEightPointEstimator>
+                    F_ransac(options.ransac_options);
+            F_report = F_ransac.Estimate(matched_points1, matched_points2);
+
+            LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
+                    options.ransac_options);
+            H_report = H_ransac.Estimate(matched_points1, matched_points2);
+        }
 
-        LORANSAC<FundamentalMatrixSevenPointEstimator,
-        FundamentalMatrixEightPointEstimator>
-                F_ransac(options.ransac_options);
-        const auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
         F = F_report.model;
         F_num_inliers = F_report.support.num_inliers;
-
-        // Estimate planar or panoramic model.
-
-        LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
-                options.ransac_options);
-        const auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
         H = H_report.model;
         H_num_inliers = H_report.support.num_inliers;
 
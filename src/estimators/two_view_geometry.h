@@ -77,6 +77,19 @@ namespace bkmap {
             // Whether to ignore watermark models in multiple model estimation.
             bool multiple_ignore_watermark = true;
 
+            // Whether to estimate the models in an interleaved schedule, in which
+            // the trials of the E, F, and H estimations alternate in small rounds and
+            // the models are verified with the sequential probability ratio test.
+            // Hopeless image pairs are rejected early, as defined by
+            // `early_exit_min_inlier_ratio`.
+            bool interleaved_estimation = false;
+
+            // In the interleaved estimation, an image pair is rejected as degenerate,
+            // if none of the models has reached `min_num_inliers`, once the number of
+            // trials suffices to sample an outlier-free fundamental matrix with
+            // the RANSAC confidence for pairs with this inlier ratio.
+            double early_exit_min_inlier_ratio = 0.5;
+
             // Options used to robustly estimate the geometry.
             RANSACOptions ransac_options;
 
@@ -90,6 +103,8 @@ namespace bkmap {
                 CHECK_LE(watermark_min_inlier_ratio, 1);
                 CHECK_GE(watermark_border_size, 0);
                 CHECK_LE(watermark_border_size, 1);
+                CHECK_GT(early_exit_min_inlier_ratio, 0);
+                CHECK_LE(early_exit_min_inlier_ratio, 1);
                 ransac_options.Check();
             }
         };
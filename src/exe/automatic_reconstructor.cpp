@@ -40,6 +40,10 @@ int main(int argc, char** argv) {
     options.AddDefaultOption("num_threads", &reconstruction_options.num_threads);
     options.AddDefaultOption("use_gpu", &reconstruction_options.use_gpu);
     options.AddDefaultOption("gpu_index", &reconstruction_options.gpu_index);
+    options.AddDefaultOption("image_cache_size",
+                             &reconstruction_options.image_cache_size);
+    options.AddDefaultOption("disk_image_cache",
+                             &reconstruction_options.disk_image_cache);
     options.Parse(argc, argv);
 
     StringToLower(&data_type);
@@ -0,0 +1,555 @@
+#include <Eigen/Geometry>
+
+#include "estimators/absolute_pose.h"
+#include "estimators/essential_matrix.h"
+#include "estimators/fundamental_matrix.h"
+#include "estimators/generalized_absolute_pose.h"
+#include "estimators/generalized_relative_pose.h"
+#include "estimators/homography_matrix.h"
+#include "estimators/triangulation.h"
+#include "optim/combination_sampler.h"
+#include "optim/loransac.h"
+#include "optim/progressive_sampler.h"
+#include "optim/random_sampler.h"
+#include "optim/ransac.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/random.h"
+#include "util/timer.h"
+
+using namespace bkmap;
+
+namespace {
+
+    // Focal length and principal point of the synthetic pinhole cameras, which
+    // are used for the estimators operating in pixel coordinates.
+    const double kFocalLength = 1000;
+    const double kPrincipalPoint = 500;
+
+    // Standard deviation of the noise of the inlier observations in pixels.
+    const double kNoiseStddev = 0.5;
+
+    // Maximum error of the inlier observations in pixels.
+    const double kMaxError = 4;
+
+    // Number of cameras of the synthetic generalized camera rig.
+    const size_t kNumRigCameras = 4;
+
+    // Number of observations of the synthetic point in the triangulation.
+    const size_t kNumTriangulationViews = 50;
+
+    // Number of precomputed minimal samples for the solver benchmarks.
+    const size_t kNumSolverSamples = 100;
+
+    struct BenchmarkOptions {
+        int num_points = 500;
+        int num_solves = 10000;
+        int num_runs = 10;
+        int max_num_trials = 10000;
+        std::vector<double> outlier_ratios;
+        // Only run the benchmarks, whose estimator name contains the filter.
+        std::string filter;
+    };
+
+    // Synthetic correspondences of an estimator with known inliers.
+    template <typename Estimator>
+    struct Problem {
+        std::vector<typename Estimator::X_t> X;
+        std::vector<typename Estimator::Y_t> Y;
+        std::vector<char> inlier_mask;
+        // The maximum error of the inliers in the units of the residuals.
+        double max_error = 0;
+    };
+
+    // Triangulation estimator with angular residuals, which do not require the
+    // camera models of the observations.
+    class AngularTriangulationEstimator : public TriangulationEstimator {
+    public:
+        AngularTriangulationEstimator() {
+            SetResidualType(ResidualType::ANGULAR_ERROR);
+        }
+    };
+
+    Eigen::Matrix3d RandomRotation(const double max_angle) {
+        const Eigen::Vector3d axis = Eigen::Vector3d::Random().normalized();
+        return Eigen::AngleAxisd(RandomReal(-max_angle, max_angle), axis)
+                .toRotationMatrix();
+    }
+
+    Eigen::Matrix3x4d RandomTransformation(const double max_angle,
+                                           const double translation) {
+        Eigen::Matrix3x4d tform;
+        tform.leftCols<3>() = RandomRotation(max_angle);
+        tform.col(3) = translation * Eigen::Vector3d::Random().normalized();
+        return tform;
+    }
+
+    Eigen::Matrix3x4d InvertTransformation(const Eigen::Matrix3x4d& tform) {
+        Eigen::Matrix3x4d inv_tform;
+        inv_tform.leftCols<3>() = tform.leftCols<3>().transpose();
+        inv_tform.col(3) = -inv_tform.leftCols<3>() * tform.col(3);
+        return inv_tform;
+    }
+
+    // Random point in front of a camera at the origin.
+    Eigen::Vector3d RandomPoint3D() {
+        const double depth = RandomReal(4.0, 8.0);
+        return Eigen::Vector3d(RandomReal(-0.4, 0.4) * depth,
+                               RandomReal(-0.4, 0.4) * depth, depth);
+    }
+
+    // Random normalized image point of an outlier observation.
+    Eigen::Vector2d RandomImagePoint() {
+        return Eigen::Vector2d(RandomReal(-0.5, 0.5), RandomReal(-0.5, 0.5));
+    }
+
+    // Project a point and add noise to its normalized image observation.
+    Eigen::Vector2d ProjectPoint(const Eigen::Matrix3x4d& proj_matrix,
+                                 const Eigen::Vector3d& point3D) {
+        const Eigen::Vector2d noise(RandomGaussian(0.0, kNoiseStddev),
+                                    RandomGaussian(0.0, kNoiseStddev));
+        return (proj_matrix * point3D.homogeneous()).hnormalized() +
+               noise / kFocalLength;
+    }
+
+    Eigen::Vector2d NormalizedToPixel(const Eigen::Vector2d& point) {
+        return kFocalLength * point + Eigen::Vector2d::Constant(kPrincipalPoint);
+    }
+
+    // Draw the mask of inliers with the given ratio of outliers.
+    std::vector<char> RandomInlierMask(const size_t num_points,
+                                       const double outlier_ratio) {
+        const size_t num_outliers =
+                static_cast<size_t>(std::round(outlier_ratio * num_points));
+        std::vector<char> inlier_mask(num_points, true);
+        std::fill(inlier_mask.begin(), inlier_mask.begin() + num_outliers, false);
+        Shuffle(static_cast<uint32_t>(num_points), &inlier_mask);
+        return inlier_mask;
+    }
+
+    // Correspondences in normalized (or pixel) coordinates between two views of
+    // a general or a planar scene.
+    template <typename Estimator>
+    Problem<Estimator> GenerateTwoViewProblem(const size_t num_points,
+                                              const double outlier_ratio,
+                                              const bool planar,
+                                              const bool pixel_coordinates) {
+        Problem<Estimator> problem;
+        problem.inlier_mask = RandomInlierMask(num_points, outlier_ratio);
+        problem.max_error =
+                pixel_coordinates ? kMaxError : kMaxError / kFocalLength;
+
+        const Eigen::Matrix3x4d proj_matrix1 = Eigen::Matrix3x4d::Identity();
+        const Eigen::Matrix3x4d proj_matrix2 = RandomTransformation(0.2, 1);
+
+        // The plane of the planar scene in front of the first camera.
+        const Eigen::Vector3d plane_normal =
+                (Eigen::Vector3d(0, 0, 1) + 0.2 * Eigen::Vector3d::Random())
+                        .normalized();
+        const double plane_distance = 6;
+
+        for (size_t i = 0; i < num_points; ++i) {
+            Eigen::Vector3d point3D = RandomPoint3D();
+            if (planar) {
+                point3D *= plane_distance / plane_normal.dot(point3D);
+            }
+
+            Eigen::Vector2d point1 = ProjectPoint(proj_matrix1, point3D);
+            Eigen::Vector2d point2 = problem.inlier_mask[i]
+                                     ? ProjectPoint(proj_matrix2, point3D)
+                                     : RandomImagePoint();
+            if (pixel_coordinates) {
+                point1 = NormalizedToPixel(point1);
+                point2 = NormalizedToPixel(point2);
+            }
+
+            problem.X.push_back(point1);
+            problem.Y.push_back(point2);
+        }
+
+        return problem;
+    }
+
+    template <typename Estimator>
+    Problem<Estimator> GenerateEssentialMatrixProblem(const size_t num_points,
+                                                      const double outlier_ratio) {
+        return GenerateTwoViewProblem<Estimator>(num_points, outlier_ratio, false,
+                                                 false);
+    }
+
+    template <typename Estimator>
+    Problem<Estimator> GenerateFundamentalMatrixProblem(
+            const size_t num_points, const double outlier_ratio) {
+        return GenerateTwoViewProblem<Estimator>(num_points, outlier_ratio, false,
+                                                 true);
+    }
+
+    Problem<HomographyMatrixEstimator> GenerateHomographyProblem(
+            const size_t num_points, const double outlier_ratio) {
+        return GenerateTwoViewProblem<HomographyMatrixEstimator>(
+                num_points, outlier_ratio, true, true);
+    }
+
+    // 2D-3D correspondences of a calibrated camera.
+    template <typename Estimator>
+    Problem<Estimator> GenerateAbsolutePoseProblem(const size_t num_points,
+                                                   const double outlier_ratio) {
+        Problem<Estimator> problem;
+        problem.inlier_mask = RandomInlierMask(num_points, outlier_ratio);
+        problem.max_error = kMaxError / kFocalLength;
+
+        const Eigen::Matrix3x4d proj_matrix = RandomTransformation(M_PI, 2);
+        const Eigen::Matrix3x4d inv_proj_matrix = InvertTransformation(proj_matrix);
+
+        for (size_t i = 0; i < num_points; ++i) {
+            const Eigen::Vector3d point3D_camera = RandomPoint3D();
+            const Eigen::Vector3d point3D =
+                    inv_proj_matrix * point3D_camera.homogeneous();
+            problem.X.push_back(problem.inlier_mask[i]
+                                ? ProjectPoint(proj_matrix, point3D)
+                                : RandomImagePoint());
+            problem.Y.push_back(point3D);
+        }
+
+        return problem;
+    }
+
+    // The relative transformations of the cameras in a generalized camera rig.
+    std::vector<Eigen::Matrix3x4d> GenerateCameraRig() {
+        std::vector<Eigen::Matrix3x4d> rel_tforms(kNumRigCameras);
+        for (auto& rel_tform : rel_tforms) {
+            rel_tform = RandomTransformation(0.1, 0.5);
+        }
+        return rel_tforms;
+    }
+
+    // 2D-3D correspondences of a generalized camera rig.
+    Problem<GP3PEstimator> GenerateGeneralizedAbsolutePoseProblem(
+            const size_t num_points, const double outlier_ratio) {
+        Problem<GP3PEstimator> problem;
+        problem.inlier_mask = RandomInlierMask(num_points, outlier_ratio);
+        problem.max_error = kMaxError / kFocalLength;
+
+        const std::vector<Eigen::Matrix3x4d> rel_tforms = GenerateCameraRig();
+        const Eigen::Matrix3x4d rig_tform = RandomTransformation(M_PI, 2);
+        const Eigen::Matrix3x4d inv_rig_tform = InvertTransformation(rig_tform);
+
+        for (size_t i = 0; i < num_points; ++i) {
+            const Eigen::Vector3d point3D_rig = RandomPoint3D();
+            GP3PEstimator::X_t point2D;
+            point2D.rel_tform = rel_tforms[i % kNumRigCameras];
+            point2D.xy = problem.inlier_mask[i]
+                         ? ProjectPoint(point2D.rel_tform, point3D_rig)
+                         : RandomImagePoint();
+            problem.X.push_back(point2D);
+            problem.Y.push_back(inv_rig_tform * point3D_rig.homogeneous());
+        }
+
+        return problem;
+    }
+
+    // 2D-2D correspondences between two poses of a generalized camera rig, where
+    // the points are observed by different cameras of the rig in both poses.
+    Problem<GR6PEstimator> GenerateGeneralizedRelativePoseProblem(
+            const size_t num_points, const double outlier_ratio) {
+        Problem<GR6PEstimator> problem;
+        problem.inlier_mask = RandomInlierMask(num_points, outlier_ratio);
+        problem.max_error = kMaxError / kFocalLength;
+
+        const std::vector<Eigen::Matrix3x4d> rel_tforms = GenerateCameraRig();
+        const Eigen::Matrix3x4d rig_tform = RandomTransformation(0.2, 1);
+
+        for (size_t i = 0; i < num_points; ++i) {
+            const Eigen::Vector3d point3D1 = RandomPoint3D();
+            const Eigen::Vector3d point3D2 = rig_tform * point3D1.homogeneous();
+            GR6PEstimator::X_t point1;
+            point1.rel_tform = rel_tforms[i % kNumRigCameras];
+            point1.xy = ProjectPoint(point1.rel_tform, point3D1);
+            GR6PEstimator::Y_t point2;
+            point2.rel_tform = rel_tforms[(i + 1) % kNumRigCameras];
+            point2.xy = problem.inlier_mask[i]
+                        ? ProjectPoint(point2.rel_tform, point3D2)
+                        : RandomImagePoint();
+            problem.X.push_back(point1);
+            problem.Y.push_back(point2);
+        }
+
+        return problem;
+    }
+
+    // Observations of a single point in many views. The number of points is
+    // ignored, since the triangulation is estimated from the observations.
+    Problem<AngularTriangulationEstimator> GenerateTriangulationProblem(
+            const size_t, const double outlier_ratio) {
+        Problem<AngularTriangulationEstimator> problem;
+        problem.inlier_mask =
+                RandomInlierMask(kNumTriangulationViews, outlier_ratio);
+        // The angular residuals are compared against the squared maximum error.
+        problem.max_error = std::sqrt(kMaxError / kFocalLength);
+
+        const Eigen::Vector3d point3D(0, 0, 10);
+
+        for (size_t i = 0; i < kNumTriangulationViews; ++i) {
+            const Eigen::Vector3d proj_center(RandomReal(-3.0, 3.0),
+                                              RandomReal(-3.0, 3.0), 0);
+            Eigen::Matrix3x4d proj_matrix;
+            proj_matrix.leftCols<3>() = RandomRotation(0.1);
+            proj_matrix.col(3) = -proj_matrix.leftCols<3>() * proj_center;
+
+            const Eigen::Vector2d point2D =
+                    problem.inlier_mask[i] ? ProjectPoint(proj_matrix, point3D)
+                                           : RandomImagePoint();
+            problem.X.emplace_back(NormalizedToPixel(point2D), point2D);
+            problem.Y.emplace_back(proj_matrix, proj_center, nullptr);
+        }
+
+        return problem;
+    }
+
+    // Measure the time per call of the minimal solver on outlier-free samples.
+    template <typename Estimator>
+    void BenchmarkSolver(const std::string& name, const Problem<Estimator>& problem,
+                         const BenchmarkOptions& options) {
+        std::vector<std::vector<typename Estimator::X_t>> X_samples(
+                kNumSolverSamples);
+        std::vector<std::vector<typename Estimator::Y_t>> Y_samples(
+                kNumSolverSamples);
+        RandomSampler sampler(Estimator::kMinNumSamples);
+        sampler.Initialize(problem.X.size());
+        for (size_t i = 0; i < kNumSolverSamples; ++i) {
+            X_samples[i].resize(Estimator::kMinNumSamples);
+            Y_samples[i].resize(Estimator::kMinNumSamples);
+            sampler.SampleXY(problem.X, problem.Y, &X_samples[i], &Y_samples[i]);
+        }
+
+        Estimator estimator;
+        size_t num_models = 0;
+
+        Timer timer;
+        timer.Start();
+        for (int i = 0; i < options.num_solves; ++i) {
+            const size_t sample_idx = i % kNumSolverSamples;
+            num_models +=
+                    estimator.Estimate(X_samples[sample_idx], Y_samples[sample_idx])
+                            .size();
+        }
+        const double elapsed_nanoseconds = 1000 * timer.ElapsedMicroSeconds();
+
+        std::cout << StringPrintf("%-16s %12.1f %12.2f", name.c_str(),
+                                  elapsed_nanoseconds / options.num_solves,
+                                  static_cast<double>(num_models) / options.num_solves)
+        << std::endl;
+    }
+
+    // Measure the time, the number of trials, and the inlier recall and
+    // precision of a robust estimator.
+    template <typename RANSACType, typename Estimator>
+    void BenchmarkRANSAC(const std::string& name, const std::string& method,
+                         const std::string& sampler_name,
+                         const double outlier_ratio,
+                         const Problem<Estimator>& problem,
+                         const BenchmarkOptions& options) {
+        RANSACOptions ransac_options;
+        ransac_options.max_error = problem.max_error;
+        ransac_options.confidence = 0.999;
+        ransac_options.min_inlier_ratio = 0.1;
+        ransac_options.max_num_trials = static_cast<size_t>(options.max_num_trials);
+
+        size_t num_true_inliers = 0;
+        for (const char is_inlier : problem.inlier_mask) {
+            num_true_inliers += is_inlier;
+        }
+
+        double elapsed_seconds = 0;
+        size_t num_trials = 0;
+        size_t num_successes = 0;
+        double recall_sum = 0;
+        double precision_sum = 0;
+
+        for (int i = 0; i < options.num_runs; ++i) {
+            RANSACType ransac(ransac_options);
+
+            Timer timer;
+            timer.Start();
+            const auto report = ransac.Estimate(problem.X, problem.Y);
+            elapsed_seconds += timer.ElapsedSeconds();
+
+            num_trials += report.num_trials;
+
+            if (!report.success) {
+                continue;
+            }
+
+            num_successes += 1;
+
+            size_t num_correct_inliers = 0;
+            for (size_t j = 0; j < report.inlier_mask.size(); ++j) {
+                if (report.inlier_mask[j] && problem.inlier_mask[j]) {
+                    num_correct_inliers += 1;
+                }
+            }
+
+            if (num_true_inliers > 0) {
+                recall_sum +=
+                        static_cast<double>(num_correct_inliers) / num_true_inliers;
+            }
+            if (report.support.num_inliers > 0) {
+                precision_sum += static_cast<double>(num_correct_inliers) /
+                                 report.support.num_inliers;
+            }
+        }
+
+        std::cout << StringPrintf(
+                "%-16s %-9s %-12s %8.2f %10.3f %10.1f %8.3f %8.3f %8.2f", name.c_str(),
+                method.c_str(), sampler_name.c_str(), outlier_ratio,
+                1000 * elapsed_seconds / options.num_runs,
+                static_cast<double>(num_trials) / options.num_runs,
+                recall_sum / options.num_runs, precision_sum / options.num_runs,
+                static_cast<double>(num_successes) / options.num_runs)
+        << std::endl;
+    }
+
+    template <typename Estimator>
+    void BenchmarkSolver(const std::string& name,
+                         Problem<Estimator> (*GenerateProblem)(const size_t,
+                                                               const double),
+                         const BenchmarkOptions& options) {
+        if (name.find(options.filter) == std::string::npos) {
+            return;
+        }
+
+        BenchmarkSolver(name, GenerateProblem(options.num_points, 0), options);
+    }
+
+    // Run RANSAC and LO-RANSAC with all samplers for all outlier ratios.
+    template <typename Estimator, typename LocalEstimator>
+    void BenchmarkRANSAC(const std::string& name,
+                         Problem<Estimator> (*GenerateProblem)(const size_t,
+                                                               const double),
+                         const BenchmarkOptions& options) {
+        if (name.find(options.filter) == std::string::npos) {
+            return;
+        }
+
+        for (const double outlier_ratio : options.outlier_ratios) {
+            const Problem<Estimator> problem =
+                    GenerateProblem(options.num_points, outlier_ratio);
+
+            BenchmarkRANSAC<RANSAC<Estimator, InlierSupportMeasurer, RandomSampler>>(
+                    name, "RANSAC", "random", outlier_ratio, problem, options);
+            BenchmarkRANSAC<
+                    RANSAC<Estimator, InlierSupportMeasurer, ProgressiveSampler>>(
+                    name, "RANSAC", "progressive", outlier_ratio, problem, options);
+            BenchmarkRANSAC<
+                    RANSAC<Estimator, InlierSupportMeasurer, CombinationSampler>>(
+                    name, "RANSAC", "combination", outlier_ratio, problem, options);
+
+            BenchmarkRANSAC<LORANSAC<Estimator, LocalEstimator, InlierSupportMeasurer,
+                    RandomSampler>>(name, "LORANSAC", "random",
+                                    outlier_ratio, problem, options);
+            BenchmarkRANSAC<LORANSAC<Estimator, LocalEstimator, InlierSupportMeasurer,
+                    ProgressiveSampler>>(name, "LORANSAC", "progressive",
+                                         outlier_ratio, problem, options);
+            BenchmarkRANSAC<LORANSAC<Estimator, LocalEstimator, InlierSupportMeasurer,
+                    CombinationSampler>>(name, "LORANSAC", "combination",
+                                         outlier_ratio, problem, options);
+        }
+    }
+
+}  // namespace
+
+// Microbenchmarks of the minimal solvers and of the robust estimators on
+// synthetic data with known inliers. Note that the data is not ordered by
+// quality, such that the progressive sampler has no prior information.
+int main(int argc, char** argv) {
+    InitializeGlog(argv);
+
+    BenchmarkOptions benchmark_options;
+    std::string outlier_ratios = "0.1,0.3,0.5,0.7";
+    int random_seed = 0;
+
+    OptionManager options;
+    options.AddDefaultOption("num_points", &benchmark_options.num_points);
+    options.AddDefaultOption("num_solves", &benchmark_options.num_solves);
+    options.AddDefaultOption("num_runs", &benchmark_options.num_runs);
+    options.AddDefaultOption("max_num_trials", &benchmark_options.max_num_trials);
+    options.AddDefaultOption("outlier_ratios", &outlier_ratios);
+    options.AddDefaultOption("filter", &benchmark_options.filter);
+    options.AddDefaultOption("random_seed", &random_seed);
+    options.Parse(argc, argv);
+
+    CHECK_GT(benchmark_options.num_points, 0);
+    CHECK_GT(benchmark_options.num_solves, 0);
+    CHECK_GT(benchmark_options.num_runs, 0);
+    CHECK_GT(benchmark_options.max_num_trials, 0);
+
+    benchmark_options.outlier_ratios = CSVToVector<double>(outlier_ratios);
+    for (const double outlier_ratio : benchmark_options.outlier_ratios) {
+        CHECK_GE(outlier_ratio, 0);
+        CHECK_LT(outlier_ratio, 1);
+    }
+
+    SetPRNGSeed(static_cast<unsigned>(random_seed));
+    std::srand(static_cast<unsigned>(random_seed));
+
+    PrintHeading1("Minimal solvers");
+
+    std::cout << StringPrintf("%-16s %12s %12s", "Estimator", "ns/solve",
+                              "models/solve")
+    << std::endl;
+
+    BenchmarkSolver("essential_5pt",
+                    GenerateEssentialMatrixProblem<EssentialMatrixFivePointEstimator>,
+                    benchmark_options);
+    BenchmarkSolver(
+            "fundamental_7pt",
+            GenerateFundamentalMatrixProblem<FundamentalMatrixSevenPointEstimator>,
+            benchmark_options);
+    BenchmarkSolver(
+            "fundamental_8pt",
+            GenerateFundamentalMatrixProblem<FundamentalMatrixEightPointEstimator>,
+            benchmark_options);
+    BenchmarkSolver("homography", GenerateHomographyProblem, benchmark_options);
+    BenchmarkSolver("p3p", GenerateAbsolutePoseProblem<P3PEstimator>,
+                    benchmark_options);
+    BenchmarkSolver("epnp", GenerateAbsolutePoseProblem<EPNPEstimator>,
+                    benchmark_options);
+    BenchmarkSolver("gp3p", GenerateGeneralizedAbsolutePoseProblem,
+                    benchmark_options);
+    BenchmarkSolver("gr6p", GenerateGeneralizedRelativePoseProblem,
+                    benchmark_options);
+    BenchmarkSolver("triangulation", GenerateTriangulationProblem,
+                    benchmark_options);
+
+    PrintHeading1("Robust estimators");
+
+    std::cout << StringPrintf("%-16s %-9s %-12s %8s %10s %10s %8s %8s %8s",
+                              "Estimator", "Method", "Sampler", "Outliers",
+                              "ms/run", "Trials", "Recall", "Precis.", "Success")
+    << std::endl;
+
+    BenchmarkRANSAC<EssentialMatrixFivePointEstimator,
+            EssentialMatrixFivePointEstimator>(
+            "essential_5pt",
+            GenerateEssentialMatrixProblem<EssentialMatrixFivePointEstimator>,
+            benchmark_options);
+    BenchmarkRANSAC<FundamentalMatrixSevenPointEstimator,
+            FundamentalMatrixEightPointEstimator>(
+            "fundamental_7pt",
+            GenerateFundamentalMatrixProblem<FundamentalMatrixSevenPointEstimator>,
+            benchmark_options);
+    BenchmarkRANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator>(
+            "homography", GenerateHomographyProblem, benchmark_options);
+    BenchmarkRANSAC<P3PEstimator, EPNPEstimator>(
+            "p3p", GenerateAbsolutePoseProblem<P3PEstimator>, benchmark_options);
+    BenchmarkRANSAC<GP3PEstimator, GP3PEstimator>(
+            "gp3p", GenerateGeneralizedAbsolutePoseProblem, benchmark_options);
+    BenchmarkRANSAC<GR6PEstimator, GR6PEstimator>(
+            "gr6p", GenerateGeneralizedRelativePoseProblem, benchmark_options);
+    BenchmarkRANSAC<AngularTriangulationEstimator,
+            AngularTriangulationEstimator>(
+            "triangulation", GenerateTriangulationProblem, benchmark_options);
+
+    return EXIT_SUCCESS;
+}
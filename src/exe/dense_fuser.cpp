@@ -13,14 +13,14 @@ int main(int argc, char* argv[]) {
 
   std::string workspace_path;
   std::string input_type = "geometric";
-  std::string workspace_format = "COLMAP";
+  std::string workspace_format = "bkmap";
   std::string pmvs_option_name = "option-all";
   std::string output_path;
 
   OptionManager options;
   options.AddRequiredOption("workspace_path", &workspace_path);
   options.AddDefaultOption("workspace_format", &workspace_format,
-                           "{COLMAP, PMVS}");
+                           "{bkmap, PMVS}");
   options.AddDefaultOption("pmvs_option_name", &pmvs_option_name);
   options.AddDefaultOption("input_type", &input_type,
                            "{photometric, geometric}");
@@ -31,7 +31,7 @@ int main(int argc, char* argv[]) {
   StringToLower(&workspace_format);
   if (workspace_format != "bkmap" && workspace_format != "pmvs") {
     std::cout << "ERROR: Invalid `workspace_format` - supported values are "
-                 "'COLMAP' or 'PMVS'."
+                 "'bkmap' or 'PMVS'."
               << std::endl;
     return EXIT_FAILURE;
   }
@@ -0,0 +1,51 @@
+#include "base/database.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/timer.h"
+
+using namespace bkmap;
+
+// Export the features of the database to its memory-mapped sidecar feature
+// store or import the features of a feature store into the database.
+int main(int argc, char** argv) {
+    InitializeGlog(argv);
+
+    std::string mode;
+    std::string store_path;
+
+    OptionManager options;
+    options.AddDatabaseOptions();
+    options.AddRequiredOption("mode", &mode, "{'export', 'import'}");
+    options.AddDefaultOption("store_path", &store_path);
+    options.Parse(argc, argv);
+
+    if (store_path.empty()) {
+        store_path = FeatureStore::DefaultPath(*options.database_path);
+    }
+
+    Timer timer;
+    timer.Start();
+
+    Database database(*options.database_path);
+
+    if (mode == "export") {
+        PrintHeading1("Exporting features to " + store_path);
+        database.ExportFeatureStore(store_path);
+    } else if (mode == "import") {
+        if (!ExistsFile(store_path)) {
+            std::cerr << "ERROR: Feature store does not exist" << std::endl;
+            return EXIT_FAILURE;
+        }
+        PrintHeading1("Importing features from " + store_path);
+        database.ImportFeatureStore(store_path);
+    } else {
+        std::cerr << "ERROR: Invalid mode, must be 'export' or 'import'"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    timer.PrintMinutes();
+
+    return EXIT_SUCCESS;
+}
@@ -2,60 +2,46 @@
 // Created by tri on 25/09/2017.
 //
 
+#include <algorithm>
+#include <numeric>
+#include <random>
+
 #include "base/database.h"
-#include "optim/random_sampler.h"
 #include "retrieval/visual_index.h"
+#include "retrieval/vocab_tree_builder.h"
 #include "util/logging.h"
 #include "util/option_manager.h"
 
 using namespace bkmap;
 
-// Loads descriptors for training from the database. Loads all descriptors from
-// the database if max_num_images < 0, otherwise the descriptors of a random
-// subset of images are selected.
-FeatureDescriptors LoadDescriptors(const std::string& database_path,
-                                   const int max_num_images) {
-    Database database(database_path);
-    DatabaseTransaction database_transaction(&database);
-
+// Selects the images whose descriptors are used for training. Selects all
+// images in the database if max_num_images < 0, otherwise a random subset of
+// images is selected. The subset is drawn with a fixed seed and is the same on
+// every run, so that a build resumed from its checkpoint is trained on the
+// same descriptors.
+std::vector<image_t> SelectImages(const Database& database,
+                                  const int max_num_images) {
     const std::vector<Image> images = database.ReadAllImages();
 
-    FeatureDescriptors descriptors;
-
-    std::vector<size_t> image_ids;
-    size_t num_descriptors = 0;
+    std::vector<image_t> image_ids;
     if (max_num_images < 0) {
         // All images in the database.
-        image_ids.resize(images.size());
-        std::iota(image_ids.begin(), image_ids.end(), 0);
-        num_descriptors = database.NumDescriptors();
+        for (const auto& image : images) {
+            image_ids.push_back(image.ImageId());
+        }
     } else {
         // Random subset of images in the database.
         CHECK_LE(max_num_images, images.size());
-        RandomSampler random_sampler(max_num_images);
-        random_sampler.Initialize(images.size());
-        image_ids = random_sampler.Sample();
-        for (const auto image_id : image_ids) {
-            const auto& image = images.at(image_id);
-            num_descriptors += database.NumDescriptorsForImage(image.ImageId());
+        std::vector<size_t> image_idxs(images.size());
+        std::iota(image_idxs.begin(), image_idxs.end(), 0);
+        std::mt19937 prng(0);
+        std::shuffle(image_idxs.begin(), image_idxs.end(), prng);
+        for (int i = 0; i < max_num_images; ++i) {
+            image_ids.push_back(images.at(image_idxs[i]).ImageId());
         }
     }
 
-    descriptors.resize(num_descriptors, 128);
-
-    size_t descriptor_row = 0;
-    for (const auto image_id : image_ids) {
-        const auto& image = images.at(image_id);
-        const FeatureDescriptors image_descriptors =
-                database.ReadDescriptors(image.ImageId());
-        descriptors.block(descriptor_row, 0, image_descriptors.rows(), 128) =
-                image_descriptors;
-        descriptor_row += image_descriptors.rows();
-    }
-
-    CHECK_EQ(descriptor_row, num_descriptors);
-
-    return descriptors;
+    return image_ids;
 }
 
 int main(int argc, char** argv) {
@@ -63,27 +49,54 @@ int main(int argc, char** argv) {
 
     std::string vocab_tree_path;
     retrieval::VisualIndex<>::BuildOptions build_options;
+    retrieval::VocabTreeBuilder::Options builder_options;
     int max_num_images = -1;
 
     OptionManager options;
     options.AddDatabaseOptions();
     options.AddRequiredOption("vocab_tree_path", &vocab_tree_path);
-    options.AddDefaultOption("num_visual_words", &build_options.num_visual_words);
-    options.AddDefaultOption("branching", &build_options.branching);
-    options.AddDefaultOption("num_iterations", &build_options.num_iterations);
+    options.AddDefaultOption("num_visual_words",
+                             &builder_options.num_visual_words);
+    options.AddDefaultOption("branching", &builder_options.branching);
+    options.AddDefaultOption("num_iterations", &builder_options.num_iterations);
+    options.AddDefaultOption("num_samples_per_cluster",
+                             &builder_options.num_samples_per_cluster);
+    options.AddDefaultOption("max_num_samples", &builder_options.max_num_samples);
+    options.AddDefaultOption("num_threads", &builder_options.num_threads);
+    options.AddDefaultOption("checkpoint_path", &builder_options.checkpoint_path);
     options.AddDefaultOption("max_num_images", &max_num_images);
     options.Parse(argc, argv);
 
-    retrieval::VisualIndex<> visual_index;
-
-    std::cout << "Loading descriptors..." << std::endl;
-    const auto descriptors =
-            LoadDescriptors(*options.database_path, max_num_images);
-    std::cout << "  => Loaded a total of " << descriptors.rows() << " descriptors"
-    << std::endl;
+    build_options.num_visual_words = builder_options.num_visual_words;
+    build_options.branching = builder_options.branching;
+    build_options.num_iterations = builder_options.num_iterations;
+    build_options.num_threads = builder_options.num_threads;
+
+    Database database(*options.database_path);
+
+    const std::vector<image_t> image_ids =
+            SelectImages(database, max_num_images);
+    std::cout << "Training on the descriptors of " << image_ids.size()
+    << " images" << std::endl;
+
+    // The descriptors are read from the database for every level of the tree,
+    // so that they never have to be held in memory at once.
+    auto descriptor_source =
+            [&](const retrieval::VocabTreeBuilder::DescriptorCallback& callback) {
+                DatabaseTransaction database_transaction(&database);
+                for (const auto image_id : image_ids) {
+                    callback(database.ReadDescriptors(image_id));
+                }
+            };
+
+    FeatureDescriptors visual_words;
+    FeatureDescriptors descriptors_sample;
+    retrieval::VocabTreeBuilder builder(builder_options, descriptor_source);
+    builder.Build(&visual_words, &descriptors_sample);
 
     std::cout << "Building index for visual words..." << std::endl;
-    visual_index.Build(build_options, descriptors);
+    retrieval::VisualIndex<> visual_index;
+    visual_index.Build(build_options, visual_words, descriptors_sample);
     std::cout << " => Quantized descriptor space using "
     << visual_index.NumVisualWords() << " visual words" << std::endl;
 
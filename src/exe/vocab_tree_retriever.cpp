@@ -30,13 +30,19 @@ std::vector<Image> ReadImageList(const std::string& path, Database* database) {
     return images;
 }
 
-void IndexImagesInVisualIndex(const int max_num_features,
-                              const std::vector<Image>& images,
-                              Database* database,
-                              retrieval::VisualIndex<>* visual_index) {
+// Index the images that are not indexed yet and return their number.
+size_t IndexImagesInVisualIndex(const int max_num_features,
+                                const std::vector<Image>& images,
+                                Database* database,
+                                retrieval::VisualIndex<>* visual_index) {
     DatabaseTransaction database_transaction(database);
 
+    size_t num_indexed_images = 0;
     for (size_t i = 0; i < images.size(); ++i) {
+        if (visual_index->HasImage(images[i].ImageId())) {
+            continue;
+        }
+
         Timer timer;
         timer.Start();
 
@@ -51,12 +57,17 @@ void IndexImagesInVisualIndex(const int max_num_features,
 
         visual_index->Add(retrieval::VisualIndex<>::IndexOptions(),
                           images[i].ImageId(), keypoints, descriptors);
+        num_indexed_images += 1;
 
         std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
     }
 
     // Compute the TF-IDF weights, etc.
-    visual_index->Prepare();
+    if (num_indexed_images > 0 || !visual_index->IsPrepared()) {
+        visual_index->Prepare();
+    }
+
+    return num_indexed_images;
 }
 
 void QueryImagesInVisualIndex(const int max_num_features,
@@ -77,32 +88,55 @@ void QueryImagesInVisualIndex(const int max_num_features,
         image_id_to_image.emplace(image.ImageId(), &image);
     }
 
-    for (size_t i = 0; i < query_images.size(); ++i) {
+    // Query the images in batches, which is much faster than querying them one
+    // by one, since the visual words and inverted files are searched at once.
+    const size_t kQueryBatchSize = 64;
+
+    for (size_t begin = 0; begin < query_images.size(); begin += kQueryBatchSize) {
+        const size_t end = std::min(begin + kQueryBatchSize, query_images.size());
+
         Timer timer;
         timer.Start();
 
-        std::cout << StringPrintf("Querying for image %s [%d/%d]",
-                                  query_images[i].Name().c_str(), i + 1,
+        std::cout << StringPrintf("Querying for images [%d-%d/%d]", begin + 1, end,
                                   query_images.size())
         << std::flush;
 
-        auto keypoints = database->ReadKeypoints(query_images[i].ImageId());
-        auto descriptors = database->ReadDescriptors(query_images[i].ImageId());
-        if (max_num_features > 0 && descriptors.rows() > max_num_features) {
-            ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
+        std::vector<FeatureKeypoints> keypoints;
+        std::vector<FeatureDescriptors> descriptors;
+        keypoints.reserve(end - begin);
+        descriptors.reserve(end - begin);
+        for (size_t i = begin; i < end; ++i) {
+            keypoints.push_back(database->ReadKeypoints(query_images[i].ImageId()));
+            descriptors.push_back(
+                    database->ReadDescriptors(query_images[i].ImageId()));
+            if (max_num_features > 0 &&
+                descriptors.back().rows() > max_num_features) {
+                ExtractTopScaleFeatures(&keypoints.back(), &descriptors.back(),
+                                        max_num_features);
+            }
         }
 
-        std::vector<retrieval::ImageScore> image_scores;
+        std::vector<std::vector<retrieval::ImageScore>> image_scores;
         visual_index->QueryWithVerification(query_options, keypoints, descriptors,
                                             &image_scores);
 
         std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
-        for (const auto& image_score : image_scores) {
-            const auto& image = *image_id_to_image.at(image_score.image_id);
-            std::cout << StringPrintf("  image_id=%d, image_name=%s, score=%f",
-                                      image_score.image_id, image.Name().c_str(),
-                                      image_score.score)
+        for (size_t i = begin; i < end; ++i) {
+            std::cout << StringPrintf("Image %s", query_images[i].Name().c_str())
             << std::endl;
+            for (const auto& image_score : image_scores[i - begin]) {
+                // A persistent index can contain images that are not in the list.
+                const auto image_it = image_id_to_image.find(image_score.image_id);
+                if (image_it == image_id_to_image.end()) {
+                    continue;
+                }
+                std::cout << StringPrintf("  image_id=%d, image_name=%s, score=%f",
+                                          image_score.image_id,
+                                          image_it->second->Name().c_str(),
+                                          image_score.score)
+                << std::endl;
+            }
         }
     }
 }
@@ -111,6 +145,7 @@ int main(int argc, char** argv) {
     InitializeGlog(argv);
 
     std::string vocab_tree_path;
+    std::string index_path;
     std::string database_image_list_path;
     std::string query_image_list_path;
     int num_images = -1;
@@ -120,6 +155,7 @@ int main(int argc, char** argv) {
     OptionManager options;
     options.AddDatabaseOptions();
     options.AddRequiredOption("vocab_tree_path", &vocab_tree_path);
+    options.AddDefaultOption("index_path", &index_path);
     options.AddDefaultOption("database_image_list_path",
                              &database_image_list_path);
     options.AddDefaultOption("query_image_list_path", &query_image_list_path);
@@ -128,8 +164,14 @@ int main(int argc, char** argv) {
     options.AddDefaultOption("max_num_features", &max_num_features);
     options.Parse(argc, argv);
 
+    // The persistent index of previously indexed images is read instead of the
+    // vocabulary tree, if it exists, and the newly indexed images are appended.
     retrieval::VisualIndex<> visual_index;
-    visual_index.Read(vocab_tree_path);
+    if (!index_path.empty() && ExistsFile(index_path)) {
+        visual_index.Read(index_path);
+    } else {
+        visual_index.Read(vocab_tree_path);
+    }
 
     Database database(*options.database_path);
 
@@ -137,8 +179,12 @@ int main(int argc, char** argv) {
             ReadImageList(database_image_list_path, &database);
     const auto query_images = ReadImageList(query_image_list_path, &database);
 
-    IndexImagesInVisualIndex(max_num_features, database_images, &database,
-                             &visual_index);
+    const size_t num_indexed_images = IndexImagesInVisualIndex(
+            max_num_features, database_images, &database, &visual_index);
+    if (!index_path.empty() && num_indexed_images > 0) {
+        visual_index.Append(index_path);
+    }
+
     QueryImagesInVisualIndex(max_num_features, database_images, query_images,
                              num_images, num_verifications, &database,
                              &visual_index);
@@ -12,11 +12,11 @@
 namespace bkmap {
     namespace mvs {
 
-        Image::Image() {}
+        Image::Image() : bitmap_(new Bitmap()) {}
 
         Image::Image(const std::string& path, const size_t width, const size_t height,
                      const float* K, const float* R, const float* T)
-                : path_(path), width_(width), height_(height) {
+                : path_(path), width_(width), height_(height), bitmap_(new Bitmap()) {
             memcpy(K_, K, 9 * sizeof(float));
             memcpy(R_, R, 9 * sizeof(float));
             memcpy(T_, T, 3 * sizeof(float));
@@ -24,10 +24,11 @@ namespace bkmap {
             ComposeInverseProjectionMatrix(K_, R_, T_, inv_P_);
         }
 
-        void Image::SetBitmap(const Bitmap& bitmap) {
+        void Image::SetBitmap(const std::shared_ptr<const Bitmap>& bitmap) {
+            CHECK_NOTNULL(bitmap.get());
             bitmap_ = bitmap;
-            CHECK_EQ(width_, bitmap_.Width());
-            CHECK_EQ(height_, bitmap_.Height());
+            CHECK_EQ(width_, bitmap_->Width());
+            CHECK_EQ(height_, bitmap_->Height());
         }
 
         void Image::Rescale(const float factor) { Rescale(factor, factor); }
@@ -36,8 +37,11 @@ namespace bkmap {
             const size_t new_width = std::round(width_ * factor_x);
             const size_t new_height = std::round(height_ * factor_y);
 
-            if (bitmap_.Data() != nullptr) {
-                bitmap_.Rescale(new_width, new_height);
+            if (bitmap_->Data() != nullptr) {
+                // The bitmap might be shared, so that it is rescaled as a copy.
+                std::shared_ptr<Bitmap> rescaled_bitmap(new Bitmap(*bitmap_));
+                rescaled_bitmap->Rescale(new_width, new_height);
+                bitmap_ = rescaled_bitmap;
             }
 
             const float scale_x = new_width / static_cast<float>(width_);
@@ -7,6 +7,7 @@
 
 #include <cstdint>
 #include <fstream>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -26,7 +27,8 @@ namespace bkmap {
             inline size_t GetWidth() const;
             inline size_t GetHeight() const;
 
-            void SetBitmap(const Bitmap& bitmap);
+            // Set the bitmap, which is shared with the caller and not copied.
+            void SetBitmap(const std::shared_ptr<const Bitmap>& bitmap);
             inline const Bitmap& GetBitmap() const;
 
             inline const std::string& GetPath() const;
@@ -50,7 +52,7 @@ namespace bkmap {
             float T_[3];
             float P_[12];
             float inv_P_[12];
-            Bitmap bitmap_;
+            std::shared_ptr<const Bitmap> bitmap_;
         };
 
         void ComputeRelativePose(const float R1[9], const float T1[3],
@@ -75,7 +77,7 @@ namespace bkmap {
 
         size_t Image::GetHeight() const { return height_; }
 
-        const Bitmap& Image::GetBitmap() const { return bitmap_; }
+        const Bitmap& Image::GetBitmap() const { return *bitmap_; }
 
         const std::string& Image::GetPath() const { return path_; }
 
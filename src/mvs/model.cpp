@@ -15,7 +15,8 @@ namespace bkmap {
         void Model::Read(const std::string& path, const std::string& format) {
             auto format_lower_case = format;
             StringToLower(&format_lower_case);
-            if (format_lower_case == "bkmap") {
+            // The format is also accepted by its former name.
+            if (format_lower_case == "bkmap" || format_lower_case == "colmap") {
                 ReadFromCOLMAP(path);
             } else if (format_lower_case == "pmvs") {
                 ReadFromPMVS(path);
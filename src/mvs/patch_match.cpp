@@ -8,7 +8,7 @@
 #include <unordered_set>
 
 #include "mvs/consistency_graph.h"
-#include "mvs/patch_match_cuda.h"
+#include "mvs/patch_match_cpu.h"
 #include "mvs/workspace.h"
 #include "util/math.h"
 #include "util/misc.h"
@@ -26,7 +26,7 @@ namespace bkmap {
         void PatchMatch::Options::Print() const {
             PrintHeading2("PatchMatch::Options");
             PrintOption(max_image_size);
-            PrintOption(gpu_index);
+            PrintOption(num_threads);
             PrintOption(depth_min);
             PrintOption(depth_max);
             PrintOption(window_radius);
@@ -67,11 +67,6 @@ namespace bkmap {
         void PatchMatch::Check() const {
             CHECK(options_.Check());
 
-            CHECK(!options_.gpu_index.empty());
-            const std::vector<int> gpu_indices = CSVToVector<int>(options_.gpu_index);
-            CHECK_EQ(gpu_indices.size(), 1);
-            CHECK_GE(gpu_indices[0], -1);
-
             CHECK_NOTNULL(problem_.images);
             if (options_.geom_consistency) {
                 CHECK_NOTNULL(problem_.depth_maps);
@@ -130,26 +125,26 @@ namespace bkmap {
 
             Check();
 
-            patch_match_cuda_.reset(new PatchMatchCuda(options_, problem_));
-            patch_match_cuda_->Run();
+            patch_match_cpu_.reset(new PatchMatchCPU(options_, problem_));
+            patch_match_cpu_->Run();
         }
 
         DepthMap PatchMatch::GetDepthMap() const {
-            return patch_match_cuda_->GetDepthMap();
+            return patch_match_cpu_->GetDepthMap();
         }
 
         NormalMap PatchMatch::GetNormalMap() const {
-            return patch_match_cuda_->GetNormalMap();
+            return patch_match_cpu_->GetNormalMap();
         }
 
         Mat<float> PatchMatch::GetSelProbMap() const {
-            return patch_match_cuda_->GetSelProbMap();
+            return patch_match_cpu_->GetSelProbMap();
         }
 
         ConsistencyGraph PatchMatch::GetConsistencyGraph() const {
             const auto& ref_image = problem_.images->at(problem_.ref_image_id);
             return ConsistencyGraph(ref_image.GetWidth(), ref_image.GetHeight(),
-                                    patch_match_cuda_->GetConsistentImageIds());
+                                    patch_match_cpu_->GetConsistentImageIds());
         }
 
         PatchMatchController::PatchMatchController(const PatchMatch::Options& options,
@@ -159,16 +154,15 @@ namespace bkmap {
                 : options_(options),
                   workspace_path_(workspace_path),
                   workspace_format_(workspace_format),
-                  pmvs_option_name_(pmvs_option_name) {
-            std::vector<int> gpu_indices = CSVToVector<int>(options_.gpu_index);
-        }
+                  pmvs_option_name_(pmvs_option_name) {}
 
         void PatchMatchController::Run() {
             ReadWorkspace();
             ReadProblems();
-            ReadGpuIndices();
 
-            thread_pool_.reset(new ThreadPool(gpu_indices_.size()));
+            // The CPU implementation parallelizes each problem internally, so
+            // problems are processed one after the other.
+            thread_pool_.reset(new ThreadPool(1));
 
             // If geometric consistency is enabled, then photometric output must be
             // computed first for all images without filtering.
@@ -364,16 +358,6 @@ namespace bkmap {
             << std::endl;
         }
 
-        void PatchMatchController::ReadGpuIndices() {
-            gpu_indices_ = CSVToVector<int>(options_.gpu_index);
-            if (gpu_indices_.size() == 1 && gpu_indices_[0] == -1) {
-                const int num_cuda_devices = GetNumCudaDevices();
-                CHECK_GT(num_cuda_devices, 0);
-                gpu_indices_.resize(num_cuda_devices);
-                std::iota(gpu_indices_.begin(), gpu_indices_.end(), 0);
-            }
-        }
-
         void PatchMatchController::ProcessProblem(const PatchMatch::Options& options,
                                                   const size_t problem_idx) {
             if (IsStopped()) {
@@ -383,9 +367,6 @@ namespace bkmap {
             const auto& model = workspace_->GetModel();
 
             auto& problem = problems_.at(problem_idx);
-            const int gpu_index = gpu_indices_.at(thread_pool_->GetThreadIndex());
-            CHECK_GE(gpu_index, -1);
-
             const std::string& stereo_folder = workspace_->GetOptions().stereo_folder;
             const std::string output_type =
                     options.geom_consistency ? "geometric" : "photometric";
@@ -432,7 +413,7 @@ namespace bkmap {
 
                 std::cout << "Reading inputs..." << std::endl;
                 for (const auto image_id : used_image_ids) {
-                    images.at(image_id).SetBitmap(workspace_->GetBitmap(image_id));
+                    images.at(image_id).SetBitmap(workspace_->GetBitmapPtr(image_id));
                     if (options.geom_consistency) {
                         depth_maps.at(image_id) = workspace_->GetDepthMap(image_id);
                         normal_maps.at(image_id) = workspace_->GetNormalMap(image_id);
@@ -445,7 +426,6 @@ namespace bkmap {
             auto patch_match_options = options;
             patch_match_options.depth_min = depth_ranges_.at(problem.ref_image_id).first;
             patch_match_options.depth_max = depth_ranges_.at(problem.ref_image_id).second;
-            patch_match_options.gpu_index = std::to_string(gpu_index);
             patch_match_options.Print();
 
             PatchMatch patch_match(patch_match_options, problem);
@@ -21,26 +21,24 @@ namespace bkmap {
     namespace mvs {
 
         class ConsistencyGraph;
-        class PatchMatchCuda;
+        class PatchMatchCPU;
         class Workspace;
 
-// This is a wrapper class around the actual PatchMatchCuda implementation. This
-// class is necessary to hide Cuda code from any boost or Eigen code, since
-// NVCC/MSVC cannot compile complex C++ code.
+// This is a wrapper class around the actual PatchMatchCPU implementation, which
+// hides its internals from the users of the options and outputs.
         class PatchMatch {
         public:
-            // Maximum possible window radius for the photometric consistency cost. This
-            // value is equal to THREADS_PER_BLOCK in patch_match_cuda.cu and the limit
-            // arises from the shared memory implementation.
+            // Maximum possible window radius for the photometric consistency cost. The
+            // limit is kept from the former GPU implementation, where it arose from
+            // the shared memory, so that existing configurations remain valid.
             const static size_t kMaxWindowRadius = 32;
 
             struct Options {
                 // Maximum image size in either dimension.
                 int max_image_size = -1;
 
-                // Index of the GPU used for patch match. For multi-GPU usage,
-                // you should separate multiple GPU indices by comma, e.g., "0,1,2,3".
-                std::string gpu_index = "-1";
+                // Number of threads used by the CPU implementation.
+                int num_threads = -1;
 
                 // Depth range in which to randomly sample depth hypotheses.
                 double depth_min = 0.0f;
@@ -131,6 +129,7 @@ namespace bkmap {
                     CHECK_OPTION_GE(filter_min_num_consistent, 0);
                     CHECK_OPTION_GE(filter_geom_consistency_max_cost, 0.0f);
                     CHECK_OPTION_GT(cache_size, 0);
+                    CHECK_OPTION_NE(num_threads, 0);
                     return true;
                 }
             };
@@ -173,11 +172,11 @@ namespace bkmap {
         private:
             const Options options_;
             const Problem problem_;
-            std::unique_ptr<PatchMatchCuda> patch_match_cuda_;
+            std::unique_ptr<PatchMatchCPU> patch_match_cpu_;
         };
 
 // This thread processes all problems in a workspace. A workspace has the
-// following file structure, if the workspace format is "COLMAP":
+// following file structure, if the workspace format is "bkmap":
 //
 //    images/*
 //    sparse/{cameras.txt, images.txt, points3D.txt}
@@ -218,7 +217,6 @@ namespace bkmap {
             void Run();
             void ReadWorkspace();
             void ReadProblems();
-            void ReadGpuIndices();
             void ProcessProblem(const PatchMatch::Options& options,
                                 const size_t problem_idx);
 
@@ -231,7 +229,6 @@ namespace bkmap {
             std::mutex workspace_mutex_;
             std::unique_ptr<Workspace> workspace_;
             std::vector<PatchMatch::Problem> problems_;
-            std::vector<int> gpu_indices_;
             std::vector<std::pair<float, float>> depth_ranges_;
         };
 
@@ -0,0 +1,922 @@
+#include "mvs/patch_match_cpu.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+#include "util/math.h"
+#include "util/misc.h"
+#include "util/random.h"
+
+namespace bkmap {
+    namespace mvs {
+        namespace {
+
+            // Maximum photometric cost, i.e. an NCC of -1.
+            const float kMaxCost = 2.0f;
+
+            // Minimum variance of the reference or source patch for the NCC to be
+            // considered well-defined.
+            const float kMinNCCVariance = 1e-5f;
+
+            // Probability of a source image to be selected if the cost does not
+            // provide any evidence.
+            const float kUniformProb = 0.5f;
+
+            // Probability of the selection state of a source image to remain the
+            // same between neighboring pixels in the sweep direction.
+            const float kTransitionProb = 0.999f;
+
+            // Lower bound of the selection probability to keep the messages from
+            // collapsing to zero.
+            const float kMinSelProb = 1e-6f;
+
+            // Initial relative perturbation of the depth and normal hypotheses,
+            // which is halved in every iteration.
+            const float kInitPerturbation = 0.1f;
+
+            // Number of tiles per thread to balance the work between threads.
+            const int kNumTilesPerThread = 4;
+
+            inline float DotProduct3(const float vec1[3], const float vec2[3]) {
+                return vec1[0] * vec2[0] + vec1[1] * vec2[1] + vec1[2] * vec2[2];
+            }
+
+            inline void Normalize3(float vec[3]) {
+                const float inv_norm = 1.0f / std::sqrt(DotProduct3(vec, vec));
+                vec[0] *= inv_norm;
+                vec[1] *= inv_norm;
+                vec[2] *= inv_norm;
+            }
+
+            // Bilinear interpolation of a row-major image. Returns false if the
+            // position lies outside the image.
+            inline bool InterpolateBilinear(const float* data, const int width,
+                                            const int height, const float x,
+                                            const float y, float* value) {
+                if (!(x >= 0.0f && y >= 0.0f && x <= width - 1 && y <= height - 1)) {
+                    return false;
+                }
+
+                const int x0 = std::min(static_cast<int>(x), width - 2);
+                const int y0 = std::min(static_cast<int>(y), height - 2);
+                const float dx = x - x0;
+                const float dy = y - y0;
+
+                const float* row0 = data + y0 * width + x0;
+                const float* row1 = row0 + width;
+                const float top = row0[0] + dx * (row0[1] - row0[0]);
+                const float bottom = row1[0] + dx * (row1[1] - row1[0]);
+                *value = top + dy * (bottom - top);
+
+                return true;
+            }
+
+            // Compute the homography that maps pixels of the reference image onto
+            // the source image induced by the plane through the given point with
+            // the given normal, i.e. H = K * (R + T * n' / (n' * X)) * K_ref^-1.
+            void ComposeHomography(const float ref_K[4], const float K[4],
+                                   const float R[9], const float T[3],
+                                   const float point[3], const float normal[3],
+                                   float H[9]) {
+                const float inv_dist = 1.0f / DotProduct3(normal, point);
+                const float inv_dist_N0 = inv_dist * normal[0];
+                const float inv_dist_N1 = inv_dist * normal[1];
+                const float inv_dist_N2 = inv_dist * normal[2];
+
+                // A = R + T * n' / d.
+                const float A[9] = {
+                        R[0] + inv_dist_N0 * T[0], R[1] + inv_dist_N1 * T[0],
+                        R[2] + inv_dist_N2 * T[0], R[3] + inv_dist_N0 * T[1],
+                        R[4] + inv_dist_N1 * T[1], R[5] + inv_dist_N2 * T[1],
+                        R[6] + inv_dist_N0 * T[2], R[7] + inv_dist_N1 * T[2],
+                        R[8] + inv_dist_N2 * T[2]};
+
+                // B = K * A.
+                float B[9];
+                for (int i = 0; i < 3; ++i) {
+                    B[i] = K[0] * A[i] + K[2] * A[6 + i];
+                    B[3 + i] = K[1] * A[3 + i] + K[3] * A[6 + i];
+                    B[6 + i] = A[6 + i];
+                }
+
+                // H = B * K_ref^-1.
+                const float inv_fx = 1.0f / ref_K[0];
+                const float inv_fy = 1.0f / ref_K[1];
+                for (int i = 0; i < 3; ++i) {
+                    H[3 * i] = B[3 * i] * inv_fx;
+                    H[3 * i + 1] = B[3 * i + 1] * inv_fy;
+                    H[3 * i + 2] = B[3 * i + 2] - B[3 * i] * ref_K[2] * inv_fx -
+                                   B[3 * i + 1] * ref_K[3] * inv_fy;
+                }
+            }
+
+        }  // namespace
+
+        PatchMatchCPU::PatchMatchCPU(const PatchMatch::Options& options,
+                                     const PatchMatch::Problem& problem)
+                : options_(options), problem_(problem) {}
+
+        void PatchMatchCPU::Run() {
+            thread_pool_.reset(new ThreadPool(options_.num_threads));
+            thread_buffers_.resize(thread_pool_->NumThreads());
+
+            InitRefImage();
+            InitSourceImages();
+            InitHypotheses();
+
+            for (int iteration = 0; iteration < options_.num_iterations;
+                 ++iteration) {
+                Timer timer;
+                timer.Start();
+                Sweep(SweepDirection::TOP_TO_BOTTOM, iteration);
+                Sweep(SweepDirection::BOTTOM_TO_TOP, iteration);
+                Sweep(SweepDirection::LEFT_TO_RIGHT, iteration);
+                Sweep(SweepDirection::RIGHT_TO_LEFT, iteration);
+                std::cout << StringPrintf("Iteration %d / %d in %.3fs", iteration + 1,
+                                          options_.num_iterations,
+                                          timer.ElapsedSeconds())
+                << std::endl;
+            }
+
+            Filter();
+
+            thread_pool_.reset();
+            thread_buffers_.clear();
+        }
+
+        DepthMap PatchMatchCPU::GetDepthMap() const {
+            DepthMap depth_map(width_, height_, options_.depth_min,
+                               options_.depth_max);
+            std::copy(depths_.begin(), depths_.end(), depth_map.GetPtr());
+            return depth_map;
+        }
+
+        NormalMap PatchMatchCPU::GetNormalMap() const {
+            NormalMap normal_map(width_, height_);
+            for (int row = 0; row < height_; ++row) {
+                for (int col = 0; col < width_; ++col) {
+                    const float* normal = &normals_[3 * (row * width_ + col)];
+                    for (int d = 0; d < 3; ++d) {
+                        normal_map.Set(row, col, d, normal[d]);
+                    }
+                }
+            }
+            return normal_map;
+        }
+
+        Mat<float> PatchMatchCPU::GetSelProbMap() const {
+            const size_t num_src_images = src_images_.size();
+            Mat<float> sel_prob_map(width_, height_, num_src_images);
+            for (int row = 0; row < height_; ++row) {
+                for (int col = 0; col < width_; ++col) {
+                    const size_t offset = (row * width_ + col) * num_src_images;
+                    for (size_t image_idx = 0; image_idx < num_src_images;
+                         ++image_idx) {
+                        sel_prob_map.Set(row, col, image_idx,
+                                         sel_probs_[offset + image_idx]);
+                    }
+                }
+            }
+            return sel_prob_map;
+        }
+
+        std::vector<int> PatchMatchCPU::GetConsistentImageIds() const {
+            return consistent_image_ids_;
+        }
+
+        void PatchMatchCPU::InitRefImage() {
+            const Image& ref_image = problem_.images->at(problem_.ref_image_id);
+
+            width_ = static_cast<int>(ref_image.GetWidth());
+            height_ = static_cast<int>(ref_image.GetHeight());
+
+            const float* K = ref_image.GetK();
+            ref_K_[0] = K[0];
+            ref_K_[1] = K[4];
+            ref_K_[2] = K[2];
+            ref_K_[3] = K[5];
+
+            const BitmapView bitmap = ref_image.GetBitmap().View();
+            ref_image_.resize(static_cast<size_t>(bitmap.Width()) * bitmap.Height() *
+                              bitmap.Channels());
+            bitmap.ConvertToRowMajorArray(255.0f, ref_image_.data());
+
+            cos_min_triangulation_angle_ = std::cos(
+                    DegToRad(static_cast<float>(options_.min_triangulation_angle)));
+
+            const int window_size = 2 * options_.window_radius + 1;
+            window_row_offsets_.clear();
+            window_col_offsets_.clear();
+            window_spatial_dists_.clear();
+            for (int dr = -options_.window_radius; dr <= options_.window_radius;
+                 ++dr) {
+                for (int dc = -options_.window_radius; dc <= options_.window_radius;
+                     ++dc) {
+                    window_row_offsets_.push_back(dr);
+                    window_col_offsets_.push_back(dc);
+                    window_spatial_dists_.push_back(dr * dr + dc * dc);
+                }
+            }
+
+            // Pad the window to a multiple of the SIMD width. The padded elements
+            // are at the window center with zero weight, so that they are always
+            // sampled within the image bounds if the center is.
+            while (window_row_offsets_.size() % 4 != 0) {
+                window_row_offsets_.push_back(0);
+                window_col_offsets_.push_back(0);
+                window_spatial_dists_.push_back(-1);
+            }
+
+            CHECK_GE(window_row_offsets_.size(),
+                     static_cast<size_t>(window_size * window_size));
+        }
+
+        void PatchMatchCPU::InitSourceImages() {
+            const Image& ref_image = problem_.images->at(problem_.ref_image_id);
+
+            src_images_.clear();
+            src_images_.resize(problem_.src_image_ids.size());
+
+            for (size_t i = 0; i < problem_.src_image_ids.size(); ++i) {
+                const int image_id = problem_.src_image_ids[i];
+                const Image& image = problem_.images->at(image_id);
+
+                SourceImage& src_image = src_images_[i];
+                src_image.image_id = image_id;
+                src_image.width = static_cast<int>(image.GetWidth());
+                src_image.height = static_cast<int>(image.GetHeight());
+
+                const BitmapView bitmap = image.GetBitmap().View();
+                src_image.data.resize(static_cast<size_t>(bitmap.Width()) *
+                                      bitmap.Height() * bitmap.Channels());
+                bitmap.ConvertToRowMajorArray(255.0f, src_image.data.data());
+
+                const float* K = image.GetK();
+                src_image.K[0] = K[0];
+                src_image.K[1] = K[4];
+                src_image.K[2] = K[2];
+                src_image.K[3] = K[5];
+
+                ComputeRelativePose(ref_image.GetR(), ref_image.GetT(), image.GetR(),
+                                    image.GetT(), src_image.R, src_image.T);
+
+                // C = -R' * T.
+                for (int d = 0; d < 3; ++d) {
+                    src_image.C[d] = -(src_image.R[d] * src_image.T[0] +
+                                       src_image.R[3 + d] * src_image.T[1] +
+                                       src_image.R[6 + d] * src_image.T[2]);
+                }
+
+                if (options_.geom_consistency) {
+                    src_image.depth_map = &problem_.depth_maps->at(image_id);
+                }
+            }
+        }
+
+        void PatchMatchCPU::InitHypotheses() {
+            const size_t num_pixels = static_cast<size_t>(width_) * height_;
+            const size_t num_src_images = src_images_.size();
+
+            depths_.resize(num_pixels);
+            normals_.resize(3 * num_pixels);
+            costs_.resize(num_pixels * num_src_images);
+            sel_probs_.assign(num_pixels * num_src_images, kUniformProb);
+
+            const DepthMap* ref_depth_map = nullptr;
+            const NormalMap* ref_normal_map = nullptr;
+            if (options_.geom_consistency) {
+                ref_depth_map = &problem_.depth_maps->at(problem_.ref_image_id);
+                ref_normal_map = &problem_.normal_maps->at(problem_.ref_image_id);
+            }
+
+            auto InitRows = [this, ref_depth_map, ref_normal_map,
+                    num_src_images](const int begin, const int end) {
+                RefPatch patch;
+                for (int row = begin; row < end; ++row) {
+                    for (int col = 0; col < width_; ++col) {
+                        const size_t pixel_idx = row * width_ + col;
+
+                        Hypothesis hypothesis;
+                        if (ref_depth_map != nullptr &&
+                            ref_depth_map->Get(row, col) > 0) {
+                            hypothesis.depth = ref_depth_map->Get(row, col);
+                            for (int d = 0; d < 3; ++d) {
+                                hypothesis.normal[d] = ref_normal_map->Get(row, col, d);
+                            }
+                        } else {
+                            GenerateRandomHypothesis(row, col, &hypothesis);
+                        }
+
+                        depths_[pixel_idx] = hypothesis.depth;
+                        std::copy(hypothesis.normal, hypothesis.normal + 3,
+                                  &normals_[3 * pixel_idx]);
+
+                        ExtractRefPatch(row, col, &patch);
+                        for (size_t image_idx = 0; image_idx < num_src_images;
+                             ++image_idx) {
+                            costs_[pixel_idx * num_src_images + image_idx] =
+                                    ComputeCost(patch, row, col, hypothesis,
+                                                src_images_[image_idx]);
+                        }
+                    }
+                }
+            };
+
+            const int num_tiles =
+                    static_cast<int>(thread_pool_->NumThreads()) * kNumTilesPerThread;
+            const int tile_size = std::max(1, (height_ + num_tiles - 1) / num_tiles);
+            for (int begin = 0; begin < height_; begin += tile_size) {
+                thread_pool_->AddTask(InitRows, begin,
+                                      std::min(height_, begin + tile_size));
+            }
+            thread_pool_->Wait();
+        }
+
+        void PatchMatchCPU::Sweep(const SweepDirection direction,
+                                  const int iteration) {
+            // During vertical sweeps, columns are independent and vice versa.
+            const bool vertical = direction == SweepDirection::TOP_TO_BOTTOM ||
+                                  direction == SweepDirection::BOTTOM_TO_TOP;
+            const int num_lines = vertical ? width_ : height_;
+
+            const int num_tiles =
+                    static_cast<int>(thread_pool_->NumThreads()) * kNumTilesPerThread;
+            const int tile_size =
+                    std::max(1, (num_lines + num_tiles - 1) / num_tiles);
+            for (int begin = 0; begin < num_lines; begin += tile_size) {
+                thread_pool_->AddTask(&PatchMatchCPU::SweepTile, this, direction,
+                                      iteration, begin,
+                                      std::min(num_lines, begin + tile_size));
+            }
+            thread_pool_->Wait();
+        }
+
+        void PatchMatchCPU::SweepTile(const SweepDirection direction,
+                                      const int iteration, const int begin,
+                                      const int end) {
+            ThreadBuffers& buffers =
+                    thread_buffers_.at(thread_pool_->GetThreadIndex());
+            buffers.sampling_probs.resize(src_images_.size());
+            buffers.num_samples_per_image.resize(src_images_.size());
+            buffers.candidate_costs.resize(src_images_.size());
+            buffers.best_costs.resize(src_images_.size());
+
+            // The tile is traversed in the sweep direction one line at a time,
+            // such that consecutive pixels are processed in memory order for
+            // vertical sweeps.
+            switch (direction) {
+                case SweepDirection::TOP_TO_BOTTOM:
+                    for (int row = 0; row < height_; ++row) {
+                        for (int col = begin; col < end; ++col) {
+                            ProcessPixel(row, col, row - 1, col, iteration, &buffers);
+                        }
+                    }
+                    break;
+                case SweepDirection::BOTTOM_TO_TOP:
+                    for (int row = height_ - 1; row >= 0; --row) {
+                        for (int col = begin; col < end; ++col) {
+                            ProcessPixel(row, col, row + 1, col, iteration, &buffers);
+                        }
+                    }
+                    break;
+                case SweepDirection::LEFT_TO_RIGHT:
+                    for (int row = begin; row < end; ++row) {
+                        for (int col = 0; col < width_; ++col) {
+                            ProcessPixel(row, col, row, col - 1, iteration, &buffers);
+                        }
+                    }
+                    break;
+                case SweepDirection::RIGHT_TO_LEFT:
+                    for (int row = begin; row < end; ++row) {
+                        for (int col = width_ - 1; col >= 0; --col) {
+                            ProcessPixel(row, col, row, col + 1, iteration, &buffers);
+                        }
+                    }
+                    break;
+            }
+        }
+
+        void PatchMatchCPU::ProcessPixel(const int row, const int col,
+                                         const int prev_row, const int prev_col,
+                                         const int iteration,
+                                         ThreadBuffers* buffers) {
+            const size_t num_src_images = src_images_.size();
+            const size_t pixel_idx = row * width_ + col;
+            const bool has_prev = prev_row >= 0 && prev_row < height_ &&
+                                  prev_col >= 0 && prev_col < width_;
+            const size_t prev_pixel_idx =
+                    has_prev ? prev_row * width_ + prev_col : pixel_idx;
+
+            float* costs = &costs_[pixel_idx * num_src_images];
+            float* sel_probs = &sel_probs_[pixel_idx * num_src_images];
+            const float* prev_sel_probs = &sel_probs_[prev_pixel_idx * num_src_images];
+
+            Hypothesis current;
+            current.depth = depths_[pixel_idx];
+            std::copy(&normals_[3 * pixel_idx], &normals_[3 * pixel_idx] + 3,
+                      current.normal);
+
+            // Update the selection probabilities using the forward message of the
+            // previous pixel in the sweep direction as prior.
+            const float ncc_factor =
+                    -1.0f / (2.0f * options_.ncc_sigma * options_.ncc_sigma);
+            RefPatch* patch = &buffers->patch;
+            float* sampling_probs = buffers->sampling_probs.data();
+            float sum_sampling_probs = 0.0f;
+            for (size_t image_idx = 0; image_idx < num_src_images; ++image_idx) {
+                float cos_triangulation_angle;
+                const float view_likelihood = ComputeViewLikelihood(
+                        row, col, current, src_images_[image_idx],
+                        &cos_triangulation_angle);
+                const float cost = costs[image_idx];
+                const float likelihood =
+                        std::exp(cost * cost * ncc_factor) * view_likelihood;
+                const float prior = prev_sel_probs[image_idx] * kTransitionProb +
+                                    (1.0f - prev_sel_probs[image_idx]) *
+                                    (1.0f - kTransitionProb);
+                const float selected = likelihood * prior;
+                const float unselected = kUniformProb * (1.0f - prior);
+                sel_probs[image_idx] = std::max(
+                        kMinSelProb, selected / (selected + unselected));
+                sampling_probs[image_idx] = view_likelihood > 0 ? sel_probs[image_idx] : 0;
+                sum_sampling_probs += sampling_probs[image_idx];
+            }
+
+            if (sum_sampling_probs <= 0.0f) {
+                return;
+            }
+
+            // Monte Carlo sampling of the source images according to their
+            // selection probabilities.
+            int* num_samples_per_image = buffers->num_samples_per_image.data();
+            std::fill(num_samples_per_image, num_samples_per_image + num_src_images,
+                      0);
+            for (int sample = 0; sample < options_.num_samples; ++sample) {
+                const float rand_prob = RandomReal(0.0f, sum_sampling_probs);
+                float cum_prob = 0.0f;
+                size_t image_idx = 0;
+                for (; image_idx + 1 < num_src_images; ++image_idx) {
+                    cum_prob += sampling_probs[image_idx];
+                    if (rand_prob < cum_prob) {
+                        break;
+                    }
+                }
+                num_samples_per_image[image_idx] += 1;
+            }
+
+            // The costs of the current hypothesis are already known.
+            float best_cost = 0.0f;
+            for (size_t image_idx = 0; image_idx < num_src_images; ++image_idx) {
+                best_cost += num_samples_per_image[image_idx] * costs[image_idx];
+            }
+            best_cost /= options_.num_samples;
+
+            ExtractRefPatch(row, col, patch);
+
+            // Candidate hypotheses: the propagated from the previous pixel, a
+            // random, and a perturbed version of the current hypothesis.
+            Hypothesis candidates[3];
+            int num_candidates = 0;
+            if (has_prev) {
+                Hypothesis& propagated = candidates[num_candidates++];
+                propagated.depth = depths_[prev_pixel_idx];
+                std::copy(&normals_[3 * prev_pixel_idx],
+                          &normals_[3 * prev_pixel_idx] + 3, propagated.normal);
+            }
+            GenerateRandomHypothesis(row, col, &candidates[num_candidates++]);
+            Hypothesis& perturbed = candidates[num_candidates++];
+            perturbed = current;
+            PerturbHypothesis(row, col,
+                              kInitPerturbation / static_cast<float>(1 << iteration),
+                              &perturbed);
+
+            std::vector<float>& candidate_costs = buffers->candidate_costs;
+            std::vector<float>& best_costs = buffers->best_costs;
+            int best_idx = -1;
+            for (int i = 0; i < num_candidates; ++i) {
+                float cost = 0.0f;
+                for (size_t image_idx = 0; image_idx < num_src_images; ++image_idx) {
+                    if (num_samples_per_image[image_idx] > 0) {
+                        candidate_costs[image_idx] =
+                                ComputeCost(*patch, row, col, candidates[i],
+                                            src_images_[image_idx]);
+                        cost += num_samples_per_image[image_idx] *
+                                candidate_costs[image_idx];
+                    }
+                }
+                cost /= options_.num_samples;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_idx = i;
+                    best_costs.swap(candidate_costs);
+                }
+            }
+
+            if (best_idx == -1) {
+                return;
+            }
+
+            const Hypothesis& best = candidates[best_idx];
+            depths_[pixel_idx] = best.depth;
+            std::copy(best.normal, best.normal + 3, &normals_[3 * pixel_idx]);
+
+            // Only the sampled costs were evaluated for the new hypothesis, the
+            // remaining ones are required for the selection probabilities of the
+            // next pixel in the sweep.
+            for (size_t image_idx = 0; image_idx < num_src_images; ++image_idx) {
+                if (num_samples_per_image[image_idx] > 0) {
+                    costs[image_idx] = best_costs[image_idx];
+                } else {
+                    costs[image_idx] = ComputeCost(*patch, row, col, best,
+                                                   src_images_[image_idx]);
+                }
+            }
+        }
+
+        void PatchMatchCPU::ExtractRefPatch(const int row, const int col,
+                                            RefPatch* patch) const {
+            const size_t size = window_row_offsets_.size();
+            patch->size = size;
+            patch->weights.resize(size);
+            patch->weighted_values.resize(size);
+            patch->src_values.resize(size);
+
+            const float center_value = ref_image_[row * width_ + col];
+            const float color_factor =
+                    -1.0f / (2.0f * options_.sigma_color * options_.sigma_color);
+            const float spatial_factor =
+                    -1.0f / (2.0f * options_.sigma_spatial * options_.sigma_spatial);
+
+            float sum_weights = 0.0f;
+            float sum_weighted_values = 0.0f;
+            float sum_weighted_squares = 0.0f;
+            for (size_t i = 0; i < size; ++i) {
+                const int r = row + static_cast<int>(window_row_offsets_[i]);
+                const int c = col + static_cast<int>(window_col_offsets_[i]);
+                if (window_spatial_dists_[i] < 0 || r < 0 || r >= height_ || c < 0 ||
+                    c >= width_) {
+                    patch->weights[i] = 0.0f;
+                    patch->weighted_values[i] = 0.0f;
+                    continue;
+                }
+
+                const float value = ref_image_[r * width_ + c];
+                const float color_dist = value - center_value;
+                const float weight =
+                        std::exp(color_dist * color_dist * color_factor +
+                                 window_spatial_dists_[i] * spatial_factor);
+                patch->weights[i] = weight;
+                patch->weighted_values[i] = weight * value;
+                sum_weights += weight;
+                sum_weighted_values += weight * value;
+                sum_weighted_squares += weight * value * value;
+            }
+
+            patch->sum_weights = sum_weights;
+            patch->mean = sum_weighted_values / sum_weights;
+            patch->variance =
+                    sum_weighted_squares / sum_weights - patch->mean * patch->mean;
+        }
+
+        float PatchMatchCPU::ComputePhotometricCost(const RefPatch& patch,
+                                                    const int row, const int col,
+                                                    const Hypothesis& hypothesis,
+                                                    const SourceImage& image) const {
+            if (patch.variance < kMinNCCVariance) {
+                return kMaxCost;
+            }
+
+            float ray[3];
+            ComputeViewingRay(row, col, ray);
+            const float point[3] = {hypothesis.depth * ray[0],
+                                    hypothesis.depth * ray[1],
+                                    hypothesis.depth * ray[2]};
+
+            float H[9];
+            ComposeHomography(ref_K_, image.K, image.R, image.T, point,
+                              hypothesis.normal, H);
+
+            // Sample the source image at the projected window positions.
+            const size_t size = patch.size;
+            float* src_values = patch.src_values.data();
+            const float base_col = static_cast<float>(col);
+            const float base_row = static_cast<float>(row);
+            for (size_t i = 0; i < size; ++i) {
+                if (patch.weights[i] == 0.0f) {
+                    src_values[i] = 0.0f;
+                    continue;
+                }
+                const float x = base_col + window_col_offsets_[i];
+                const float y = base_row + window_row_offsets_[i];
+                const float inv_z = 1.0f / (H[6] * x + H[7] * y + H[8]);
+                if (inv_z <= 0.0f) {
+                    return kMaxCost;
+                }
+                const float u = (H[0] * x + H[1] * y + H[2]) * inv_z;
+                const float v = (H[3] * x + H[4] * y + H[5]) * inv_z;
+                if (!InterpolateBilinear(image.data.data(), image.width, image.height,
+                                         u, v, &src_values[i])) {
+                    return kMaxCost;
+                }
+            }
+
+            // Accumulate the weighted source statistics and the cross term.
+            float sum_weighted_src = 0.0f;
+            float sum_weighted_src_squares = 0.0f;
+            float sum_weighted_ref_src = 0.0f;
+#ifdef __SSE2__
+            __m128 sum_src = _mm_setzero_ps();
+            __m128 sum_src_squares = _mm_setzero_ps();
+            __m128 sum_ref_src = _mm_setzero_ps();
+            for (size_t i = 0; i < size; i += 4) {
+                const __m128 weights = _mm_loadu_ps(&patch.weights[i]);
+                const __m128 weighted_values = _mm_loadu_ps(&patch.weighted_values[i]);
+                const __m128 values = _mm_loadu_ps(&src_values[i]);
+                const __m128 weighted_src = _mm_mul_ps(weights, values);
+                sum_src = _mm_add_ps(sum_src, weighted_src);
+                sum_src_squares =
+                        _mm_add_ps(sum_src_squares, _mm_mul_ps(weighted_src, values));
+                sum_ref_src =
+                        _mm_add_ps(sum_ref_src, _mm_mul_ps(weighted_values, values));
+            }
+            float sums[4];
+            _mm_storeu_ps(sums, sum_src);
+            sum_weighted_src = sums[0] + sums[1] + sums[2] + sums[3];
+            _mm_storeu_ps(sums, sum_src_squares);
+            sum_weighted_src_squares = sums[0] + sums[1] + sums[2] + sums[3];
+            _mm_storeu_ps(sums, sum_ref_src);
+            sum_weighted_ref_src = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+            for (size_t i = 0; i < size; ++i) {
+                const float weighted_src = patch.weights[i] * src_values[i];
+                sum_weighted_src += weighted_src;
+                sum_weighted_src_squares += weighted_src * src_values[i];
+                sum_weighted_ref_src += patch.weighted_values[i] * src_values[i];
+            }
+#endif
+
+            const float inv_sum_weights = 1.0f / patch.sum_weights;
+            const float src_mean = sum_weighted_src * inv_sum_weights;
+            const float src_variance =
+                    sum_weighted_src_squares * inv_sum_weights - src_mean * src_mean;
+            if (src_variance < kMinNCCVariance) {
+                return kMaxCost;
+            }
+
+            const float covariance =
+                    sum_weighted_ref_src * inv_sum_weights - patch.mean * src_mean;
+            const float ncc = covariance / std::sqrt(patch.variance * src_variance);
+
+            return std::max(0.0f, std::min(kMaxCost, 1.0f - ncc));
+        }
+
+        float PatchMatchCPU::ComputeGeometricError(const int row, const int col,
+                                                   const Hypothesis& hypothesis,
+                                                   const SourceImage& image) const {
+            const float max_error = std::numeric_limits<float>::max();
+
+            float ray[3];
+            ComputeViewingRay(row, col, ray);
+
+            // Project the reference point into the source image.
+            const float point[3] = {hypothesis.depth * ray[0],
+                                    hypothesis.depth * ray[1],
+                                    hypothesis.depth * ray[2]};
+            float src_point[3];
+            for (int d = 0; d < 3; ++d) {
+                src_point[d] = image.R[3 * d] * point[0] + image.R[3 * d + 1] * point[1] +
+                               image.R[3 * d + 2] * point[2] + image.T[d];
+            }
+            if (src_point[2] <= 0.0f) {
+                return max_error;
+            }
+
+            const float src_col =
+                    image.K[0] * src_point[0] / src_point[2] + image.K[2];
+            const float src_row =
+                    image.K[1] * src_point[1] / src_point[2] + image.K[3];
+            const int src_col_int = static_cast<int>(std::round(src_col));
+            const int src_row_int = static_cast<int>(std::round(src_row));
+            if (src_col_int < 0 || src_row_int < 0 ||
+                src_col_int >= static_cast<int>(image.depth_map->GetWidth()) ||
+                src_row_int >= static_cast<int>(image.depth_map->GetHeight())) {
+                return max_error;
+            }
+
+            const float src_depth = image.depth_map->Get(src_row_int, src_col_int);
+            if (src_depth <= 0.0f) {
+                return max_error;
+            }
+
+            // Back-project the source depth and transform it into the reference.
+            const float src_back_point[3] = {
+                    src_depth * (src_col - image.K[2]) / image.K[0],
+                    src_depth * (src_row - image.K[3]) / image.K[1], src_depth};
+            float ref_point[3];
+            for (int d = 0; d < 3; ++d) {
+                ref_point[d] = image.R[d] * (src_back_point[0] - image.T[0]) +
+                               image.R[3 + d] * (src_back_point[1] - image.T[1]) +
+                               image.R[6 + d] * (src_back_point[2] - image.T[2]);
+            }
+            if (ref_point[2] <= 0.0f) {
+                return max_error;
+            }
+
+            const float ref_col = ref_K_[0] * ref_point[0] / ref_point[2] + ref_K_[2];
+            const float ref_row = ref_K_[1] * ref_point[1] / ref_point[2] + ref_K_[3];
+            const float diff_col = col - ref_col;
+            const float diff_row = row - ref_row;
+
+            return std::sqrt(diff_col * diff_col + diff_row * diff_row);
+        }
+
+        float PatchMatchCPU::ComputeCost(const RefPatch& patch, const int row,
+                                         const int col, const Hypothesis& hypothesis,
+                                         const SourceImage& image) const {
+            float cost = ComputePhotometricCost(patch, row, col, hypothesis, image);
+            if (options_.geom_consistency) {
+                const float error = ComputeGeometricError(row, col, hypothesis, image);
+                cost += static_cast<float>(options_.geom_consistency_regularizer) *
+                        std::min(error,
+                                 static_cast<float>(options_.geom_consistency_max_cost));
+            }
+            return cost;
+        }
+
+        float PatchMatchCPU::ComputeViewLikelihood(
+                const int row, const int col, const Hypothesis& hypothesis,
+                const SourceImage& image, float* cos_triangulation_angle) const {
+            float ray[3];
+            ComputeViewingRay(row, col, ray);
+            const float point[3] = {hypothesis.depth * ray[0],
+                                    hypothesis.depth * ray[1],
+                                    hypothesis.depth * ray[2]};
+
+            // Rays from the point to the reference and source projection center.
+            float ref_dir[3] = {-point[0], -point[1], -point[2]};
+            float src_dir[3] = {image.C[0] - point[0], image.C[1] - point[1],
+                                image.C[2] - point[2]};
+            Normalize3(ref_dir);
+            Normalize3(src_dir);
+
+            *cos_triangulation_angle = DotProduct3(ref_dir, src_dir);
+
+            if (*cos_triangulation_angle > cos_min_triangulation_angle_) {
+                return 0.0f;
+            }
+
+            const float cos_incident_angle = DotProduct3(hypothesis.normal, src_dir);
+            if (cos_incident_angle <= 0.0f) {
+                return 0.0f;
+            }
+
+            const float incident_angle = std::acos(std::min(1.0f, cos_incident_angle));
+            return std::exp(-incident_angle * incident_angle /
+                            (2.0f * options_.incident_angle_sigma *
+                             options_.incident_angle_sigma));
+        }
+
+        void PatchMatchCPU::GenerateRandomHypothesis(const int row, const int col,
+                                                     Hypothesis* hypothesis) const {
+            hypothesis->depth = RandomReal(static_cast<float>(options_.depth_min),
+                                           static_cast<float>(options_.depth_max));
+
+            // Uniformly sample a normal on the hemisphere facing the camera.
+            float ray[3];
+            ComputeViewingRay(row, col, ray);
+            float* normal = hypothesis->normal;
+            do {
+                for (int d = 0; d < 3; ++d) {
+                    normal[d] = RandomGaussian(0.0f, 1.0f);
+                }
+            } while (DotProduct3(normal, normal) < 1e-6f);
+            Normalize3(normal);
+            if (DotProduct3(normal, ray) > 0.0f) {
+                normal[0] = -normal[0];
+                normal[1] = -normal[1];
+                normal[2] = -normal[2];
+            }
+        }
+
+        void PatchMatchCPU::PerturbHypothesis(const int row, const int col,
+                                              const float perturbation,
+                                              Hypothesis* hypothesis) const {
+            const float depth_min = static_cast<float>(options_.depth_min);
+            const float depth_max = static_cast<float>(options_.depth_max);
+            const float depth_delta = perturbation * hypothesis->depth;
+            hypothesis->depth = Clip(hypothesis->depth +
+                                     RandomReal(-depth_delta, depth_delta),
+                                     depth_min, depth_max);
+
+            float ray[3];
+            ComputeViewingRay(row, col, ray);
+            float* normal = hypothesis->normal;
+            for (int d = 0; d < 3; ++d) {
+                normal[d] += RandomReal(-perturbation, perturbation);
+            }
+            Normalize3(normal);
+            if (DotProduct3(normal, ray) > 0.0f) {
+                normal[0] = -normal[0];
+                normal[1] = -normal[1];
+                normal[2] = -normal[2];
+            }
+        }
+
+        void PatchMatchCPU::ComputeViewingRay(const int row, const int col,
+                                              float ray[3]) const {
+            ray[0] = (col - ref_K_[2]) / ref_K_[0];
+            ray[1] = (row - ref_K_[3]) / ref_K_[1];
+            ray[2] = 1.0f;
+        }
+
+        void PatchMatchCPU::Filter() {
+            const size_t num_src_images = src_images_.size();
+
+            consistent_image_ids_.clear();
+
+            if (!options_.filter) {
+                return;
+            }
+
+            const float max_cost = 1.0f - static_cast<float>(options_.filter_min_ncc);
+            const float cos_min_triangulation_angle = std::cos(
+                    DegToRad(static_cast<float>(options_.filter_min_triangulation_angle)));
+
+            // Pixels are filtered row by row in parallel, the consistent images
+            // are collected per row to retain the row-major output order.
+            std::vector<std::vector<int>> row_image_ids(height_);
+
+            auto FilterRow = [&](const int row) {
+                RefPatch patch;
+                std::vector<int>& image_ids = row_image_ids[row];
+                std::vector<int> consistent;
+                consistent.reserve(num_src_images);
+                for (int col = 0; col < width_; ++col) {
+                    const size_t pixel_idx = row * width_ + col;
+
+                    Hypothesis hypothesis;
+                    hypothesis.depth = depths_[pixel_idx];
+                    std::copy(&normals_[3 * pixel_idx], &normals_[3 * pixel_idx] + 3,
+                              hypothesis.normal);
+
+                    ExtractRefPatch(row, col, &patch);
+
+                    consistent.clear();
+                    for (size_t image_idx = 0; image_idx < num_src_images;
+                         ++image_idx) {
+                        const SourceImage& image = src_images_[image_idx];
+
+                        float cos_triangulation_angle;
+                        ComputeViewLikelihood(row, col, hypothesis, image,
+                                              &cos_triangulation_angle);
+                        if (cos_triangulation_angle > cos_min_triangulation_angle) {
+                            continue;
+                        }
+
+                        if (ComputePhotometricCost(patch, row, col, hypothesis,
+                                                   image) > max_cost) {
+                            continue;
+                        }
+
+                        if (options_.geom_consistency &&
+                            ComputeGeometricError(row, col, hypothesis, image) >
+                            options_.filter_geom_consistency_max_cost) {
+                            continue;
+                        }
+
+                        consistent.push_back(image.image_id);
+                    }
+
+                    if (consistent.size() <
+                        static_cast<size_t>(options_.filter_min_num_consistent)) {
+                        depths_[pixel_idx] = 0.0f;
+                        std::fill(&normals_[3 * pixel_idx], &normals_[3 * pixel_idx] + 3,
+                                  0.0f);
+                    } else if (!consistent.empty()) {
+                        image_ids.push_back(row);
+                        image_ids.push_back(col);
+                        image_ids.push_back(static_cast<int>(consistent.size()));
+                        image_ids.insert(image_ids.end(), consistent.begin(),
+                                         consistent.end());
+                    }
+                }
+            };
+
+            for (int row = 0; row < height_; ++row) {
+                thread_pool_->AddTask(FilterRow, row);
+            }
+            thread_pool_->Wait();
+
+            for (const auto& image_ids : row_image_ids) {
+                consistent_image_ids_.insert(consistent_image_ids_.end(),
+                                             image_ids.begin(), image_ids.end());
+            }
+        }
+
+    }  // namespace mvs
+}
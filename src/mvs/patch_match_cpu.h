@@ -0,0 +1,177 @@
+#ifndef BKMAP_PATCH_MATCH_CPU_H
+#define BKMAP_PATCH_MATCH_CPU_H
+
+#include <memory>
+#include <vector>
+
+#include "mvs/depth_map.h"
+#include "mvs/mat.h"
+#include "mvs/normal_map.h"
+#include "mvs/patch_match.h"
+#include "util/threading.h"
+
+namespace bkmap {
+    namespace mvs {
+
+// Multi-threaded CPU implementation of the PatchMatch stereo algorithm with
+// joint view selection. It computes the depth, normal and selection
+// probability maps and the consistent images of a problem using the options
+// of PatchMatch.
+//
+// Each iteration consists of four sweeps (top to bottom, bottom to top, left
+// to right, right to left). During a vertical sweep, all columns of the image
+// are independent of each other and are split into tiles that are processed
+// in parallel; the same holds for the rows during a horizontal sweep. The
+// bilaterally weighted NCC cost over the support window is evaluated with
+// SSE instructions, if available.
+        class PatchMatchCPU {
+        public:
+            PatchMatchCPU(const PatchMatch::Options& options,
+                          const PatchMatch::Problem& problem);
+
+            void Run();
+
+            DepthMap GetDepthMap() const;
+            NormalMap GetNormalMap() const;
+            Mat<float> GetSelProbMap() const;
+            std::vector<int> GetConsistentImageIds() const;
+
+        private:
+            enum class SweepDirection {
+                TOP_TO_BOTTOM,
+                BOTTOM_TO_TOP,
+                LEFT_TO_RIGHT,
+                RIGHT_TO_LEFT,
+            };
+
+            // Source image with its pose relative to the reference image.
+            struct SourceImage {
+                int image_id = -1;
+                int width = 0;
+                int height = 0;
+                // Grey values in the range [0, 1] in row-major order.
+                std::vector<float> data;
+                // Intrinsics in the order fx, fy, cx, cy.
+                float K[4];
+                // Relative transformation from reference to source frame.
+                float R[9];
+                float T[3];
+                // Projection center in the reference frame.
+                float C[3];
+                // Depth map for the geometric consistency term, may be null.
+                const DepthMap* depth_map = nullptr;
+            };
+
+            // Support window of the reference image around a pixel with the
+            // precomputed bilateral weights and weighted reference statistics.
+            struct RefPatch {
+                // Number of window elements padded to a multiple of four.
+                size_t size = 0;
+                // Bilateral weights, zero for padding and pixels outside the image.
+                std::vector<float> weights;
+                // Weighted reference grey values.
+                std::vector<float> weighted_values;
+                // Weighted statistics of the reference window.
+                float sum_weights = 0.0f;
+                float mean = 0.0f;
+                float variance = 0.0f;
+                // Scratch buffer for the sampled source grey values.
+                mutable std::vector<float> src_values;
+            };
+
+            // Scratch buffers of a worker thread, which are reused for all pixels
+            // it processes, with one entry per source image.
+            struct ThreadBuffers {
+                RefPatch patch;
+                std::vector<float> sampling_probs;
+                std::vector<int> num_samples_per_image;
+                std::vector<float> candidate_costs;
+                std::vector<float> best_costs;
+            };
+
+            // Depth and normal hypothesis of a pixel.
+            struct Hypothesis {
+                float depth;
+                float normal[3];
+            };
+
+            void InitRefImage();
+            void InitSourceImages();
+            void InitHypotheses();
+
+            void Sweep(const SweepDirection direction, const int iteration);
+            void SweepTile(const SweepDirection direction, const int iteration,
+                           const int begin, const int end);
+            void ProcessPixel(const int row, const int col, const int prev_row,
+                              const int prev_col, const int iteration,
+                              ThreadBuffers* buffers);
+
+            void ExtractRefPatch(const int row, const int col,
+                                 RefPatch* patch) const;
+
+            // Compute the photometric cost 1 - NCC in the range [0, 2] of the
+            // given hypothesis w.r.t. the given source image.
+            float ComputePhotometricCost(const RefPatch& patch, const int row,
+                                         const int col, const Hypothesis& hypothesis,
+                                         const SourceImage& image) const;
+
+            // Compute the forward-backward reprojection error in pixels.
+            float ComputeGeometricError(const int row, const int col,
+                                        const Hypothesis& hypothesis,
+                                        const SourceImage& image) const;
+
+            float ComputeCost(const RefPatch& patch, const int row, const int col,
+                              const Hypothesis& hypothesis,
+                              const SourceImage& image) const;
+
+            // Compute the likelihood of a source image to be selected given the
+            // angular configuration of the hypothesis.
+            float ComputeViewLikelihood(const int row, const int col,
+                                        const Hypothesis& hypothesis,
+                                        const SourceImage& image,
+                                        float* cos_triangulation_angle) const;
+
+            void GenerateRandomHypothesis(const int row, const int col,
+                                          Hypothesis* hypothesis) const;
+            void PerturbHypothesis(const int row, const int col,
+                                   const float perturbation,
+                                   Hypothesis* hypothesis) const;
+
+            void ComputeViewingRay(const int row, const int col, float ray[3]) const;
+
+            void Filter();
+
+            const PatchMatch::Options options_;
+            const PatchMatch::Problem problem_;
+
+            std::unique_ptr<ThreadPool> thread_pool_;
+            // Indexed by the thread index of the thread pool.
+            std::vector<ThreadBuffers> thread_buffers_;
+
+            int width_ = 0;
+            int height_ = 0;
+            float ref_K_[4];
+            float cos_min_triangulation_angle_ = 0.0f;
+            std::vector<float> ref_image_;
+            std::vector<SourceImage> src_images_;
+
+            // Flattened offsets of the support window.
+            std::vector<float> window_row_offsets_;
+            std::vector<float> window_col_offsets_;
+            std::vector<float> window_spatial_dists_;
+
+            // Per-pixel state of the algorithm in row-major order. The costs and
+            // selection probabilities are stored contiguously per pixel, i.e.
+            // at index `(row * width + col) * num_src_images + image_idx`.
+            std::vector<float> depths_;
+            std::vector<float> normals_;
+            std::vector<float> costs_;
+            std::vector<float> sel_probs_;
+
+            std::vector<int> consistent_image_ids_;
+        };
+
+    }  // namespace mvs
+}
+
+#endif //BKMAP_PATCH_MATCH_CPU_H
@@ -4,6 +4,7 @@
 
 #include "mvs/workspace.h"
 
+#include "util/bitmap_cache.h"
 #include "util/misc.h"
 
 namespace bkmap {
@@ -57,18 +58,32 @@ namespace bkmap {
         const Model& Workspace::GetModel() const { return model_; }
 
         const Bitmap& Workspace::GetBitmap(const int image_id) {
+            return *GetBitmapPtr(image_id);
+        }
+
+        std::shared_ptr<const Bitmap> Workspace::GetBitmapPtr(const int image_id) {
             auto& cached_image = cache_.GetMutable(image_id);
             if (!cached_image.bitmap) {
-                cached_image.bitmap.reset(new Bitmap());
-                cached_image.bitmap->Read(GetBitmapPath(image_id), options_.image_as_rgb);
+                // The images are shared with the other stages through the
+                // process-wide cache, which also holds the images written by the
+                // undistortion, so that they are usually not decoded again. The
+                // images read here are only kept in the workspace's own cache, so
+                // that they are not counted under both memory budgets.
+                int width = 0;
+                int height = 0;
                 if (options_.max_image_size > 0) {
-                    cached_image.bitmap->Rescale(model_.images.at(image_id).GetWidth(),
-                                                 model_.images.at(image_id).GetHeight());
+                    width = static_cast<int>(model_.images.at(image_id).GetWidth());
+                    height = static_cast<int>(model_.images.at(image_id).GetHeight());
+                }
+                cached_image.bitmap = BitmapCache::Global().ReadUncached(
+                        GetBitmapPath(image_id), options_.image_as_rgb, width, height);
+                if (!cached_image.bitmap) {
+                    cached_image.bitmap.reset(new Bitmap());
                 }
                 cached_image.num_bytes += cached_image.bitmap->NumBytes();
                 cache_.UpdateNumBytes(image_id);
             }
-            return *cached_image.bitmap;
+            return cached_image.bitmap;
         }
 
         const DepthMap& Workspace::GetDepthMap(const int image_id) {
@@ -42,6 +42,9 @@ namespace bkmap {
 
             const Model& GetModel() const;
             const Bitmap& GetBitmap(const int image_id);
+            // Get the cached bitmap, which is shared with the caller instead of being
+            // copied and stays valid even after it is evicted from the cache.
+            std::shared_ptr<const Bitmap> GetBitmapPtr(const int image_id);
             const DepthMap& GetDepthMap(const int image_id);
             const NormalMap& GetNormalMap(const int image_id);
 
@@ -65,7 +68,7 @@ namespace bkmap {
                 CachedImage& operator=(CachedImage&& other);
                 size_t NumBytes() const;
                 size_t num_bytes = 0;
-                std::unique_ptr<Bitmap> bitmap;
+                std::shared_ptr<const Bitmap> bitmap;
                 std::unique_ptr<DepthMap> depth_map;
                 std::unique_ptr<NormalMap> normal_map;
 
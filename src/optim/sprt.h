@@ -42,6 +42,20 @@ namespace bkmap {
         bool Evaluate(const std::vector<double>& residuals, const double max_residual,
                       size_t* num_inliers, size_t* num_eval_samples);
 
+        // Continue the evaluation of a model with the next block of residuals,
+        // where the likelihood ratio is carried over between the blocks and must
+        // be initialized to 1 for the first block of a model. The number of
+        // inliers and evaluated samples refer to the given block only.
+        bool Evaluate(const std::vector<double>& residuals, const double max_residual,
+                      double* likelihood_ratio, size_t* num_inliers,
+                      size_t* num_eval_samples);
+
+        const Options& GetOptions() const;
+
+        // The decision threshold A. A good model is rejected with a probability
+        // of approximately 1 / A.
+        double DecisionThreshold() const;
+
     private:
         void UpdateDecisionThreshold();
 
@@ -0,0 +1,449 @@
+#ifndef BKMAP_SPRT_LORANSAC_H
+#define BKMAP_SPRT_LORANSAC_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "optim/random_sampler.h"
+#include "optim/ransac.h"
+#include "optim/sprt.h"
+#include "optim/support_measurement.h"
+#include "util/logging.h"
+#include "util/random.h"
+
+namespace bkmap {
+
+// Implementation of LO-RANSAC, in which the models of the random samples are
+// verified with the Sequential Probability Ratio Test (SPRT) as proposed in
+//
+//   "Randomized RANSAC with Sequential Probability Ratio Test",
+//   Matas et al., 2005
+//
+// The data is evaluated in random order and in small blocks, such that bad
+// models are rejected after evaluating only a small fraction of the data. The
+// SPRT parameters are adapted to the inlier ratio of the best model and to the
+// observed consistency of the rejected models.
+//
+// Besides the one-shot `Estimate`, the estimation can be run incrementally
+// with `Initialize`, `Iterate`, and `Finish`, which allows to interleave the
+// trials of multiple estimations over the same data.
+    template <typename Estimator, typename LocalEstimator,
+            typename SupportMeasurer = InlierSupportMeasurer,
+            typename Sampler = RandomSampler>
+    class SPRTLORANSAC : public RANSAC<Estimator, SupportMeasurer, Sampler> {
+    public:
+        using typename RANSAC<Estimator, SupportMeasurer, Sampler>::Report;
+
+        SPRTLORANSAC(const RANSACOptions& options,
+                     const SPRT::Options& sprt_options);
+
+        // Robustly estimate model with SPRT LO-RANSAC.
+        //
+        // @param X              Independent variables.
+        // @param Y              Dependent variables.
+        //
+        // @return               The report with the results of the estimation.
+        Report Estimate(const std::vector<typename Estimator::X_t>& X,
+                        const std::vector<typename Estimator::Y_t>& Y);
+
+        // Start an incremental estimation. The data must remain valid until the
+        // estimation is finished.
+        void Initialize(const std::vector<typename Estimator::X_t>& X,
+                        const std::vector<typename Estimator::Y_t>& Y);
+
+        // Run up to the given number of trials and return whether the estimation
+        // requires further trials.
+        bool Iterate(const size_t num_trials);
+
+        // Determine the inlier mask of the best model and return the report.
+        Report Finish();
+
+        size_t NumTrials() const;
+
+        // The number of inliers of the best model so far.
+        size_t NumInliers() const;
+
+        // Objects used in RANSAC procedure.
+        using RANSAC<Estimator, SupportMeasurer, Sampler>::estimator;
+        LocalEstimator local_estimator;
+        using RANSAC<Estimator, SupportMeasurer, Sampler>::sampler;
+        using RANSAC<Estimator, SupportMeasurer, Sampler>::support_measurer;
+
+    private:
+        using RANSAC<Estimator, SupportMeasurer, Sampler>::options_;
+
+        // Number of data points evaluated at once by the SPRT.
+        static const size_t kBlockSize = 32;
+
+        // Verify the model of a random sample and update the best model.
+        void VerifyModel(const typename Estimator::M_t& model);
+
+        // Update the SPRT for a new estimate of the inlier ratio of a good model
+        // or of the probability that a data point is consistent with a bad model.
+        void UpdateSPRT(const double epsilon, const double delta);
+
+        // Number of trials required to find the best model with the confidence,
+        // taking into account that the SPRT rejects good models with a
+        // probability of approximately 1 / A.
+        size_t ComputeNumTrials() const;
+
+        const std::vector<typename Estimator::X_t>* X_ = nullptr;
+        const std::vector<typename Estimator::Y_t>* Y_ = nullptr;
+
+        // The data in random order, split into blocks for the SPRT.
+        std::vector<std::vector<typename Estimator::X_t>> X_blocks_;
+        std::vector<std::vector<typename Estimator::Y_t>> Y_blocks_;
+
+        std::vector<typename Estimator::X_t> X_rand_;
+        std::vector<typename Estimator::Y_t> Y_rand_;
+        std::vector<typename LocalEstimator::X_t> X_inlier_;
+        std::vector<typename LocalEstimator::Y_t> Y_inlier_;
+        std::vector<double> block_residuals_;
+        std::vector<double> residuals_;
+
+        const SPRT::Options sprt_options_;
+        SPRT sprt_;
+
+        // Statistics of the rejected models to estimate the SPRT delta.
+        size_t num_rejected_models_ = 0;
+        double rejected_inlier_ratio_sum_ = 0;
+
+        typename SupportMeasurer::Support best_support_;
+        typename Estimator::M_t best_model_;
+        bool best_model_is_local_ = false;
+
+        size_t num_trials_ = 0;
+        size_t max_num_trials_ = 0;
+        size_t dyn_max_num_trials_ = 0;
+        bool finished_ = true;
+    };
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    const size_t SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::kBlockSize;
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::SPRTLORANSAC(
+            const RANSACOptions& options, const SPRT::Options& sprt_options)
+            : RANSAC<Estimator, SupportMeasurer, Sampler>(options),
+              sprt_options_(sprt_options),
+              sprt_(sprt_options) {}
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    typename SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::Report
+    SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Estimate(
+            const std::vector<typename Estimator::X_t>& X,
+            const std::vector<typename Estimator::Y_t>& Y) {
+        Initialize(X, Y);
+        while (Iterate(options_.max_num_trials)) {
+        }
+        return Finish();
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    void SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::Initialize(const std::vector<typename Estimator::X_t>& X,
+                                 const std::vector<typename Estimator::Y_t>& Y) {
+        CHECK_EQ(X.size(), Y.size());
+
+        X_ = &X;
+        Y_ = &Y;
+
+        const size_t num_samples = X.size();
+
+        best_support_ = typename SupportMeasurer::Support();
+        best_model_ = typename Estimator::M_t();
+        best_model_is_local_ = false;
+        num_trials_ = 0;
+        sprt_.Update(sprt_options_);
+        num_rejected_models_ = 0;
+        rejected_inlier_ratio_sum_ = 0;
+
+        if (num_samples < Estimator::kMinNumSamples) {
+            finished_ = true;
+            return;
+        }
+
+        finished_ = false;
+
+        std::vector<size_t> sample_idxs(num_samples);
+        for (size_t i = 0; i < num_samples; ++i) {
+            sample_idxs[i] = i;
+        }
+        Shuffle(static_cast<uint32_t>(num_samples), &sample_idxs);
+
+        const size_t num_blocks = (num_samples + kBlockSize - 1) / kBlockSize;
+        X_blocks_.resize(num_blocks);
+        Y_blocks_.resize(num_blocks);
+        for (size_t i = 0; i < num_blocks; ++i) {
+            const size_t begin = i * kBlockSize;
+            const size_t end = std::min(begin + kBlockSize, num_samples);
+            X_blocks_[i].clear();
+            Y_blocks_[i].clear();
+            X_blocks_[i].reserve(end - begin);
+            Y_blocks_[i].reserve(end - begin);
+            for (size_t j = begin; j < end; ++j) {
+                X_blocks_[i].push_back(X[sample_idxs[j]]);
+                Y_blocks_[i].push_back(Y[sample_idxs[j]]);
+            }
+        }
+
+        residuals_.resize(num_samples);
+        X_rand_.resize(Estimator::kMinNumSamples);
+        Y_rand_.resize(Estimator::kMinNumSamples);
+
+        sampler.Initialize(num_samples);
+
+        max_num_trials_ =
+                std::min<size_t>(options_.max_num_trials, sampler.MaxNumSamples());
+        dyn_max_num_trials_ = max_num_trials_;
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    bool SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Iterate(
+            const size_t num_trials) {
+        const size_t end_num_trials =
+                std::min(max_num_trials_, num_trials_ + num_trials);
+
+        while (!finished_ && num_trials_ < end_num_trials) {
+            sampler.SampleXY(*X_, *Y_, &X_rand_, &Y_rand_);
+
+            // Estimate model for current subset.
+            const std::vector<typename Estimator::M_t> sample_models =
+                    estimator.Estimate(X_rand_, Y_rand_);
+
+            num_trials_ += 1;
+
+            // Iterate through all estimated models
+            for (const auto& sample_model : sample_models) {
+                VerifyModel(sample_model);
+            }
+
+            if (num_trials_ >= dyn_max_num_trials_ &&
+                num_trials_ >= options_.min_num_trials) {
+                finished_ = true;
+            }
+        }
+
+        if (num_trials_ >= max_num_trials_) {
+            finished_ = true;
+        }
+
+        return !finished_;
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    typename SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::Report
+    SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Finish() {
+        Report report;
+        report.success = false;
+        report.num_trials = num_trials_;
+        report.support = best_support_;
+        report.model = best_model_;
+
+        finished_ = true;
+        X_blocks_.clear();
+        Y_blocks_.clear();
+
+        // No valid model was found
+        if (X_ == nullptr ||
+            report.support.num_inliers < Estimator::kMinNumSamples) {
+            return report;
+        }
+
+        report.success = true;
+
+        if (best_model_is_local_) {
+            local_estimator.Residuals(*X_, *Y_, report.model, &residuals_);
+        } else {
+            estimator.Residuals(*X_, *Y_, report.model, &residuals_);
+        }
+
+        CHECK_EQ(residuals_.size(), X_->size());
+
+        const double max_residual = options_.max_error * options_.max_error;
+
+        report.inlier_mask.resize(residuals_.size());
+        for (size_t i = 0; i < residuals_.size(); ++i) {
+            report.inlier_mask[i] = residuals_[i] <= max_residual;
+        }
+
+        return report;
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    size_t SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::NumTrials() const {
+        return num_trials_;
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    size_t SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::NumInliers() const {
+        return best_support_.num_inliers;
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    void SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::VerifyModel(const typename Estimator::M_t& model) {
+        const double max_residual = options_.max_error * options_.max_error;
+        const size_t num_samples = X_->size();
+
+        // Evaluate the blocks starting at a random block, so that the rejection
+        // decisions of different models are based on different data.
+        const size_t num_blocks = X_blocks_.size();
+        const size_t first_block_idx = RandomInteger<size_t>(0, num_blocks - 1);
+
+        double likelihood_ratio = 1;
+        size_t num_eval_inliers = 0;
+        size_t num_eval_samples = 0;
+
+        for (size_t i = 0; i < num_blocks; ++i) {
+            const size_t block_idx = (first_block_idx + i) % num_blocks;
+
+            estimator.Residuals(X_blocks_[block_idx], Y_blocks_[block_idx], model,
+                                &block_residuals_);
+            CHECK_EQ(block_residuals_.size(), X_blocks_[block_idx].size());
+
+            size_t num_block_inliers;
+            size_t num_block_eval_samples;
+            const bool accepted =
+                    sprt_.Evaluate(block_residuals_, max_residual, &likelihood_ratio,
+                                   &num_block_inliers, &num_block_eval_samples);
+
+            num_eval_inliers += num_block_inliers;
+            num_eval_samples += num_block_eval_samples;
+
+            if (!accepted) {
+                // Update the estimate of the probability that a data point is
+                // consistent with a bad model.
+                num_rejected_models_ += 1;
+                rejected_inlier_ratio_sum_ +=
+                        num_eval_inliers / static_cast<double>(num_eval_samples);
+                const double delta =
+                        rejected_inlier_ratio_sum_ / num_rejected_models_;
+                if (std::abs(delta - sprt_.GetOptions().delta) >
+                    0.1 * sprt_.GetOptions().delta) {
+                    UpdateSPRT(sprt_.GetOptions().epsilon, delta);
+                }
+                return;
+            }
+
+            std::copy(block_residuals_.begin(), block_residuals_.end(),
+                      residuals_.begin() + block_idx * kBlockSize);
+        }
+
+        const auto support = support_measurer.Evaluate(residuals_, max_residual);
+
+        // Do local optimization if better than all previous subsets.
+        if (!support_measurer.Compare(support, best_support_)) {
+            return;
+        }
+
+        best_support_ = support;
+        best_model_ = model;
+        best_model_is_local_ = false;
+
+        // Estimate locally optimized model from inliers.
+        if (support.num_inliers > Estimator::kMinNumSamples &&
+            support.num_inliers >= LocalEstimator::kMinNumSamples) {
+            X_inlier_.clear();
+            Y_inlier_.clear();
+            X_inlier_.reserve(support.num_inliers);
+            Y_inlier_.reserve(support.num_inliers);
+            for (size_t i = 0; i < num_blocks; ++i) {
+                for (size_t j = 0; j < X_blocks_[i].size(); ++j) {
+                    if (residuals_[i * kBlockSize + j] <= max_residual) {
+                        X_inlier_.push_back(X_blocks_[i][j]);
+                        Y_inlier_.push_back(Y_blocks_[i][j]);
+                    }
+                }
+            }
+
+            const std::vector<typename LocalEstimator::M_t> local_models =
+                    local_estimator.Estimate(X_inlier_, Y_inlier_);
+
+            for (const auto& local_model : local_models) {
+                local_estimator.Residuals(*X_, *Y_, local_model, &block_residuals_);
+                CHECK_EQ(block_residuals_.size(), num_samples);
+
+                const auto local_support =
+                        support_measurer.Evaluate(block_residuals_, max_residual);
+
+                // Check if non-locally optimized model is better.
+                if (support_measurer.Compare(local_support, best_support_)) {
+                    best_support_ = local_support;
+                    best_model_ = local_model;
+                    best_model_is_local_ = true;
+                }
+            }
+        }
+
+        // The inlier ratio of the best model is the new estimate of the inlier
+        // ratio of a good model.
+        const double epsilon = best_support_.num_inliers /
+                               static_cast<double>(num_samples);
+        if (epsilon > sprt_.GetOptions().epsilon) {
+            UpdateSPRT(epsilon, sprt_.GetOptions().delta);
+        }
+
+        dyn_max_num_trials_ = ComputeNumTrials();
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    void SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::UpdateSPRT(const double epsilon, const double delta) {
+        // The test is only meaningful, if a data point is less likely to be
+        // consistent with a bad model than with a good model.
+        const double kMinDelta = 1e-3;
+        const double kMaxEpsilon = 0.99;
+        SPRT::Options sprt_options = sprt_.GetOptions();
+        sprt_options.epsilon = std::min(epsilon, kMaxEpsilon);
+        sprt_options.delta =
+                std::max(kMinDelta, std::min(delta, 0.5 * sprt_options.epsilon));
+        sprt_.Update(sprt_options);
+    }
+
+    template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+            typename Sampler>
+    size_t SPRTLORANSAC<Estimator, LocalEstimator, SupportMeasurer,
+            Sampler>::ComputeNumTrials() const {
+        const double inlier_ratio =
+                best_support_.num_inliers / static_cast<double>(X_->size());
+
+        const double nom = 1 - options_.confidence;
+        if (nom <= 0) {
+            return std::numeric_limits<size_t>::max();
+        }
+
+        const double denom =
+                1 - std::pow(inlier_ratio, Estimator::kMinNumSamples) *
+                    (1 - 1 / sprt_.DecisionThreshold());
+        if (denom <= 0) {
+            return 1;
+        }
+
+        return static_cast<size_t>(std::ceil(std::log(nom) / std::log(denom)));
+    }
+
+}
+
+#endif //BKMAP_SPRT_LORANSAC_H
@@ -6,16 +6,15 @@
 #define BKMAP_INVERTED_FILE_H
 
 #include <algorithm>
-#include <bitset>
 #include <cstdint>
 #include <fstream>
+#include <numeric>
 #include <unordered_set>
 #include <vector>
 
 #include <Eigen/Core>
 
 #include "retrieval/geometry.h"
-#include "retrieval/inverted_file_entry.h"
 #include "retrieval/utils.h"
 #include "util/alignment.h"
 #include "util/logging.h"
@@ -26,14 +25,17 @@ namespace bkmap {
 
 // Implements an inverted file, including the ability to compute image scores
 // and matches. The template parameter is the length of the binary vectors
-// in the Hamming Embedding.
+// in the Hamming Embedding. The entries are stored as separate arrays of image
+// identifiers, binary signatures packed into 64 bit words and geometries, so
+// that scoring only streams through the identifiers and signatures. Besides
+// the added entries, the file can reference segments of entries whose memory
+// is owned elsewhere, e.g. by a memory-mapped visual index.
 // This class is based on an original implementation by Torsten Sattler.
         template <int kEmbeddingDim>
         class InvertedFile {
         public:
             typedef Eigen::VectorXf DescType;
             typedef FeatureGeometry GeomType;
-            typedef InvertedFileEntry<kEmbeddingDim> EntryType;
 
             enum Status {
                 UNUSABLE = 0x00,
@@ -42,13 +44,27 @@ namespace bkmap {
                 USABLE = 0x03,
             };
 
+            // A contiguous range of entries in ascending order of image ids, where the
+            // i-th elements of the arrays belong to the i-th entry.
+            struct EntrySegment {
+                size_t num_entries = 0;
+                const int* image_ids = nullptr;
+                const uint64_t* descriptors = nullptr;
+                const GeomType* geometries = nullptr;
+            };
+
             InvertedFile();
 
-            // The number of added entries.
+            // The number of entries, including the entries of all segments.
             size_t NumEntries() const;
 
-            // Return all entries in the file.
-            const std::vector<EntryType>& GetEntries() const;
+            // The number of entries that were added with AddEntry.
+            size_t NumAddedEntries() const;
+
+            // Add a segment of entries without copying them. The memory of the segment
+            // must outlive the entries in this file and the images of the segment must
+            // not have any other entries in this file.
+            void AddSegment(const EntrySegment& segment);
 
             // Whether the Hamming embedding was computed for this file.
             bool HasHammingEmbedding() const;
@@ -71,22 +87,22 @@ namespace bkmap {
             // required for efficient scoring and must be called before ScoreFeature.
             void SortEntries();
 
-            // Clear all entries in this file.
+            // Clear all entries and segments in this file.
             void ClearEntries();
 
             // Reset all computed weights/thresholds and clear all entries.
             void Reset();
 
-            // Given a projected descriptor, returns the corresponding binary string.
-            void ConvertToBinaryDescriptor(
-                    const DescType& descriptor,
-                    std::bitset<kEmbeddingDim>* binary_descriptor) const;
+            // Given a projected descriptor, returns the corresponding binary string,
+            // where the i-th bit of the word is the i-th dimension.
+            uint64_t ConvertToBinaryDescriptor(const DescType& descriptor) const;
 
             // Compute the idf-weight for this inverted file.
             void ComputeIDFWeight(const int num_total_images);
 
-            // Return the idf-weight of this inverted file.
+            // Return or set the idf-weight of this inverted file.
             float IDFWeight() const;
+            void SetIDFWeight(const float idf_weight);
 
             // Given a set of descriptors, learns the thresholds required for the Hamming
             // embedding. Each row in descriptors represents a single descriptor projected
@@ -98,6 +114,10 @@ namespace bkmap {
             void ScoreFeature(const DescType& descriptor,
                               std::vector<ImageScore>* image_scores) const;
 
+            // Find the geometries of all entries of the given images.
+            void FindMatches(const std::unordered_set<int>& image_ids,
+                             std::vector<std::pair<int, GeomType>>* matches) const;
+
             // Get the identifiers of all indexed images in this file.
             void GetImageIds(std::unordered_set<int>* ids) const;
 
@@ -108,11 +128,46 @@ namespace bkmap {
             void ComputeImageSelfSimilarities(
                     std::vector<double>* self_similarities) const;
 
-            // Read/write the inverted file from/to a binary file.
+            // Read/write the inverted file from/to a binary file in the format before
+            // the memory-mapped format of the visual index. Each entry is stored as
+            // a 32 bit image identifier, its geometry and its binary signature as a
+            // 64 bit word.
             void Read(std::ifstream* ifs);
             void Write(std::ofstream* ofs) const;
 
+            // Read/write the status, the idf-weight, and the Hamming embedding
+            // thresholds of the inverted file without its entries.
+            void ReadHeader(std::istream* ifs);
+            void WriteHeader(std::ostream* ofs) const;
+
+            // Write the entries as one block of image identifiers, padded to 8 bytes,
+            // binary signatures, and geometries in ascending order of image ids, which
+            // can be referenced in place by MapEntries. The entries of the segments
+            // are only written, if `include_segments` is true.
+            void WriteEntries(std::ostream* ofs, const bool include_segments) const;
+            void MapEntries(const char* data, const size_t num_entries);
+
+            // The number of bytes of a block of entries written by WriteEntries.
+            static size_t EntriesNumBytes(const size_t num_entries);
+
         private:
+            // The number of entries whose Hamming distances are computed at once
+            // during scoring.
+            static const size_t kScoreBlockSize = 256;
+
+            // Sort the arrays of entries stably in ascending order of image ids.
+            static void SortByImageId(std::vector<int>* image_ids,
+                                      std::vector<uint64_t>* descriptors,
+                                      std::vector<GeomType>* geometries);
+
+            // Call the function for the added entries and all segments.
+            template <typename Func>
+            void ForEachSegment(const Func& func) const;
+
+            void ScoreSegment(const uint64_t bin_descriptor,
+                              const EntrySegment& segment,
+                              std::vector<ImageScore>* image_scores) const;
+
             // Whether the inverted file is initialized.
             uint8_t status_;
 
@@ -120,7 +175,12 @@ namespace bkmap {
             float idf_weight_;
 
             // The entries of the inverted file system.
-            std::vector<EntryType> entries_;
+            std::vector<int> image_ids_;
+            std::vector<uint64_t> descriptors_;
+            std::vector<GeomType> geometries_;
+
+            // The segments of entries whose memory is owned elsewhere.
+            std::vector<EntrySegment> segments_;
 
             // The thresholds used for Hamming embedding.
             DescType thresholds_;
@@ -138,6 +198,9 @@ namespace bkmap {
         const HammingDistWeightFunctor<kEmbeddingDim>
                 InvertedFile<kEmbeddingDim>::hamming_dist_weight_functor_;
 
+        template <int kEmbeddingDim>
+        const size_t InvertedFile<kEmbeddingDim>::kScoreBlockSize;
+
         template <int kEmbeddingDim>
         InvertedFile<kEmbeddingDim>::InvertedFile()
                 : status_(UNUSABLE), idf_weight_(0.0f) {
@@ -146,6 +209,10 @@ namespace bkmap {
                                   " be a multiple of 8.");
             static_assert(kEmbeddingDim > 0,
                           "Dimensionality of projected space needs to be > 0.");
+            static_assert(kEmbeddingDim <= 64,
+                          "Dimensionality of projected space needs to be <= 64.");
+            static_assert(sizeof(GeomType) == 16, "Geometry type size mismatch");
+            static_assert(sizeof(int) == 4, "Expected int to be 4 bytes");
 
             thresholds_.resize(kEmbeddingDim);
             thresholds_.setZero();
@@ -153,13 +220,23 @@ namespace bkmap {
 
         template <int kEmbeddingDim>
         size_t InvertedFile<kEmbeddingDim>::NumEntries() const {
-            return entries_.size();
+            size_t num_entries = image_ids_.size();
+            for (const auto& segment : segments_) {
+                num_entries += segment.num_entries;
+            }
+            return num_entries;
+        }
+
+        template <int kEmbeddingDim>
+        size_t InvertedFile<kEmbeddingDim>::NumAddedEntries() const {
+            return image_ids_.size();
         }
 
         template <int kEmbeddingDim>
-        const std::vector<typename InvertedFile<kEmbeddingDim>::EntryType>&
-        InvertedFile<kEmbeddingDim>::GetEntries() const {
-            return entries_;
+        void InvertedFile<kEmbeddingDim>::AddSegment(const EntrySegment& segment) {
+            if (segment.num_entries > 0) {
+                segments_.push_back(segment);
+            }
         }
 
         template <int kEmbeddingDim>
@@ -183,26 +260,24 @@ namespace bkmap {
                                                    const GeomType& geometry) {
             CHECK_GE(image_id, 0);
             CHECK_EQ(descriptor.size(), kEmbeddingDim);
-            EntryType entry;
-            entry.image_id = image_id;
-            entry.geometry = geometry;
-            ConvertToBinaryDescriptor(descriptor, &entry.descriptor);
-            entries_.push_back(entry);
+            image_ids_.push_back(image_id);
+            descriptors_.push_back(ConvertToBinaryDescriptor(descriptor));
+            geometries_.push_back(geometry);
             status_ &= ~ENTRIES_SORTED;
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::SortEntries() {
-            std::sort(entries_.begin(), entries_.end(),
-                      [](const EntryType& entry1, const EntryType& entry2) {
-                          return entry1.image_id < entry2.image_id;
-                      });
+            SortByImageId(&image_ids_, &descriptors_, &geometries_);
             status_ |= ENTRIES_SORTED;
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::ClearEntries() {
-            entries_.clear();
+            image_ids_.clear();
+            descriptors_.clear();
+            geometries_.clear();
+            segments_.clear();
             status_ &= ~ENTRIES_SORTED;
         }
 
@@ -210,23 +285,26 @@ namespace bkmap {
         void InvertedFile<kEmbeddingDim>::Reset() {
             status_ = UNUSABLE;
             idf_weight_ = 0.0f;
-            entries_.clear();
+            ClearEntries();
             thresholds_.setZero();
         }
 
         template <int kEmbeddingDim>
-        void InvertedFile<kEmbeddingDim>::ConvertToBinaryDescriptor(
-                const DescType& descriptor,
-                std::bitset<kEmbeddingDim>* binary_descriptor) const {
+        uint64_t InvertedFile<kEmbeddingDim>::ConvertToBinaryDescriptor(
+                const DescType& descriptor) const {
             CHECK_EQ(descriptor.size(), kEmbeddingDim);
+            uint64_t binary_descriptor = 0;
             for (int i = 0; i < kEmbeddingDim; ++i) {
-                (*binary_descriptor)[i] = descriptor[i] > thresholds_[i];
+                if (descriptor[i] > thresholds_[i]) {
+                    binary_descriptor |= static_cast<uint64_t>(1) << i;
+                }
             }
+            return binary_descriptor;
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::ComputeIDFWeight(const int num_total_images) {
-            if (entries_.empty()) {
+            if (NumEntries() == 0) {
                 return;
             }
 
@@ -242,6 +320,11 @@ namespace bkmap {
             return idf_weight_;
         }
 
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::SetIDFWeight(const float idf_weight) {
+            idf_weight_ = idf_weight;
+        }
+
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::ComputeHammingEmbedding(
                 const Eigen::Matrix<float, Eigen::Dynamic, kEmbeddingDim>& descriptors) {
@@ -268,51 +351,70 @@ namespace bkmap {
 
             image_scores->clear();
 
-            if (!IsUsable()) {
+            if (!IsUsable() || (image_ids_.empty() && segments_.empty())) {
                 return;
             }
 
-            if (entries_.size() == 0) {
-                return;
-            }
+            const uint64_t bin_descriptor = ConvertToBinaryDescriptor(descriptor);
 
-            const float squared_idf_weight = idf_weight_ * idf_weight_;
+            // The images of different segments are disjoint, so that the segments
+            // can be scored independently.
+            ForEachSegment([&](const EntrySegment& segment) {
+                ScoreSegment(bin_descriptor, segment, image_scores);
+            });
+        }
 
-            std::bitset<kEmbeddingDim> bin_descriptor;
-            ConvertToBinaryDescriptor(descriptor, &bin_descriptor);
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::ScoreSegment(
+                const uint64_t bin_descriptor, const EntrySegment& segment,
+                std::vector<ImageScore>* image_scores) const {
+            const float squared_idf_weight = idf_weight_ * idf_weight_;
 
             ImageScore image_score;
-            image_score.image_id = entries_.front().image_id;
+            image_score.image_id = segment.image_ids[0];
             image_score.score = 0.0f;
             int num_image_votes = 0;
 
+            // The Hamming distances of a block of entries are computed first, so
+            // that the POPCNT instructions are not interleaved with the branches of
+            // the voting.
+            uint8_t hamming_dists[kScoreBlockSize];
+
             // Note that this assumes that the entries are sorted using SortEntries
             // according to their image identifiers.
-            for (const auto& entry : entries_) {
-                if (image_score.image_id < entry.image_id) {
-                    if (num_image_votes > 0) {
-                        // Finalizes the voting since we now know how many features from
-                        // the database image match the current image feature. This is
-                        // required to perform burstiness normalization (cf. Eqn. 2 in
-                        // Arandjelovic, Zisserman: Scalable descriptor
-                        // distinctiveness for location recognition. ACCV 2014.
-                        // Notice that the weight from the descriptor matching is already
-                        // accumulated in image_score.score, i.e., we only need
-                        // to apply the burstiness weighting.
-                        image_score.score /= std::sqrt(static_cast<float>(num_image_votes));
-                        image_score.score *= squared_idf_weight;
-                        image_scores->push_back(image_score);
+            const size_t num_entries = segment.num_entries;
+            for (size_t begin = 0; begin < num_entries; begin += kScoreBlockSize) {
+                const size_t end = std::min(begin + kScoreBlockSize, num_entries);
+                ComputeHammingDistances(bin_descriptor, segment.descriptors + begin,
+                                        end - begin, hamming_dists);
+
+                for (size_t i = begin; i < end; ++i) {
+                    const int image_id = segment.image_ids[i];
+                    if (image_score.image_id < image_id) {
+                        if (num_image_votes > 0) {
+                            // Finalizes the voting since we now know how many features
+                            // from the database image match the current image feature.
+                            // This is required to perform burstiness normalization
+                            // (cf. Eqn. 2 in Arandjelovic, Zisserman: Scalable
+                            // descriptor distinctiveness for location recognition.
+                            // ACCV 2014. Notice that the weight from the descriptor
+                            // matching is already accumulated in image_score.score,
+                            // i.e., we only need to apply the burstiness weighting.
+                            image_score.score /=
+                                    std::sqrt(static_cast<float>(num_image_votes));
+                            image_score.score *= squared_idf_weight;
+                            image_scores->push_back(image_score);
+                        }
+
+                        image_score.image_id = image_id;
+                        image_score.score = 0.0f;
+                        num_image_votes = 0;
                     }
 
-                    image_score.image_id = entry.image_id;
-                    image_score.score = 0.0f;
-                    num_image_votes = 0;
+                    image_score.score +=
+                            hamming_dist_weight_functor_(hamming_dists[i - begin]);
+                    num_image_votes += 1;
                 }
-
-                const size_t hamming_dist = (bin_descriptor ^ entry.descriptor).count();
-
-                image_score.score += hamming_dist_weight_functor_(hamming_dist);
-                num_image_votes += 1;
             }
 
             // Add the voting for the largest image_id in the entries.
@@ -326,56 +428,210 @@ namespace bkmap {
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::GetImageIds(
                 std::unordered_set<int>* ids) const {
-            for (const EntryType& entry : entries_) {
-                ids->insert(entry.image_id);
-            }
+            ForEachSegment([ids](const EntrySegment& segment) {
+                ids->insert(segment.image_ids, segment.image_ids + segment.num_entries);
+            });
+        }
+
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::FindMatches(
+                const std::unordered_set<int>& image_ids,
+                std::vector<std::pair<int, GeomType>>* matches) const {
+            ForEachSegment([&](const EntrySegment& segment) {
+                for (size_t i = 0; i < segment.num_entries; ++i) {
+                    if (image_ids.count(segment.image_ids[i])) {
+                        matches->emplace_back(segment.image_ids[i],
+                                              segment.geometries[i]);
+                    }
+                }
+            });
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::ComputeImageSelfSimilarities(
                 std::vector<double>* self_similarities) const {
             const double squared_idf_weight = idf_weight_ * idf_weight_;
-            for (const auto& entry : entries_) {
-                self_similarities->at(entry.image_id) += squared_idf_weight;
-            }
+            ForEachSegment([&](const EntrySegment& segment) {
+                for (size_t i = 0; i < segment.num_entries; ++i) {
+                    self_similarities->at(segment.image_ids[i]) += squared_idf_weight;
+                }
+            });
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::Read(std::ifstream* ifs) {
             CHECK(ifs->is_open());
 
-            ifs->read(reinterpret_cast<char*>(&status_), sizeof(uint8_t));
-            ifs->read(reinterpret_cast<char*>(&idf_weight_), sizeof(float));
+            segments_.clear();
 
-            for (int i = 0; i < kEmbeddingDim; ++i) {
-                ifs->read(reinterpret_cast<char*>(&thresholds_[i]), sizeof(float));
-            }
+            ReadHeader(ifs);
 
             uint32_t num_entries = 0;
             ifs->read(reinterpret_cast<char*>(&num_entries), sizeof(uint32_t));
-            entries_.resize(num_entries);
+            image_ids_.resize(num_entries);
+            descriptors_.resize(num_entries);
+            geometries_.resize(num_entries);
+
+            if (num_entries == 0) {
+                return;
+            }
+
+            static_assert(sizeof(GeomType) == 16, "Geometry type size mismatch");
 
             for (uint32_t i = 0; i < num_entries; ++i) {
-                entries_[i].Read(ifs);
+                int32_t image_id = 0;
+                ifs->read(reinterpret_cast<char*>(&image_id), sizeof(int32_t));
+                image_ids_[i] = static_cast<int>(image_id);
+                ifs->read(reinterpret_cast<char*>(&geometries_[i]), sizeof(GeomType));
+                ifs->read(reinterpret_cast<char*>(&descriptors_[i]), sizeof(uint64_t));
             }
+
+            CHECK(ifs->good()) << "Truncated inverted file";
         }
 
         template <int kEmbeddingDim>
         void InvertedFile<kEmbeddingDim>::Write(std::ofstream* ofs) const {
             CHECK(ofs->is_open());
+            CHECK(segments_.empty())
+                << "Segments are only written in the memory-mapped format";
+
+            WriteHeader(ofs);
+
+            const uint32_t num_entries = static_cast<uint32_t>(image_ids_.size());
+            ofs->write(reinterpret_cast<const char*>(&num_entries), sizeof(uint32_t));
+
+            if (num_entries == 0) {
+                return;
+            }
+
+            for (uint32_t i = 0; i < num_entries; ++i) {
+                const int32_t image_id = static_cast<int32_t>(image_ids_[i]);
+                ofs->write(reinterpret_cast<const char*>(&image_id), sizeof(int32_t));
+                ofs->write(reinterpret_cast<const char*>(&geometries_[i]),
+                           sizeof(GeomType));
+                ofs->write(reinterpret_cast<const char*>(&descriptors_[i]),
+                           sizeof(uint64_t));
+            }
+        }
+
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::ReadHeader(std::istream* ifs) {
+            ifs->read(reinterpret_cast<char*>(&status_), sizeof(uint8_t));
+            ifs->read(reinterpret_cast<char*>(&idf_weight_), sizeof(float));
+
+            for (int i = 0; i < kEmbeddingDim; ++i) {
+                ifs->read(reinterpret_cast<char*>(&thresholds_[i]), sizeof(float));
+            }
+        }
 
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::WriteHeader(std::ostream* ofs) const {
             ofs->write(reinterpret_cast<const char*>(&status_), sizeof(uint8_t));
             ofs->write(reinterpret_cast<const char*>(&idf_weight_), sizeof(float));
 
             for (int i = 0; i < kEmbeddingDim; ++i) {
                 ofs->write(reinterpret_cast<const char*>(&thresholds_[i]), sizeof(float));
             }
+        }
+
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::WriteEntries(
+                std::ostream* ofs, const bool include_segments) const {
+            std::vector<int> image_ids;
+            std::vector<uint64_t> descriptors;
+            std::vector<GeomType> geometries;
+            auto AppendSegment = [&](const EntrySegment& segment) {
+                image_ids.insert(image_ids.end(), segment.image_ids,
+                                 segment.image_ids + segment.num_entries);
+                descriptors.insert(descriptors.end(), segment.descriptors,
+                                   segment.descriptors + segment.num_entries);
+                geometries.insert(geometries.end(), segment.geometries,
+                                  segment.geometries + segment.num_entries);
+            };
+
+            if (include_segments) {
+                ForEachSegment(AppendSegment);
+            } else if (!image_ids_.empty()) {
+                image_ids = image_ids_;
+                descriptors = descriptors_;
+                geometries = geometries_;
+            }
 
-            const uint32_t num_entries = static_cast<uint32_t>(entries_.size());
-            ofs->write(reinterpret_cast<const char*>(&num_entries), sizeof(uint32_t));
+            SortByImageId(&image_ids, &descriptors, &geometries);
+
+            const size_t num_entries = image_ids.size();
+            const char kPadding[8] = {0};
+            ofs->write(reinterpret_cast<const char*>(image_ids.data()),
+                       num_entries * sizeof(int));
+            ofs->write(kPadding, (num_entries % 2) * sizeof(int));
+            ofs->write(reinterpret_cast<const char*>(descriptors.data()),
+                       num_entries * sizeof(uint64_t));
+            ofs->write(reinterpret_cast<const char*>(geometries.data()),
+                       num_entries * sizeof(GeomType));
+        }
 
-            for (uint32_t i = 0; i < num_entries; ++i) {
-                entries_[i].Write(ofs);
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::MapEntries(const char* data,
+                                                     const size_t num_entries) {
+            CHECK_EQ(reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t), 0);
+            EntrySegment segment;
+            segment.num_entries = num_entries;
+            segment.image_ids = reinterpret_cast<const int*>(data);
+            data += (num_entries + num_entries % 2) * sizeof(int);
+            segment.descriptors = reinterpret_cast<const uint64_t*>(data);
+            data += num_entries * sizeof(uint64_t);
+            segment.geometries = reinterpret_cast<const GeomType*>(data);
+            AddSegment(segment);
+        }
+
+        template <int kEmbeddingDim>
+        size_t InvertedFile<kEmbeddingDim>::EntriesNumBytes(const size_t num_entries) {
+            return (num_entries + num_entries % 2) * sizeof(int) +
+                   num_entries * (sizeof(uint64_t) + sizeof(GeomType));
+        }
+
+        template <int kEmbeddingDim>
+        void InvertedFile<kEmbeddingDim>::SortByImageId(
+                std::vector<int>* image_ids, std::vector<uint64_t>* descriptors,
+                std::vector<GeomType>* geometries) {
+            if (std::is_sorted(image_ids->begin(), image_ids->end())) {
+                return;
+            }
+
+            std::vector<size_t> order(image_ids->size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [image_ids](const size_t idx1, const size_t idx2) {
+                                 return (*image_ids)[idx1] < (*image_ids)[idx2];
+                             });
+
+            std::vector<int> sorted_image_ids(order.size());
+            std::vector<uint64_t> sorted_descriptors(order.size());
+            std::vector<GeomType> sorted_geometries(order.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                sorted_image_ids[i] = (*image_ids)[order[i]];
+                sorted_descriptors[i] = (*descriptors)[order[i]];
+                sorted_geometries[i] = (*geometries)[order[i]];
+            }
+
+            image_ids->swap(sorted_image_ids);
+            descriptors->swap(sorted_descriptors);
+            geometries->swap(sorted_geometries);
+        }
+
+        template <int kEmbeddingDim>
+        template <typename Func>
+        void InvertedFile<kEmbeddingDim>::ForEachSegment(const Func& func) const {
+            if (!image_ids_.empty()) {
+                EntrySegment segment;
+                segment.num_entries = image_ids_.size();
+                segment.image_ids = image_ids_.data();
+                segment.descriptors = descriptors_.data();
+                segment.geometries = geometries_.data();
+                func(segment);
+            }
+            for (const auto& segment : segments_) {
+                func(segment);
             }
         }
 
@@ -6,7 +6,6 @@
 #define BKMAP_INVERTED_INDEX_H
 
 #include <algorithm>
-#include <bitset>
 #include <cstdint>
 #include <fstream>
 #include <unordered_map>
@@ -18,6 +17,7 @@
 
 #include "retrieval/inverted_file.h"
 #include "util/alignment.h"
+#include "util/endian.h"
 #include "util/random.h"
 
 namespace bkmap {
@@ -67,6 +67,17 @@ namespace bkmap {
             void Query(const DescType& descriptors, const Eigen::MatrixXi& word_ids,
                        std::vector<ImageScore>* image_scores) const;
 
+            // Query the inverted files for the images in the range [begin, end) of a
+            // batch of images. The features of all images in the range are scored in
+            // the order of their visual words, so that each inverted file is scanned
+            // for all of its features while it is in cache, and the scores are
+            // accumulated in dense arrays instead of hash maps. The scores of the
+            // other images in the batch are not modified.
+            void Query(const std::vector<DescType>& descriptors,
+                       const std::vector<Eigen::MatrixXi>& word_ids, const size_t begin,
+                       const size_t end,
+                       std::vector<std::vector<ImageScore>>* image_scores) const;
+
             void FindMatches(const int word_id, const std::unordered_set<int>& image_ids,
                              std::vector<std::pair<int, GeomType>>* matches) const;
 
@@ -80,6 +91,22 @@ namespace bkmap {
             void Read(std::ifstream* ifs);
             void Write(std::ofstream* ofs) const;
 
+            // Read/write the inverted index in separate parts, as used by the
+            // memory-mapped format of the visual index. The header contains the
+            // projection matrix and the Hamming embedding of all inverted files, the
+            // weights contain the idf-weights and the normalization constants, which
+            // change whenever images are added, and the entries are written as one
+            // segment, which can be referenced in place by MapEntries.
+            void ReadHeader(std::istream* ifs);
+            void WriteHeader(std::ostream* ofs) const;
+            void ReadWeights(std::istream* ifs);
+            void WriteWeights(std::ostream* ofs) const;
+            void WriteEntries(std::ostream* ofs, const bool include_segments) const;
+
+            // Reference a segment of entries written by WriteEntries without copying
+            // them. The data must be aligned to 8 bytes and outlive the entries.
+            void MapEntries(const char* data);
+
         private:
             void ComputeWeightsAndNormalizationConstants();
 
@@ -251,17 +278,126 @@ namespace bkmap {
             }
         }
 
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
+                const std::vector<DescType>& descriptors,
+                const std::vector<Eigen::MatrixXi>& word_ids, const size_t begin,
+                const size_t end,
+                std::vector<std::vector<ImageScore>>* image_scores) const {
+            CHECK_EQ(descriptors.size(), word_ids.size());
+            CHECK_EQ(descriptors.size(), image_scores->size());
+            CHECK_LE(begin, end);
+            CHECK_LE(end, descriptors.size());
+
+            struct FeatureWord {
+                int word_id;
+                int image_idx;
+                int feature_idx;
+            };
+
+            // Project all descriptors at once and collect their visual words.
+            std::vector<Eigen::MatrixXf> proj_descriptors(end - begin);
+            std::vector<FeatureWord> feature_words;
+            for (size_t image_idx = begin; image_idx < end; ++image_idx) {
+                const DescType& image_descriptors = descriptors[image_idx];
+                const Eigen::MatrixXi& image_word_ids = word_ids[image_idx];
+                CHECK_EQ(image_descriptors.cols(), kDescDim);
+                CHECK_EQ(image_descriptors.rows(), image_word_ids.rows());
+                proj_descriptors[image_idx - begin] =
+                        proj_matrix_ *
+                        image_descriptors.transpose().template cast<float>();
+                for (Eigen::MatrixXi::Index i = 0; i < image_word_ids.rows(); ++i) {
+                    for (Eigen::MatrixXi::Index n = 0; n < image_word_ids.cols(); ++n) {
+                        const int word_id = image_word_ids(i, n);
+                        if (word_id != kInvalidWordId) {
+                            FeatureWord feature_word;
+                            feature_word.word_id = word_id;
+                            feature_word.image_idx = static_cast<int>(image_idx - begin);
+                            feature_word.feature_idx = static_cast<int>(i);
+                            feature_words.push_back(feature_word);
+                        }
+                    }
+                }
+            }
+
+            std::sort(feature_words.begin(), feature_words.end(),
+                      [](const FeatureWord& feature_word1,
+                         const FeatureWord& feature_word2) {
+                          if (feature_word1.word_id != feature_word2.word_id) {
+                              return feature_word1.word_id < feature_word2.word_id;
+                          }
+                          if (feature_word1.image_idx != feature_word2.image_idx) {
+                              return feature_word1.image_idx < feature_word2.image_idx;
+                          }
+                          return feature_word1.feature_idx < feature_word2.feature_idx;
+                      });
+
+            // The dense scores of each query image, indexed by the database image
+            // identifiers, and the identifiers of the database images in the order
+            // in which they were first scored.
+            const size_t num_database_images = normalization_constants_.size();
+            std::vector<std::vector<float>> scores(end - begin);
+            std::vector<std::vector<bool>> scored(end - begin);
+            std::vector<std::vector<int>> scored_image_ids(end - begin);
+
+            std::vector<ImageScore> inverted_file_scores;
+            ProjDescType proj_descriptor(kEmbeddingDim);
+            for (const FeatureWord& feature_word : feature_words) {
+                proj_descriptor = proj_descriptors[feature_word.image_idx].col(
+                        feature_word.feature_idx);
+                inverted_files_.at(feature_word.word_id)
+                        .ScoreFeature(proj_descriptor, &inverted_file_scores);
+                if (inverted_file_scores.empty()) {
+                    continue;
+                }
+
+                std::vector<float>& image_scores_dense = scores[feature_word.image_idx];
+                std::vector<bool>& image_scored = scored[feature_word.image_idx];
+                if (image_scores_dense.empty()) {
+                    image_scores_dense.resize(num_database_images, 0.0f);
+                    image_scored.resize(num_database_images, false);
+                }
+
+                for (const ImageScore& score : inverted_file_scores) {
+                    if (!image_scored[score.image_id]) {
+                        image_scored[score.image_id] = true;
+                        scored_image_ids[feature_word.image_idx].push_back(
+                                score.image_id);
+                    }
+                    image_scores_dense[score.image_id] += score.score;
+                }
+            }
+
+            for (size_t image_idx = begin; image_idx < end; ++image_idx) {
+                // Computes the self-similarity score for the query image.
+                const float self_similarity =
+                        ComputeSelfSimilarity(word_ids[image_idx]);
+                float normalization_weight = 1.0f;
+                if (self_similarity > 0.0f) {
+                    normalization_weight = 1.0f / std::sqrt(self_similarity);
+                }
+
+                std::vector<ImageScore>& query_image_scores = (*image_scores)[image_idx];
+                const std::vector<int>& query_image_ids =
+                        scored_image_ids[image_idx - begin];
+                const std::vector<float>& query_scores = scores[image_idx - begin];
+                query_image_scores.resize(query_image_ids.size());
+                for (size_t i = 0; i < query_image_ids.size(); ++i) {
+                    const int image_id = query_image_ids[i];
+                    query_image_scores[i].image_id = image_id;
+                    query_image_scores[i].score = query_scores[image_id] *
+                                                  normalization_weight *
+                                                  normalization_constants_[image_id];
+                }
+            }
+        }
+
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
         void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::FindMatches(
                 const int word_id, const std::unordered_set<int>& image_ids,
                 std::vector<std::pair<int, GeomType>>* matches) const {
             matches->clear();
-            const auto& entries = inverted_files_.at(word_id).GetEntries();
-            for (const auto& entry : entries) {
-                if (image_ids.count(entry.image_id)) {
-                    matches->emplace_back(entry.image_id, entry.geometry);
-                }
-            }
+            inverted_files_.at(word_id).FindMatches(image_ids, matches);
         }
 
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
@@ -357,12 +493,121 @@ namespace bkmap {
             }
         }
 
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::ReadHeader(
+                std::istream* ifs) {
+            const int32_t num_words = ReadBinaryLittleEndian<int32_t>(ifs);
+            CHECK_GT(num_words, 0);
+
+            Initialize(num_words);
+
+            const int32_t N_t = ReadBinaryLittleEndian<int32_t>(ifs);
+            CHECK_EQ(N_t, kEmbeddingDim)
+                << "The length of the binary strings should be " << kEmbeddingDim
+                << " but is " << N_t << ". The indices are not compatible!";
+
+            for (int i = 0; i < kEmbeddingDim; ++i) {
+                for (int j = 0; j < kDescDim; ++j) {
+                    proj_matrix_(i, j) = ReadBinaryLittleEndian<float>(ifs);
+                }
+            }
+
+            for (auto& inverted_file : inverted_files_) {
+                inverted_file.ReadHeader(ifs);
+                // Mapped segments are always sorted.
+                inverted_file.SortEntries();
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::WriteHeader(
+                std::ostream* ofs) const {
+            CHECK_GT(NumVisualWords(), 0);
+            WriteBinaryLittleEndian<int32_t>(ofs, NumVisualWords());
+            WriteBinaryLittleEndian<int32_t>(ofs, kEmbeddingDim);
+
+            for (int i = 0; i < kEmbeddingDim; ++i) {
+                for (int j = 0; j < kDescDim; ++j) {
+                    WriteBinaryLittleEndian<float>(ofs, proj_matrix_(i, j));
+                }
+            }
+
+            for (const auto& inverted_file : inverted_files_) {
+                inverted_file.WriteHeader(ofs);
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::ReadWeights(
+                std::istream* ifs) {
+            for (auto& inverted_file : inverted_files_) {
+                inverted_file.SetIDFWeight(ReadBinaryLittleEndian<float>(ifs));
+            }
+
+            const uint64_t num_images = ReadBinaryLittleEndian<uint64_t>(ifs);
+            normalization_constants_.resize(num_images);
+            for (auto& normalization_constant : normalization_constants_) {
+                normalization_constant = ReadBinaryLittleEndian<float>(ifs);
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::WriteWeights(
+                std::ostream* ofs) const {
+            for (const auto& inverted_file : inverted_files_) {
+                WriteBinaryLittleEndian<float>(ofs, inverted_file.IDFWeight());
+            }
+
+            WriteBinaryLittleEndian<uint64_t>(ofs, normalization_constants_.size());
+            for (const float normalization_constant : normalization_constants_) {
+                WriteBinaryLittleEndian<float>(ofs, normalization_constant);
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::WriteEntries(
+                std::ostream* ofs, const bool include_segments) const {
+            // The segment starts with the number of words and the number of entries
+            // of each word, followed by the blocks of entries of all words.
+            WriteBinaryLittleEndian<uint64_t>(ofs, inverted_files_.size());
+            for (const auto& inverted_file : inverted_files_) {
+                WriteBinaryLittleEndian<uint64_t>(
+                        ofs, include_segments ? inverted_file.NumEntries()
+                                              : inverted_file.NumAddedEntries());
+            }
+
+            for (const auto& inverted_file : inverted_files_) {
+                inverted_file.WriteEntries(ofs, include_segments);
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::MapEntries(
+                const char* data) {
+            const uint64_t* header = reinterpret_cast<const uint64_t*>(data);
+            CHECK_EQ(header[0], inverted_files_.size());
+
+            const char* entries_data =
+                    data + (inverted_files_.size() + 1) * sizeof(uint64_t);
+            for (size_t i = 0; i < inverted_files_.size(); ++i) {
+                const size_t num_entries = static_cast<size_t>(header[i + 1]);
+                inverted_files_[i].MapEntries(entries_data, num_entries);
+                entries_data +=
+                        InvertedFile<kEmbeddingDim>::EntriesNumBytes(num_entries);
+            }
+        }
+
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
         void InvertedIndex<kDescType, kDescDim,
                 kEmbeddingDim>::ComputeWeightsAndNormalizationConstants() {
             std::unordered_set<int> image_ids;
             GetImageIds(&image_ids);
 
+            if (image_ids.empty()) {
+                normalization_constants_.clear();
+                return;
+            }
+
             for (auto& inverted_file : inverted_files_) {
                 inverted_file.ComputeIDFWeight(image_ids.size());
             }
@@ -0,0 +1,36 @@
+#include "retrieval/utils.h"
+
+#if defined(__POPCNT__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace bkmap {
+    namespace retrieval {
+        namespace {
+
+            int PopCount(const uint64_t value) {
+#if defined(__POPCNT__) && defined(__x86_64__)
+                return static_cast<int>(_mm_popcnt_u64(value));
+#else
+                uint64_t count = value - ((value >> 1) & 0x5555555555555555ULL);
+                count = (count & 0x3333333333333333ULL) +
+                        ((count >> 2) & 0x3333333333333333ULL);
+                count = (count + (count >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+                return static_cast<int>((count * 0x0101010101010101ULL) >> 56);
+#endif
+            }
+
+        }  // namespace
+
+        void ComputeHammingDistances(const uint64_t descriptor,
+                                     const uint64_t* descriptors,
+                                     const size_t num_descriptors,
+                                     uint8_t* hamming_dists) {
+            for (size_t i = 0; i < num_descriptors; ++i) {
+                hamming_dists[i] =
+                        static_cast<uint8_t>(PopCount(descriptor ^ descriptors[i]));
+            }
+        }
+
+    }  // namespace retrieval
+}
@@ -7,6 +7,8 @@
 
 #include <array>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 
 namespace bkmap {
     namespace retrieval {
@@ -43,7 +45,7 @@ namespace bkmap {
             // Returns the weight for Hamming distance h and standard deviation sigma.
             // Does not perform a range check when performing the look-up.
             inline float operator()(const size_t hamming_dist) const {
-                return look_up_table_.at(hamming_dist);
+                return look_up_table_[hamming_dist];
             }
 
         private:
@@ -53,6 +55,14 @@ namespace bkmap {
             std::array<float, N + 1> look_up_table_;
         };
 
+// Compute the Hamming distances between one binary signature and a block of
+// binary signatures. This is implemented in its own source, which is compiled
+// with `SSE_FLAGS` to use the POPCNT instruction, if available.
+        void ComputeHammingDistances(const uint64_t descriptor,
+                                     const uint64_t* descriptors,
+                                     const size_t num_descriptors,
+                                     uint8_t* hamming_dists);
+
     }  // namespace retrieval
 }
 
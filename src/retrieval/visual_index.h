@@ -5,8 +5,17 @@
 #ifndef BKMAP_VISUAL_INDEX_H
 #define BKMAP_VISUAL_INDEX_H
 
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <queue>
+
 #include <Eigen/Core>
 
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
 #include "base/feature.h"
 #include "ext/FLANN/flann.hpp"
 #include "retrieval/inverted_file.h"
@@ -16,6 +25,8 @@
 #include "util/endian.h"
 #include "util/logging.h"
 #include "util/math.h"
+#include "util/misc.h"
+#include "util/threading.h"
 
 namespace bkmap {
     namespace retrieval {
@@ -28,6 +39,23 @@ namespace bkmap {
 //
 //    Arandjelovic, Zisserman: Scalable descriptor
 //    distinctiveness for location recognition. ACCV 2014.
+//
+// The index is written in a versioned format, whose entries are memory-mapped
+// and queried in place when reading the index, such that the entries of large
+// databases are neither loaded nor kept in memory. The file consists of:
+//
+//    - A 32 byte header with the magic "BKMAPVIX", the format version, the
+//      descriptor and embedding dimensions, and the offset of the footer.
+//    - The visual words, their search index, and the Hamming embedding.
+//    - One or more segments of inverted file entries, aligned to 8 bytes. The
+//      images of different segments are disjoint.
+//    - The footer with the offsets of all segments, the idf-weights, the
+//      normalization constants, and the identifiers of the indexed images.
+//
+// New images are appended as a new segment followed by a new footer, after
+// which the footer offset in the header is updated, such that the existing
+// segments are never rewritten. The entries are stored in native byte order.
+// Files written before the versioned format are read into memory.
         template <typename kDescType = uint8_t, int kDescDim = 128,
                 int kEmbeddingDim = 64>
         class VisualIndex {
@@ -107,28 +135,104 @@ namespace bkmap {
                                        const DescType& descriptors,
                                        std::vector<ImageScore>* image_scores) const;
 
+            // Query for the most similar images of a batch of query images. The visual
+            // words of all query images are found in a single nearest neighbor search,
+            // and the inverted files are then scanned for blocks of query images at a
+            // time in parallel. This is much faster than querying the images one by
+            // one, whose searches and scans are each too small to use all threads.
+            void Query(const QueryOptions& options,
+                       const std::vector<DescType>& descriptors,
+                       std::vector<std::vector<ImageScore>>* image_scores) const;
+
+            // Query for the most similar images of a batch of query images, as above,
+            // and spatially verify the top-ranked images of each query in parallel.
+            void QueryWithVerification(
+                    const QueryOptions& options, const std::vector<GeomType>& geometries,
+                    const std::vector<DescType>& descriptors,
+                    std::vector<std::vector<ImageScore>>* image_scores) const;
+
+            // Whether the image was added to the index.
+            bool HasImage(const int image_id) const;
+
             // Prepare the index after adding images and before querying.
             void Prepare();
+            bool IsPrepared() const;
 
             // Build a visual index from a set of training descriptors by quantizing the
             // descriptor space into visual words and compute their Hamming embedding.
             void Build(const BuildOptions& options, const DescType& descriptors);
 
+            // Build a visual index from given visual words, e.g. from a separately
+            // trained vocabulary tree, and compute their Hamming embedding from a set
+            // of training descriptors.
+            void Build(const BuildOptions& options, const DescType& visual_words,
+                       const DescType& descriptors);
+
             // Read and write the visual index. This can be done for an index with and
-            // without indexed images.
+            // without indexed images. The entries of the index are memory-mapped and
+            // remain mapped until the index is destroyed or read again.
             void Read(const std::string& path);
             void Write(const std::string& path);
 
+            // Append the images added since the index was read from or written to the
+            // given path as a new segment of the file. The whole index is written, if
+            // it was not read from or written to the path.
+            void Append(const std::string& path);
+
         private:
+            static const char kFileMagic[9];
+            static const uint32_t kFileVersion;
+            static const size_t kFileHeaderSize;
+            static const size_t kFooterOffsetPos;
+
+            // Read the index in the format before the versioned format.
+            void ReadLegacy(const std::string& path);
+
+            // Write the footer at the current position of the file and update its
+            // offset in the header.
+            void WriteFooter(std::fstream* file,
+                             const std::vector<uint64_t>& segment_offsets) const;
+
+            // Map the file and reference its segments and read its footer.
+            void MapFile(const std::string& path);
+
             // Quantize the descriptor space into visual words.
             void Quantize(const BuildOptions& options, const DescType& descriptors);
 
+            // Build the search index on the visual words and a new inverted index
+            // with the Hamming embedding learned from the training descriptors.
+            void BuildIndex(const BuildOptions& options, const DescType& descriptors);
+
             // Query for nearest neighbor images and return nearest neighbor visual word
             // identifiers for each descriptor.
             void QueryAndFindWordIds(const QueryOptions& options,
                                      const DescType& descriptors,
                                      std::vector<ImageScore>* image_scores,
                                      Eigen::MatrixXi* word_ids) const;
+            void QueryAndFindWordIds(const QueryOptions& options,
+                                     const std::vector<DescType>& descriptors,
+                                     std::vector<std::vector<ImageScore>>* image_scores,
+                                     std::vector<Eigen::MatrixXi>* word_ids) const;
+
+            // The number of top-ranked images to spatially verify.
+            size_t GetNumVerifications(const QueryOptions& options) const;
+
+            // Spatially verify the top-ranked images of a query image and re-rank
+            // the images using the verification scores. The images are verified in
+            // the order of their highest possible score and the verification stops
+            // once no remaining image can enter the retrieved images. The images are
+            // verified in parallel, if a thread pool is given.
+            void VerifyImageScores(const QueryOptions& options,
+                                   const size_t num_verifications,
+                                   const GeomType& geometries,
+                                   const Eigen::MatrixXi& word_ids,
+                                   ThreadPool* thread_pool,
+                                   std::vector<ImageScore>* image_scores) const;
+
+            // Sort the image scores and keep at most the given number of images,
+            // unless it is negative.
+            static void SortImageScores(const int max_num_images,
+                                        std::vector<ImageScore>* image_scores);
 
             // Find the nearest neighbor visual words for the given descriptors.
             Eigen::MatrixXi FindWordIds(const DescType& descriptors,
@@ -149,12 +253,34 @@ namespace bkmap {
 
             // Whether the index is prepared.
             bool prepared_;
+
+            // The path, the offsets of the segments, and the memory of the mapped file.
+            std::string mapped_path_;
+            std::vector<uint64_t> mapped_segment_offsets_;
+            std::unique_ptr<boost::interprocess::file_mapping> file_mapping_;
+            std::unique_ptr<boost::interprocess::mapped_region> mapped_region_;
         };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        const char VisualIndex<kDescType, kDescDim, kEmbeddingDim>::kFileMagic[9] =
+                "BKMAPVIX";
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        const uint32_t VisualIndex<kDescType, kDescDim, kEmbeddingDim>::kFileVersion =
+                1;
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        const size_t VisualIndex<kDescType, kDescDim, kEmbeddingDim>::kFileHeaderSize =
+                32;
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        const size_t VisualIndex<kDescType, kDescDim, kEmbeddingDim>::kFooterOffsetPos =
+                24;
+
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
         VisualIndex<kDescType, kDescDim, kEmbeddingDim>::VisualIndex()
                 : prepared_(false) {}
@@ -220,12 +346,7 @@ namespace bkmap {
                 const DescType& descriptors, std::vector<ImageScore>* image_scores) const {
             CHECK_EQ(descriptors.rows(), geometries.size());
 
-            size_t num_verifications = image_ids_.size();
-            if (options.max_num_verifications >= 0) {
-                num_verifications =
-                        std::min<size_t>(image_ids_.size(), options.max_num_verifications);
-            }
-
+            const size_t num_verifications = GetNumVerifications(options);
             if (num_verifications == 0) {
                 Query(options, descriptors, image_scores);
                 return;
@@ -238,72 +359,61 @@ namespace bkmap {
             QueryAndFindWordIds(verification_options, descriptors, image_scores,
                                 &word_ids);
 
-            // Extract top-ranked images to verify.
-            std::unordered_set<int> image_ids;
-            for (size_t i = 0; i < num_verifications; ++i) {
-                image_ids.insert((*image_scores)[i].image_id);
-            }
+            ThreadPool thread_pool(options.num_threads);
+            VerifyImageScores(options, num_verifications, geometries, word_ids,
+                              &thread_pool, image_scores);
+        }
 
-            // Find matches for top-ranked images, only use single nearest neighbor word.
-            std::vector<std::pair<int, typename InvertedIndexType::GeomType>>
-                    word_matches;
-            std::unordered_map<int, std::unordered_map<int, std::vector<FeatureGeometry>>>
-                    image_matches;
-            for (typename DescType::Index i = 0; i < descriptors.rows(); ++i) {
-                const int word_id = word_ids(i, 0);
-                if (word_id != InvertedIndexType::kInvalidWordId) {
-                    inverted_index_.FindMatches(word_id, image_ids, &word_matches);
-                    for (const auto& match : word_matches) {
-                        image_matches[match.first][i].push_back(match.second);
-                    }
-                }
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
+                const QueryOptions& options, const std::vector<DescType>& descriptors,
+                std::vector<std::vector<ImageScore>>* image_scores) const {
+            std::vector<Eigen::MatrixXi> word_ids;
+            QueryAndFindWordIds(options, descriptors, image_scores, &word_ids);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::QueryWithVerification(
+                const QueryOptions& options, const std::vector<GeomType>& geometries,
+                const std::vector<DescType>& descriptors,
+                std::vector<std::vector<ImageScore>>* image_scores) const {
+            CHECK_EQ(descriptors.size(), geometries.size());
+            for (size_t i = 0; i < descriptors.size(); ++i) {
+                CHECK_EQ(descriptors[i].rows(), geometries[i].size());
             }
 
-            // Verify top-ranked images using the found matches.
-            for (size_t i = 0; i < num_verifications; ++i) {
-                auto& image_score = (*image_scores)[i];
-                const auto& geometry_matches = image_matches[image_score.image_id];
+            const size_t num_verifications = GetNumVerifications(options);
+            if (num_verifications == 0) {
+                Query(options, descriptors, image_scores);
+                return;
+            }
 
-                // No matches found,
-                if (geometry_matches.empty()) {
-                    continue;
-                }
+            auto verification_options = options;
+            verification_options.max_num_images = options.max_num_verifications;
 
-                // Collect matches for all features of current image.
-                std::vector<FeatureGeometryMatch> matches;
-                matches.reserve(geometry_matches.size());
-                for (const auto& geometries2 : geometry_matches) {
-                    FeatureGeometryMatch match;
-                    match.geometry1.x = geometries[geometries2.first].x;
-                    match.geometry1.y = geometries[geometries2.first].y;
-                    match.geometry1.scale = geometries[geometries2.first].scale;
-                    match.geometry1.orientation = geometries[geometries2.first].orientation;
-                    match.geometries2 = geometries2.second;
-                    matches.push_back(match);
-                }
+            std::vector<Eigen::MatrixXi> word_ids;
+            QueryAndFindWordIds(verification_options, descriptors, image_scores,
+                                &word_ids);
 
-                VoteAndVerifyOptions vote_and_verify_options;
-                image_score.score += VoteAndVerify(vote_and_verify_options, matches);
+            ThreadPool thread_pool(options.num_threads);
+            std::vector<std::future<void>> futures;
+            futures.reserve(descriptors.size());
+            for (size_t i = 0; i < descriptors.size(); ++i) {
+                futures.push_back(thread_pool.AddTask([&, i]() {
+                    VerifyImageScores(options, num_verifications, geometries[i],
+                                      word_ids[i], nullptr, &(*image_scores)[i]);
+                }));
             }
 
-            // Re-rank the images using the spatial verification scores.
-
-            size_t num_images = image_scores->size();
-            if (options.max_num_images >= 0) {
-                num_images = std::min<size_t>(image_scores->size(), options.max_num_images);
+            for (auto& future : futures) {
+                future.get();
             }
+        }
 
-            auto SortFunc = [](const ImageScore& score1, const ImageScore& score2) {
-                return score1.score > score2.score;
-            };
-
-            if (num_images == image_scores->size()) {
-                std::sort(image_scores->begin(), image_scores->end(), SortFunc);
-            } else {
-                std::partial_sort(image_scores->begin(), image_scores->begin() + num_images,
-                                  image_scores->end(), SortFunc);
-                image_scores->resize(num_images);
-            }
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        bool VisualIndex<kDescType, kDescDim, kEmbeddingDim>::HasImage(
+                const int image_id) const {
+            return image_ids_.count(image_id) > 0;
         }
 
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
@@ -312,12 +422,47 @@ namespace bkmap {
             prepared_ = true;
         }
 
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        bool VisualIndex<kDescType, kDescDim, kEmbeddingDim>::IsPrepared() const {
+            return prepared_;
+        }
+
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
         void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Build(
                 const BuildOptions& options, const DescType& descriptors) {
             // Quantize the descriptor space into visual words.
             Quantize(options, descriptors);
 
+            BuildIndex(options, descriptors);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Build(
+                const BuildOptions& options, const DescType& visual_words,
+                const DescType& descriptors) {
+            static_assert(DescType::IsRowMajor, "Descriptors must be row-major.");
+
+            CHECK_GT(visual_words.rows(), 0);
+            CHECK_EQ(visual_words.cols(), descriptors.cols());
+
+            const size_t visual_word_data_size = visual_words.size();
+            kDescType* visual_words_data = new kDescType[visual_word_data_size];
+            std::copy(visual_words.data(), visual_words.data() + visual_word_data_size,
+                      visual_words_data);
+
+            if (visual_words_.ptr() != nullptr) {
+                delete[] visual_words_.ptr();
+            }
+
+            visual_words_ = flann::Matrix<kDescType>(
+                    visual_words_data, visual_words.rows(), visual_words.cols());
+
+            BuildIndex(options, descriptors);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::BuildIndex(
+                const BuildOptions& options, const DescType& descriptors) {
             // Build the search index on the visual words.
             flann::AutotunedIndexParams index_params;
             index_params["target_precision"] =
@@ -345,15 +490,32 @@ namespace bkmap {
                 const std::string& path) {
             long int file_offset = 0;
 
-            // Read the visual words.
+            // Read the header and the visual words.
 
             {
+                std::ifstream file(path, std::ios::binary);
+                CHECK(file.is_open()) << path;
+
+                char magic[sizeof(kFileMagic) - 1];
+                file.read(magic, sizeof(magic));
+                if (!file || std::string(magic, sizeof(magic)) != kFileMagic) {
+                    file.close();
+                    ReadLegacy(path);
+                    return;
+                }
+
+                const uint32_t version = ReadBinaryLittleEndian<uint32_t>(&file);
+                CHECK_EQ(version, kFileVersion)
+                    << "Unsupported visual index version in " << path;
+                CHECK_EQ(ReadBinaryLittleEndian<uint32_t>(&file), kDescDim);
+                CHECK_EQ(ReadBinaryLittleEndian<uint32_t>(&file), kEmbeddingDim);
+                CHECK_EQ(ReadBinaryLittleEndian<uint32_t>(&file), sizeof(kDescType));
+                file.seekg(kFileHeaderSize, std::ios::beg);
+
                 if (visual_words_.ptr() != nullptr) {
                     delete[] visual_words_.ptr();
                 }
 
-                std::ifstream file(path, std::ios::binary);
-                CHECK(file.is_open()) << path;
                 const uint64_t rows = ReadBinaryLittleEndian<uint64_t>(&file);
                 const uint64_t cols = ReadBinaryLittleEndian<uint64_t>(&file);
                 kDescType* visual_words_data = new kDescType[rows * cols];
@@ -378,25 +540,39 @@ namespace bkmap {
                 fclose(fin);
             }
 
-            // Read the inverted index.
+            // Read the Hamming embedding and map the entries.
 
             {
                 std::ifstream file(path, std::ios::binary);
                 CHECK(file.is_open()) << path;
                 file.seekg(file_offset, std::ios::beg);
-                inverted_index_.Read(&file);
+                inverted_index_.ReadHeader(&file);
             }
+
+            MapFile(path);
         }
 
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
         void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Write(
                 const std::string& path) {
-            // Write the visual words.
+            // The index is written to a temporary file first, since the entries of
+            // the index might be mapped from the file at the given path.
+            const std::string temp_path = path + ".tmp";
+
+            // Write the header and the visual words.
 
             {
                 CHECK_NOTNULL(visual_words_.ptr());
-                std::ofstream file(path, std::ios::binary);
-                CHECK(file.is_open()) << path;
+                std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+                CHECK(file.is_open()) << temp_path;
+                file.write(kFileMagic, sizeof(kFileMagic) - 1);
+                WriteBinaryLittleEndian<uint32_t>(&file, kFileVersion);
+                WriteBinaryLittleEndian<uint32_t>(&file, kDescDim);
+                WriteBinaryLittleEndian<uint32_t>(&file, kEmbeddingDim);
+                WriteBinaryLittleEndian<uint32_t>(&file, sizeof(kDescType));
+                WriteBinaryLittleEndian<uint64_t>(&file, 0);
+                CHECK_EQ(static_cast<size_t>(file.tellp()), kFileHeaderSize);
+
                 WriteBinaryLittleEndian<uint64_t>(&file, visual_words_.rows);
                 WriteBinaryLittleEndian<uint64_t>(&file, visual_words_.cols);
                 for (size_t i = 0; i < visual_words_.rows * visual_words_.cols; ++i) {
@@ -407,19 +583,200 @@ namespace bkmap {
             // Write the visual words search index.
 
             {
-                FILE* fout = fopen(path.c_str(), "ab");
+                FILE* fout = fopen(temp_path.c_str(), "ab");
                 CHECK_NOTNULL(fout);
                 visual_word_index_.saveIndex(fout);
                 fclose(fout);
             }
 
-            // Write the inverted index.
+            // Write the Hamming embedding, all entries as a single segment, and the
+            // footer.
+
+            {
+                std::fstream file(temp_path,
+                                  std::ios::binary | std::ios::in | std::ios::out);
+                CHECK(file.is_open()) << temp_path;
+                file.seekp(0, std::ios::end);
+                inverted_index_.WriteHeader(&file);
+
+                while (file.tellp() % sizeof(uint64_t) != 0) {
+                    file.put(0);
+                }
+
+                const uint64_t segment_offset = file.tellp();
+                inverted_index_.WriteEntries(&file, true);
+
+                WriteFooter(&file, {segment_offset});
+            }
+
+            boost::filesystem::rename(temp_path, path);
+
+            MapFile(path);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Append(
+                const std::string& path) {
+            if (path != mapped_path_ || !ExistsFile(path)) {
+                Write(path);
+                return;
+            }
+
+            std::vector<uint64_t> segment_offsets = mapped_segment_offsets_;
 
             {
-                std::ofstream file(path, std::ios::binary | std::ios::app);
+                std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
                 CHECK(file.is_open()) << path;
-                inverted_index_.Write(&file);
+                file.seekp(0, std::ios::end);
+
+                while (file.tellp() % sizeof(uint64_t) != 0) {
+                    file.put(0);
+                }
+
+                segment_offsets.push_back(file.tellp());
+                inverted_index_.WriteEntries(&file, false);
+
+                WriteFooter(&file, segment_offsets);
             }
+
+            MapFile(path);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::ReadLegacy(
+                const std::string& path) {
+            long int file_offset = 0;
+
+            // Read the visual words.
+
+            {
+                if (visual_words_.ptr() != nullptr) {
+                    delete[] visual_words_.ptr();
+                }
+
+                std::ifstream file(path, std::ios::binary);
+                CHECK(file.is_open()) << path;
+                const uint64_t rows = ReadBinaryLittleEndian<uint64_t>(&file);
+                const uint64_t cols = ReadBinaryLittleEndian<uint64_t>(&file);
+                kDescType* visual_words_data = new kDescType[rows * cols];
+                for (size_t i = 0; i < rows * cols; ++i) {
+                    visual_words_data[i] = ReadBinaryLittleEndian<kDescType>(&file);
+                }
+                visual_words_ = flann::Matrix<kDescType>(visual_words_data, rows, cols);
+                file_offset = file.tellg();
+            }
+
+            // Read the visual words search index.
+
+            visual_word_index_ =
+                    flann::AutotunedIndex<flann::L2<kDescType>>(visual_words_);
+
+            {
+                FILE* fin = fopen(path.c_str(), "rb");
+                CHECK_NOTNULL(fin);
+                fseek(fin, file_offset, SEEK_SET);
+                visual_word_index_.loadIndex(fin);
+                file_offset = ftell(fin);
+                fclose(fin);
+            }
+
+            // Read the inverted index.
+
+            {
+                std::ifstream file(path, std::ios::binary);
+                CHECK(file.is_open()) << path;
+                file.seekg(file_offset, std::ios::beg);
+                inverted_index_.Read(&file);
+            }
+
+            image_ids_.clear();
+            inverted_index_.GetImageIds(&image_ids_);
+            prepared_ = false;
+
+            mapped_path_.clear();
+            mapped_segment_offsets_.clear();
+            mapped_region_.reset();
+            file_mapping_.reset();
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::WriteFooter(
+                std::fstream* file, const std::vector<uint64_t>& segment_offsets) const {
+            const uint64_t footer_offset = file->tellp();
+
+            WriteBinaryLittleEndian<uint64_t>(file, segment_offsets.size());
+            for (const uint64_t segment_offset : segment_offsets) {
+                WriteBinaryLittleEndian<uint64_t>(file, segment_offset);
+            }
+
+            inverted_index_.WriteWeights(file);
+
+            WriteBinaryLittleEndian<uint64_t>(file, image_ids_.size());
+            for (const int image_id : image_ids_) {
+                WriteBinaryLittleEndian<int32_t>(file, image_id);
+            }
+
+            WriteBinaryLittleEndian<uint8_t>(file, prepared_ ? 1 : 0);
+
+            // The new footer only becomes valid once all of its data is written.
+            file->flush();
+            file->seekp(kFooterOffsetPos, std::ios::beg);
+            WriteBinaryLittleEndian<uint64_t>(file, footer_offset);
+            file->flush();
+            CHECK(file->good());
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::MapFile(
+                const std::string& path) {
+            std::unique_ptr<boost::interprocess::file_mapping> file_mapping(
+                    new boost::interprocess::file_mapping(
+                            path.c_str(), boost::interprocess::read_only));
+            std::unique_ptr<boost::interprocess::mapped_region> mapped_region(
+                    new boost::interprocess::mapped_region(
+                            *file_mapping, boost::interprocess::read_only));
+            const char* data = static_cast<const char*>(mapped_region->get_address());
+            const size_t num_bytes = mapped_region->get_size();
+
+            std::ifstream file(path, std::ios::binary);
+            CHECK(file.is_open()) << path;
+            file.seekg(kFooterOffsetPos, std::ios::beg);
+            const uint64_t footer_offset = ReadBinaryLittleEndian<uint64_t>(&file);
+            CHECK_GT(footer_offset, kFileHeaderSize) << path;
+            CHECK_LT(footer_offset, num_bytes) << path;
+            file.seekg(footer_offset, std::ios::beg);
+
+            std::vector<uint64_t> segment_offsets(
+                    ReadBinaryLittleEndian<uint64_t>(&file));
+            for (auto& segment_offset : segment_offsets) {
+                segment_offset = ReadBinaryLittleEndian<uint64_t>(&file);
+                CHECK_LT(segment_offset, footer_offset) << path;
+                CHECK_EQ(segment_offset % sizeof(uint64_t), 0) << path;
+            }
+
+            // Replace the entries of the previous mapping, which is only released
+            // after the new segments are referenced.
+            inverted_index_.ClearEntries();
+            for (const uint64_t segment_offset : segment_offsets) {
+                inverted_index_.MapEntries(data + segment_offset);
+            }
+
+            inverted_index_.ReadWeights(&file);
+
+            image_ids_.clear();
+            const uint64_t num_images = ReadBinaryLittleEndian<uint64_t>(&file);
+            image_ids_.reserve(num_images);
+            for (uint64_t i = 0; i < num_images; ++i) {
+                image_ids_.insert(ReadBinaryLittleEndian<int32_t>(&file));
+            }
+
+            prepared_ = ReadBinaryLittleEndian<uint8_t>(&file) != 0;
+            CHECK(file.good()) << path;
+
+            mapped_path_ = path;
+            mapped_segment_offsets_ = segment_offsets;
+            mapped_region_ = std::move(mapped_region);
+            file_mapping_ = std::move(file_mapping);
         }
 
         template <typename kDescType, int kDescDim, int kEmbeddingDim>
@@ -481,13 +838,222 @@ namespace bkmap {
                                     options.num_checks, options.num_threads);
             inverted_index_.Query(descriptors, *word_ids, image_scores);
 
+            SortImageScores(options.max_num_images, image_scores);
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::QueryAndFindWordIds(
+                const QueryOptions& options, const std::vector<DescType>& descriptors,
+                std::vector<std::vector<ImageScore>>* image_scores,
+                std::vector<Eigen::MatrixXi>* word_ids) const {
+            CHECK(prepared_);
+
+            const size_t num_queries = descriptors.size();
+            image_scores->clear();
+            image_scores->resize(num_queries);
+            word_ids->clear();
+            word_ids->resize(num_queries);
+
+            // Concatenate the descriptors of all query images, so that their visual
+            // words are found in a single nearest neighbor search.
+            std::vector<typename DescType::Index> offsets(num_queries + 1, 0);
+            for (size_t i = 0; i < num_queries; ++i) {
+                CHECK_EQ(descriptors[i].cols(), kDescDim);
+                offsets[i + 1] = offsets[i] + descriptors[i].rows();
+            }
+
+            if (offsets.back() == 0) {
+                return;
+            }
+
+            DescType all_descriptors(offsets.back(), kDescDim);
+            for (size_t i = 0; i < num_queries; ++i) {
+                all_descriptors.middleRows(offsets[i], descriptors[i].rows()) =
+                        descriptors[i];
+            }
+
+            const Eigen::MatrixXi all_word_ids =
+                    FindWordIds(all_descriptors, options.num_neighbors,
+                                options.num_checks, options.num_threads);
+            for (size_t i = 0; i < num_queries; ++i) {
+                (*word_ids)[i] =
+                        all_word_ids.middleRows(offsets[i], descriptors[i].rows());
+            }
+
+            // Scan the inverted files for one block of query images per thread.
+            ThreadPool thread_pool(options.num_threads);
+            const size_t block_size =
+                    (num_queries + thread_pool.NumThreads() - 1) / thread_pool.NumThreads();
+
+            std::vector<std::future<void>> futures;
+            for (size_t begin = 0; begin < num_queries; begin += block_size) {
+                const size_t end = std::min(begin + block_size, num_queries);
+                futures.push_back(thread_pool.AddTask([&, begin, end]() {
+                    inverted_index_.Query(descriptors, *word_ids, begin, end,
+                                          image_scores);
+                    for (size_t i = begin; i < end; ++i) {
+                        SortImageScores(options.max_num_images, &(*image_scores)[i]);
+                    }
+                }));
+            }
+
+            for (auto& future : futures) {
+                future.get();
+            }
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        size_t VisualIndex<kDescType, kDescDim, kEmbeddingDim>::GetNumVerifications(
+                const QueryOptions& options) const {
+            if (options.max_num_verifications >= 0) {
+                return std::min<size_t>(image_ids_.size(), options.max_num_verifications);
+            }
+            return image_ids_.size();
+        }
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::VerifyImageScores(
+                const QueryOptions& options, const size_t num_verifications,
+                const GeomType& geometries, const Eigen::MatrixXi& word_ids,
+                ThreadPool* thread_pool, std::vector<ImageScore>* image_scores) const {
+            CHECK_EQ(word_ids.rows(), geometries.size());
+
+            const size_t num_images_to_verify =
+                    std::min(num_verifications, image_scores->size());
+
+            // Extract top-ranked images to verify.
+            std::unordered_set<int> image_ids;
+            std::unordered_map<int, size_t> image_idxs;
+            for (size_t i = 0; i < num_images_to_verify; ++i) {
+                image_ids.insert((*image_scores)[i].image_id);
+                image_idxs.emplace((*image_scores)[i].image_id, i);
+            }
+
+            // Find matches for top-ranked images, only use single nearest neighbor word.
+            // The features are visited in order, so that the matches of a feature
+            // are consecutive in the matches of each image.
+            std::vector<std::pair<int, typename InvertedIndexType::GeomType>>
+                    word_matches;
+            std::vector<std::vector<FeatureGeometryMatch>> image_matches(
+                    num_images_to_verify);
+            std::vector<int> last_feature_idxs(num_images_to_verify, -1);
+            for (typename DescType::Index i = 0; i < word_ids.rows(); ++i) {
+                const int word_id = word_ids(i, 0);
+                if (word_id == InvertedIndexType::kInvalidWordId) {
+                    continue;
+                }
+                inverted_index_.FindMatches(word_id, image_ids, &word_matches);
+                for (const auto& match : word_matches) {
+                    const size_t image_idx = image_idxs.at(match.first);
+                    auto& matches = image_matches[image_idx];
+                    if (last_feature_idxs[image_idx] != i) {
+                        last_feature_idxs[image_idx] = i;
+                        matches.emplace_back();
+                        matches.back().geometry1.x = geometries[i].x;
+                        matches.back().geometry1.y = geometries[i].y;
+                        matches.back().geometry1.scale = geometries[i].scale;
+                        matches.back().geometry1.orientation = geometries[i].orientation;
+                    }
+                    matches.back().geometries2.push_back(match.second);
+                }
+            }
+
+            // The verification adds at most one inlier per matched feature to the
+            // score of an image, which bounds its verified score.
+            std::vector<std::pair<float, size_t>> max_image_scores;
+            max_image_scores.reserve(num_images_to_verify);
+            for (size_t i = 0; i < num_images_to_verify; ++i) {
+                if (!image_matches[i].empty()) {
+                    max_image_scores.emplace_back(
+                            (*image_scores)[i].score + image_matches[i].size(), i);
+                }
+            }
+            std::sort(max_image_scores.begin(), max_image_scores.end(),
+                      std::greater<std::pair<float, size_t>>());
+
+            // The lowest score of the retrieved images among the images with final
+            // scores, which are the verified images and the images that are not
+            // verified at all.
+            const size_t max_num_images =
+                    options.max_num_images >= 0
+                    ? std::min<size_t>(options.max_num_images, image_scores->size())
+                    : image_scores->size();
+            const bool early_termination = max_num_images < image_scores->size();
+            std::priority_queue<float, std::vector<float>, std::greater<float>>
+                    min_retrieved_scores;
+            auto AddFinalScore = [&](const float score) {
+                if (!early_termination) {
+                    return;
+                }
+                min_retrieved_scores.push(score);
+                if (min_retrieved_scores.size() > max_num_images) {
+                    min_retrieved_scores.pop();
+                }
+            };
+
+            for (size_t i = 0; i < image_scores->size(); ++i) {
+                if (i >= num_images_to_verify || image_matches[i].empty()) {
+                    AddFinalScore((*image_scores)[i].score);
+                }
+            }
+
+            // Verify top-ranked images using the found matches.
+            const VoteAndVerifyOptions vote_and_verify_options;
+            auto VerifyImage = [&](const size_t image_idx) {
+                (*image_scores)[image_idx].score +=
+                        VoteAndVerify(vote_and_verify_options, image_matches[image_idx]);
+            };
+
+            const size_t num_images_per_step =
+                    thread_pool == nullptr ? 1 : thread_pool->NumThreads();
+            std::vector<std::future<void>> futures;
+            for (size_t begin = 0; begin < max_image_scores.size();
+                 begin += num_images_per_step) {
+                if (early_termination &&
+                    (max_num_images == 0 ||
+                     (min_retrieved_scores.size() == max_num_images &&
+                      min_retrieved_scores.top() >= max_image_scores[begin].first))) {
+                    break;
+                }
+
+                const size_t end =
+                        std::min(begin + num_images_per_step, max_image_scores.size());
+                if (thread_pool == nullptr) {
+                    for (size_t i = begin; i < end; ++i) {
+                        VerifyImage(max_image_scores[i].second);
+                    }
+                } else {
+                    futures.clear();
+                    for (size_t i = begin; i < end; ++i) {
+                        futures.push_back(thread_pool->AddTask(
+                                VerifyImage, max_image_scores[i].second));
+                    }
+                    for (auto& future : futures) {
+                        future.get();
+                    }
+                }
+
+                for (size_t i = begin; i < end; ++i) {
+                    AddFinalScore((*image_scores)[max_image_scores[i].second].score);
+                }
+            }
+
+            // Re-rank the images using the spatial verification scores.
+
+            SortImageScores(options.max_num_images, image_scores);
+        }
+
+
+        template <typename kDescType, int kDescDim, int kEmbeddingDim>
+        void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::SortImageScores(
+                const int max_num_images, std::vector<ImageScore>* image_scores) {
             auto SortFunc = [](const ImageScore& score1, const ImageScore& score2) {
                 return score1.score > score2.score;
             };
 
             size_t num_images = image_scores->size();
-            if (options.max_num_images >= 0) {
-                num_images = std::min<size_t>(image_scores->size(), options.max_num_images);
+            if (max_num_images >= 0) {
+                num_images = std::min<size_t>(image_scores->size(), max_num_images);
             }
 
             if (num_images == image_scores->size()) {
@@ -0,0 +1,732 @@
+#include "retrieval/vocab_tree_builder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+
+#include <boost/filesystem/operations.hpp>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/threading.h"
+#include "util/timer.h"
+
+namespace bkmap {
+    namespace retrieval {
+        namespace {
+
+            typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic,
+                    Eigen::RowMajor> FloatMatrix;
+
+            const char kCheckpointMagic[] = "BKMAPVTB";
+            const size_t kCheckpointMagicSize = sizeof(kCheckpointMagic) - 1;
+            const uint32_t kCheckpointVersion = 1;
+
+            // The number of streamed descriptors that are assigned to the tree at a
+            // time, and the number of points whose distances to the centers are
+            // computed in a single matrix product.
+            const size_t kStreamBatchSize = 64 * 1024;
+            const size_t kDistanceBlockSize = 1024;
+
+            // Find the nearest center of the points in the given range.
+            void FindNearestCenters(const FloatMatrix& points, const size_t begin,
+                                    const size_t end, const FloatMatrix& centers,
+                                    const Eigen::VectorXf& center_norms,
+                                    std::vector<int>* labels) {
+                for (size_t block_begin = begin; block_begin < end;
+                     block_begin += kDistanceBlockSize) {
+                    const size_t block_size =
+                            std::min(kDistanceBlockSize, end - block_begin);
+                    const Eigen::MatrixXf products =
+                            points.middleRows(block_begin, block_size) *
+                            centers.transpose();
+                    for (size_t i = 0; i < block_size; ++i) {
+                        int best_center_idx = 0;
+                        float best_dist = std::numeric_limits<float>::max();
+                        for (int j = 0; j < centers.rows(); ++j) {
+                            const float dist = center_norms(j) - 2 * products(i, j);
+                            if (dist < best_dist) {
+                                best_dist = dist;
+                                best_center_idx = j;
+                            }
+                        }
+                        (*labels)[block_begin + i] = best_center_idx;
+                    }
+                }
+            }
+
+            // Find the nearest center of all points, in parallel if a thread pool
+            // is given.
+            void FindNearestCenters(const FloatMatrix& points,
+                                    const FloatMatrix& centers,
+                                    ThreadPool* thread_pool,
+                                    std::vector<int>* labels) {
+                const Eigen::VectorXf center_norms = centers.rowwise().squaredNorm();
+                labels->resize(points.rows());
+
+                const size_t num_points = points.rows();
+                if (thread_pool == nullptr || num_points <= kDistanceBlockSize) {
+                    FindNearestCenters(points, 0, num_points, centers, center_norms,
+                                       labels);
+                    return;
+                }
+
+                const size_t num_tasks = thread_pool->NumThreads();
+                const size_t num_points_per_task =
+                        (num_points + num_tasks - 1) / num_tasks;
+                std::vector<std::future<void>> futures;
+                for (size_t begin = 0; begin < num_points;
+                     begin += num_points_per_task) {
+                    const size_t end = std::min(begin + num_points_per_task, num_points);
+                    futures.push_back(thread_pool->AddTask([&, begin, end]() {
+                        FindNearestCenters(points, begin, end, centers, center_norms,
+                                           labels);
+                    }));
+                }
+                for (auto& future : futures) {
+                    future.get();
+                }
+            }
+
+            // Cluster the points into at most the given number of clusters using
+            // k-means++ seeding followed by Lloyd's iterations.
+            FloatMatrix KMeans(const FloatMatrix& points, const int num_clusters,
+                               const int num_iterations, const unsigned int seed,
+                               ThreadPool* thread_pool) {
+                CHECK_GT(points.rows(), 0);
+                CHECK_GT(num_clusters, 0);
+
+                std::mt19937 prng(seed);
+                const size_t num_points = points.rows();
+
+                FloatMatrix centers(std::min<size_t>(num_clusters, num_points),
+                                    points.cols());
+
+                std::uniform_int_distribution<size_t> point_distribution(
+                        0, num_points - 1);
+                centers.row(0) = points.row(point_distribution(prng));
+                Eigen::VectorXf min_dists =
+                        (points.rowwise() - centers.row(0)).rowwise().squaredNorm();
+
+                int num_centers = 1;
+                for (; num_centers < centers.rows(); ++num_centers) {
+                    // Stop early, if all points coincide with a center.
+                    const double sum_dists = min_dists.cast<double>().sum();
+                    if (sum_dists <= 0) {
+                        break;
+                    }
+                    const double threshold =
+                            std::uniform_real_distribution<double>(0, sum_dists)(prng);
+                    double cumulative_dist = 0;
+                    size_t point_idx = 0;
+                    for (; point_idx < num_points - 1; ++point_idx) {
+                        cumulative_dist += min_dists(point_idx);
+                        if (cumulative_dist > threshold) {
+                            break;
+                        }
+                    }
+                    centers.row(num_centers) = points.row(point_idx);
+                    min_dists = min_dists.cwiseMin(
+                            (points.rowwise() - centers.row(num_centers))
+                                    .rowwise()
+                                    .squaredNorm());
+                }
+
+                centers.conservativeResize(num_centers, Eigen::NoChange);
+
+                std::vector<int> labels;
+                std::vector<int> prev_labels;
+                Eigen::MatrixXd center_sums(centers.rows(), centers.cols());
+                std::vector<size_t> center_counts(centers.rows());
+                for (int iteration = 0; iteration < num_iterations; ++iteration) {
+                    FindNearestCenters(points, centers, thread_pool, &labels);
+                    if (labels == prev_labels) {
+                        break;
+                    }
+
+                    center_sums.setZero();
+                    std::fill(center_counts.begin(), center_counts.end(), 0);
+                    for (size_t i = 0; i < num_points; ++i) {
+                        center_sums.row(labels[i]) += points.row(i).cast<double>();
+                        center_counts[labels[i]] += 1;
+                    }
+
+                    for (int j = 0; j < centers.rows(); ++j) {
+                        if (center_counts[j] > 0) {
+                            centers.row(j) =
+                                    (center_sums.row(j) / center_counts[j]).cast<float>();
+                        } else {
+                            // Reseed empty clusters with a random point.
+                            centers.row(j) = points.row(point_distribution(prng));
+                        }
+                    }
+
+                    std::swap(labels, prev_labels);
+                }
+
+                return centers;
+            }
+
+        }  // namespace
+
+        bool VocabTreeBuilder::Options::Check() const {
+            CHECK_OPTION_GT(num_visual_words, 0);
+            CHECK_OPTION_GT(branching, 1);
+            CHECK_OPTION_GE(num_iterations, 0);
+            CHECK_OPTION_GT(num_samples_per_cluster, 0);
+            CHECK_OPTION_GT(max_num_samples, 0);
+            CHECK_OPTION_GE(checkpoint_interval, 0);
+            return true;
+        }
+
+        VocabTreeBuilder::VocabTreeBuilder(const Options& options,
+                                           const DescriptorSource& descriptor_source)
+                : options_(options),
+                  descriptor_source_(descriptor_source),
+                  descriptor_dim_(0) {
+            CHECK(options_.Check());
+        }
+
+        void VocabTreeBuilder::Build(FeatureDescriptors* visual_words,
+                                     FeatureDescriptors* descriptors_sample) {
+            CHECK_NOTNULL(visual_words);
+            CHECK_NOTNULL(descriptors_sample);
+
+            nodes_.clear();
+            embedding_sample_.clear();
+
+            if (!options_.checkpoint_path.empty() &&
+                ExistsFile(options_.checkpoint_path) && ReadCheckpoint()) {
+                std::cout << StringPrintf("Resuming from checkpoint with %d nodes",
+                                          static_cast<int>(nodes_.size()))
+                << std::endl;
+            }
+
+            // Cluster the levels until the last level was clustered, i.e. the
+            // level whose nodes share the desired number of visual words, or until
+            // the tree no longer grows.
+            const size_t num_visual_words = options_.num_visual_words;
+            size_t prev_num_cells = 0;
+            int level = 0;
+            std::vector<Cell> cells;
+            for (;; ++level) {
+                cells = GetCells(level);
+                if (level > 0 && (prev_num_cells * options_.branching >=
+                                  num_visual_words ||
+                                  cells.size() >= num_visual_words ||
+                                  cells.size() <= prev_num_cells)) {
+                    break;
+                }
+                ClusterLevel(level, cells);
+                prev_num_cells = cells.size();
+            }
+
+            if (embedding_sample_.empty()) {
+                SampleEmbedding();
+            }
+
+            visual_words->resize(cells.size(), descriptor_dim_);
+            for (size_t i = 0; i < cells.size(); ++i) {
+                const auto& center =
+                        nodes_[cells[i].node_idx].centers.row(cells[i].center_idx);
+                for (int d = 0; d < descriptor_dim_; ++d) {
+                    (*visual_words)(i, d) = static_cast<uint8_t>(
+                            std::min(255.0f, std::max(0.0f, std::round(center(d)))));
+                }
+            }
+
+            descriptors_sample->resize(embedding_sample_.size() / descriptor_dim_,
+                                       descriptor_dim_);
+            std::memcpy(descriptors_sample->data(), embedding_sample_.data(),
+                        embedding_sample_.size());
+        }
+
+        std::vector<VocabTreeBuilder::Cell> VocabTreeBuilder::GetCells(
+                const int level) const {
+            std::vector<Cell> cells;
+            if (level == 0) {
+                cells.emplace_back();
+                return cells;
+            }
+            for (size_t node_idx = 0; node_idx < nodes_.size(); ++node_idx) {
+                if (nodes_[node_idx].depth == level - 1) {
+                    for (int center_idx = 0;
+                         center_idx < nodes_[node_idx].centers.rows(); ++center_idx) {
+                        Cell cell;
+                        cell.node_idx = static_cast<int>(node_idx);
+                        cell.center_idx = center_idx;
+                        cells.push_back(cell);
+                    }
+                }
+            }
+            return cells;
+        }
+
+        bool VocabTreeBuilder::IsClustered(const Cell& cell) const {
+            if (cell.node_idx < 0) {
+                return !nodes_.empty();
+            }
+            return nodes_[cell.node_idx].child_node_idxs[cell.center_idx] >= 0;
+        }
+
+        void VocabTreeBuilder::AssignToCells(const int level,
+                                             const std::vector<int>& cell_offsets,
+                                             const FloatMatrix& descriptors,
+                                             const size_t begin, const size_t end,
+                                             std::vector<int>* cell_idxs) const {
+            if (level == 0) {
+                std::fill(cell_idxs->begin() + begin, cell_idxs->begin() + end, 0);
+                return;
+            }
+
+            // Descend the tree for groups of descriptors in the same node at a
+            // time, so that their distances are computed in a single product.
+            std::vector<std::pair<int, size_t>> node_descriptor_idxs;
+            node_descriptor_idxs.reserve(end - begin);
+            for (size_t i = begin; i < end; ++i) {
+                node_descriptor_idxs.emplace_back(0, i);
+            }
+
+            FloatMatrix node_descriptors;
+            std::vector<int> labels;
+            for (int depth = 0; depth < level; ++depth) {
+                std::sort(node_descriptor_idxs.begin(), node_descriptor_idxs.end());
+                size_t group_begin = 0;
+                while (group_begin < node_descriptor_idxs.size()) {
+                    const int node_idx = node_descriptor_idxs[group_begin].first;
+                    size_t group_end = group_begin + 1;
+                    while (group_end < node_descriptor_idxs.size() &&
+                           node_descriptor_idxs[group_end].first == node_idx) {
+                        group_end += 1;
+                    }
+
+                    const Node& node = nodes_[node_idx];
+                    node_descriptors.resize(group_end - group_begin, descriptor_dim_);
+                    for (size_t i = group_begin; i < group_end; ++i) {
+                        node_descriptors.row(i - group_begin) =
+                                descriptors.row(node_descriptor_idxs[i].second);
+                    }
+                    FindNearestCenters(node_descriptors, node.centers, nullptr, &labels);
+
+                    for (size_t i = group_begin; i < group_end; ++i) {
+                        const int label = labels[i - group_begin];
+                        if (depth + 1 < level) {
+                            node_descriptor_idxs[i].first = node.child_node_idxs[label];
+                        } else {
+                            (*cell_idxs)[node_descriptor_idxs[i].second] =
+                                    cell_offsets[node_idx] + label;
+                        }
+                    }
+
+                    group_begin = group_end;
+                }
+            }
+        }
+
+        void VocabTreeBuilder::SampleCells(
+                const int level, const std::vector<Cell>& cells,
+                const bool sample_embedding, std::vector<size_t>* num_descriptors,
+                std::vector<std::vector<uint8_t>>* cell_samples) {
+            std::vector<int> cell_offsets(nodes_.size(), -1);
+            for (size_t cell_idx = 0; cell_idx < cells.size(); ++cell_idx) {
+                const Cell& cell = cells[cell_idx];
+                if (cell.node_idx >= 0 && cell.center_idx == 0) {
+                    cell_offsets[cell.node_idx] = static_cast<int>(cell_idx);
+                }
+            }
+
+            // Share the sampled descriptors among the cells to be clustered.
+            size_t num_pending_cells = 0;
+            for (const auto& cell : cells) {
+                if (!IsClustered(cell)) {
+                    num_pending_cells += 1;
+                }
+            }
+            const size_t max_num_cell_samples = std::max<size_t>(
+                    1, std::min<size_t>(static_cast<size_t>(options_.branching) *
+                                        options_.num_samples_per_cluster,
+                                        options_.max_num_samples /
+                                        std::max<size_t>(1, num_pending_cells)));
+
+            std::vector<size_t> num_cell_samples(cells.size(), 0);
+            for (size_t cell_idx = 0; cell_idx < cells.size(); ++cell_idx) {
+                if (!IsClustered(cells[cell_idx])) {
+                    num_cell_samples[cell_idx] = max_num_cell_samples;
+                }
+            }
+
+            num_descriptors->assign(cells.size(), 0);
+            cell_samples->assign(cells.size(), std::vector<uint8_t>());
+
+            const size_t max_num_embedding_samples = options_.max_num_samples;
+            size_t num_embedding_descriptors = 0;
+            if (sample_embedding) {
+                embedding_sample_.clear();
+            }
+
+            // The same descriptors are sampled, if the level is clustered again
+            // after resuming from a checkpoint, since the source yields the same
+            // descriptors in the same order on every call.
+            std::mt19937 prng(level);
+
+            ThreadPool thread_pool(options_.num_threads);
+
+            // Add the descriptor to the reservoir sample, which replaces a random
+            // sampled descriptor with decreasing probability once it is full.
+            auto SampleDescriptor = [&prng](const uint8_t* descriptor,
+                                            const size_t dim,
+                                            const size_t num_sampled_descriptors,
+                                            const size_t max_num_sampled_descriptors,
+                                            std::vector<uint8_t>* sample) {
+                if (sample->size() < max_num_sampled_descriptors * dim) {
+                    sample->insert(sample->end(), descriptor, descriptor + dim);
+                    return;
+                }
+                const size_t sample_idx = std::uniform_int_distribution<size_t>(
+                        0, num_sampled_descriptors - 1)(prng);
+                if (sample_idx < max_num_sampled_descriptors) {
+                    std::memcpy(sample->data() + sample_idx * dim, descriptor, dim);
+                }
+            };
+
+            FeatureDescriptors batch;
+            size_t batch_size = 0;
+            std::vector<int> cell_idxs;
+
+            auto ProcessBatch = [&]() {
+                if (batch_size == 0) {
+                    return;
+                }
+
+                const FloatMatrix batch_float =
+                        batch.topRows(batch_size).cast<float>();
+                cell_idxs.resize(batch_size);
+
+                const size_t num_tasks = thread_pool.NumThreads();
+                const size_t num_descriptors_per_task =
+                        (batch_size + num_tasks - 1) / num_tasks;
+                std::vector<std::future<void>> futures;
+                for (size_t begin = 0; begin < batch_size;
+                     begin += num_descriptors_per_task) {
+                    const size_t end =
+                            std::min(begin + num_descriptors_per_task, batch_size);
+                    futures.push_back(thread_pool.AddTask([&, begin, end]() {
+                        AssignToCells(level, cell_offsets, batch_float, begin, end,
+                                      &cell_idxs);
+                    }));
+                }
+                for (auto& future : futures) {
+                    future.get();
+                }
+
+                for (size_t i = 0; i < batch_size; ++i) {
+                    const int cell_idx = cell_idxs[i];
+                    (*num_descriptors)[cell_idx] += 1;
+                    if (num_cell_samples[cell_idx] > 0) {
+                        SampleDescriptor(batch.row(i).data(), descriptor_dim_,
+                                         (*num_descriptors)[cell_idx],
+                                         num_cell_samples[cell_idx],
+                                         &(*cell_samples)[cell_idx]);
+                    }
+                    if (sample_embedding) {
+                        num_embedding_descriptors += 1;
+                        SampleDescriptor(batch.row(i).data(), descriptor_dim_,
+                                         num_embedding_descriptors,
+                                         max_num_embedding_samples, &embedding_sample_);
+                    }
+                }
+
+                batch_size = 0;
+            };
+
+            descriptor_source_([&](const FeatureDescriptors& descriptors) {
+                if (descriptors.rows() == 0) {
+                    return;
+                }
+                if (descriptor_dim_ == 0) {
+                    descriptor_dim_ = descriptors.cols();
+                }
+                CHECK_EQ(descriptors.cols(), descriptor_dim_);
+                if (batch.rows() == 0) {
+                    batch.resize(kStreamBatchSize, descriptor_dim_);
+                }
+
+                for (FeatureDescriptors::Index row = 0; row < descriptors.rows();) {
+                    const size_t num_rows = std::min<size_t>(
+                            kStreamBatchSize - batch_size, descriptors.rows() - row);
+                    batch.middleRows(batch_size, num_rows) =
+                            descriptors.middleRows(row, num_rows);
+                    batch_size += num_rows;
+                    row += num_rows;
+                    if (batch_size == kStreamBatchSize) {
+                        ProcessBatch();
+                    }
+                }
+            });
+
+            ProcessBatch();
+        }
+
+        void VocabTreeBuilder::ClusterLevel(const int level,
+                                            const std::vector<Cell>& cells) {
+            std::vector<size_t> pending_cell_idxs;
+            for (size_t cell_idx = 0; cell_idx < cells.size(); ++cell_idx) {
+                if (!IsClustered(cells[cell_idx])) {
+                    pending_cell_idxs.push_back(cell_idx);
+                }
+            }
+
+            if (pending_cell_idxs.empty()) {
+                return;
+            }
+
+            PrintHeading2(StringPrintf("Clustering level %d (%d of %d nodes)",
+                                       level + 1,
+                                       static_cast<int>(pending_cell_idxs.size()),
+                                       static_cast<int>(cells.size())));
+
+            // The last level distributes the desired number of visual words among
+            // its nodes according to their number of descriptors.
+            const size_t num_visual_words = options_.num_visual_words;
+            const bool is_last_level =
+                    cells.size() * options_.branching >= num_visual_words;
+
+            Timer timer;
+            timer.Start();
+
+            std::vector<size_t> num_descriptors;
+            std::vector<std::vector<uint8_t>> cell_samples;
+            SampleCells(level, cells, is_last_level, &num_descriptors, &cell_samples);
+
+            size_t total_num_descriptors = 0;
+            for (const auto num_cell_descriptors : num_descriptors) {
+                total_num_descriptors += num_cell_descriptors;
+            }
+            CHECK_GT(total_num_descriptors, 0) << "No training descriptors";
+
+            std::cout << StringPrintf(" => Sampled %llu descriptors in %.3fs",
+                                      static_cast<unsigned long long>(
+                                              total_num_descriptors),
+                                      timer.ElapsedSeconds())
+            << std::endl;
+
+            // Cells without descriptors keep their center as the only child. The
+            // centers are copied before the clustering, because the nodes are
+            // added while the cells are clustered in parallel.
+            std::vector<FloatMatrix> empty_cell_centers(cells.size());
+            for (const auto cell_idx : pending_cell_idxs) {
+                const Cell& cell = cells[cell_idx];
+                if (cell_samples[cell_idx].empty()) {
+                    CHECK_GE(cell.node_idx, 0);
+                    empty_cell_centers[cell_idx] =
+                            nodes_[cell.node_idx].centers.row(cell.center_idx);
+                }
+            }
+
+            auto ClusterCell = [&](const size_t cell_idx, ThreadPool* thread_pool) {
+                const std::vector<uint8_t>& sample = cell_samples[cell_idx];
+                const size_t num_samples = sample.size() / descriptor_dim_;
+
+                if (num_samples == 0) {
+                    return empty_cell_centers[cell_idx];
+                }
+
+                int num_clusters = options_.branching;
+                if (is_last_level) {
+                    num_clusters = std::max<int>(
+                            1, std::min<size_t>(options_.branching,
+                                                (num_visual_words *
+                                                 num_descriptors[cell_idx] +
+                                                 total_num_descriptors / 2) /
+                                                total_num_descriptors));
+                }
+
+                const FloatMatrix points =
+                        Eigen::Map<const FeatureDescriptors>(
+                                sample.data(), num_samples, descriptor_dim_)
+                                .cast<float>();
+
+                return KMeans(points, num_clusters, options_.num_iterations,
+                              static_cast<unsigned int>(level * cells.size() + cell_idx),
+                              thread_pool);
+            };
+
+            ThreadPool thread_pool(options_.num_threads);
+
+            // Cluster many nodes in parallel, and otherwise parallelize within the
+            // clustering of each node.
+            const bool parallel_cells =
+                    pending_cell_idxs.size() >= static_cast<size_t>(thread_pool.NumThreads());
+
+            std::vector<std::future<FloatMatrix>> futures;
+            if (parallel_cells) {
+                futures.reserve(pending_cell_idxs.size());
+                for (const auto cell_idx : pending_cell_idxs) {
+                    futures.push_back(thread_pool.AddTask(
+                            [&, cell_idx]() { return ClusterCell(cell_idx, nullptr); }));
+                }
+            }
+
+            Timer checkpoint_timer;
+            checkpoint_timer.Start();
+
+            // Add the nodes in the order of their cells, so that the tree does not
+            // depend on the order in which the clusterings finish.
+            for (size_t i = 0; i < pending_cell_idxs.size(); ++i) {
+                const size_t cell_idx = pending_cell_idxs[i];
+                FloatMatrix centers = parallel_cells
+                                      ? futures[i].get()
+                                      : ClusterCell(cell_idx, &thread_pool);
+                AddNode(cells[cell_idx], level, std::move(centers));
+                std::vector<uint8_t>().swap(cell_samples[cell_idx]);
+
+                if (!options_.checkpoint_path.empty() &&
+                    checkpoint_timer.ElapsedSeconds() >= options_.checkpoint_interval) {
+                    WriteCheckpoint();
+                    checkpoint_timer.Restart();
+                }
+            }
+
+            if (!options_.checkpoint_path.empty()) {
+                WriteCheckpoint();
+            }
+
+            std::cout << StringPrintf(" => Clustered level in %.3fs",
+                                      timer.ElapsedSeconds())
+            << std::endl;
+        }
+
+        void VocabTreeBuilder::SampleEmbedding() {
+            PrintHeading2("Sampling descriptors for Hamming embedding");
+
+            const size_t max_num_samples = options_.max_num_samples;
+            size_t num_descriptors = 0;
+            std::mt19937 prng(0);
+
+            embedding_sample_.clear();
+            descriptor_source_([&](const FeatureDescriptors& descriptors) {
+                if (descriptors.rows() == 0) {
+                    return;
+                }
+                if (descriptor_dim_ == 0) {
+                    descriptor_dim_ = descriptors.cols();
+                }
+                CHECK_EQ(descriptors.cols(), descriptor_dim_);
+                for (FeatureDescriptors::Index row = 0; row < descriptors.rows();
+                     ++row) {
+                    num_descriptors += 1;
+                    if (embedding_sample_.size() < max_num_samples * descriptor_dim_) {
+                        embedding_sample_.insert(
+                                embedding_sample_.end(), descriptors.row(row).data(),
+                                descriptors.row(row).data() + descriptor_dim_);
+                        continue;
+                    }
+                    const size_t sample_idx = std::uniform_int_distribution<size_t>(
+                            0, num_descriptors - 1)(prng);
+                    if (sample_idx < max_num_samples) {
+                        std::memcpy(embedding_sample_.data() +
+                                    sample_idx * descriptor_dim_,
+                                    descriptors.row(row).data(), descriptor_dim_);
+                    }
+                }
+            });
+        }
+
+        int VocabTreeBuilder::AddNode(const Cell& cell, const int depth,
+                                      FloatMatrix centers) {
+            const int node_idx = static_cast<int>(nodes_.size());
+            nodes_.emplace_back();
+            Node& node = nodes_.back();
+            node.depth = depth;
+            node.parent_node_idx = cell.node_idx;
+            node.parent_center_idx = cell.center_idx;
+            node.centers = std::move(centers);
+            node.child_node_idxs.resize(node.centers.rows(), -1);
+            if (cell.node_idx >= 0) {
+                nodes_[cell.node_idx].child_node_idxs[cell.center_idx] = node_idx;
+            }
+            return node_idx;
+        }
+
+        bool VocabTreeBuilder::ReadCheckpoint() {
+            std::ifstream file(options_.checkpoint_path, std::ios::binary);
+            CHECK(file.is_open()) << options_.checkpoint_path;
+
+            char magic[kCheckpointMagicSize];
+            file.read(magic, kCheckpointMagicSize);
+            if (!file ||
+                std::string(magic, kCheckpointMagicSize) != kCheckpointMagic ||
+                ReadBinaryLittleEndian<uint32_t>(&file) != kCheckpointVersion) {
+                std::cerr << "WARNING: Ignoring invalid checkpoint at "
+                << options_.checkpoint_path << std::endl;
+                return false;
+            }
+
+            const int num_visual_words = ReadBinaryLittleEndian<int32_t>(&file);
+            const int branching = ReadBinaryLittleEndian<int32_t>(&file);
+            const int descriptor_dim = ReadBinaryLittleEndian<int32_t>(&file);
+            if (num_visual_words != options_.num_visual_words ||
+                branching != options_.branching) {
+                std::cerr << "WARNING: Ignoring checkpoint at "
+                << options_.checkpoint_path
+                << ", which was built with different options" << std::endl;
+                return false;
+            }
+
+            const uint64_t num_nodes = ReadBinaryLittleEndian<uint64_t>(&file);
+            nodes_.clear();
+            descriptor_dim_ = descriptor_dim;
+            for (uint64_t i = 0; i < num_nodes; ++i) {
+                const int depth = ReadBinaryLittleEndian<int32_t>(&file);
+                Cell cell;
+                cell.node_idx = ReadBinaryLittleEndian<int32_t>(&file);
+                cell.center_idx = ReadBinaryLittleEndian<int32_t>(&file);
+                const uint32_t num_centers = ReadBinaryLittleEndian<uint32_t>(&file);
+                std::vector<float> centers_data(num_centers * descriptor_dim);
+                ReadBinaryLittleEndian<float>(&file, &centers_data);
+                CHECK(file) << "Truncated checkpoint at " << options_.checkpoint_path;
+                CHECK_LT(cell.node_idx, static_cast<int>(nodes_.size()));
+                AddNode(cell, depth,
+                        Eigen::Map<const FloatMatrix>(centers_data.data(),
+                                                      num_centers, descriptor_dim));
+            }
+
+            return true;
+        }
+
+        void VocabTreeBuilder::WriteCheckpoint() const {
+            // Write to a temporary file first, so that an interrupted write never
+            // corrupts the previous checkpoint.
+            const std::string temp_path = options_.checkpoint_path + ".tmp";
+            {
+                std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+                CHECK(file.is_open()) << temp_path;
+
+                file.write(kCheckpointMagic, kCheckpointMagicSize);
+                WriteBinaryLittleEndian<uint32_t>(&file, kCheckpointVersion);
+                WriteBinaryLittleEndian<int32_t>(&file, options_.num_visual_words);
+                WriteBinaryLittleEndian<int32_t>(&file, options_.branching);
+                WriteBinaryLittleEndian<int32_t>(&file, descriptor_dim_);
+
+                WriteBinaryLittleEndian<uint64_t>(&file, nodes_.size());
+                for (const auto& node : nodes_) {
+                    WriteBinaryLittleEndian<int32_t>(&file, node.depth);
+                    WriteBinaryLittleEndian<int32_t>(&file, node.parent_node_idx);
+                    WriteBinaryLittleEndian<int32_t>(&file, node.parent_center_idx);
+                    WriteBinaryLittleEndian<uint32_t>(&file, node.centers.rows());
+                    for (Eigen::Index i = 0; i < node.centers.size(); ++i) {
+                        WriteBinaryLittleEndian<float>(&file, node.centers.data()[i]);
+                    }
+                }
+
+                CHECK(file) << temp_path;
+            }
+
+            boost::filesystem::rename(temp_path, options_.checkpoint_path);
+        }
+
+    }  // namespace retrieval
+}
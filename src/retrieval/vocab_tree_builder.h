@@ -0,0 +1,141 @@
+#ifndef BKMAP_VOCAB_TREE_BUILDER_H
+#define BKMAP_VOCAB_TREE_BUILDER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/feature.h"
+
+namespace bkmap {
+    namespace retrieval {
+
+// Builds the visual words of a vocabulary tree by hierarchical k-means, whose
+// levels are clustered one after another from descriptors that are streamed
+// from their source, e.g. the database, for every level. The memory is thus
+// bounded by the number of sampled descriptors instead of the number of all
+// descriptors. For each level, the descriptors are assigned to the leaves of
+// the tree and a random sample of each leaf is clustered using k-means++ and
+// Lloyd's iterations into the children of the leaf. The leaves are clustered
+// in parallel, if there are many, and otherwise the assignment steps of each
+// clustering are parallelized. The tree is written to a checkpoint after every
+// level and periodically within a level, from which an interrupted build
+// resumes. The leaves of the last level are the visual words.
+        class VocabTreeBuilder {
+        public:
+            struct Options {
+                // The desired number of visual words, i.e. the number of leaf node
+                // clusters. Note that the actual number of visual words is only
+                // approximately the same.
+                int num_visual_words = 256 * 256;
+
+                // The branching factor of the hierarchical k-means tree.
+                int branching = 256;
+
+                // The number of iterations for the clustering.
+                int num_iterations = 11;
+
+                // The number of sampled descriptors per cluster of a node, so that a
+                // node with the full branching factor is clustered from at most
+                // `branching * num_samples_per_cluster` descriptors.
+                int num_samples_per_cluster = 256;
+
+                // The maximum number of sampled descriptors in memory, which is
+                // shared by all nodes of a level. The same number of descriptors is
+                // additionally sampled for learning the Hamming embedding.
+                int max_num_samples = 4 * 1024 * 1024;
+
+                // The number of threads used in the clustering.
+                int num_threads = -1;
+
+                // The path of the checkpoint, which is disabled if empty.
+                std::string checkpoint_path = "";
+
+                // The minimum time in seconds between checkpoints within a level.
+                double checkpoint_interval = 300.0;
+
+                bool Check() const;
+            };
+
+            typedef std::function<void(const FeatureDescriptors&)> DescriptorCallback;
+
+            // The source of the training descriptors, which passes all descriptors
+            // in chunks to the given callback. It is called once per level and must
+            // yield the same descriptors in the same order on every call.
+            typedef std::function<void(const DescriptorCallback&)> DescriptorSource;
+
+            VocabTreeBuilder(const Options& options,
+                             const DescriptorSource& descriptor_source);
+
+            // Build the tree, or resume from its checkpoint, and return its visual
+            // words and a random sample of the descriptors for learning the Hamming
+            // embedding of the visual words.
+            void Build(FeatureDescriptors* visual_words,
+                       FeatureDescriptors* descriptors_sample);
+
+        private:
+            typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic,
+                    Eigen::RowMajor> FloatMatrix;
+
+            struct Node {
+                int depth = 0;
+                // The node and cluster whose descriptors are clustered by the node,
+                // which is -1 for the root.
+                int parent_node_idx = -1;
+                int parent_center_idx = -1;
+                FloatMatrix centers;
+                // The node of each cluster, which is -1 if it was not clustered.
+                std::vector<int> child_node_idxs;
+            };
+
+            // A leaf cluster of the tree, which is split into a new node.
+            struct Cell {
+                int node_idx = -1;
+                int center_idx = 0;
+            };
+
+            // Whether the cell was already split into a node.
+            bool IsClustered(const Cell& cell) const;
+
+            // The cells of the given level, i.e. the clusters of the nodes of the
+            // previous level, or the root cell.
+            std::vector<Cell> GetCells(const int level) const;
+
+            // Assign the descriptors to the cells of the given level by descending
+            // the tree.
+            void AssignToCells(const int level, const std::vector<int>& cell_offsets,
+                               const FloatMatrix& descriptors, const size_t begin,
+                               const size_t end, std::vector<int>* cell_idxs) const;
+
+            // Stream the descriptors once, count the descriptors of each cell and
+            // sample them for the cells that are not yet clustered.
+            void SampleCells(const int level, const std::vector<Cell>& cells,
+                             const bool sample_embedding,
+                             std::vector<size_t>* num_descriptors,
+                             std::vector<std::vector<uint8_t>>* cell_samples);
+
+            // Cluster the cells of the level, which are not yet clustered.
+            void ClusterLevel(const int level, const std::vector<Cell>& cells);
+
+            // Stream the descriptors once and only sample them for the embedding.
+            void SampleEmbedding();
+
+            int AddNode(const Cell& cell, const int depth, FloatMatrix centers);
+
+            bool ReadCheckpoint();
+            void WriteCheckpoint() const;
+
+            const Options options_;
+            const DescriptorSource descriptor_source_;
+
+            int descriptor_dim_;
+            std::vector<Node> nodes_;
+            std::vector<uint8_t> embedding_sample_;
+        };
+
+    }  // namespace retrieval
+}
+
+#endif //BKMAP_VOCAB_TREE_BUILDER_H
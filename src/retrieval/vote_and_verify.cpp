@@ -4,8 +4,7 @@
 
 #include "retrieval/vote_and_verify.h"
 
-#include <array>
-#include <unordered_map>
+#include <algorithm>
 
 #include "estimators/affine_transform.h"
 #include "optim/ransac.h"
@@ -73,50 +72,81 @@ namespace bkmap {
                 FeatureGeometryTransform sum_tform_;
             };
 
-// Compute the difference in scale between the two features when aligning them
-// with the given transformation.
-            float ComputeScaleError(const FeatureGeometry& feature1,
-                                    const FeatureGeometry& feature2,
-                                    const TwoWayTransform& tform) {
-                const float area_transformed = feature1.GetAreaUnderTransform(tform.A21);
-                const float area_measured = feature2.GetArea();
-                if (area_transformed > area_measured) {
-                    return area_transformed / area_measured;
-                } else {
-                    return area_measured / area_transformed;
+// The number of bits of the given non-negative number.
+            int NumBits(int value) {
+                int num_bits = 0;
+                while (value > 0) {
+                    num_bits += 1;
+                    value >>= 1;
+                }
+                return num_bits;
+            }
+
+// A single 1-to-1 feature match, which is extracted once from the 1-to-M
+// matches, so that the transformations are verified on a flat array.
+            struct PointMatch {
+                int match_idx;
+                Eigen::Vector2f xy1;
+                Eigen::Vector2f xy2;
+                // The ratio of the feature areas, which determines their scale error
+                // under an affine transformation.
+                float area_ratio;
+            };
+
+            void ExtractPointMatches(const std::vector<FeatureGeometryMatch>& matches,
+                                     std::vector<PointMatch>* point_matches) {
+                point_matches->clear();
+                for (size_t i = 0; i < matches.size(); ++i) {
+                    const auto& geometry1 = matches[i].geometry1;
+                    for (const auto& geometry2 : matches[i].geometries2) {
+                        PointMatch point_match;
+                        point_match.match_idx = static_cast<int>(i);
+                        point_match.xy1 = Eigen::Vector2f(geometry1.x, geometry1.y);
+                        point_match.xy2 = Eigen::Vector2f(geometry2.x, geometry2.y);
+                        // The area of the first feature under the transformation A21
+                        // is its own area divided by |det(A21)|.
+                        point_match.area_ratio = geometry1.GetArea() / geometry2.GetArea();
+                        point_matches->push_back(point_match);
+                    }
                 }
             }
 
-// Compute the two-way transfer error between two features.
-            float ComputeTransferError(const FeatureGeometry& feature1,
-                                       const FeatureGeometry& feature2,
-                                       const TwoWayTransform& tform) {
-                const Eigen::Vector2f xy1(feature1.x, feature1.y);
-                const Eigen::Vector2f xy2(feature2.x, feature2.y);
-                const float error1 = (xy2 - tform.A12 * xy1 - tform.t12).squaredNorm();
-                const float error2 = (xy1 - tform.A21 * xy2 - tform.t21).squaredNorm();
-                return error1 + error2;
+// Check whether the match satisfies the transfer and scale thresholds, where the
+// scale error of the features is the ratio of their areas after aligning them
+// with the given transformation.
+            bool IsInlier(const PointMatch& point_match, const TwoWayTransform& tform,
+                          const float abs_det21, const float max_transfer_error,
+                          const float max_scale_error) {
+                const float area_ratio = point_match.area_ratio / abs_det21;
+                const float scale_error =
+                        area_ratio > 1.0f ? area_ratio : 1.0f / area_ratio;
+                if (scale_error > max_scale_error) {
+                    return false;
+                }
+                const float error1 =
+                        (point_match.xy2 - tform.A12 * point_match.xy1 - tform.t12)
+                                .squaredNorm();
+                const float error2 =
+                        (point_match.xy1 - tform.A21 * point_match.xy2 - tform.t21)
+                                .squaredNorm();
+                return error1 + error2 <= max_transfer_error;
             }
 
 // Compute inlier matches that satisfy the transfer, scale thresholds.
             void ComputeInlier(const TwoWayTransform& tform,
-                               const std::vector<FeatureGeometryMatch>& matches,
+                               const std::vector<PointMatch>& point_matches,
                                const float max_transfer_error, const float max_scale_error,
-                               std::vector<std::pair<int, int>>* inlier_idxs) {
+                               std::vector<int>* inlier_idxs) {
                 CHECK_GT(max_transfer_error, 0);
                 CHECK_GT(max_scale_error, 0);
 
+                const float abs_det21 = std::abs(tform.A21.determinant());
+
                 inlier_idxs->clear();
-                for (size_t i = 0; i < matches.size(); ++i) {
-                    const auto& match = matches[i];
-                    for (size_t j = 0; j < match.geometries2.size(); ++j) {
-                        const auto& geometry2 = match.geometries2[j];
-                        if (ComputeScaleError(match.geometry1, geometry2, tform) <=
-                            max_scale_error &&
-                            ComputeTransferError(match.geometry1, geometry2, tform) <=
-                            max_transfer_error) {
-                            inlier_idxs->emplace_back(i, j);
-                        }
+                for (size_t i = 0; i < point_matches.size(); ++i) {
+                    if (IsInlier(point_matches[i], tform, abs_det21, max_transfer_error,
+                                 max_scale_error)) {
+                        inlier_idxs->push_back(static_cast<int>(i));
                     }
                 }
             }
@@ -124,35 +154,39 @@ namespace bkmap {
 // Compute effective inlier count that satisfy the transfer, scale thresholds.
             size_t ComputeEffectiveInlierCount(
                     const TwoWayTransform& tform,
-                    const std::vector<FeatureGeometryMatch>& matches,
+                    const std::vector<PointMatch>& point_matches,
                     const float max_transfer_error, const float max_scale_error,
                     const int num_bins) {
                 CHECK_GT(max_transfer_error, 0);
                 CHECK_GT(max_scale_error, 0);
                 CHECK_GT(num_bins, 0);
 
+                const float abs_det21 = std::abs(tform.A21.determinant());
+
                 std::vector<std::pair<float, float>> inlier_coords;
-                inlier_coords.reserve(matches.size());
+                inlier_coords.reserve(point_matches.size());
 
                 float min_x = std::numeric_limits<float>::max();
                 float min_y = std::numeric_limits<float>::max();
                 float max_x = 0;
                 float max_y = 0;
 
-                for (const auto& match : matches) {
-                    for (const auto& geometry2 : match.geometries2) {
-                        if (ComputeScaleError(match.geometry1, geometry2, tform) <=
-                            max_scale_error &&
-                            ComputeTransferError(match.geometry1, geometry2, tform) <=
-                            max_transfer_error) {
-                            inlier_coords.emplace_back(match.geometry1.x, match.geometry1.y);
-                            min_x = std::min(min_x, match.geometry1.x);
-                            min_y = std::min(min_y, match.geometry1.y);
-                            max_x = std::max(max_x, match.geometry1.x);
-                            max_y = std::max(min_y, match.geometry1.y);
-                            break;
-                        }
+                // Count at most one inlier per feature of the first image.
+                int last_inlier_match_idx = -1;
+                for (const auto& point_match : point_matches) {
+                    if (point_match.match_idx == last_inlier_match_idx ||
+                        !IsInlier(point_match, tform, abs_det21, max_transfer_error,
+                                  max_scale_error)) {
+                        continue;
                     }
+                    last_inlier_match_idx = point_match.match_idx;
+                    const float x = point_match.xy1.x();
+                    const float y = point_match.xy1.y();
+                    inlier_coords.emplace_back(x, y);
+                    min_x = std::min(min_x, x);
+                    min_y = std::min(min_y, y);
+                    max_x = std::max(max_x, x);
+                    max_y = std::max(min_y, y);
                 }
 
                 if (inlier_coords.empty()) {
@@ -196,6 +230,9 @@ namespace bkmap {
                 return 0;
             }
 
+            std::vector<PointMatch> point_matches;
+            ExtractPointMatches(matches, &point_matches);
+
             const float max_trans = options.max_image_size;
             const float kMaxScale = 10.0f;
             const float max_log_scale = std::log2(kMaxScale);
@@ -204,9 +241,21 @@ namespace bkmap {
             // Fill the multi-resolution voting histogram.
             //////////////////////////////////////////////////////////////////////////////
 
+            // The votes are sorted by the interleaved bits of their bin coordinates,
+            // from the most to the least significant bit, so that the votes of each
+            // bin are contiguous on all levels, which replaces the sparse histograms.
             const int kNumLevels = 6;
-            std::array<std::unordered_map<size_t, VotingBin>, kNumLevels> bins;
-            std::unordered_map<size_t, Eigen::Vector4i> coords;
+            const int num_trans_bits = NumBits(options.num_trans_bins - 1);
+            const int num_scale_bits = NumBits(options.num_scale_bins - 1);
+            const int num_angle_bits = NumBits(options.num_angle_bins - 1);
+            const int max_num_bits =
+                    std::max(num_trans_bits, std::max(num_scale_bits, num_angle_bits));
+            CHECK_LE(2 * num_trans_bits + num_scale_bits + num_angle_bits, 64);
+
+            std::vector<FeatureGeometryTransform> vote_tforms;
+            std::vector<std::pair<uint64_t, int>> votes;
+            vote_tforms.reserve(point_matches.size());
+            votes.reserve(point_matches.size());
 
             for (const auto& match : matches) {
                 for (const auto& geometry2 : match.geometries2) {
@@ -227,64 +276,86 @@ namespace bkmap {
                     const float s = (log_scale + max_log_scale) / (2.0f * max_log_scale);
                     const float o = (T.angle + M_PI) / (2.0f * M_PI);
 
-                    int n_x = std::min(static_cast<int>(x * options.num_trans_bins),
-                                       static_cast<int>(options.num_trans_bins - 1));
-                    int n_y = std::min(static_cast<int>(y * options.num_trans_bins),
-                                       static_cast<int>(options.num_trans_bins - 1));
-                    int n_s = std::min(static_cast<int>(s * options.num_scale_bins),
-                                       static_cast<int>(options.num_scale_bins - 1));
-                    int n_a = std::min(static_cast<int>(o * options.num_angle_bins),
-                                       static_cast<int>(options.num_angle_bins - 1));
-
-                    for (int level = 0; level < kNumLevels; ++level) {
-                        const uint64_t index =
-                                n_a + options.num_angle_bins * n_s +
-                                options.num_scale_bins * options.num_angle_bins * n_x +
-                                options.num_scale_bins * options.num_angle_bins *
-                                options.num_trans_bins * n_y;
-
-                        if (level == 0) {
-                            coords[index] = Eigen::Vector4i(n_a, n_s, n_x, n_y);
+                    const int n_x = std::min(static_cast<int>(x * options.num_trans_bins),
+                                             static_cast<int>(options.num_trans_bins - 1));
+                    const int n_y = std::min(static_cast<int>(y * options.num_trans_bins),
+                                             static_cast<int>(options.num_trans_bins - 1));
+                    const int n_s = std::min(static_cast<int>(s * options.num_scale_bins),
+                                             static_cast<int>(options.num_scale_bins - 1));
+                    const int n_a = std::min(static_cast<int>(o * options.num_angle_bins),
+                                             static_cast<int>(options.num_angle_bins - 1));
+
+                    uint64_t key = 0;
+                    for (int bit = max_num_bits - 1; bit >= 0; --bit) {
+                        if (bit < num_trans_bits) {
+                            key = (key << 1) | ((n_y >> bit) & 1);
+                            key = (key << 1) | ((n_x >> bit) & 1);
+                        }
+                        if (bit < num_scale_bits) {
+                            key = (key << 1) | ((n_s >> bit) & 1);
                         }
+                        if (bit < num_angle_bits) {
+                            key = (key << 1) | ((n_a >> bit) & 1);
+                        }
+                    }
 
-                        bins[level][index].Vote(T);
+                    votes.emplace_back(key, static_cast<int>(vote_tforms.size()));
+                    vote_tforms.push_back(T);
+                }
+            }
 
-                        n_x >>= 1;
-                        n_y >>= 1;
-                        n_s >>= 1;
-                        n_a >>= 1;
-                    }
+            std::sort(votes.begin(), votes.end());
+
+            // The bins of the finest level and the index of their first vote.
+            std::vector<VotingBin> bins;
+            std::vector<size_t> bin_begins;
+            for (size_t i = 0; i < votes.size(); ++i) {
+                if (i == 0 || votes[i].first != votes[i - 1].first) {
+                    bins.emplace_back();
+                    bin_begins.push_back(i);
                 }
+                bins.back().Vote(vote_tforms[votes[i].second]);
             }
 
             //////////////////////////////////////////////////////////////////////////////
             // Compute the multi-resolution scores for all occupied bins.
             //////////////////////////////////////////////////////////////////////////////
 
-            std::vector<std::pair<int, float>> bin_scores;
-            for (const auto& bin : bins[0]) {
-                if (bin.second.GetNumVotes() >=
-                    static_cast<size_t>(options.min_num_votes)) {
-                    const auto coord = coords.at(bin.first);
-                    int n_a = coord(0);
-                    int n_s = coord(1);
-                    int n_x = coord(2);
-                    int n_y = coord(3);
-                    float score = bin.second.GetNumVotes();
-                    for (int level = 1; level < kNumLevels; ++level) {
-                        n_x >>= 1;
-                        n_y >>= 1;
-                        n_s >>= 1;
-                        n_a >>= 1;
-                        const uint64_t index =
-                                n_a + options.num_angle_bins * n_s +
-                                options.num_scale_bins * options.num_angle_bins * n_x +
-                                options.num_scale_bins * options.num_angle_bins *
-                                options.num_trans_bins * n_y;
-                        score +=
-                                bins[level][index].GetNumVotes() / static_cast<float>(1 << level);
+            std::vector<float> bin_level_scores(bins.size());
+            for (size_t i = 0; i < bins.size(); ++i) {
+                bin_level_scores[i] = bins[i].GetNumVotes();
+            }
+
+            for (int level = 1; level < kNumLevels; ++level) {
+                // The bin of a coarser level is the common prefix of the keys above
+                // the `level` least significant bits of each coordinate.
+                const int shift = 2 * std::min(level, num_trans_bits) +
+                                  std::min(level, num_scale_bits) +
+                                  std::min(level, num_angle_bits);
+                const float level_weight = 1.0f / static_cast<float>(1 << level);
+                size_t bin_idx = 0;
+                while (bin_idx < bins.size()) {
+                    const uint64_t coarse_key = votes[bin_begins[bin_idx]].first >> shift;
+                    size_t end_bin_idx = bin_idx + 1;
+                    while (end_bin_idx < bins.size() &&
+                           (votes[bin_begins[end_bin_idx]].first >> shift) == coarse_key) {
+                        end_bin_idx += 1;
+                    }
+                    const size_t end_vote_idx = end_bin_idx < bins.size()
+                                                ? bin_begins[end_bin_idx]
+                                                : votes.size();
+                    const float score =
+                            (end_vote_idx - bin_begins[bin_idx]) * level_weight;
+                    for (; bin_idx < end_bin_idx; ++bin_idx) {
+                        bin_level_scores[bin_idx] += score;
                     }
-                    bin_scores.emplace_back(bin.first, score);
+                }
+            }
+
+            std::vector<std::pair<int, float>> bin_scores;
+            for (size_t i = 0; i < bins.size(); ++i) {
+                if (bins[i].GetNumVotes() >= static_cast<size_t>(options.min_num_votes)) {
+                    bin_scores.emplace_back(i, bin_level_scores[i]);
                 }
             }
 
@@ -310,14 +381,14 @@ namespace bkmap {
             size_t best_num_inliers = 0;
             TwoWayTransform best_tform;
 
-            std::vector<std::pair<int, int>> inlier_idxs;
+            std::vector<int> inlier_idxs;
             std::vector<Eigen::Vector2d> inlier_points1;
             std::vector<Eigen::Vector2d> inlier_points2;
 
             for (size_t i = 0; i < num_transformations && i < max_num_trials; ++i) {
-                const auto& bin = bins[0].at(bin_scores.at(i).first);
+                const auto& bin = bins[bin_scores[i].first];
                 const auto tform = TwoWayTransform(bin.GetTransformation());
-                ComputeInlier(tform, matches, options.max_transfer_error,
+                ComputeInlier(tform, point_matches, options.max_transfer_error,
                               options.max_scale_error, &inlier_idxs);
 
                 if (inlier_idxs.size() < best_num_inliers ||
@@ -332,12 +403,9 @@ namespace bkmap {
                 inlier_points1.resize(inlier_idxs.size());
                 inlier_points2.resize(inlier_idxs.size());
                 for (size_t j = 0; j < inlier_idxs.size(); ++j) {
-                    const auto& inlier_idx = inlier_idxs[j];
-                    const auto& match = matches.at(inlier_idx.first);
-                    const auto& geometry1 = match.geometry1;
-                    const auto& geometry2 = match.geometries2.at(inlier_idx.second);
-                    inlier_points1[j] = Eigen::Vector2d(geometry1.x, geometry1.y);
-                    inlier_points2[j] = Eigen::Vector2d(geometry2.x, geometry2.y);
+                    const auto& point_match = point_matches[inlier_idxs[j]];
+                    inlier_points1[j] = point_match.xy1.cast<double>();
+                    inlier_points2[j] = point_match.xy2.cast<double>();
                 }
 
                 // Local optimization on matching inlier points.
@@ -354,7 +422,7 @@ namespace bkmap {
                 local_tform.A21 = inv_A.leftCols<2>().cast<float>();
                 local_tform.t21 = inv_A.rightCols<1>().cast<float>();
 
-                ComputeInlier(tform, matches, options.max_transfer_error,
+                ComputeInlier(tform, point_matches, options.max_transfer_error,
                               options.max_scale_error, &inlier_idxs);
 
                 if (inlier_idxs.size() > best_num_inliers) {
@@ -372,7 +440,7 @@ namespace bkmap {
             }
 
             const int kNumBins = 64;
-            return ComputeEffectiveInlierCount(best_tform, matches,
+            return ComputeEffectiveInlierCount(best_tform, point_matches,
                                                options.max_transfer_error,
                                                options.max_scale_error, kNumBins);
         }
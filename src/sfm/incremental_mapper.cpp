@@ -801,7 +801,7 @@ namespace bkmap {
         std::unordered_map<image_t, point2D_t> num_correspondences;
         for (point2D_t point2D_idx = 0; point2D_idx < image1.NumPoints2D();
              ++point2D_idx) {
-            const std::vector<SceneGraph::Correspondence>& corrs =
+            const SceneGraph::CorrespondenceRange corrs =
                     scene_graph.FindCorrespondences(image_id1, point2D_idx);
             for (const SceneGraph::Correspondence& corr : corrs) {
                 if (num_registrations_.count(corr.image_id) == 0 ||
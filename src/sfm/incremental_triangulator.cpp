@@ -572,7 +572,7 @@ namespace bkmap {
         const auto& point3D = reconstruction_->Point3D(point3D_id);
 
         for (const auto& track_el : point3D.Track().Elements()) {
-            const std::vector<SceneGraph::Correspondence>& corrs =
+            const SceneGraph::CorrespondenceRange corrs =
                     scene_graph_->FindCorrespondences(track_el.image_id,
                                                       track_el.point2D_idx);
 
@@ -678,7 +678,7 @@ namespace bkmap {
             queue.clear();
 
             for (const TrackElement queue_elem : prev_queue) {
-                const std::vector<SceneGraph::Correspondence>& corrs =
+                const SceneGraph::CorrespondenceRange corrs =
                         scene_graph_->FindCorrespondences(queue_elem.image_id,
                                                           queue_elem.point2D_idx);
 
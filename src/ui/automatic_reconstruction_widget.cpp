@@ -57,6 +57,9 @@ namespace bkmap {
         AddOptionInt(&options_.num_threads, "num_threads", -1);
         AddOptionBool(&options_.use_gpu, "GPU");
         AddOptionText(&options_.gpu_index, "gpu_index");
+        AddOptionDouble(&options_.image_cache_size, "image_cache_size [gigabytes]",
+                        0.0, std::numeric_limits<double>::max(), 0.1, 1);
+        AddOptionBool(&options_.disk_image_cache, "disk_image_cache");
 
         AddSpacer();
 
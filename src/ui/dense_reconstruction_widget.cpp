@@ -23,7 +23,7 @@ namespace bkmap {
                 }
 
                 AddOptionInt(&options->dense_stereo->max_image_size, "max_image_size", -1);
-                AddOptionText(&options->dense_stereo->gpu_index, "gpu_index");
+                AddOptionInt(&options->dense_stereo->num_threads, "num_threads", -1);
                 AddOptionInt(&options->dense_stereo->window_radius, "window_radius");
                 AddOptionDouble(&options->dense_stereo->sigma_spatial, "sigma_spatial");
                 AddOptionDouble(&options->dense_stereo->sigma_color, "sigma_color");
@@ -269,15 +269,11 @@ namespace bkmap {
             return;
         }
 
-#ifdef CUDA_ENABLED
         mvs::PatchMatchController* processor = new mvs::PatchMatchController(
-      *options_->dense_stereo, workspace_path, "COLMAP", "");
-  processor->AddCallback(Thread::FINISHED_CALLBACK,
-                         [this]() { refresh_workspace_action_->trigger(); });
-  thread_control_widget_->StartThread("Stereo...", true, processor);
-#else
-        QMessageBox::critical(this, "", tr("CUDA not supported"));
-#endif
+                *options_->dense_stereo, workspace_path, "COLMAP", "");
+        processor->AddCallback(Thread::FINISHED_CALLBACK,
+                               [this]() { refresh_workspace_action_->trigger(); });
+        thread_control_widget_->StartThread("Stereo...", true, processor);
     }
 
     void DenseReconstructionWidget::Fusion() {
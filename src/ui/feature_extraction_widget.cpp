@@ -65,6 +65,10 @@ namespace bkmap {
 
         AddOptionInt(&options->sift_extraction->max_image_size, "max_image_size");
         AddOptionInt(&options->sift_extraction->max_num_features, "max_num_features");
+        AddOptionBool(&options->sift_extraction->budget_octave_features,
+                      "budget_octave_features");
+        AddOptionInt(&options->sift_extraction->feature_grid_size,
+                     "feature_grid_size");
         AddOptionInt(&options->sift_extraction->first_octave, "first_octave", -5);
         AddOptionInt(&options->sift_extraction->num_octaves, "num_octaves");
         AddOptionInt(&options->sift_extraction->octave_resolution,
@@ -75,8 +79,23 @@ namespace bkmap {
         AddOptionInt(&options->sift_extraction->max_num_orientations,
                      "max_num_orientations");
         AddOptionBool(&options->sift_extraction->upright, "upright");
+        AddOptionBool(&options->sift_extraction->use_simd, "use_simd");
 
         AddOptionInt(&options->sift_extraction->num_threads, "num_threads", 1, 16, true);
+        AddOptionInt(&options->sift_extraction->num_image_threads,
+                     "num_image_threads", -1, 16, true);
+        AddOptionBool(&options->sift_extraction->binary_descriptors,
+                      "binary_descriptors");
+        AddOptionInt(&options->sift_extraction->binary_num_levels,
+                     "binary_num_levels", 1);
+        AddOptionDouble(&options->sift_extraction->binary_scale_factor,
+                        "binary_scale_factor", 1.01, 4);
+        AddOptionInt(&options->sift_extraction->binary_fast_threshold,
+                     "binary_fast_threshold", 1, 254);
+        AddOptionInt(&options->sift_extraction->max_write_batch_size,
+                     "max_write_batch_size", 1);
+        AddOptionInt(&options->sift_extraction->max_write_batch_time,
+                     "max_write_batch_time [ms]");
         AddOptionBool(&options->sift_extraction->use_gpu, "use_gpu");
         AddOptionText(&options->sift_extraction->gpu_index, "gpu_index");
     }
@@ -79,6 +79,13 @@ namespace bkmap {
         AddOptionDouble(&options_->sift_matching->max_ratio, "max_ratio");
         AddOptionDouble(&options_->sift_matching->max_distance, "max_distance");
         AddOptionBool(&options_->sift_matching->cross_check, "cross_check");
+        AddOptionBool(&options_->sift_matching->cpu_brute_force_matching,
+                      "cpu_brute_force_matching");
+        AddOptionBool(&options_->sift_matching->binary_descriptors,
+                      "binary_descriptors");
+        AddOptionInt(&options_->sift_matching->max_hamming_distance,
+                     "max_hamming_distance", 0, 256);
+        AddOptionInt(&options_->sift_matching->cpu_batch_size, "cpu_batch_size", 1);
         AddOptionInt(&options_->sift_matching->max_num_matches, "max_num_matches");
         AddOptionDouble(&options_->sift_matching->max_error, "max_error");
         AddOptionDouble(&options_->sift_matching->confidence, "confidence", 0, 1,
@@ -88,6 +95,8 @@ namespace bkmap {
                         "min_inlier_ratio", 0, 1, 0.001, 3);
         AddOptionInt(&options_->sift_matching->min_num_inliers, "min_num_inliers");
         AddOptionBool(&options_->sift_matching->multiple_models, "multiple_models");
+        AddOptionBool(&options_->sift_matching->interleaved_verification,
+                      "interleaved_verification");
         AddOptionBool(&options_->sift_matching->guided_matching, "guided_matching");
 
         AddSpacer();
@@ -17,6 +17,17 @@
 
 namespace bkmap {
 
+    BitmapView::BitmapView()
+            : data_(nullptr), width_(0), height_(0), channels_(0), stride_(0) {}
+
+    BitmapView::BitmapView(const uint8_t* data, const int width, const int height,
+                           const int channels, const std::ptrdiff_t stride)
+            : data_(data),
+              width_(width),
+              height_(height),
+              channels_(channels),
+              stride_(stride) {}
+
     Bitmap::Bitmap()
             : data_(nullptr, &FreeImage_Unload), width_(0), height_(0), channels_(0) {}
 
@@ -96,20 +107,27 @@ namespace bkmap {
     }
 
     std::vector<uint8_t> Bitmap::ConvertToRowMajorArray() const {
-        std::vector<uint8_t> array(width_ * height_ * channels_);
-        size_t i = 0;
-        for (int y = 0; y < height_; ++y) {
-            const uint8_t* line = FreeImage_GetScanLine(data_.get(), height_ - 1 - y);
-            for (int x = 0; x < width_; ++x) {
-                for (int d = 0; d < channels_; ++d) {
-                    array[i] = line[x * channels_ + d];
-                    i += 1;
-                }
-            }
-        }
+        std::vector<uint8_t> array;
+        ConvertToRowMajorArray(&array);
         return array;
     }
 
+    void Bitmap::ConvertToRowMajorArray(std::vector<uint8_t>* array) const {
+        CHECK_NOTNULL(array);
+        array->resize(static_cast<size_t>(width_) * height_ * channels_);
+        View().CopyToRowMajorArray(array->data());
+    }
+
+    BitmapView Bitmap::View() const {
+        if (!data_) {
+            return BitmapView();
+        }
+        // FreeImage stores the bottom scanline first.
+        return BitmapView(FreeImage_GetScanLine(data_.get(), height_ - 1), width_,
+                          height_, channels_,
+                          -static_cast<std::ptrdiff_t>(ScanWidth()));
+    }
+
     std::vector<uint8_t> Bitmap::ConvertToColMajorArray() const {
         std::vector<uint8_t> array(width_ * height_ * channels_);
         size_t i = 0;
@@ -395,24 +413,61 @@ namespace bkmap {
             return false;
         }
 
-        data_ = FIBitmapPtr(fi_bitmap, &FreeImage_Unload);
+        return SetLoadedPtr(fi_bitmap, as_rgb);
+    }
+
+    bool Bitmap::ReadScaled(const std::string& path, const bool as_rgb,
+                            const int min_image_size, int* original_width,
+                            int* original_height) {
+        CHECK_NOTNULL(original_width);
+        CHECK_NOTNULL(original_height);
 
-        if (!IsPtrRGB(data_.get()) && as_rgb) {
-            FIBITMAP* converted_bitmap = FreeImage_ConvertTo24Bits(fi_bitmap);
-            data_ = FIBitmapPtr(converted_bitmap, &FreeImage_Unload);
-        } else if (!IsPtrGrey(data_.get()) && !as_rgb) {
-            FIBITMAP* converted_bitmap = FreeImage_ConvertToGreyscale(fi_bitmap);
-            data_ = FIBitmapPtr(converted_bitmap, &FreeImage_Unload);
+        if (!ExistsFile(path)) {
+            return false;
         }
 
-        if (!IsPtrSupported(data_.get())) {
-            data_.reset();
+        const FREE_IMAGE_FORMAT format = FreeImage_GetFileType(path.c_str(), 0);
+
+#ifdef FIF_LOAD_NOPIXELS
+        if (format == FIF_JPEG && min_image_size > 0) {
+            // Only parse the header to obtain the original dimensions.
+            FIBITMAP* fi_header =
+                    FreeImage_Load(format, path.c_str(), FIF_LOAD_NOPIXELS);
+            if (fi_header == nullptr) {
+                return false;
+            }
+            *original_width = FreeImage_GetWidth(fi_header);
+            *original_height = FreeImage_GetHeight(fi_header);
+            FreeImage_Unload(fi_header);
+
+            // The JPEG codec chooses the largest reduction of 1/2, 1/4 or 1/8, for
+            // which the larger dimension is not smaller than the requested size,
+            // which is encoded in the upper 16 bits of the flags.
+            const int size_flags = std::min(min_image_size, 0xFFFF) << 16;
+
+            FIBITMAP* fi_bitmap = nullptr;
+            if (!as_rgb) {
+                fi_bitmap = FreeImage_Load(format, path.c_str(),
+                                           size_flags | JPEG_GREYSCALE);
+            }
+            // Some color spaces, e.g. CMYK, cannot be decoded directly to grey.
+            if (fi_bitmap == nullptr) {
+                fi_bitmap = FreeImage_Load(format, path.c_str(), size_flags);
+            }
+            if (fi_bitmap == nullptr) {
+                return false;
+            }
+
+            return SetLoadedPtr(fi_bitmap, as_rgb);
+        }
+#endif
+
+        if (!Read(path, as_rgb)) {
             return false;
         }
 
-        width_ = FreeImage_GetWidth(data_.get());
-        height_ = FreeImage_GetHeight(data_.get());
-        channels_ = as_rgb ? 3 : 1;
+        *original_width = width_;
+        *original_height = height_;
 
         return true;
     }
@@ -494,6 +549,18 @@ namespace bkmap {
         }
     }
 
+    void Bitmap::ConvertToGrey() {
+        if (data_ && !IsPtrGrey(data_.get())) {
+            SetPtr(FreeImage_ConvertToGreyscale(data_.get()));
+        }
+    }
+
+    void Bitmap::ConvertToRGB() {
+        if (data_ && !IsPtrRGB(data_.get())) {
+            SetPtr(FreeImage_ConvertTo24Bits(data_.get()));
+        }
+    }
+
     void Bitmap::CloneMetadata(Bitmap* target) const {
 //        CHECK_NOTNULL(target);
 //        CHECK_NOTNULL(target->Data());
@@ -521,8 +588,9 @@ namespace bkmap {
 
     void Bitmap::SetPtr(FIBITMAP* data) {
         if (!IsPtrSupported(data)) {
+            FIBITMAP* converted_data = FreeImage_ConvertTo24Bits(data);
             FreeImage_Unload(data);
-            data = FreeImage_ConvertTo24Bits(data);
+            data = converted_data;
         }
 
         data_ = FIBitmapPtr(data, &FreeImage_Unload);
@@ -531,6 +599,29 @@ namespace bkmap {
         channels_ = IsPtrRGB(data) ? 3 : 1;
     }
 
+    bool Bitmap::SetLoadedPtr(FIBITMAP* data, const bool as_rgb) {
+        data_ = FIBitmapPtr(data, &FreeImage_Unload);
+
+        // The decoded image is converted in place, i.e., the decoded data is
+        // released as soon as it is converted.
+        if (as_rgb) {
+            ConvertToRGB();
+        } else {
+            ConvertToGrey();
+        }
+
+        if (!(as_rgb ? IsPtrRGB(data_.get()) : IsPtrGrey(data_.get()))) {
+            data_.reset();
+            return false;
+        }
+
+        width_ = FreeImage_GetWidth(data_.get());
+        height_ = FreeImage_GetHeight(data_.get());
+        channels_ = as_rgb ? 3 : 1;
+
+        return true;
+    }
+
     bool Bitmap::IsPtrGrey(FIBITMAP* data) {
         return FreeImage_GetColorType(data) == FIC_MINISBLACK &&
                FreeImage_GetBPP(data) == 8;
@@ -7,6 +7,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <ios>
 #include <limits>
 #include <memory>
@@ -43,6 +45,48 @@ namespace bkmap{
         T b;
     };
 
+    // Non-owning view of the pixels of a bitmap or any other strided 8 bit image
+    // buffer. The rows are accessed top-down, independent of their order in
+    // memory, e.g. FreeImage stores the bottom scanline first, which is
+    // represented by a negative stride. The underlying buffer must outlive the
+    // view and it is not copied.
+    class BitmapView {
+    public:
+        BitmapView();
+        BitmapView(const uint8_t* data, const int width, const int height,
+                   const int channels, const std::ptrdiff_t stride);
+
+        // Dimensions of view.
+        inline int Width() const;
+        inline int Height() const;
+        inline int Channels() const;
+
+        // Number of bytes between the starts of two consecutive rows.
+        inline std::ptrdiff_t Stride() const;
+
+        inline bool IsEmpty() const;
+
+        // Get pointer to y-th row, where the 0-th row is at the top.
+        inline const uint8_t* GetRow(const int y) const;
+
+        // Copy the pixels to a row-major array of size width * height * channels,
+        // which is allocated by the caller and can thus be reused across images.
+        inline void CopyToRowMajorArray(uint8_t* array) const;
+
+        // Convert the pixels to a row-major array of size width * height * channels,
+        // where each value is divided by the given normalization, e.g. 255 to
+        // obtain intensities in the range [0, 1].
+        template <typename T>
+        void ConvertToRowMajorArray(const T normalization, T* array) const;
+
+    private:
+        const uint8_t* data_;
+        int width_;
+        int height_;
+        int channels_;
+        std::ptrdiff_t stride_;
+    };
+
     // Wrapper class around FreeImage bitmaps.
     class Bitmap {
     public:
@@ -96,6 +140,14 @@ namespace bkmap{
         std::vector<uint8_t> ConvertToRowMajorArray() const;
         std::vector<uint8_t> ConvertToColMajorArray() const;
 
+        // Copy the image data to a row-major array, whose memory is reused, if it
+        // has enough capacity.
+        void ConvertToRowMajorArray(std::vector<uint8_t>* array) const;
+
+        // Get a non-owning view of the pixels, which is invalidated by any
+        // operation that reallocates the bitmap.
+        BitmapView View() const;
+
         // Manipulate individual pixels. For grayscale images, only the red element
         // of the RGB color is used.
         bool GetPixel(const int x, const int y, BitmapColor<uint8_t>* color) const;
@@ -124,6 +176,18 @@ namespace bkmap{
         // Read bitmap at given path and convert to grey- or colorscale.
         bool Read(const std::string& path, const bool as_rgb = true);
 
+        // Read bitmap at given path at the lowest resolution, whose larger
+        // dimension is not smaller than `min_image_size`. JPEG images are decoded
+        // at a reduced scale of 1/2, 1/4 or 1/8 in the DCT domain and greyscale
+        // JPEG images are decoded directly from the luminance channel, so that the
+        // full resolution is never decoded. Other formats are read at the full
+        // resolution. The dimensions of the original image are returned in
+        // `original_width` and `original_height`. The EXIF information of the
+        // original image is preserved.
+        bool ReadScaled(const std::string& path, const bool as_rgb,
+                        const int min_image_size, int* original_width,
+                        int* original_height);
+
         // Write image to file. Flags can be used to set e.g. the JPEG quality.
         // Consult the FreeImage documentation for all available flags.
         bool Write(const std::string& path,
@@ -142,6 +206,11 @@ namespace bkmap{
         Bitmap CloneAsGrey() const;
         Bitmap CloneAsRGB() const;
 
+        // Convert the image to grey- or colorscale in place. The original data is
+        // released as part of the conversion, so that no second bitmap is alive.
+        void ConvertToGrey();
+        void ConvertToRGB();
+
         // Clone metadata from this bitmap object to another target bitmap object.
         void CloneMetadata(Bitmap* target) const;
 
@@ -154,6 +223,10 @@ namespace bkmap{
 
         void SetPtr(FIBITMAP* data);
 
+        // Take ownership of a loaded FreeImage object and convert it to grey- or
+        // colorscale. Returns false if the conversion fails.
+        bool SetLoadedPtr(FIBITMAP* data, const bool as_rgb);
+
         static bool IsPtrGrey(FIBITMAP* data);
         static bool IsPtrRGB(FIBITMAP* data);
         static bool IsPtrSupported(FIBITMAP* data);
@@ -229,6 +302,39 @@ namespace bkmap{
 //        return output;
 //    }
 
+    template <typename T>
+    void BitmapView::ConvertToRowMajorArray(const T normalization,
+                                            T* array) const {
+        const int row_size = width_ * channels_;
+        for (int y = 0; y < height_; ++y) {
+            const uint8_t* row = GetRow(y);
+            for (int i = 0; i < row_size; ++i) {
+                array[i] = static_cast<T>(row[i]) / normalization;
+            }
+            array += row_size;
+        }
+    }
+
+    int BitmapView::Width() const { return width_; }
+    int BitmapView::Height() const { return height_; }
+    int BitmapView::Channels() const { return channels_; }
+
+    std::ptrdiff_t BitmapView::Stride() const { return stride_; }
+
+    bool BitmapView::IsEmpty() const { return data_ == nullptr; }
+
+    const uint8_t* BitmapView::GetRow(const int y) const {
+        return data_ + y * stride_;
+    }
+
+    void BitmapView::CopyToRowMajorArray(uint8_t* array) const {
+        const size_t row_size = static_cast<size_t>(width_ * channels_);
+        for (int y = 0; y < height_; ++y) {
+            std::memcpy(array, GetRow(y), row_size);
+            array += row_size;
+        }
+    }
+
     FIBITMAP* Bitmap::Data() { return data_.get(); }
     const FIBITMAP* Bitmap::Data() const { return data_.get(); }
 
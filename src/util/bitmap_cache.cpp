@@ -0,0 +1,321 @@
+#include "util/bitmap_cache.h"
+
+#include <fstream>
+#include <functional>
+
+#include <boost/filesystem/operations.hpp>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/string.h"
+
+namespace bkmap {
+    namespace {
+
+        const char kDiskCacheMagic[] = "BKMAPBMP";
+        const size_t kDiskCacheMagicSize = sizeof(kDiskCacheMagic) - 1;
+
+        // The modification time and size of the source image, which invalidate
+        // its entry in the on-disk cache, if the image is changed.
+        bool GetSourceStamp(const std::string& path, int64_t* modification_time,
+                            uint64_t* num_bytes) {
+            boost::system::error_code error;
+            const std::time_t time = boost::filesystem::last_write_time(path, error);
+            if (error) {
+                return false;
+            }
+            const uintmax_t size = boost::filesystem::file_size(path, error);
+            if (error) {
+                return false;
+            }
+            *modification_time = static_cast<int64_t>(time);
+            *num_bytes = static_cast<uint64_t>(size);
+            return true;
+        }
+
+        std::shared_ptr<const Bitmap> DeriveBitmap(const Bitmap& source,
+                                                   const bool as_rgb,
+                                                   const int width,
+                                                   const int height) {
+            std::shared_ptr<Bitmap> bitmap(
+                    new Bitmap(as_rgb ? source.CloneAsRGB() : source.CloneAsGrey()));
+            if (width > 0 &&
+                (bitmap->Width() != width || bitmap->Height() != height)) {
+                bitmap->Rescale(width, height);
+            }
+            return bitmap;
+        }
+
+    }  // namespace
+
+    bool BitmapCache::Options::Check() const {
+        CHECK_OPTION_GE(cache_size, 0);
+        return true;
+    }
+
+    size_t BitmapCache::CachedBitmap::NumBytes() const {
+        return bitmap ? bitmap->NumBytes() : 0;
+    }
+
+    BitmapCache& BitmapCache::Global() {
+        static BitmapCache cache((Options()));
+        return cache;
+    }
+
+    BitmapCache::BitmapCache(const Options& options) { SetOptions(options); }
+
+    void BitmapCache::SetOptions(const Options& options) {
+        CHECK(options.Check());
+        std::unique_lock<std::mutex> lock(mutex_);
+        options_ = options;
+        if (options_.cache_size > 0) {
+            cache_.reset(new CacheType(
+                    static_cast<size_t>(1024.0 * 1024.0 * 1024.0 * options_.cache_size),
+                    [](const std::string&) { return CachedBitmap(); }));
+        } else {
+            cache_.reset();
+        }
+        if (!options_.disk_cache_path.empty()) {
+            CreateDirIfNotExists(options_.disk_cache_path);
+        }
+    }
+
+    BitmapCache::Options BitmapCache::GetOptions() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return options_;
+    }
+
+    std::shared_ptr<const Bitmap> BitmapCache::Read(const std::string& path,
+                                                    const bool as_rgb,
+                                                    const int width,
+                                                    const int height) {
+        return Read(path, as_rgb, width, height, true);
+    }
+
+    std::shared_ptr<const Bitmap> BitmapCache::ReadUncached(const std::string& path,
+                                                            const bool as_rgb,
+                                                            const int width,
+                                                            const int height) {
+        return Read(path, as_rgb, width, height, false);
+    }
+
+    std::shared_ptr<const Bitmap> BitmapCache::Read(const std::string& path,
+                                                    const bool as_rgb,
+                                                    const int width,
+                                                    const int height,
+                                                    const bool keep) {
+        CHECK_GE(width, 0);
+        CHECK_GE(height, 0);
+        CHECK_EQ(width == 0, height == 0);
+
+        const std::string key = GetKey(path, as_rgb, width, height);
+        std::shared_ptr<const Bitmap> bitmap = Find(key);
+        if (bitmap) {
+            return bitmap;
+        }
+
+        // Derive the image from its cached original, if possible, which is much
+        // cheaper than decoding it again.
+        std::shared_ptr<const Bitmap> source;
+        if (width > 0) {
+            source = Find(GetKey(path, as_rgb, 0, 0));
+        }
+        if (!source && !as_rgb) {
+            source = Find(GetKey(path, true, 0, 0));
+        }
+
+        if (source) {
+            bitmap = DeriveBitmap(*source, as_rgb, width, height);
+            WriteToDisk(key, path, *bitmap);
+        } else {
+            bitmap = ReadFromDisk(key, path);
+            if (!bitmap) {
+                std::shared_ptr<Bitmap> decoded_bitmap(new Bitmap());
+                if (!decoded_bitmap->Read(path, as_rgb)) {
+                    return nullptr;
+                }
+                if (width > 0 && (decoded_bitmap->Width() != width ||
+                                  decoded_bitmap->Height() != height)) {
+                    decoded_bitmap->Rescale(width, height);
+                }
+                WriteToDisk(key, path, *decoded_bitmap);
+                bitmap = decoded_bitmap;
+            }
+        }
+
+        if (keep) {
+            Set(key, bitmap);
+        }
+
+        return bitmap;
+    }
+
+    void BitmapCache::Insert(const std::string& path,
+                             const std::shared_ptr<const Bitmap>& bitmap) {
+        CHECK_NOTNULL(bitmap.get());
+        const std::string key = GetKey(path, bitmap->IsRGB(), 0, 0);
+        WriteToDisk(key, path, *bitmap);
+        Set(key, bitmap);
+    }
+
+    void BitmapCache::Clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (cache_) {
+            cache_->Clear();
+        }
+    }
+
+    size_t BitmapCache::NumBytes() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cache_ ? cache_->NumBytes() : 0;
+    }
+
+    std::string BitmapCache::GetKey(const std::string& path, const bool as_rgb,
+                                    const int width, const int height) {
+        return StringPrintf("%s|%s|%dx%d", path.c_str(), as_rgb ? "rgb" : "grey",
+                            width, height);
+    }
+
+    std::shared_ptr<const Bitmap> BitmapCache::Find(const std::string& key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (cache_ && cache_->Exists(key)) {
+            return cache_->Get(key).bitmap;
+        }
+        return nullptr;
+    }
+
+    void BitmapCache::Set(const std::string& key,
+                          const std::shared_ptr<const Bitmap>& bitmap) {
+        CachedBitmap cached_bitmap;
+        cached_bitmap.bitmap = bitmap;
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (cache_) {
+            cache_->Set(key, std::move(cached_bitmap));
+        }
+    }
+
+    std::string BitmapCache::GetDiskCachePath(const std::string& key) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (options_.disk_cache_path.empty()) {
+            return "";
+        }
+        const size_t hash = std::hash<std::string>()(key);
+        return JoinPaths(options_.disk_cache_path,
+                         StringPrintf("%016llx.bin",
+                                      static_cast<unsigned long long>(hash)));
+    }
+
+    std::shared_ptr<const Bitmap> BitmapCache::ReadFromDisk(
+            const std::string& key, const std::string& path) const {
+        const std::string cache_path = GetDiskCachePath(key);
+        if (cache_path.empty() || !ExistsFile(cache_path)) {
+            return nullptr;
+        }
+
+        int64_t modification_time;
+        uint64_t num_bytes;
+        if (!GetSourceStamp(path, &modification_time, &num_bytes)) {
+            return nullptr;
+        }
+
+        std::ifstream file(cache_path, std::ios::binary);
+        if (!file.is_open()) {
+            return nullptr;
+        }
+
+        // The key is stored to detect collisions of the hashed file names.
+        char magic[kDiskCacheMagicSize];
+        file.read(magic, kDiskCacheMagicSize);
+        if (!file || std::string(magic, kDiskCacheMagicSize) != kDiskCacheMagic) {
+            return nullptr;
+        }
+        const uint64_t key_size = ReadBinaryLittleEndian<uint64_t>(&file);
+        if (!file || key_size != key.size()) {
+            return nullptr;
+        }
+        std::string cached_key(key_size, '\0');
+        file.read(&cached_key[0], key_size);
+        if (!file || cached_key != key ||
+            ReadBinaryLittleEndian<int64_t>(&file) != modification_time ||
+            ReadBinaryLittleEndian<uint64_t>(&file) != num_bytes) {
+            return nullptr;
+        }
+
+        const int width = ReadBinaryLittleEndian<int32_t>(&file);
+        const int height = ReadBinaryLittleEndian<int32_t>(&file);
+        const int channels = ReadBinaryLittleEndian<int32_t>(&file);
+        if (!file || width <= 0 || height <= 0 || (channels != 1 && channels != 3)) {
+            return nullptr;
+        }
+
+        std::shared_ptr<Bitmap> bitmap(new Bitmap());
+        if (!bitmap->Allocate(width, height, channels == 3)) {
+            return nullptr;
+        }
+
+        // FreeImage stores the bottom scanline first.
+        const std::streamsize row_size = static_cast<std::streamsize>(width) * channels;
+        for (int y = 0; y < height; ++y) {
+            file.read(reinterpret_cast<char*>(
+                              FreeImage_GetScanLine(bitmap->Data(), height - 1 - y)),
+                      row_size);
+        }
+        if (!file) {
+            return nullptr;
+        }
+
+        return bitmap;
+    }
+
+    void BitmapCache::WriteToDisk(const std::string& key, const std::string& path,
+                                  const Bitmap& bitmap) const {
+        const std::string cache_path = GetDiskCachePath(key);
+        if (cache_path.empty()) {
+            return;
+        }
+
+        int64_t modification_time;
+        uint64_t num_bytes;
+        if (!GetSourceStamp(path, &modification_time, &num_bytes)) {
+            return;
+        }
+
+        // Write to a temporary file first, so that concurrent readers never see
+        // a partially written entry. The random name is unique across threads
+        // and processes sharing the cache directory.
+        const std::string temp_path = boost::filesystem::unique_path(
+                cache_path + ".%%%%-%%%%-%%%%-%%%%.tmp").string();
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "WARNING: Cannot write image cache at " << temp_path
+                << std::endl;
+                return;
+            }
+
+            file.write(kDiskCacheMagic, kDiskCacheMagicSize);
+            WriteBinaryLittleEndian<uint64_t>(&file, key.size());
+            file.write(key.data(), key.size());
+            WriteBinaryLittleEndian<int64_t>(&file, modification_time);
+            WriteBinaryLittleEndian<uint64_t>(&file, num_bytes);
+            WriteBinaryLittleEndian<int32_t>(&file, bitmap.Width());
+            WriteBinaryLittleEndian<int32_t>(&file, bitmap.Height());
+            WriteBinaryLittleEndian<int32_t>(&file, bitmap.Channels());
+
+            const BitmapView view = bitmap.View();
+            const std::streamsize row_size =
+                    static_cast<std::streamsize>(view.Width()) * view.Channels();
+            for (int y = 0; y < view.Height(); ++y) {
+                file.write(reinterpret_cast<const char*>(view.GetRow(y)), row_size);
+            }
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::rename(temp_path, cache_path, error);
+        if (error) {
+            boost::filesystem::remove(temp_path, error);
+        }
+    }
+
+}
@@ -0,0 +1,111 @@
+#ifndef BKMAP_BITMAP_CACHE_H
+#define BKMAP_BITMAP_CACHE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "util/bitmap.h"
+#include "util/cache.h"
+
+namespace bkmap {
+
+// Process-wide cache of decoded images, which is shared by the stages that
+// read the same images, e.g. the color extraction of the mapper, the image
+// undistortion, the dense stereo and the dense fusion. The decoded images are
+// kept in a memory-constrained LRU cache and optionally in an on-disk cache of
+// raw pixels, which are faster to read than decoding the original images and
+// which are shared across processes. The images are identified by their path,
+// their color mode and their dimensions, so that pre-scaled images are cached
+// separately from their originals. Images read from the on-disk cache do not
+// contain the metadata of the original images. The cache is thread-safe.
+//
+// The memory cache of the global instance is disabled by default, since most
+// stages read each image only once, and it is enabled for the stages of the
+// automatic reconstruction, which read the same images repeatedly.
+    class BitmapCache {
+    public:
+        struct Options {
+            // Maximum size of the decoded images in memory in gigabytes. The images
+            // are not kept in memory, if the size is zero.
+            double cache_size = 0.0;
+
+            // Folder of the on-disk cache of raw pixels, which is disabled if empty.
+            std::string disk_cache_path = "";
+
+            bool Check() const;
+        };
+
+        // Get the cache instance of the process.
+        static BitmapCache& Global();
+
+        explicit BitmapCache(const Options& options);
+
+        BitmapCache(const BitmapCache&) = delete;
+        BitmapCache& operator=(const BitmapCache&) = delete;
+
+        // Replace the options, which clears the images in memory.
+        void SetOptions(const Options& options);
+        Options GetOptions() const;
+
+        // Read the image at the given path as grey- or colorscale. The image is
+        // rescaled to the given dimensions, unless they are zero. The image is
+        // derived from the cached original color image, if it exists, and is
+        // otherwise read from the on-disk cache or decoded. Returns null if the
+        // image cannot be read.
+        std::shared_ptr<const Bitmap> Read(const std::string& path,
+                                           const bool as_rgb, const int width = 0,
+                                           const int height = 0);
+
+        // Read the image as in `Read`, but without keeping it in memory, e.g.,
+        // for callers that keep the image in their own memory budget. Images in
+        // memory are still returned without decoding them again.
+        std::shared_ptr<const Bitmap> ReadUncached(const std::string& path,
+                                                   const bool as_rgb,
+                                                   const int width = 0,
+                                                   const int height = 0);
+
+        // Insert an image that was just written to the given path, so that later
+        // reads of the image do not decode it again.
+        void Insert(const std::string& path,
+                    const std::shared_ptr<const Bitmap>& bitmap);
+
+        // Remove all images from memory.
+        void Clear();
+
+        // The number of bytes of the images in memory.
+        size_t NumBytes() const;
+
+    private:
+        struct CachedBitmap {
+            size_t NumBytes() const;
+            std::shared_ptr<const Bitmap> bitmap;
+        };
+
+        typedef MemoryConstrainedLRUCache<std::string, CachedBitmap> CacheType;
+
+        static std::string GetKey(const std::string& path, const bool as_rgb,
+                                  const int width, const int height);
+
+        std::shared_ptr<const Bitmap> Read(const std::string& path,
+                                           const bool as_rgb, const int width,
+                                           const int height, const bool keep);
+
+        std::shared_ptr<const Bitmap> Find(const std::string& key);
+        void Set(const std::string& key, const std::shared_ptr<const Bitmap>& bitmap);
+
+        std::string GetDiskCachePath(const std::string& key) const;
+        std::shared_ptr<const Bitmap> ReadFromDisk(const std::string& key,
+                                                   const std::string& path) const;
+        void WriteToDisk(const std::string& key, const std::string& path,
+                         const Bitmap& bitmap) const;
+
+        mutable std::mutex mutex_;
+        Options options_;
+        // The images in memory or null, if the memory cache is disabled.
+        std::unique_ptr<CacheType> cache_;
+    };
+
+}
+
+#endif //BKMAP_BITMAP_CACHE_H
@@ -0,0 +1,222 @@
+#ifndef BKMAP_BUFFER_POOL_H
+#define BKMAP_BUFFER_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace bkmap {
+
+// Pool of reusable buffers, which are grouped into buckets of power of two
+// capacities. A buffer is returned to the pool when its handle is destroyed,
+// and later requests that fall into the same bucket reuse its memory instead
+// of allocating a new buffer. This avoids the allocator churn of large
+// temporary images, which are otherwise mapped and unmapped for every image.
+// At most `max_num_bytes` of unused buffers are retained. The elements of
+// acquired buffers are uninitialized and the pool is thread-safe. The pool must
+// outlive all of its acquired buffers.
+    template <typename T>
+    class BufferPool {
+    public:
+        class Buffer {
+        public:
+            Buffer();
+            Buffer(Buffer&& other);
+            Buffer& operator=(Buffer&& other);
+            ~Buffer();
+
+            Buffer(const Buffer&) = delete;
+            Buffer& operator=(const Buffer&) = delete;
+
+            inline T* Data();
+            inline const T* Data() const;
+            inline size_t Size() const;
+
+        private:
+            friend class BufferPool;
+
+            // Return the memory to the pool, if the buffer is valid.
+            void Release();
+
+            BufferPool* pool_;
+            std::unique_ptr<T[]> data_;
+            size_t size_;
+            int bucket_idx_;
+        };
+
+        explicit BufferPool(const size_t max_num_bytes);
+
+        // Acquire a buffer with the given number of elements.
+        Buffer Acquire(const size_t size);
+
+        // The number of bytes of the unused buffers in the pool.
+        size_t NumBytes() const;
+        size_t MaxNumBytes() const;
+
+        // Free all unused buffers in the pool.
+        void Clear();
+
+    private:
+        static int GetBucketIdx(const size_t size);
+        static size_t GetBucketNumBytes(const int bucket_idx);
+
+        void Release(const int bucket_idx, std::unique_ptr<T[]> data);
+
+        const size_t max_num_bytes_;
+        size_t num_bytes_;
+        mutable std::mutex mutex_;
+
+        // The unused buffers of each bucket, whose capacity is 2^bucket_idx.
+        std::vector<std::vector<std::unique_ptr<T[]>>> buckets_;
+    };
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+    template <typename T>
+    BufferPool<T>::Buffer::Buffer()
+            : pool_(nullptr), size_(0), bucket_idx_(-1) {}
+
+    template <typename T>
+    BufferPool<T>::Buffer::Buffer(Buffer&& other)
+            : pool_(other.pool_),
+              data_(std::move(other.data_)),
+              size_(other.size_),
+              bucket_idx_(other.bucket_idx_) {
+        other.pool_ = nullptr;
+        other.size_ = 0;
+        other.bucket_idx_ = -1;
+    }
+
+    template <typename T>
+    typename BufferPool<T>::Buffer& BufferPool<T>::Buffer::operator=(
+            Buffer&& other) {
+        if (this != &other) {
+            Release();
+            pool_ = other.pool_;
+            data_ = std::move(other.data_);
+            size_ = other.size_;
+            bucket_idx_ = other.bucket_idx_;
+            other.pool_ = nullptr;
+            other.size_ = 0;
+            other.bucket_idx_ = -1;
+        }
+        return *this;
+    }
+
+    template <typename T>
+    BufferPool<T>::Buffer::~Buffer() {
+        Release();
+    }
+
+    template <typename T>
+    T* BufferPool<T>::Buffer::Data() {
+        return data_.get();
+    }
+
+    template <typename T>
+    const T* BufferPool<T>::Buffer::Data() const {
+        return data_.get();
+    }
+
+    template <typename T>
+    size_t BufferPool<T>::Buffer::Size() const {
+        return size_;
+    }
+
+    template <typename T>
+    void BufferPool<T>::Buffer::Release() {
+        if (pool_ != nullptr && data_) {
+            pool_->Release(bucket_idx_, std::move(data_));
+        }
+        pool_ = nullptr;
+        data_.reset();
+        size_ = 0;
+        bucket_idx_ = -1;
+    }
+
+    template <typename T>
+    BufferPool<T>::BufferPool(const size_t max_num_bytes)
+            : max_num_bytes_(max_num_bytes), num_bytes_(0) {}
+
+    template <typename T>
+    typename BufferPool<T>::Buffer BufferPool<T>::Acquire(const size_t size) {
+        Buffer buffer;
+        buffer.pool_ = this;
+        buffer.size_ = size;
+        buffer.bucket_idx_ = GetBucketIdx(size);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (buffer.bucket_idx_ < static_cast<int>(buckets_.size()) &&
+                !buckets_[buffer.bucket_idx_].empty()) {
+                auto& bucket = buckets_[buffer.bucket_idx_];
+                buffer.data_ = std::move(bucket.back());
+                bucket.pop_back();
+                num_bytes_ -= GetBucketNumBytes(buffer.bucket_idx_);
+                return buffer;
+            }
+        }
+
+        // Large buffers are mapped lazily, so that the pages of the rounded up
+        // capacity, which are never written, do not increase the memory usage.
+        buffer.data_.reset(new T[static_cast<size_t>(1) << buffer.bucket_idx_]);
+
+        return buffer;
+    }
+
+    template <typename T>
+    size_t BufferPool<T>::NumBytes() const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return num_bytes_;
+    }
+
+    template <typename T>
+    size_t BufferPool<T>::MaxNumBytes() const {
+        return max_num_bytes_;
+    }
+
+    template <typename T>
+    void BufferPool<T>::Clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        buckets_.clear();
+        num_bytes_ = 0;
+    }
+
+    template <typename T>
+    int BufferPool<T>::GetBucketIdx(const size_t size) {
+        int bucket_idx = 0;
+        while ((static_cast<size_t>(1) << bucket_idx) < size) {
+            bucket_idx += 1;
+        }
+        return bucket_idx;
+    }
+
+    template <typename T>
+    size_t BufferPool<T>::GetBucketNumBytes(const int bucket_idx) {
+        return (static_cast<size_t>(1) << bucket_idx) * sizeof(T);
+    }
+
+    template <typename T>
+    void BufferPool<T>::Release(const int bucket_idx, std::unique_ptr<T[]> data) {
+        const size_t num_bytes = GetBucketNumBytes(bucket_idx);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // Free the buffer instead of retaining it, if the pool is full.
+        if (num_bytes_ + num_bytes > max_num_bytes_) {
+            return;
+        }
+
+        if (bucket_idx >= static_cast<int>(buckets_.size())) {
+            buckets_.resize(bucket_idx + 1);
+        }
+
+        buckets_[bucket_idx].push_back(std::move(data));
+        num_bytes_ += num_bytes;
+    }
+
+}
+
+#endif //BKMAP_BUFFER_POOL_H
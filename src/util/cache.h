@@ -5,7 +5,9 @@
 #ifndef BKMAP_CACHE_H
 #define BKMAP_CACHE_H
 
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <unordered_map>
 
@@ -194,10 +196,14 @@ namespace bkmap {
         if (it != elems_map_.end()) {
             elems_list_.erase(it->second);
             elems_map_.erase(it);
+            num_bytes_ -= elems_num_bytes_.at(key);
+            elems_num_bytes_.erase(key);
         }
         elems_map_[key] = elems_list_.begin();
 
-        const size_t num_bytes = value.NumBytes();
+        // The value was moved into the list, so that its size must be queried
+        // from the stored element.
+        const size_t num_bytes = elems_list_.front().second.NumBytes();
         num_bytes_ += num_bytes;
         elems_num_bytes_.emplace(key, num_bytes);
 
@@ -6,6 +6,10 @@
 
 #include <cstdarg>
 
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
 #include <boost/algorithm/string.hpp>
 
 namespace bkmap {
@@ -141,6 +145,23 @@ namespace bkmap {
         return file.tellg();
     }
 
+    size_t GetPeakMemoryUsage() {
+#ifdef _WIN32
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+#ifdef __APPLE__
+        // Reported in bytes on macOS and in kilobytes on other platforms.
+        return static_cast<size_t>(usage.ru_maxrss);
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
     void PrintHeading1(const std::string& heading) {
         std::cout << std::endl << std::string(78, '=') << std::endl;
         std::cout << heading << std::endl;
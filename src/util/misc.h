@@ -71,6 +71,10 @@ namespace bkmap {
 // Get the size in bytes of a file.
     size_t GetFileSize(const std::string& path);
 
+// Get the peak resident memory of the process in bytes. Returns zero, if the
+// memory usage cannot be determined on the current platform.
+    size_t GetPeakMemoryUsage();
+
 // Print first-order heading with over- and underscores to `std::cout`.
     void PrintHeading1(const std::string& heading);
 
@@ -115,9 +115,15 @@ namespace bkmap {
                                     &image_reader->camera_params);
         AddAndRegisterDefaultOption("ImageReader.default_focal_length_factor",
                                     &image_reader->default_focal_length_factor);
+        AddAndRegisterDefaultOption("ImageReader.scaled_decoding",
+                                    &image_reader->scaled_decoding);
+        AddAndRegisterDefaultOption("ImageReader.check_content_hashes",
+                                    &image_reader->check_content_hashes);
 
         AddAndRegisterDefaultOption("SiftExtraction.num_threads",
                                     &sift_extraction->num_threads);
+        AddAndRegisterDefaultOption("SiftExtraction.num_image_threads",
+                                    &sift_extraction->num_image_threads);
         AddAndRegisterDefaultOption("SiftExtraction.use_gpu",
                                     &sift_extraction->use_gpu);
         AddAndRegisterDefaultOption("SiftExtraction.gpu_index",
@@ -126,6 +132,10 @@ namespace bkmap {
                                     &sift_extraction->max_image_size);
         AddAndRegisterDefaultOption("SiftExtraction.max_num_features",
                                     &sift_extraction->max_num_features);
+        AddAndRegisterDefaultOption("SiftExtraction.budget_octave_features",
+                                    &sift_extraction->budget_octave_features);
+        AddAndRegisterDefaultOption("SiftExtraction.feature_grid_size",
+                                    &sift_extraction->feature_grid_size);
         AddAndRegisterDefaultOption("SiftExtraction.first_octave",
                                     &sift_extraction->first_octave);
         AddAndRegisterDefaultOption("SiftExtraction.num_octaves",
@@ -140,6 +150,20 @@ namespace bkmap {
                                     &sift_extraction->max_num_orientations);
         AddAndRegisterDefaultOption("SiftExtraction.upright",
                                     &sift_extraction->upright);
+        AddAndRegisterDefaultOption("SiftExtraction.use_simd",
+                                    &sift_extraction->use_simd);
+        AddAndRegisterDefaultOption("SiftExtraction.binary_descriptors",
+                                    &sift_extraction->binary_descriptors);
+        AddAndRegisterDefaultOption("SiftExtraction.binary_num_levels",
+                                    &sift_extraction->binary_num_levels);
+        AddAndRegisterDefaultOption("SiftExtraction.binary_scale_factor",
+                                    &sift_extraction->binary_scale_factor);
+        AddAndRegisterDefaultOption("SiftExtraction.binary_fast_threshold",
+                                    &sift_extraction->binary_fast_threshold);
+        AddAndRegisterDefaultOption("SiftExtraction.max_write_batch_size",
+                                    &sift_extraction->max_write_batch_size);
+        AddAndRegisterDefaultOption("SiftExtraction.max_write_batch_time",
+                                    &sift_extraction->max_write_batch_time);
     }
 
     void OptionManager::AddMatchingOptions() {
@@ -159,6 +183,14 @@ namespace bkmap {
                                     &sift_matching->max_distance);
         AddAndRegisterDefaultOption("SiftMatching.cross_check",
                                     &sift_matching->cross_check);
+        AddAndRegisterDefaultOption("SiftMatching.cpu_brute_force_matching",
+                                    &sift_matching->cpu_brute_force_matching);
+        AddAndRegisterDefaultOption("SiftMatching.binary_descriptors",
+                                    &sift_matching->binary_descriptors);
+        AddAndRegisterDefaultOption("SiftMatching.max_hamming_distance",
+                                    &sift_matching->max_hamming_distance);
+        AddAndRegisterDefaultOption("SiftMatching.cpu_batch_size",
+                                    &sift_matching->cpu_batch_size);
         AddAndRegisterDefaultOption("SiftMatching.max_error",
                                     &sift_matching->max_error);
         AddAndRegisterDefaultOption("SiftMatching.max_num_matches",
@@ -173,6 +205,8 @@ namespace bkmap {
                                     &sift_matching->min_num_inliers);
         AddAndRegisterDefaultOption("SiftMatching.multiple_models",
                                     &sift_matching->multiple_models);
+        AddAndRegisterDefaultOption("SiftMatching.interleaved_verification",
+                                    &sift_matching->interleaved_verification);
         AddAndRegisterDefaultOption("SiftMatching.guided_matching",
                                     &sift_matching->guided_matching);
     }
@@ -233,6 +267,8 @@ namespace bkmap {
                                     &vocab_tree_matching->max_num_features);
         AddAndRegisterDefaultOption("VocabTreeMatching.vocab_tree_path",
                                     &vocab_tree_matching->vocab_tree_path);
+        AddAndRegisterDefaultOption("VocabTreeMatching.index_path",
+                                    &vocab_tree_matching->index_path);
         AddAndRegisterDefaultOption("VocabTreeMatching.match_list_path",
                                     &vocab_tree_matching->match_list_path);
     }
@@ -419,8 +455,8 @@ namespace bkmap {
 
         AddAndRegisterDefaultOption("DenseStereo.max_image_size",
                                     &dense_stereo->max_image_size);
-        AddAndRegisterDefaultOption("DenseStereo.gpu_index",
-                                    &dense_stereo->gpu_index);
+        AddAndRegisterDefaultOption("DenseStereo.num_threads",
+                                    &dense_stereo->num_threads);
         AddAndRegisterDefaultOption("DenseStereo.window_radius",
                                     &dense_stereo->window_radius);
         AddAndRegisterDefaultOption("DenseStereo.sigma_spatial",
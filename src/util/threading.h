@@ -5,7 +5,9 @@
 #ifndef BKMAP_THREADING_H
 #define BKMAP_THREADING_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <climits>
 #include <functional>
 #include <future>
@@ -263,6 +265,27 @@ namespace bkmap {
             bool valid_;
         };
 
+        // Statistics of the queue, where the wait times are accumulated over all
+        // threads that pushed to or popped from the queue.
+        struct Stats {
+            // The number of pushed and popped jobs.
+            size_t num_pushed = 0;
+            size_t num_popped = 0;
+
+            // The maximum and the accumulated number of jobs in the queue after
+            // each push, i.e., the mean depth is `sum_num_jobs / num_pushed`.
+            size_t max_num_jobs = 0;
+            size_t sum_num_jobs = 0;
+
+            // Time in seconds that producers waited for a free slot, i.e. the
+            // consumers were the bottleneck.
+            double push_wait_time = 0.0;
+
+            // Time in seconds that consumers waited for a job, i.e. the producers
+            // were the bottleneck.
+            double pop_wait_time = 0.0;
+        };
+
         JobQueue();
         explicit JobQueue(const size_t max_num_jobs);
         ~JobQueue();
@@ -276,6 +299,14 @@ namespace bkmap {
         // Pop a job from the queue. Waits if there is no job in the queue.
         Job Pop();
 
+        // Pop a job from the queue without waiting. Returns an invalid job if
+        // there is no job in the queue or if the queue is stopped.
+        Job TryPop();
+
+        // Pop a job from the queue and wait at most the given time in milliseconds
+        // for a job. Returns an invalid job on timeout or if the queue is stopped.
+        Job TryPop(const int timeout_ms);
+
         // Wait for all jobs to be popped and then stop the queue.
         void Wait();
 
@@ -285,8 +316,12 @@ namespace bkmap {
         // Clear all pushed and not popped jobs from the queue.
         void Clear();
 
+        // Get the accumulated statistics of the queue.
+        Stats GetStats();
+
     private:
         size_t max_num_jobs_;
+        Stats stats_;
         std::atomic<bool> stop_;
         std::queue<T> jobs_;
         std::mutex mutex_;
@@ -349,13 +384,21 @@ namespace bkmap {
     template <typename T>
     bool JobQueue<T>::Push(const T& data) {
         std::unique_lock<std::mutex> lock(mutex_);
-        while (jobs_.size() >= max_num_jobs_ && !stop_) {
-            pop_condition_.wait(lock);
+        if (jobs_.size() >= max_num_jobs_ && !stop_) {
+            const auto wait_begin = std::chrono::steady_clock::now();
+            while (jobs_.size() >= max_num_jobs_ && !stop_) {
+                pop_condition_.wait(lock);
+            }
+            stats_.push_wait_time += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - wait_begin).count();
         }
         if (stop_) {
             return false;
         } else {
             jobs_.push(data);
+            stats_.num_pushed += 1;
+            stats_.max_num_jobs = std::max(stats_.max_num_jobs, jobs_.size());
+            stats_.sum_num_jobs += jobs_.size();
             push_condition_.notify_one();
             return true;
         }
@@ -364,14 +407,62 @@ namespace bkmap {
     template <typename T>
     typename JobQueue<T>::Job JobQueue<T>::Pop() {
         std::unique_lock<std::mutex> lock(mutex_);
-        while (jobs_.empty() && !stop_) {
-            push_condition_.wait(lock);
+        if (jobs_.empty() && !stop_) {
+            const auto wait_begin = std::chrono::steady_clock::now();
+            while (jobs_.empty() && !stop_) {
+                push_condition_.wait(lock);
+            }
+            stats_.pop_wait_time += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - wait_begin).count();
         }
         if (stop_) {
             return Job();
         } else {
             const T data = jobs_.front();
             jobs_.pop();
+            stats_.num_popped += 1;
+            pop_condition_.notify_one();
+            if (jobs_.empty()) {
+                empty_condition_.notify_all();
+            }
+            return Job(data);
+        }
+    }
+
+    template <typename T>
+    typename JobQueue<T>::Job JobQueue<T>::TryPop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (jobs_.empty() || stop_) {
+            return Job();
+        } else {
+            const T data = jobs_.front();
+            jobs_.pop();
+            stats_.num_popped += 1;
+            pop_condition_.notify_one();
+            if (jobs_.empty()) {
+                empty_condition_.notify_all();
+            }
+            return Job(data);
+        }
+    }
+
+    template <typename T>
+    typename JobQueue<T>::Job JobQueue<T>::TryPop(const int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (jobs_.empty() && !stop_) {
+            const auto wait_begin = std::chrono::steady_clock::now();
+            push_condition_.wait_until(
+                    lock, wait_begin + std::chrono::milliseconds(timeout_ms),
+                    [this]() { return !jobs_.empty() || stop_; });
+            stats_.pop_wait_time += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - wait_begin).count();
+        }
+        if (jobs_.empty() || stop_) {
+            return Job();
+        } else {
+            const T data = jobs_.front();
+            jobs_.pop();
+            stats_.num_popped += 1;
             pop_condition_.notify_one();
             if (jobs_.empty()) {
                 empty_condition_.notify_all();
@@ -402,6 +493,12 @@ namespace bkmap {
         std::swap(jobs_, empty_jobs);
     }
 
+    template <typename T>
+    typename JobQueue<T>::Stats JobQueue<T>::GetStats() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
 }
 
 #endif //BKMAP_THREADING_H